@@ -0,0 +1,204 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace spiritsaway::http_utils
+{
+	constexpr std::size_t access_log_max_method_size = 15;
+	/// Longer uris are truncated.
+	constexpr std::size_t access_log_max_uri_size = 199;
+
+	/// One finished request. Fixed size so that the rings hold them without allocating.
+	struct access_log_record
+	{
+		/// Microseconds since the unix epoch when the reply was written.
+		std::uint64_t timestamp_us = 0;
+		/// The content of the request and all the bytes of the reply.
+		std::uint64_t request_bytes = 0;
+		std::uint64_t reply_bytes = 0;
+		std::uint32_t status = 0;
+		/// The phases of server_metrics, 0 when the session does not have one.
+		std::uint32_t read_us = 0;
+		std::uint32_t handler_us = 0;
+		std::uint32_t write_us = 0;
+		std::uint8_t method_size = 0;
+		std::uint8_t uri_size = 0;
+		std::array<char, access_log_max_method_size> method;
+		std::array<char, access_log_max_uri_size> uri;
+
+		void set_request(std::string_view in_method, std::string_view in_uri);
+
+		std::string_view method_view() const
+		{
+			return std::string_view(method.data(), method_size);
+		}
+
+		std::string_view uri_view() const
+		{
+			return std::string_view(uri.data(), uri_size);
+		}
+	};
+
+	enum class access_log_format
+	{
+		/// Little endian fields behind an "HUAL" header, read back by access_log_dump.
+		binary,
+		csv,
+	};
+
+	struct access_log_config
+	{
+		std::string path;
+		access_log_format format = access_log_format::binary;
+		/// Records each io thread can queue before the writer drains them, rounded up to a power of two.
+		std::size_t ring_capacity = 1024;
+		/// How long the writer sleeps between drains.
+		std::uint32_t flush_interval_ms = 100;
+	};
+
+	/// A single producer single consumer queue of records.
+	class access_log_ring
+	{
+	public:
+		explicit access_log_ring(std::size_t capacity);
+
+		/// Called by the owning thread only, false when full.
+		bool push(const access_log_record& record)
+		{
+			auto cur_head = m_head.load(std::memory_order_relaxed);
+			if (cur_head - m_tail.load(std::memory_order_acquire) == m_records.size())
+			{
+				return false;
+			}
+			m_records[cur_head & m_mask] = record;
+			m_head.store(cur_head + 1, std::memory_order_release);
+			return true;
+		}
+
+		/// Called by the writer only, passes every queued record to consume.
+		template <typename Consume>
+		std::size_t drain(Consume&& consume)
+		{
+			auto cur_tail = m_tail.load(std::memory_order_relaxed);
+			auto cur_head = m_head.load(std::memory_order_acquire);
+			for (auto i = cur_tail; i != cur_head; i++)
+			{
+				consume(m_records[i & m_mask]);
+			}
+			m_tail.store(cur_head, std::memory_order_release);
+			return std::size_t(cur_head - cur_tail);
+		}
+
+	private:
+		std::vector<access_log_record> m_records;
+		const std::uint64_t m_mask;
+		alignas(64) std::atomic<std::uint64_t> m_head;
+		alignas(64) std::atomic<std::uint64_t> m_tail;
+	};
+
+	/// Queues records into a ring per calling thread without locks and writes them to a file from
+	/// a background thread, so the io threads neither format nor block on the disk.
+	class access_logger
+	{
+	public:
+		access_logger(const access_logger&) = delete;
+		access_logger& operator=(const access_logger&) = delete;
+
+		/// Opens config.path and starts the writer, check is_open.
+		explicit access_logger(const access_log_config& config);
+
+		/// Writes what is still queued.
+		~access_logger();
+
+		bool is_open() const
+		{
+			return m_file.is_open();
+		}
+
+		/// Queue record, false and counted as dropped when the ring of this thread is full.
+		bool log(const access_log_record& record)
+		{
+			if (!local_ring().push(record))
+			{
+				m_dropped.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			return true;
+		}
+
+		std::uint64_t dropped() const
+		{
+			return m_dropped.load(std::memory_order_relaxed);
+		}
+
+		std::uint64_t written() const
+		{
+			return m_written.load(std::memory_order_relaxed);
+		}
+
+		/// Drain the rings and write them now, from any thread.
+		void flush();
+
+	private:
+		access_log_ring& local_ring()
+		{
+			thread_local std::vector<access_log_ring*> cur_rings;
+			if (m_id < cur_rings.size() && cur_rings[m_id])
+			{
+				return *cur_rings[m_id];
+			}
+			return add_local_ring(cur_rings);
+		}
+
+		access_log_ring& add_local_ring(std::vector<access_log_ring*>& thread_rings);
+
+		void run_writer();
+
+		// drain all rings into the file, called with m_write_mutex held
+		void write_rings();
+
+		const access_log_config m_config;
+		// ids are never reused, like the ones of metrics_registry
+		const std::size_t m_id;
+		std::mutex m_rings_mutex;
+		// rings outlive their thread, what a thread queued before exiting is still written
+		std::vector<std::unique_ptr<access_log_ring>> m_rings;
+
+		std::mutex m_write_mutex;
+		std::ofstream m_file;
+		std::string m_write_buffer;
+
+		std::atomic<std::uint64_t> m_dropped = 0;
+		std::atomic<std::uint64_t> m_written = 0;
+
+		std::mutex m_stop_mutex;
+		std::condition_variable m_stop_cv;
+		bool m_stopped = false;
+		std::thread m_writer;
+	};
+
+	/// The "HUAL" magic and version starting a binary log.
+	void append_access_log_header(std::string& out);
+	void append_access_log_binary(const access_log_record& record, std::string& out);
+
+	/// One csv line, the uri quoted when it holds a comma or a quote.
+	void append_access_log_csv(const access_log_record& record, std::string& out);
+	std::string_view access_log_csv_header();
+
+	/// Consume the header of a binary log, false when the magic or version differ.
+	bool read_access_log_header(std::istream& in);
+
+	/// Read the next record of a binary log, false at the end or on a truncated record.
+	bool read_access_log_record(std::istream& in, access_log_record& record);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+
+// set by the cmake option of the same name, which replaces the global operator new and delete
+#ifndef HTTP_UTILS_ALLOC_ACCOUNTING
+#define HTTP_UTILS_ALLOC_ACCOUNTING 0
+#endif
+
+namespace spiritsaway::http_utils
+{
+	constexpr bool alloc_accounting_enabled = HTTP_UTILS_ALLOC_ACCOUNTING != 0;
+
+	/// Heap allocations through operator new and their sizes as the allocator reports them. The
+	/// memory openssl takes with malloc is not included.
+	struct alloc_counters
+	{
+		std::uint64_t allocs = 0;
+		std::uint64_t frees = 0;
+		std::uint64_t alloc_bytes = 0;
+		std::uint64_t free_bytes = 0;
+
+		std::int64_t live_bytes() const
+		{
+			return std::int64_t(alloc_bytes - free_bytes);
+		}
+
+		alloc_counters& operator+=(const alloc_counters& other);
+		alloc_counters operator-(const alloc_counters& other) const;
+	};
+
+	/// The allocations of the calling thread so far, all zero without HTTP_UTILS_ALLOC_ACCOUNTING.
+	alloc_counters thread_alloc_counters();
+
+	/// The allocations of all threads so far.
+	alloc_counters process_alloc_counters();
+
+	/// Add the allocations of the calling thread to target until destroyed. A scope opened inside
+	/// another one on the same thread counts nothing, every allocation goes to the outermost target.
+	class alloc_scope
+	{
+	public:
+		alloc_scope(const alloc_scope&) = delete;
+		alloc_scope& operator=(const alloc_scope&) = delete;
+
+#if HTTP_UTILS_ALLOC_ACCOUNTING
+		explicit alloc_scope(alloc_counters& target);
+		~alloc_scope();
+
+		/// Add what was counted so far to target now, for targets read before the scope ends.
+		void flush();
+
+	private:
+		alloc_counters* m_target = nullptr;
+		alloc_counters m_begin;
+#else
+		explicit alloc_scope(alloc_counters&)
+		{
+
+		}
+
+		void flush()
+		{
+
+		}
+#endif
+	};
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+namespace spiritsaway::http_utils
+{
+	struct buffer_pool_stats
+	{
+		std::uint64_t in_use_buffers = 0;
+		std::uint64_t free_buffers = 0;
+		/// Buffers that had to be allocated because the free list was empty.
+		std::uint64_t allocated_buffers = 0;
+	};
+
+	/// Fixed size buffers shared by the sessions of a server, so that a connection only
+	/// holds one while it has data to read instead of for its whole lifetime.
+	class buffer_pool : public std::enable_shared_from_this<buffer_pool>
+	{
+	public:
+		/// Move only handle giving the buffer back to its pool when destroyed.
+		class buffer
+		{
+		public:
+			buffer() = default;
+			buffer(const buffer&) = delete;
+			buffer& operator=(const buffer&) = delete;
+			buffer(buffer&& other) noexcept;
+			buffer& operator=(buffer&& other) noexcept;
+			~buffer();
+
+			char* data() const
+			{
+				return m_data;
+			}
+			std::size_t size() const;
+			explicit operator bool() const
+			{
+				return m_data != nullptr;
+			}
+			/// Give the buffer back now.
+			void reset();
+
+		private:
+			friend class buffer_pool;
+			buffer(std::shared_ptr<buffer_pool> pool, char* data);
+
+			std::shared_ptr<buffer_pool> m_pool;
+			char* m_data = nullptr;
+		};
+
+		buffer_pool(const buffer_pool&) = delete;
+		buffer_pool& operator=(const buffer_pool&) = delete;
+
+		/// Keep at most max_free_count released buffers for reuse, the others are freed.
+		buffer_pool(std::size_t buffer_size, std::size_t max_free_count);
+		~buffer_pool();
+
+		buffer acquire();
+
+		std::size_t buffer_size() const
+		{
+			return m_buffer_size;
+		}
+
+		buffer_pool_stats get_stats() const;
+
+	private:
+		void release(char* data);
+
+		const std::size_t m_buffer_size;
+		const std::size_t m_max_free_count;
+		mutable std::mutex m_mutex;
+		std::vector<char*> m_free_buffers;
+		std::atomic<std::uint64_t> m_in_use_counter = 0;
+		std::atomic<std::uint64_t> m_alloc_counter = 0;
+	};
+}
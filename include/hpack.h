@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include "http_packet.h"
+
+namespace spiritsaway::http_utils
+{
+	/// Header table of HPACK (RFC 7541): the 61 static entries followed by the dynamic entries,
+	/// newest first, evicted once their size passes the table limit.
+	class hpack_table
+	{
+	public:
+		explicit hpack_table(std::size_t max_size = 4096);
+
+		void set_max_size(std::size_t max_size);
+		std::size_t max_size() const
+		{
+			return m_max_size;
+		}
+
+		void add(const std::string& name, const std::string& value);
+
+		/// Entry of the 1 based index, nullptr when out of range.
+		const header* get(std::size_t index) const;
+
+		/// Index of the entry with both name and value, 0 when missing. name_index gets an entry
+		/// with the same name, 0 when there is none.
+		std::size_t find(const std::string& name, const std::string& value, std::size_t& name_index) const;
+
+	private:
+		void evict(std::size_t target_size);
+
+		std::deque<header> m_entries;
+		std::size_t m_size = 0;
+		std::size_t m_max_size;
+	};
+
+	/// Decoder of the header blocks sent by the peer.
+	class hpack_decoder
+	{
+	public:
+		/// max_table_size is the SETTINGS_HEADER_TABLE_SIZE announced to the peer, max_list_size bounds
+		/// the decoded size of a block (name + value + 32 per header) since indexed fields expand.
+		explicit hpack_decoder(std::size_t max_table_size = 4096, std::size_t max_list_size = 65536);
+
+		/// Append the headers of a complete header block to result, false on a compression error
+		/// which the connection can not recover from.
+		bool decode(const std::uint8_t* data, std::size_t len, std::vector<header>& result);
+
+	private:
+		hpack_table m_table;
+		const std::size_t m_max_table_size;
+		const std::size_t m_max_list_size;
+	};
+
+	/// Encoder of the header blocks we send.
+	class hpack_encoder
+	{
+	public:
+		hpack_encoder();
+
+		/// Append the header block of headers to dest, names must be lower case.
+		void encode(const std::vector<header>& headers, std::string& dest);
+
+		/// SETTINGS_HEADER_TABLE_SIZE of the peer, announced at the start of the next header block.
+		void set_max_table_size(std::size_t max_size);
+
+	private:
+		void encode_header(const std::string& name, const std::string& value, std::string& dest);
+
+		hpack_table m_table;
+		bool m_table_size_update = false;
+	};
+
+	/// Decode the huffman coded src, false on invalid code or padding.
+	bool huffman_decode(const std::uint8_t* src, std::size_t len, std::string& dest);
+	void huffman_encode(std::string_view src, std::string& dest);
+	std::size_t huffman_encoded_size(std::string_view src);
+}
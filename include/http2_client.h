@@ -0,0 +1,435 @@
+#pragma once
+
+#include <array>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include <boost/asio.hpp>
+#include <spdlog/logger.h>
+#include "http2_connection.h"
+#include "http2_server_session.h"
+#include "http_client_engine.h"
+
+namespace spiritsaway::http_utils
+{
+	namespace asio = boost::asio;
+	using asio_ec = boost::system::error_code;
+
+	struct http2_client_stats
+	{
+		std::uint64_t requests = 0;
+		/// Transport connections opened, a reconnect follows a GOAWAY or a connection error.
+		std::uint64_t connections = 0;
+		/// Requests sent again after the server refused their stream.
+		std::uint64_t retried_streams = 0;
+		std::uint64_t active_streams = 0;
+		std::uint64_t max_active_streams = 0;
+		/// Requests waiting for a free stream below the concurrency limit of the server.
+		std::uint64_t queued_requests = 0;
+	};
+
+	/// One HTTP/2 connection to an upstream carrying all the requests issued on it as concurrent streams.
+	/// The connection is opened on the first request and again when the previous one went away,
+	/// requests beyond the stream limit of the server wait for a free stream.
+	/// Every event runs on a strand, the public functions may be called from any thread.
+	template <typename Stream>
+	class http2_client_session
+		: public std::enable_shared_from_this<http2_client_session<Stream>>
+	{
+	public:
+		using executor_type = asio::strand<asio::io_context::executor_type>;
+		using connect_handler = std::function<void(const std::string& err, std::unique_ptr<Stream>&& stream)>;
+		/// Open the transport on the executor and call the handler with the connected stream or an error.
+		using connector = std::function<void(executor_type executor, connect_handler handler)>;
+
+		http2_client_session(const http2_client_session&) = delete;
+		http2_client_session& operator=(const http2_client_session&) = delete;
+
+		http2_client_session(asio::io_context& io_context, std::shared_ptr<spdlog::logger> in_logger, const std::string& scheme, const std::string& authority, connector in_connector, const http2_settings& settings)
+			: m_strand(asio::make_strand(io_context))
+			, m_logger(std::move(in_logger))
+			, m_scheme(scheme)
+			, m_authority(authority)
+			, m_connector(std::move(in_connector))
+			, m_settings(settings)
+			, m_timer(m_strand)
+		{
+
+		}
+
+		/// Send req and call callback with an empty error and the reply, or the error. Returns a handle for cancel.
+		std::uint64_t async_request(const request& req, reply_callback callback, std::uint32_t timeout_second)
+		{
+			auto cur_task = std::make_shared<request_task>();
+			cur_task->handle = ++m_handle_counter;
+			cur_task->req = req;
+			cur_task->callback = std::move(callback);
+			cur_task->deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout_second);
+			asio::post(m_strand, [self = this->shared_from_this(), this, cur_task]()
+				{
+					m_request_counter++;
+					m_tasks[cur_task->handle] = cur_task;
+					m_queued.push_back(cur_task);
+					if (!m_timer_running)
+					{
+						check_timeout();
+					}
+					if (!m_stream && !m_connecting)
+					{
+						do_connect();
+						return;
+					}
+					if (m_stream)
+					{
+						open_streams();
+						do_write();
+					}
+				});
+			return cur_task->handle;
+		}
+
+		/// Abort the request without invoking its callback.
+		void cancel(std::uint64_t request_handle)
+		{
+			asio::post(m_strand, [self = this->shared_from_this(), this, request_handle]()
+				{
+					auto cur_iter = m_tasks.find(request_handle);
+					if (cur_iter == m_tasks.end())
+					{
+						return;
+					}
+					auto cur_task = cur_iter->second;
+					m_tasks.erase(cur_iter);
+					// a queued task is skipped once it reaches the front
+					cur_task->callback = nullptr;
+					if (cur_task->stream_id)
+					{
+						m_active.erase(cur_task->stream_id);
+						m_connection->cancel_stream(cur_task->stream_id);
+						do_write();
+					}
+				});
+		}
+
+		/// Fail all requests and close the connection.
+		void close()
+		{
+			asio::post(m_strand, [self = this->shared_from_this(), this]()
+				{
+					m_closed = true;
+					m_timer.cancel();
+					fail_all("client closed");
+					if (m_stream)
+					{
+						close_stream(*m_stream);
+						m_stream.reset();
+					}
+				});
+		}
+
+		http2_client_stats get_stats() const
+		{
+			http2_client_stats result;
+			result.requests = m_request_counter.load();
+			result.connections = m_connection_counter.load();
+			result.retried_streams = m_retry_counter.load();
+			result.active_streams = m_active_count.load();
+			result.max_active_streams = m_max_active_count.load();
+			result.queued_requests = m_queued_count.load();
+			return result;
+		}
+
+	private:
+		struct request_task
+		{
+			std::uint64_t handle = 0;
+			request req;
+			reply_callback callback;
+			std::chrono::steady_clock::time_point deadline;
+			std::uint32_t stream_id = 0;
+		};
+
+		void do_connect()
+		{
+			m_connecting = true;
+			m_connection_counter++;
+			m_connector(m_strand, [self = this->shared_from_this(), this](const std::string& err, std::unique_ptr<Stream>&& stream)
+				{
+					// the connector may finish on another executor
+					asio::dispatch(m_strand, [self, this, err, stream = std::shared_ptr<Stream>(std::move(stream))]()
+						{
+							on_connect(err, stream);
+						});
+				});
+		}
+
+		void on_connect(const std::string& err, std::shared_ptr<Stream> stream)
+		{
+			m_connecting = false;
+			if (m_closed)
+			{
+				if (stream)
+				{
+					close_stream(*stream);
+				}
+				return;
+			}
+			if (!err.empty())
+			{
+				m_logger->error("http2 client {} connect fail: {}", m_authority, err);
+				fail_all(err);
+				return;
+			}
+			m_stream = std::move(stream);
+			m_connection = std::make_unique<http2_connection>(m_settings, http2_role::client);
+			m_connection->start();
+			open_streams();
+			do_write();
+			do_read();
+		}
+
+		void open_streams()
+		{
+			while (!m_queued.empty() && m_connection->can_open_stream())
+			{
+				auto cur_task = std::move(m_queued.front());
+				m_queued.pop_front();
+				if (!cur_task->callback)
+				{
+					continue;
+				}
+				cur_task->stream_id = m_connection->submit_request(cur_task->req, m_scheme, m_authority);
+				m_active[cur_task->stream_id] = cur_task;
+			}
+			m_active_count = m_active.size();
+			m_queued_count = m_queued.size();
+			if (m_active.size() > m_max_active_count.load())
+			{
+				m_max_active_count = m_active.size();
+			}
+		}
+
+		void do_read()
+		{
+			m_stream->async_read_some(asio::buffer(m_read_buffer), [self = this->shared_from_this(), this, cur_stream = m_stream](const asio_ec& ec, std::size_t bytes_transferred)
+				{
+					if (cur_stream != m_stream)
+					{
+						// a read of the previous connection
+						return;
+					}
+					if (ec)
+					{
+						on_disconnect("connection closed: " + ec.message());
+						return;
+					}
+					m_connection->feed(m_read_buffer.data(), bytes_transferred);
+					deliver_results();
+					open_streams();
+					do_write();
+					if (m_stream == cur_stream && !m_connection->failed())
+					{
+						do_read();
+					}
+				});
+		}
+
+		void deliver_results()
+		{
+			for (auto& one_pair : m_connection->take_replies())
+			{
+				auto cur_iter = m_active.find(one_pair.first);
+				if (cur_iter == m_active.end())
+				{
+					continue;
+				}
+				auto cur_task = cur_iter->second;
+				m_active.erase(cur_iter);
+				finish_task(cur_task, std::string(), one_pair.second);
+			}
+			for (const auto& one_error : m_connection->take_stream_errors())
+			{
+				auto cur_iter = m_active.find(one_error.stream_id);
+				if (cur_iter == m_active.end())
+				{
+					continue;
+				}
+				auto cur_task = cur_iter->second;
+				m_active.erase(cur_iter);
+				if (one_error.retryable)
+				{
+					// not processed by the server, it keeps its place in front of the queue
+					m_retry_counter++;
+					cur_task->stream_id = 0;
+					m_queued.push_front(cur_task);
+					continue;
+				}
+				finish_task(cur_task, "stream reset with error " + std::to_string(std::uint32_t(one_error.error_code)), reply());
+			}
+		}
+
+		void do_write()
+		{
+			if (m_writing || !m_stream)
+			{
+				return;
+			}
+			if (m_connection->output().empty())
+			{
+				if (m_connection->failed() || m_connection->finished())
+				{
+					on_disconnect(m_connection->failed() ? "http2 protocol error" : "connection went away");
+				}
+				return;
+			}
+			// the buffer stays alive with the write even when the connection is replaced meanwhile
+			auto cur_buffer = std::make_shared<std::string>();
+			cur_buffer->swap(m_connection->output());
+			m_writing = true;
+			async_write_all(*m_stream, asio::buffer(*cur_buffer), [self = this->shared_from_this(), this, cur_buffer, cur_stream = m_stream](const asio_ec& ec, std::size_t)
+				{
+					if (cur_stream != m_stream)
+					{
+						return;
+					}
+					m_writing = false;
+					if (ec)
+					{
+						on_disconnect("connection closed: " + ec.message());
+						return;
+					}
+					do_write();
+				});
+		}
+
+		// fail the streams of the connection and reconnect for the queued requests
+		void on_disconnect(const std::string& reason)
+		{
+			if (m_stream)
+			{
+				close_stream(*m_stream);
+				m_stream.reset();
+			}
+			m_writing = false;
+			auto cur_active = std::move(m_active);
+			m_active.clear();
+			for (auto& one_pair : cur_active)
+			{
+				finish_task(one_pair.second, reason, reply());
+			}
+			m_active_count = 0;
+			bool has_queued = std::any_of(m_queued.begin(), m_queued.end(), [](const std::shared_ptr<request_task>& one_task)
+				{
+					return bool(one_task->callback);
+				});
+			if (has_queued && !m_closed)
+			{
+				do_connect();
+			}
+		}
+
+		// requests are timed out by one timer ticking while any is pending
+		void check_timeout()
+		{
+			m_timer_running = true;
+			m_timer.expires_from_now(std::chrono::seconds(1));
+			m_timer.async_wait([self = this->shared_from_this(), this](const asio_ec& error)
+				{
+					m_timer_running = false;
+					if (error == asio::error::operation_aborted || m_closed)
+					{
+						return;
+					}
+					auto now_ts = std::chrono::steady_clock::now();
+					std::vector<std::shared_ptr<request_task>> expired_tasks;
+					for (const auto& one_pair : m_tasks)
+					{
+						if (one_pair.second->deadline <= now_ts)
+						{
+							expired_tasks.push_back(one_pair.second);
+						}
+					}
+					for (auto& one_task : expired_tasks)
+					{
+						if (one_task->stream_id && m_active.erase(one_task->stream_id))
+						{
+							m_connection->cancel_stream(one_task->stream_id);
+						}
+						finish_task(one_task, "timeout", reply());
+					}
+					if (!expired_tasks.empty() && m_stream)
+					{
+						do_write();
+					}
+					if (!m_tasks.empty())
+					{
+						check_timeout();
+					}
+				});
+		}
+
+		void fail_all(const std::string& err)
+		{
+			auto cur_tasks = std::move(m_tasks);
+			m_tasks.clear();
+			m_active.clear();
+			m_queued.clear();
+			for (auto& one_pair : cur_tasks)
+			{
+				finish_task(one_pair.second, err, reply());
+			}
+		}
+
+		void finish_task(std::shared_ptr<request_task> task, const std::string& err, const reply& rep)
+		{
+			m_tasks.erase(task->handle);
+			auto cur_callback = std::move(task->callback);
+			task->callback = nullptr;
+			if (cur_callback)
+			{
+				cur_callback(err, rep);
+			}
+		}
+
+		executor_type m_strand;
+		std::shared_ptr<spdlog::logger> m_logger;
+		const std::string m_scheme;
+		const std::string m_authority;
+		const connector m_connector;
+		const http2_settings m_settings;
+
+		// replaced on reconnect, pending operations keep the previous one alive
+		std::shared_ptr<Stream> m_stream;
+		std::unique_ptr<http2_connection> m_connection;
+		std::array<char, 16384> m_read_buffer;
+		bool m_connecting = false;
+		bool m_writing = false;
+		bool m_closed = false;
+
+		std::unordered_map<std::uint64_t, std::shared_ptr<request_task>> m_tasks;
+		std::unordered_map<std::uint32_t, std::shared_ptr<request_task>> m_active;
+		std::deque<std::shared_ptr<request_task>> m_queued;
+		std::atomic<std::uint64_t> m_handle_counter = 0;
+		// written on the strand, read by get_stats from any thread
+		std::atomic<std::uint64_t> m_request_counter = 0;
+		std::atomic<std::uint64_t> m_connection_counter = 0;
+		std::atomic<std::uint64_t> m_retry_counter = 0;
+		std::atomic<std::uint64_t> m_active_count = 0;
+		std::atomic<std::uint64_t> m_max_active_count = 0;
+		std::atomic<std::uint64_t> m_queued_count = 0;
+
+		asio::basic_waitable_timer<std::chrono::steady_clock> m_timer;
+		bool m_timer_running = false;
+	};
+
+	/// Cleartext http2 (h2c with prior knowledge) to server_url:server_port.
+	using h2c_client = http2_client_session<asio::ip::tcp::socket>;
+
+	std::shared_ptr<h2c_client> make_h2c_client(asio::io_context& io_context, std::shared_ptr<spdlog::logger> in_logger, const std::string& server_url, const std::string& server_port, const http2_settings& settings = http2_settings());
+
+	/// Share one h2c_client per upstream between all the requests of an http_client_engine.
+	client_launcher make_h2c_client_launcher(asio::io_context& io_context, std::shared_ptr<spdlog::logger> in_logger, const http2_settings& settings = http2_settings());
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include "http_packet.h"
+#include "hpack.h"
+
+namespace spiritsaway::http_utils
+{
+	enum class http2_error_code : std::uint32_t
+	{
+		no_error = 0x0,
+		protocol_error = 0x1,
+		internal_error = 0x2,
+		flow_control_error = 0x3,
+		settings_timeout = 0x4,
+		stream_closed = 0x5,
+		frame_size_error = 0x6,
+		refused_stream = 0x7,
+		cancel = 0x8,
+		compression_error = 0x9,
+		connect_error = 0xa,
+		enhance_your_calm = 0xb,
+		inadequate_security = 0xc,
+		http_1_1_required = 0xd,
+	};
+
+	struct http2_settings
+	{
+		std::uint32_t header_table_size = 4096;
+		std::uint32_t enable_push = 0;
+		std::uint32_t max_concurrent_streams = 100;
+		std::uint32_t initial_window_size = 65535;
+		std::uint32_t max_frame_size = 16384;
+		std::uint32_t max_header_list_size = 65536;
+	};
+
+	enum class http2_role
+	{
+		server,
+		client,
+	};
+
+	/// A stream we opened that ended without a reply.
+	struct http2_stream_error
+	{
+		std::uint32_t stream_id;
+		http2_error_code error_code;
+		/// The server did not process the request (REFUSED_STREAM or above the GOAWAY last stream id),
+		/// it is safe to send again.
+		bool retryable;
+	};
+
+	/// The client connection preface.
+	extern const std::string_view http2_preface;
+
+	/// Decode the base64url HTTP2-Settings header of an h2c upgrade into a SETTINGS payload.
+	bool decode_http2_settings(std::string_view header_value, std::string& payload);
+
+	/// Transport independent HTTP/2 framing, HPACK and flow control of one connection (RFC 7540).
+	/// Bytes read from the peer are fed in, completed requests (server) or replies (client) are taken
+	/// out and the frames to send pile up in output() until the session writes them.
+	class http2_connection
+	{
+	public:
+		http2_connection(const http2_connection&) = delete;
+		http2_connection& operator=(const http2_connection&) = delete;
+
+		explicit http2_connection(const http2_settings& local_settings = http2_settings(), http2_role role = http2_role::server);
+
+		/// Queue our SETTINGS, preceded by the connection preface for a client.
+		void start();
+
+		/// Start after an HTTP/1.1 Upgrade: h2c, the upgraded request becomes stream 1 whose reply is
+		/// sent over http2. settings_payload is the decoded HTTP2-Settings header, invalid settings fail the connection.
+		bool start_upgraded(request&& req, std::string_view settings_payload);
+
+		/// Parse bytes from the peer, false once the connection failed and only the queued GOAWAY remains.
+		bool feed(const char* data, std::size_t len);
+
+		/// Requests completed by the previous feed calls with their stream id.
+		std::vector<std::pair<std::uint32_t, request>> take_requests();
+
+		/// Queue the reply of a stream, DATA beyond the flow control windows is sent on WINDOW_UPDATE.
+		/// Replies of reset streams are dropped, replies of HEAD requests keep their content-length without the DATA.
+		/// The content_file is loaded into the DATA, an event_hub can not be served and turns into a 501.
+		void submit_reply(std::uint32_t stream_id, const reply& rep);
+
+		/// Client: whether another stream fits in the concurrency limit of the server.
+		bool can_open_stream() const;
+
+		/// Client: open a stream sending req, returns its id or 0 when no stream can be opened.
+		/// The Host header is replaced by authority.
+		std::uint32_t submit_request(const request& req, const std::string& scheme, const std::string& authority);
+
+		/// Client: replies completed by the previous feed calls with their stream id.
+		std::vector<std::pair<std::uint32_t, reply>> take_replies();
+
+		/// Client: streams reset or refused by the server since the last call.
+		std::vector<http2_stream_error> take_stream_errors();
+
+		/// Client: abandon a stream with RST_STREAM(CANCEL), its reply is never reported.
+		void cancel_stream(std::uint32_t stream_id);
+
+		/// Queue a GOAWAY, no new streams are accepted afterwards.
+		void go_away(http2_error_code error_code);
+
+		/// Frames waiting to be written.
+		std::string& output()
+		{
+			return m_output;
+		}
+
+		/// Streams not finished yet.
+		std::size_t active_stream_count() const
+		{
+			return m_streams.size();
+		}
+
+		/// No more frames will be processed, the connection closes once the output is written.
+		bool failed() const
+		{
+			return m_failed;
+		}
+
+		/// A GOAWAY was sent or received and all streams are done.
+		bool finished() const
+		{
+			return (m_going_away || m_peer_going_away) && m_streams.empty();
+		}
+
+	private:
+		struct stream_state
+		{
+			std::vector<header> headers;
+			std::string body;
+			// client: the reply being received, its final headers arrived
+			reply rep;
+			bool headers_received = false;
+			// the peer ended its side with END_STREAM
+			bool remote_closed = false;
+			// our HEADERS were sent, the body may still wait in pending_data
+			bool local_submitted = false;
+			// server: the request is a HEAD, its reply ends with the HEADERS frame
+			bool head_request = false;
+			std::int64_t send_window = 0;
+			std::int64_t recv_window = 0;
+			// reply body waiting for the send windows
+			std::string pending_data;
+			std::size_t pending_offset = 0;
+		};
+
+		bool on_frame(std::uint8_t type, std::uint8_t flags, std::uint32_t stream_id, const std::uint8_t* payload, std::size_t len);
+		bool on_data(std::uint8_t flags, std::uint32_t stream_id, const std::uint8_t* payload, std::size_t len);
+		bool on_headers(std::uint8_t flags, std::uint32_t stream_id, const std::uint8_t* payload, std::size_t len);
+		bool on_continuation(std::uint8_t flags, std::uint32_t stream_id, const std::uint8_t* payload, std::size_t len);
+		bool on_header_block(std::uint32_t stream_id, bool end_stream);
+		bool on_reply_headers(std::uint32_t stream_id, bool end_stream, std::vector<header>&& headers);
+		bool on_go_away(const std::uint8_t* payload, std::size_t len);
+		// the stream was never opened by either side
+		bool is_idle_stream(std::uint32_t stream_id) const;
+		bool on_settings(std::uint8_t flags, std::uint32_t stream_id, const std::uint8_t* payload, std::size_t len);
+		bool on_window_update(std::uint32_t stream_id, const std::uint8_t* payload, std::size_t len);
+		bool apply_settings(const std::uint8_t* payload, std::size_t len);
+
+		// the peer finished its side of the stream
+		bool on_remote_end(std::uint32_t stream_id);
+		// the request of the stream is complete
+		bool finish_request(std::uint32_t stream_id);
+		// the reply of the stream is complete
+		bool finish_reply(std::uint32_t stream_id);
+		// fail a stream of ours, the session reports it with take_stream_errors
+		void fail_stream(std::uint32_t stream_id, http2_error_code error_code, bool retryable);
+		void write_header_block(std::uint32_t stream_id, const std::vector<header>& headers, bool end_stream);
+		void flush_stream(std::uint32_t stream_id);
+		void flush_all();
+		void close_stream(std::uint32_t stream_id);
+
+		bool connection_error(http2_error_code error_code);
+		void reset_stream(std::uint32_t stream_id, http2_error_code error_code);
+		void write_frame_header(std::size_t len, std::uint8_t type, std::uint8_t flags, std::uint32_t stream_id);
+		void write_window_update(std::uint32_t stream_id, std::uint32_t increment);
+
+		const http2_settings m_local_settings;
+		const http2_role m_role;
+		http2_settings m_peer_settings;
+		hpack_decoder m_decoder;
+		hpack_encoder m_encoder;
+
+		std::unordered_map<std::uint32_t, stream_state> m_streams;
+		std::vector<std::pair<std::uint32_t, request>> m_ready_requests;
+		std::vector<std::pair<std::uint32_t, reply>> m_ready_replies;
+		std::vector<http2_stream_error> m_stream_errors;
+		std::uint32_t m_last_peer_stream_id = 0;
+		std::uint32_t m_next_stream_id = 1;
+
+		std::string m_input;
+		std::string m_output;
+		bool m_preface_received = false;
+		bool m_settings_received = false;
+		// stream of the HEADERS whose block continues in CONTINUATION frames, 0 when none
+		std::uint32_t m_continuation_stream = 0;
+		bool m_continuation_end_stream = false;
+		std::string m_header_block;
+
+		std::int64_t m_send_window = 65535;
+		std::int64_t m_recv_window = 65535;
+
+		bool m_going_away = false;
+		bool m_peer_going_away = false;
+		bool m_failed = false;
+	};
+}
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <functional>
+#include <vector>
+#include <boost/asio.hpp>
+#include <spdlog/logger.h>
+#include "http2_connection.h"
+#include "http_session_manager.h"
+#include "http_log.h"
+#include "metrics.h"
+
+namespace spiritsaway::http_utils
+{
+	namespace asio = boost::asio;
+	using asio_ec = boost::system::error_code;
+
+	/// Write the whole buffer, streams without an async_write_some overload this by argument lookup.
+	template <typename Stream>
+	void async_write_all(Stream& stream, asio::const_buffer buffer, std::function<void(const asio_ec&, std::size_t)> handler)
+	{
+		asio::async_write(stream, buffer, handler);
+	}
+
+	/// Gather write of all the buffers, which must stay alive until the handler runs.
+	template <typename Stream>
+	void async_write_buffers(Stream& stream, const std::vector<asio::const_buffer>& buffers, std::function<void(const asio_ec&, std::size_t)> handler)
+	{
+		asio::async_write(stream, buffers, handler);
+	}
+
+	template <typename Stream>
+	void close_stream(Stream& stream)
+	{
+		asio_ec ignored_ec;
+		stream.lowest_layer().close(ignored_ec);
+	}
+
+	/// Called by an HTTP/1.1 session that switches to http2: the stream, the bytes read after the
+	/// switch point, and for an h2c upgrade the upgraded request with its HTTP2-Settings payload.
+	template <typename Stream>
+	using http2_handoff = std::function<void(std::unique_ptr<Stream>&& stream, std::string&& received, std::unique_ptr<request>&& upgraded_req, std::string&& settings_payload)>;
+
+	/// A connection speaking HTTP/2 over Stream, requests of all streams go to the same handler and
+	/// their replies are multiplexed in the order the handler finishes them.
+	template <typename Stream>
+	class http2_server_session
+		: public std::enable_shared_from_this<http2_server_session<Stream>>
+	{
+	public:
+		http2_server_session(const http2_server_session&) = delete;
+		http2_server_session& operator=(const http2_server_session&) = delete;
+
+		http2_server_session(std::unique_ptr<Stream>&& stream, std::shared_ptr<spdlog::logger> in_logger, std::uint64_t in_session_idx, http_session_manager<http2_server_session>& session_mgr, const request_handler& handler, server_metrics& metrics, const http2_settings& settings)
+			: m_stream(std::move(stream))
+			, m_logger(std::move(in_logger))
+			, m_session_idx(in_session_idx)
+			, m_session_mgr(session_mgr)
+			, m_request_handler(handler)
+			, m_metrics(metrics)
+			, m_connection(settings)
+			, m_con_timer(m_stream->get_executor())
+		{
+
+		}
+
+		/// Bytes already read from the stream by the previous protocol, call before start.
+		void set_received(std::string&& received)
+		{
+			m_received = std::move(received);
+		}
+
+		/// Continue an h2c upgrade, the request becomes stream 1. Call before start.
+		bool set_upgrade(request&& req, std::string_view settings_payload)
+		{
+			m_upgraded = true;
+			return m_connection.start_upgraded(std::move(req), settings_payload);
+		}
+
+		void start()
+		{
+			HTTP_UTILS_LOG_DEBUG(m_logger, "http2 session {} start", m_session_idx);
+			if (!m_upgraded)
+			{
+				m_connection.start();
+			}
+			if (!m_received.empty() || m_upgraded)
+			{
+				auto cur_received = std::move(m_received);
+				if (!on_received(cur_received.data(), cur_received.size()))
+				{
+					return;
+				}
+			}
+			arm_idle_timer();
+			do_read();
+		}
+
+		void stop()
+		{
+			HTTP_UTILS_LOG_DEBUG(m_logger, "http2 session {} stop", m_session_idx);
+			m_stopped = true;
+			m_con_timer.cancel();
+			close_stream(*m_stream);
+		}
+
+	private:
+		void do_read()
+		{
+			auto self(this->shared_from_this());
+			m_stream->async_read_some(asio::buffer(m_read_buffer), [self, this](const asio_ec& ec, std::size_t bytes_transferred)
+				{
+					if (ec)
+					{
+						if (ec != asio::error::operation_aborted && ec != asio::error::eof)
+						{
+							m_logger->error("http2 session {} error {}", m_session_idx, ec.message());
+						}
+						m_session_mgr.stop(self);
+						return;
+					}
+					if (m_stopped)
+					{
+						return;
+					}
+					arm_idle_timer();
+					m_metrics.received_bytes.add(bytes_transferred);
+					if (on_received(m_read_buffer.data(), bytes_transferred))
+					{
+						do_read();
+					}
+				});
+		}
+
+		// false when the connection is closing and reads stop
+		bool on_received(const char* data, std::size_t len)
+		{
+			if (!m_connection.feed(data, len))
+			{
+				m_logger->warn("http2 session {} protocol error", m_session_idx);
+				m_metrics.parse_errors.add();
+			}
+			dispatch_requests();
+			do_write();
+			return !m_close_after_write;
+		}
+
+		void dispatch_requests()
+		{
+			auto self(this->shared_from_this());
+			for (auto& one_pair : m_connection.take_requests())
+			{
+				auto cur_stream_id = one_pair.first;
+				// the reply callback owns the request, it stays alive as long as a handler holds the callback
+				auto cur_req = std::make_shared<request>(std::move(one_pair.second));
+				m_metrics.requests.add();
+				// frames of many streams share the reads and writes, only the handler phase is per request
+				auto* cur_phases = &m_metrics.phase_histograms(*cur_req);
+				std::shared_ptr<trace_span> cur_span;
+				if (m_metrics.tracer)
+				{
+					cur_span = std::make_shared<trace_span>();
+					if (!m_metrics.begin_trace(*cur_req, *cur_span, 0))
+					{
+						cur_span.reset();
+					}
+				}
+				trace_scope cur_trace_scope(cur_span ? cur_span->context() : trace_context(), cur_span ? m_metrics.tracer.get() : nullptr);
+				m_request_handler(*cur_req, [self, this, cur_stream_id, cur_req, cur_phases, cur_span, begin_ts = std::chrono::steady_clock::now()](const reply& in_reply)
+					{
+						auto cur_handler_us = elapsed_microseconds(begin_ts);
+						cur_phases->handler.record(cur_handler_us);
+						if (cur_span)
+						{
+							m_metrics.end_trace(std::move(*cur_span), in_reply.status_code, 0, cur_handler_us, 0, std::string());
+						}
+						on_reply(cur_stream_id, *cur_req, in_reply, cur_handler_us);
+					});
+			}
+		}
+
+		void on_reply(std::uint32_t stream_id, const request& in_req, const reply& in_reply, std::uint64_t handler_us)
+		{
+			if (in_reply.event_hub)
+			{
+				m_logger->warn("http2 session {} stream {} event stream replied with 501, only HTTP/1.1 serves them", m_session_idx, stream_id);
+			}
+			// the frames of the reply are interleaved with other streams, only the content size is known here
+			m_metrics.log_access(in_req, in_reply.status_code, in_reply.content.size(), 0, handler_us, 0);
+			if (m_stopped)
+			{
+				return;
+			}
+			m_connection.submit_reply(stream_id, in_reply);
+			do_write();
+		}
+
+		void do_write()
+		{
+			if (m_connection.failed() || m_connection.finished())
+			{
+				m_close_after_write = true;
+			}
+			if (m_writing)
+			{
+				return;
+			}
+			auto self(this->shared_from_this());
+			if (m_connection.output().empty())
+			{
+				if (m_close_after_write && !m_stopped)
+				{
+					m_session_mgr.stop(self);
+				}
+				return;
+			}
+			// frames queued while writing go out with the next write
+			m_write_buffer.clear();
+			m_write_buffer.swap(m_connection.output());
+			m_writing = true;
+			async_write_all(*m_stream, asio::buffer(m_write_buffer), [self, this](const asio_ec& ec, std::size_t bytes_transferred)
+				{
+					m_writing = false;
+					m_metrics.sent_bytes.add(bytes_transferred);
+					if (ec)
+					{
+						if (ec != asio::error::operation_aborted)
+						{
+							m_logger->error("http2 session {} error {}", m_session_idx, ec.message());
+						}
+						m_session_mgr.stop(self);
+						return;
+					}
+					if (!m_stopped)
+					{
+						do_write();
+					}
+				});
+		}
+
+		// close connections without streams once they are idle for m_timeout_seconds
+		void arm_idle_timer()
+		{
+			auto self(this->shared_from_this());
+			m_con_timer.expires_from_now(std::chrono::seconds(m_timeout_seconds));
+			m_con_timer.async_wait([self, this](const asio_ec& error)
+				{
+					if (error == asio::error::operation_aborted || m_stopped)
+					{
+						return;
+					}
+					if (m_connection.active_stream_count() || m_writing)
+					{
+						arm_idle_timer();
+						return;
+					}
+					HTTP_UTILS_LOG_DEBUG(m_logger, "http2 session {} idle timeout", m_session_idx);
+					m_connection.go_away(http2_error_code::no_error);
+					m_close_after_write = true;
+					do_write();
+				});
+		}
+
+		std::unique_ptr<Stream> m_stream;
+		std::shared_ptr<spdlog::logger> m_logger;
+		const std::uint64_t m_session_idx;
+		http_session_manager<http2_server_session>& m_session_mgr;
+		const request_handler m_request_handler;
+		server_metrics& m_metrics;
+
+		http2_connection m_connection;
+		std::array<char, 16384> m_read_buffer;
+		std::string m_received;
+		std::string m_write_buffer;
+		bool m_upgraded = false;
+		bool m_writing = false;
+		bool m_close_after_write = false;
+		bool m_stopped = false;
+
+		asio::basic_waitable_timer<std::chrono::steady_clock> m_con_timer;
+		const std::size_t m_timeout_seconds = 5;
+	};
+}
@@ -8,6 +8,7 @@
 #include <boost/asio.hpp>
 #include <spdlog/logger.h>
 #include "http_reply_parser.h"
+#include "tracing.h"
 
 namespace spiritsaway::http_utils
 {
@@ -19,7 +20,8 @@ namespace spiritsaway::http_utils
 		asio::ip::tcp::resolver m_resolver;
 		asio::ip::tcp::socket m_socket;
 		std::function<void(const std::string &, const reply &)> m_callback;
-		const std::string m_req_str;
+		// carries the traceparent of m_trace_span when created inside a trace_scope
+		std::string m_req_str;
 		const std::string m_server_url;
 		const std::string m_server_port;
 		std::string m_header_read_buffer;
@@ -30,14 +32,34 @@ namespace spiritsaway::http_utils
 		const std::size_t m_timeout_seconds = 5;
 		http_reply_parser m_rep_parser;
 		std::shared_ptr<spdlog::logger> m_logger;
+		bool m_finished = false;
+		client_span m_trace_span;
+		reply_stream_handler m_stream_handler;
+		// body chunks parsed from the last read, waiting for the stream handler
+		std::vector<std::string_view> m_pending_chunks;
+		std::size_t m_delivered_chunk_num = 0;
+		// the chunks whose resume was called, later calls of the same resume are ignored
+		std::uint64_t m_resumed_chunk_seq = 0;
+		bool m_header_notified = false;
 	public:
 		http_client(asio::io_context &io_context, std::shared_ptr<spdlog::logger> in_logger, const std::string &server_url, const std::string &server_port, const request &req, std::function<void(const std::string &, const reply &)> callback, std::uint32_t timeout_second);
+		// send a request already serialized, e.g. by request_template, move it in to avoid a copy
+		http_client(asio::io_context &io_context, std::shared_ptr<spdlog::logger> in_logger, const std::string &server_url, const std::string &server_port, std::string req_str, std::function<void(const std::string &, const reply &)> callback, std::uint32_t timeout_second);
+		// deliver the reply headers and body chunks while downloading instead of buffering the whole content,
+		// timeout_second then bounds connecting and each read instead of the whole download
+		http_client(asio::io_context &io_context, std::shared_ptr<spdlog::logger> in_logger, const std::string &server_url, const std::string &server_port, const request &req, const reply_stream_handler &stream_handler, std::uint32_t timeout_second);
 		void run();
+		// abort the request without invoking the callback
+		void cancel();
 
 	private:
 		void handle_resolve(const asio_ec& err, asio::ip::tcp::resolver::iterator iterator);
 		void handle_connect(const asio_ec &err);
 		void handle_write_request(const asio_ec &err);
+		// (re)start the timeout, for the whole request or for each read of a streamed reply
+		void arm_timer();
+		void read_content();
+		void deliver_body_chunk();
 		void handle_read_content(const asio_ec &err, std::size_t n);
 		void invoke_callback(const std::string &err);
 		void on_timeout(const asio_ec &err);
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "http_packet.h"
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#include <boost/asio.hpp>
+#include <spdlog/logger.h>
+
+namespace spiritsaway::http_utils
+{
+	namespace asio = boost::asio;
+	using asio_ec = boost::system::error_code;
+	using reply_callback = std::function<void(const std::string&, const reply&)>;
+
+	/// Start one request attempt against server_url:server_port and return a function that cancels it.
+	using client_launcher = std::function<std::function<void()>(const std::string& server_url, const std::string& server_port, const request& req, reply_callback callback, std::uint32_t timeout_second)>;
+
+	client_launcher make_http_client_launcher(asio::io_context& io_context, std::shared_ptr<spdlog::logger> in_logger);
+
+	struct http_client_policy
+	{
+		/// Send a second attempt on a new connection when the first one is slower than
+		/// hedge_percentile of the recent latencies to the same upstream.
+		bool hedge_enabled = false;
+		double hedge_percentile = 0.95;
+		std::uint32_t hedge_min_delay_ms = 1;
+		/// No hedge is sent before this many latencies have been recorded for the upstream.
+		std::uint32_t hedge_min_samples = 20;
+
+		/// Extra attempts for idempotent methods after a transport error or a 502/503/504 reply.
+		std::uint32_t max_retries = 0;
+
+		/// Every request deposits retry_budget_ratio tokens, every retry or hedge withdraws one.
+		double retry_budget_ratio = 0.1;
+		double retry_budget_max = 10;
+
+		/// Share one upstream request between identical in-flight GETs. The key is
+		/// method, host, port, uri and the values of coalesce_headers, a missing header does not match an empty one.
+		bool coalesce_enabled = false;
+		std::vector<std::string> coalesce_headers;
+	};
+
+	struct http_client_engine_stats
+	{
+		std::uint64_t requests = 0;
+		std::uint64_t hedges_sent = 0;
+		std::uint64_t hedges_won = 0;
+		std::uint64_t retries = 0;
+		std::uint64_t budget_exhausted = 0;
+		// requests answered by another in-flight request
+		std::uint64_t coalesced = 0;
+	};
+
+	/// Dispatch requests through a client_launcher, adding hedging, budgeted retries and GET coalescing on top of the single attempt clients.
+	/// The engine must outlive all the requests issued through it.
+	class http_client_engine
+	{
+	public:
+		http_client_engine(const http_client_engine&) = delete;
+		http_client_engine& operator=(const http_client_engine&) = delete;
+
+		http_client_engine(asio::io_context& io_context, std::shared_ptr<spdlog::logger> in_logger, client_launcher launcher, const http_client_policy& policy);
+
+		void async_request(const std::string& server_url, const std::string& server_port, const request& req, reply_callback callback, std::uint32_t timeout_second);
+
+		http_client_engine_stats get_stats() const;
+
+		static bool is_idempotent_method(const std::string& method);
+
+	private:
+		struct request_task;
+		struct latency_window
+		{
+			std::vector<std::uint32_t> latency_us;
+			std::size_t next_idx = 0;
+		};
+
+		void start_attempt(std::shared_ptr<request_task> task);
+		void on_hedge_timeout(std::shared_ptr<request_task> task);
+		void on_attempt_finish(std::shared_ptr<request_task> task, std::size_t attempt_idx, const std::string& err, const reply& rep);
+		void finish_task(std::shared_ptr<request_task> task, std::size_t attempt_idx, const std::string& err, const reply& rep);
+
+		// empty when the request can not be coalesced
+		std::string coalesce_key(const std::string& server_url, const std::string& server_port, const request& req) const;
+		void finish_coalesced(const std::string& key, const std::string& err, const reply& rep);
+
+		bool withdraw_retry_token();
+		void record_latency(const std::string& upstream_key, std::chrono::steady_clock::duration latency);
+		// zero when not enough samples have been recorded
+		std::chrono::microseconds hedge_delay(const std::string& upstream_key);
+
+	private:
+		asio::io_context& m_ioc;
+		std::shared_ptr<spdlog::logger> m_logger;
+		const client_launcher m_launcher;
+		const http_client_policy m_policy;
+
+		std::mutex m_mutex;
+		double m_retry_tokens = 0;
+		std::unordered_map<std::string, latency_window> m_latency_windows;
+		// callbacks waiting for the in-flight request with the same coalesce key
+		std::unordered_map<std::string, std::vector<reply_callback>> m_coalesced_callbacks;
+
+		std::atomic<std::uint64_t> m_request_counter = 0;
+		std::atomic<std::uint64_t> m_hedge_counter = 0;
+		std::atomic<std::uint64_t> m_hedge_win_counter = 0;
+		std::atomic<std::uint64_t> m_retry_counter = 0;
+		std::atomic<std::uint64_t> m_budget_exhausted_counter = 0;
+		std::atomic<std::uint64_t> m_coalesced_counter = 0;
+	};
+}
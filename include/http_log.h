@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <spdlog/logger.h>
+
+/// Log calls below this level are compiled out, the values are the ones of SPDLOG_LEVEL_TRACE to SPDLOG_LEVEL_OFF.
+#ifndef HTTP_UTILS_LOG_ACTIVE_LEVEL
+#define HTTP_UTILS_LOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+
+/// Log through logger when its runtime level allows it. The arguments are only evaluated and
+/// formatted when the level is enabled, a disabled level costs the branch.
+#define HTTP_UTILS_LOG(logger, level, ...) \
+	do \
+	{ \
+		if ((logger)->should_log(level)) \
+		{ \
+			(logger)->log(level, __VA_ARGS__); \
+		} \
+	} while (0)
+
+#if HTTP_UTILS_LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_TRACE
+#define HTTP_UTILS_LOG_TRACE(logger, ...) HTTP_UTILS_LOG(logger, spdlog::level::trace, __VA_ARGS__)
+#else
+#define HTTP_UTILS_LOG_TRACE(logger, ...) (void)0
+#endif
+
+#if HTTP_UTILS_LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_DEBUG
+#define HTTP_UTILS_LOG_DEBUG(logger, ...) HTTP_UTILS_LOG(logger, spdlog::level::debug, __VA_ARGS__)
+#else
+#define HTTP_UTILS_LOG_DEBUG(logger, ...) (void)0
+#endif
+
+#if HTTP_UTILS_LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_INFO
+#define HTTP_UTILS_LOG_INFO(logger, ...) HTTP_UTILS_LOG(logger, spdlog::level::info, __VA_ARGS__)
+#else
+#define HTTP_UTILS_LOG_INFO(logger, ...) (void)0
+#endif
+
+namespace spiritsaway::http_utils
+{
+	/// A logger whose sinks are written by the spdlog thread pool, so logging from an io thread
+	/// only queues the formatted message. When the queue is full the oldest messages are dropped
+	/// instead of blocking. The pool is shared by all async loggers and created by the first call
+	/// with queue_size slots.
+	std::shared_ptr<spdlog::logger> make_async_logger(const std::string& name, std::vector<spdlog::sink_ptr> sinks, std::size_t queue_size = 8192);
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
 #include <functional>
 #include <memory>
@@ -23,8 +24,32 @@ namespace spiritsaway::http_utils
 		std::string body;
 		std::string to_string(const std::string& server_url, const std::string& server_port) const;
 	};
+
+	/// Serialize requests that share method, uri prefix and headers. The invariant head is
+	/// formatted once, every build only appends the uri suffix, Content-Length and body.
+	class request_template
+	{
+	public:
+		/// Host carries only server_url like request::to_string.
+		request_template(const request& req, const std::string& server_url);
+
+		/// The returned buffer is reused and stays valid until the next call to build.
+		const std::string& build(std::string_view uri_suffix, std::string_view body);
+
+		/// Serialize into buffer instead, e.g. to move it into a client that outlives the next build.
+		void build(std::string& buffer, std::string_view uri_suffix, std::string_view body) const;
+
+	private:
+		// "GET /prefix"
+		std::string m_head_prefix;
+		// " HTTP/1.1\r\nHost: ...\r\n...Content-Length: "
+		std::string m_head_suffix;
+		std::string m_buffer;
+	};
 	std::string parse_uri(const std::string& full_path, std::string& server_url, std::string& server_port, std::string& resource_path);
 
+	class sse_hub;
+
 	/// A reply to be sent to a client.
 	struct reply
 	{
@@ -48,7 +73,7 @@ namespace spiritsaway::http_utils
 			bad_gateway = 502,
 			service_unavailable = 503
 		};
-		std::uint32_t status_code;
+		std::uint32_t status_code = 0;
 
 		/// The headers to be included in the reply.
 		std::vector<header> headers;
@@ -56,13 +81,49 @@ namespace spiritsaway::http_utils
 		/// The content to be sent in the reply.
 		std::string content;
 
+		/// When not empty the content is read from this file instead. Sessions that can
+		/// send it with sendfile (https over kTLS) do not load it into memory.
+		std::string content_file;
+
+		/// When set the HTTP/1.1 connection becomes an event stream subscribed to this hub: the head
+		/// goes out without Content-Length and the body is every event broadcast until either side closes.
+		/// http2 streams get a 501 instead.
+		std::shared_ptr<sse_hub> event_hub;
+
 		std::string to_string() const;
 
+		/// What to_string sends in answer to a HEAD request, the same head without the body.
+		std::string to_head_string() const;
+
+		/// The body, read from content_file when set. False when the file can not be read.
+		bool read_content(std::string& dest) const;
+
+		/// Status line and headers, ending with Content-Length and the empty line.
+		std::string head_to_string(std::size_t content_length) const;
+
+		/// Status line and headers for a body that ends when the connection closes.
+		std::string stream_head_to_string() const;
+
 		void add_header(const std::string& name, const std::string& value);
 
+		/// First header with the name compared case insensitively, nullptr when missing.
+		const header* find_header(const std::string& name) const;
+
 		/// Get a stock reply.
 		static reply stock_reply(status_type status);
 	};
+	/// Callbacks for consuming a reply while it is being downloaded.
+	struct reply_stream_handler
+	{
+		/// Called once the status line and headers are parsed, content is left empty.
+		std::function<void(const reply& rep)> on_header;
+		/// Called for every body chunk. The chunk is only valid until resume is invoked
+		/// and nothing more is read from the connection before that. Only the first call of
+		/// resume has an effect.
+		std::function<void(std::string_view chunk, std::function<void()> resume)> on_body;
+		/// Called once when the request finishes, like the callback of a buffered request.
+		std::function<void(const std::string& err, const reply& rep)> on_finish;
+	};
 	using reply_handler = std::function<void(const reply &rep)>;
 	using request_handler = std::function<void(const request& req, reply_handler cb)>;
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 
 #pragma once
 #include <tuple>
+#include <string_view>
+#include <functional>
 #include "http_parser.h"
 #include "http_packet.h"
 
@@ -25,13 +27,32 @@ namespace spiritsaway::http_utils
 		/// Parse some data. The enum return value is good when a complete request has
 		/// been parsed, bad if the data is invalid, indeterminate when more data is
 		/// required. The InputIterator return value indicates how much of the input
-		/// has been consumed.
+		/// has been consumed. Passing len 0 tells the parser the connection was closed,
+		/// which completes a reply delimited by the end of the connection.
 		///
 		result_type parse(const char *input, std::size_t len);
 
+		/// Whether the connection may carry another request after the completed reply.
+		bool keep_alive() const
+		{
+			return m_keep_alive;
+		}
+
+		/// Get ready for the next reply on the same connection, m_body_handler and m_head_request are kept.
+		void reset();
+
 	public:
 		reply m_reply;
+		bool m_header_complete = false;
 		bool m_reply_complete = false;
+		bool m_keep_alive = false;
+		/// Whether the last header callback was a value, the next name starts a new header.
+		bool m_in_header_value = false;
+		/// When set, body data is passed to the handler instead of being appended to m_reply.content.
+		/// The view points into the buffer given to parse.
+		std::function<void(std::string_view)> m_body_handler;
+		/// Set when the reply answers a HEAD request, whose headers describe a body that is not sent.
+		bool m_head_request = false;
 
 	private:
 		http_parser_settings m_parser_settings;
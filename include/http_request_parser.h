@@ -20,7 +20,10 @@ namespace spiritsaway::http_utils
 		{
 			good,
 			bad,
-			indeterminate
+			indeterminate,
+			/// A complete request asking to switch protocols (Upgrade or CONNECT), the bytes after
+			/// consumed() belong to the new protocol.
+			upgrade
 		};
 
 		/// Parse some data. The enum return value is good when a complete request has
@@ -30,10 +33,29 @@ namespace spiritsaway::http_utils
 		///
 		result_type parse(const char *input, std::size_t len);
 
+		/// Bytes of the last parse input used by the request, the rest belongs to the next pipelined request.
+		std::size_t consumed() const
+		{
+			return m_consumed;
+		}
+
+		/// Whether the connection may carry another request after the completed one.
+		bool keep_alive() const
+		{
+			return m_keep_alive;
+		}
+
+		/// Get ready for the next request on the same connection.
+		void reset();
+
 	private:
 	public:
 		request m_req;
 		bool m_req_complete = false;
+		bool m_keep_alive = false;
+		/// Whether the last header callback was a value, the next name starts a new header.
+		bool m_in_header_value = false;
+		std::size_t m_consumed = 0;
 
 	private:
 		http_parser_settings m_parse_settings;
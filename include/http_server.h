@@ -27,15 +27,44 @@ namespace spiritsaway::http_utils
 		void stop();
 
 		std::size_t get_session_count();
-		~http_server()
-		{
-		}
+
+		/// Also serve HTTP/2 over cleartext, to clients starting with the preface (prior knowledge)
+		/// or upgrading with "Upgrade: h2c". Call before run.
+		void enable_http2(const http2_settings& settings = http2_settings());
+
+		/// Accept websocket upgrades and pass them to handle_websocket. Call before run.
+		void enable_websocket(const websocket_config& config = websocket_config());
+
+		/// Limits of the event streams opened by replies with an event_hub. Call before run.
+		void set_sse_config(const sse_config& config);
+
+		/// Key the latency histograms of the requests by routes, like the matched path patterns. route_fn
+		/// returns the index of the route of a request, anything past the last route is unrouted. Call before run.
+		void set_metrics_routes(const std::vector<std::string>& routes, std::function<std::size_t(const request&)> route_fn);
+
+		/// Answer GET requests for path with the metrics of the server registry in the Prometheus text
+		/// format before they reach handle_request. Call before run.
+		void enable_metrics_endpoint(const std::string& path = "/metrics");
+
+		/// Record every written reply into log, which may be shared with other servers. Call before run.
+		void set_access_log(std::shared_ptr<access_logger> log);
+
+		/// Record a span per request into recorder and let the clients created by handle_request join
+		/// it through their traceparent header. Call before run.
+		void set_trace_recorder(std::shared_ptr<trace_recorder> recorder);
+		~http_server();
 	protected:
 		virtual void handle_request(const request& req, reply_handler rep_cb) = 0;
+
+		/// Set the handlers of an accepted websocket, the default refuses it with 1008.
+		virtual void handle_websocket(std::shared_ptr<websocket_channel> channel);
 	private:
 		/// Perform an asynchronous accept operation.
 		void do_accept();
 
+		// answer the metrics endpoint, pass everything else to handle_request
+		void dispatch_request(const request& req, reply_handler rep_cb);
+
 
 		/// The io_context used to perform asynchronous operations.
 		asio::io_context &m_ioc;
@@ -47,11 +76,29 @@ namespace spiritsaway::http_utils
 		/// The http_server_session manager which owns all live http_server_sessions.
 		http_session_manager<http_server_session> m_session_mgr;
 
+		/// The connections switched to http2.
+		http_session_manager<http2_server_session<asio::ip::tcp::socket>> m_http2_session_mgr;
+		bool m_http2_enabled = false;
+		http2_settings m_http2_settings;
+
+		/// The connections switched to websocket.
+		http_session_manager<websocket_session<asio::ip::tcp::socket>> m_websocket_session_mgr;
+		bool m_websocket_enabled = false;
+		websocket_config m_websocket_config;
+
+		/// The connections turned into event streams.
+		http_session_manager<sse_session<asio::ip::tcp::socket>> m_sse_session_mgr;
+		sse_config m_sse_config;
+
 		/// The handler for all incoming requests.
 
 		const std::string m_address;
 		const std::string m_port;
 		std::atomic<std::uint64_t> m_session_counter = 0;
+
+		server_metrics m_metrics;
+		// empty when the metrics endpoint is disabled
+		std::string m_metrics_path;
 	protected:
 		std::shared_ptr<spdlog::logger> m_logger;
 	};
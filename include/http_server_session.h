@@ -7,6 +7,10 @@
 
 #include "http_request_parser.h"
 #include "http_session_manager.h"
+#include "http2_server_session.h"
+#include "websocket_session.h"
+#include "sse_session.h"
+#include "metrics.h"
 #include <spdlog/logger.h>
 
 namespace spiritsaway::http_utils
@@ -22,7 +26,18 @@ namespace spiritsaway::http_utils
 		http_server_session &operator=(const http_server_session &) = delete;
 
 		/// Construct a http_server_session with the given socket.
-		explicit http_server_session(asio::ip::tcp::socket socket, std::shared_ptr<spdlog::logger> in_logger, std::uint64_t in_session_idx, http_session_manager<http_server_session>& session_mgr, const request_handler &handler);
+		explicit http_server_session(asio::ip::tcp::socket socket, std::shared_ptr<spdlog::logger> in_logger, std::uint64_t in_session_idx, http_session_manager<http_server_session>& session_mgr, const request_handler &handler, server_metrics& metrics);
+
+		~http_server_session();
+
+		/// Switch connections starting with the http2 preface or asking for an h2c upgrade to handoff, call before start.
+		void set_http2_handoff(http2_handoff<asio::ip::tcp::socket> handoff);
+
+		/// Answer websocket upgrades and pass the socket to handoff, call before start.
+		void set_websocket_handoff(websocket_handoff<asio::ip::tcp::socket> handoff);
+
+		/// Pass the socket to handoff when the handler replies with an event_hub, call before start.
+		void set_sse_handoff(sse_handoff<asio::ip::tcp::socket> handoff);
 
 		/// Start the first asynchronous operation for the http_server_session.
 		void start();
@@ -38,6 +53,11 @@ namespace spiritsaway::http_utils
 		void on_reply(const reply &in_reply);
 		void do_write();
 		bool should_close() const;
+
+		void on_received(const char* data, std::size_t len);
+		// write the 101 reply, on_switched passes the socket on
+		void do_upgrade(std::string&& reply_str, std::function<void()> on_switched);
+		void hand_off(std::string&& received, std::unique_ptr<request>&& upgraded_req, std::string&& settings_payload);
 		
 		void handle_request();
 		void on_timeout(const std::string& reason);
@@ -62,6 +82,24 @@ namespace spiritsaway::http_utils
 
 		http_session_manager<http_server_session>& m_session_mgr;
 
+		server_metrics& m_metrics;
+		// the phase histograms of m_request, set by handle_request
+		request_phase_histograms* m_phases = nullptr;
+		std::chrono::steady_clock::time_point m_accept_ts;
+		// start of the phase in progress
+		std::chrono::steady_clock::time_point m_phase_ts;
+		std::uint64_t m_read_us = 0;
+		std::uint64_t m_handler_us = 0;
+		// the span of m_request when m_traced
+		trace_span m_trace_span;
+		bool m_traced = false;
+		bool m_first_byte_pending = true;
+		// what the io callbacks allocated for m_request so far, with HTTP_UTILS_ALLOC_ACCOUNTING
+		alloc_counters m_request_allocs;
+		// the bytes the finished requests left allocated, counted in m_heap_bytes_gauge
+		std::int64_t m_heap_bytes = 0;
+		metrics_gauge* const m_heap_bytes_gauge;
+
 		/// The reply to be sent back to the client.
 		reply m_reply;
 
@@ -69,6 +107,13 @@ namespace spiritsaway::http_utils
 
 		bool m_stopped = false;
 
+		http2_handoff<asio::ip::tcp::socket> m_http2_handoff;
+		websocket_handoff<asio::ip::tcp::socket> m_websocket_handoff;
+		sse_handoff<asio::ip::tcp::socket> m_sse_handoff;
+		// the bytes read so far may still be the http2 preface
+		bool m_preface_pending = true;
+		std::string m_received;
+
 		// timeout timer
 		asio::basic_waitable_timer<std::chrono::steady_clock> m_con_timer;
 		const std::size_t m_timeout_seconds = 5;
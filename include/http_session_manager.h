@@ -44,6 +44,13 @@ namespace spiritsaway::http_utils
 			c->stop();
 		}
 
+		/// Forget the specified http_server_session without stopping it, used when its connection moved to another session.
+		void remove(std::shared_ptr<T> c)
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			m_sessions.erase(c);
+		}
+
 		/// Stop all http_server_sessions.
 		void stop_all()
 		{
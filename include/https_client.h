@@ -7,6 +7,10 @@
 #include <ostream>
 #include <boost/asio.hpp>
 #include "http_reply_parser.h"
+#include "tracing.h"
+#include "http_client_engine.h"
+#include "tls_session_cache.h"
+#include "http2_client.h"
 #include <boost/asio/ssl.hpp>
 #include <spdlog/logger.h>
 
@@ -19,7 +23,8 @@ namespace spiritsaway::http_utils
 	private:
 		asio::ip::tcp::resolver m_resolver;
 		std::function<void(const std::string&, const reply&)> m_callback;
-		const std::string m_req_str;
+		// carries the traceparent of m_trace_span when created inside a trace_scope
+		std::string m_req_str;
 		const std::string m_server_url;
 		const std::string m_server_port;
 		std::string m_header_read_buffer;
@@ -30,20 +35,53 @@ namespace spiritsaway::http_utils
 		http_reply_parser m_rep_parser;
 		asio::ssl::stream<asio::ip::tcp::socket> m_socket;
 		std::shared_ptr<spdlog::logger> m_logger;
+		bool m_finished = false;
+		client_span m_trace_span;
+		std::shared_ptr<tls_session_cache> m_session_cache;
+		reply_stream_handler m_stream_handler;
+		// body chunks parsed from the last read, waiting for the stream handler
+		std::vector<std::string_view> m_pending_chunks;
+		std::size_t m_delivered_chunk_num = 0;
+		// the chunks whose resume was called, later calls of the same resume are ignored
+		std::uint64_t m_resumed_chunk_seq = 0;
+		bool m_header_notified = false;
 
 	public:
 		https_client(asio::io_context& io_context, asio::ssl::context& ssl_context, std::shared_ptr<spdlog::logger> in_logger, const std::string& server_url, const std::string& server_port, const request& req, std::function<void(const std::string&, const reply&)> callback, std::uint32_t timeout_second);
+		// send a request already serialized, e.g. by request_template, move it in to avoid a copy
+		https_client(asio::io_context& io_context, asio::ssl::context& ssl_context, std::shared_ptr<spdlog::logger> in_logger, const std::string& server_url, const std::string& server_port, std::string req_str, std::function<void(const std::string&, const reply&)> callback, std::uint32_t timeout_second);
+		// deliver the reply headers and body chunks while downloading instead of buffering the whole content,
+		// timeout_second then bounds connecting and each read instead of the whole download
+		https_client(asio::io_context& io_context, asio::ssl::context& ssl_context, std::shared_ptr<spdlog::logger> in_logger, const std::string& server_url, const std::string& server_port, const request& req, const reply_stream_handler& stream_handler, std::uint32_t timeout_second);
+		/// Offer the cached session of the upstream in the handshake and store the new one, call before run.
+		void set_session_cache(std::shared_ptr<tls_session_cache> session_cache);
 		void run();
+		// abort the request without invoking the callback
+		void cancel();
 
 	private:
 		void handle_resolve(const asio_ec& error, asio::ip::tcp::resolver::results_type results);
 		void handle_connect(const asio_ec& err, asio::ip::tcp::resolver::results_type::endpoint_type);
 		void handle_hanshake(const asio_ec& err);
 		void handle_write_request(const asio_ec& err);
+		// (re)start the timeout, for the whole request or for each read of a streamed reply
+		void arm_timer();
+		void read_content();
+		void deliver_body_chunk();
 		void handle_read_content(const asio_ec& err, std::size_t n);
 		void invoke_callback(const std::string& err);
 		void on_timeout(const asio_ec& err);
 		bool verify_certificate(bool preverified,
 			asio::ssl::verify_context& ctx);
 	};
+
+	client_launcher make_https_client_launcher(asio::io_context& io_context, asio::ssl::context& ssl_context, std::shared_ptr<spdlog::logger> in_logger, std::shared_ptr<tls_session_cache> session_cache = {});
+
+	/// http2 over tls, connections offer only "h2" by alpn and fail when the server does not select it.
+	using h2_client = http2_client_session<asio::ssl::stream<asio::ip::tcp::socket>>;
+
+	std::shared_ptr<h2_client> make_h2_client(asio::io_context& io_context, asio::ssl::context& ssl_context, std::shared_ptr<spdlog::logger> in_logger, const std::string& server_url, const std::string& server_port, std::shared_ptr<tls_session_cache> session_cache = {}, const http2_settings& settings = http2_settings());
+
+	/// Share one h2_client per upstream between all the requests of an http_client_engine.
+	client_launcher make_h2_client_launcher(asio::io_context& io_context, asio::ssl::context& ssl_context, std::shared_ptr<spdlog::logger> in_logger, std::shared_ptr<tls_session_cache> session_cache = {}, const http2_settings& settings = http2_settings());
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include <boost/asio.hpp>
 #include <string>
+#include <unordered_map>
+#include <mutex>
 #include "https_server_session.h"
 #include <spdlog/logger.h>
 #include <boost/asio/ssl.hpp>
@@ -10,6 +12,50 @@ namespace spiritsaway::http_utils
 {
 	namespace asio = boost::asio;
 	using asio_ec = boost::system::error_code;
+	struct tls_resumption_config
+	{
+		/// Keep sessions in the server side cache and resume them by session id.
+		bool session_cache_enabled = true;
+		std::size_t session_cache_size = 20480;
+		std::uint32_t session_timeout_seconds = 300;
+		/// Issue stateless session tickets. The ticket key is rotated every ticket_key_rotate_seconds,
+		/// tickets sealed with the previous key are still accepted and get renewed.
+		bool session_ticket_enabled = true;
+		std::uint32_t ticket_key_rotate_seconds = 3600;
+	};
+
+	struct tls_handshake_stats
+	{
+		std::uint64_t full_handshakes = 0;
+		std::uint64_t resumed_handshakes = 0;
+		std::uint64_t failed_handshakes = 0;
+		std::uint64_t ktls_handshakes = 0;
+		std::uint64_t offloaded_handshakes = 0;
+		/// Handshakes waiting for or running on the crypto pool right now, and the peak since start.
+		std::uint64_t handshake_queue_depth = 0;
+		std::uint64_t max_handshake_queue_depth = 0;
+	};
+
+	/// How late the probe timer fires on the io_context, the time any handler waits for the io thread.
+	struct io_lag_stats
+	{
+		std::uint64_t sample_count = 0;
+		std::uint64_t avg_lag_us = 0;
+		std::uint64_t max_lag_us = 0;
+	};
+
+	struct tls_buffer_config
+	{
+		/// Let OpenSSL free the record buffers of idle connections (SSL_MODE_RELEASE_BUFFERS).
+		bool release_idle_buffers = true;
+		/// Size of the pooled read buffers, a session only takes one while it has data to read.
+		std::size_t read_buffer_size = 8192;
+		/// Released read buffers kept for reuse, the rest go back to the allocator.
+		std::size_t max_free_buffers = 1024;
+	};
+
+	class tls_ticket_key_ring;
+
 	/// The top-level class of the HTTP server.
 	class https_server
 	{
@@ -21,18 +67,103 @@ namespace spiritsaway::http_utils
 		/// serve up files from the given directory.
 		explicit https_server(asio::io_context &io_context, asio::ssl::context& ssl_ctx, std::shared_ptr<spdlog::logger> in_logger, const std::string &address, const std::string &port);
 
+		~https_server();
+
 		/// Run the server's io_context loop.
 		void run();
 
 		void stop();
 
 		std::size_t get_session_count();
+
+		/// Configure session id caching and session tickets on the ssl context, call before run.
+		void enable_session_resumption(const tls_resumption_config& config);
+
+		/// Drive OpenSSL on the socket and let it enable kernel TLS after the handshake (Linux, OpenSSL 3),
+		/// connections fall back to userspace records when the kernel or cipher lacks support. Call before run.
+		void enable_ktls();
+
+		/// Keep idle keep-alive connections from pinning record and read buffers. Sessions switch to the stream
+		/// driving OpenSSL on the socket, asio::ssl::stream keeps ~34KB of record buffers per connection.
+		/// Handshakes of these sessions are not offloaded. Call before run.
+		void enable_buffer_pooling(const tls_buffer_config& config);
+
+		buffer_pool_stats get_buffer_pool_stats() const;
+
+		/// Run the cpu heavy handshakes of new connections on thread_num crypto threads, the established
+		/// streams are handed back to the io_context for request io. Not applied to ktls sessions. Call before run.
+		void enable_handshake_offload(std::size_t thread_num);
+
+		/// Close keep-alive connections that send no new request for seconds, 75 by default. Call before run.
+		void set_keep_alive_timeout(std::uint32_t seconds);
+
+		/// Sample the io_context latency every interval_ms, call before run.
+		void enable_io_lag_probe(std::uint32_t interval_ms);
+
+		/// Serve server_name (exact or "*.domain") with ssl_ctx, replacing the previous context of that name.
+		/// Safe from any thread while running, new handshakes pick up the swapped map, established ones keep their context.
+		/// Clients without a matching name get the context passed to the constructor.
+		void set_sni_context(const std::string& server_name, std::shared_ptr<asio::ssl::context> ssl_ctx);
+
+		/// Build a context from the pem files and swap it in for server_name, the previous one stays on failure.
+		bool load_sni_certificate(const std::string& server_name, const std::string& cert_chain_file, const std::string& key_file);
+
+		bool remove_sni_context(const std::string& server_name);
+
+		/// Offer "h2" by alpn and serve the connections choosing it with http2, others keep HTTP/1.1. Call before run.
+		void enable_http2(const http2_settings& settings = http2_settings());
+
+		/// Accept websocket upgrades of HTTP/1.1 connections and pass them to handle_websocket. Call before run.
+		void enable_websocket(const websocket_config& config = websocket_config());
+
+		/// Limits of the event streams opened by replies with an event_hub. Call before run.
+		void set_sse_config(const sse_config& config);
+
+		/// Key the latency histograms of the requests by routes, like the matched path patterns. route_fn
+		/// returns the index of the route of a request, anything past the last route is unrouted. Call before run.
+		void set_metrics_routes(const std::vector<std::string>& routes, std::function<std::size_t(const request&)> route_fn);
+
+		/// Answer GET requests for path with the metrics of the server registry in the Prometheus text
+		/// format before they reach handle_request. Call before run.
+		void enable_metrics_endpoint(const std::string& path = "/metrics");
+
+		/// Record every written reply into log, which may be shared with other servers. Call before run.
+		void set_access_log(std::shared_ptr<access_logger> log);
+
+		/// Record a span per request into recorder and let the clients created by handle_request join
+		/// it through their traceparent header. Call before run.
+		void set_trace_recorder(std::shared_ptr<trace_recorder> recorder);
+
+		tls_handshake_stats get_handshake_stats() const;
+
+		io_lag_stats get_io_lag_stats() const;
 	protected:
 		virtual void handle_request(const request& req, reply_handler rep_cb) = 0;
+
+		/// Set the handlers of an accepted websocket, the default refuses it with 1008.
+		virtual void handle_websocket(std::shared_ptr<websocket_channel> channel);
 	private:
 		/// Perform an asynchronous accept operation.
 		void do_accept();
 
+		// answer the metrics endpoint, pass everything else to handle_request
+		void dispatch_request(const request& req, reply_handler rep_cb);
+
+		void rotate_ticket_key();
+
+		void probe_io_lag();
+
+		// select the context of the requested server name during the client hello
+		static int on_server_name_cb(SSL* ssl, int* alert, void* arg);
+		// share the session id context, ticket keys and alpn selection of m_ssl_ctx so that sessions resume across names
+		void prepare_sni_context(SSL_CTX* ssl_ctx);
+
+		void set_http2_handoff(https_server_session& session);
+
+		void set_websocket_handoff(https_server_session& session);
+
+		void set_sse_handoff(https_server_session& session);
+
 
 		/// The io_context used to perform asynchronous operations.
 		asio::io_context &m_ioc;
@@ -46,13 +177,55 @@ namespace spiritsaway::http_utils
 		/// The https_server_session manager which owns all live https_server_sessions.
 		http_session_manager<https_server_session> m_session_mgr;
 
+		/// The connections that negotiated h2, per stream type.
+		http_session_manager<http2_server_session<asio::ssl::stream<asio::ip::tcp::socket>>> m_http2_session_mgr;
+		http_session_manager<http2_server_session<ktls_stream>> m_ktls_http2_session_mgr;
+		bool m_http2_enabled = false;
+		http2_settings m_http2_settings;
+
+		/// The connections switched to websocket, per stream type.
+		http_session_manager<websocket_session<asio::ssl::stream<asio::ip::tcp::socket>>> m_websocket_session_mgr;
+		http_session_manager<websocket_session<ktls_stream>> m_ktls_websocket_session_mgr;
+		bool m_websocket_enabled = false;
+		websocket_config m_websocket_config;
+
+		/// The connections turned into event streams, per stream type.
+		http_session_manager<sse_session<asio::ssl::stream<asio::ip::tcp::socket>>> m_sse_session_mgr;
+		http_session_manager<sse_session<ktls_stream>> m_ktls_sse_session_mgr;
+		sse_config m_sse_config;
+
 		/// The handler for all incoming requests.
 		const request_handler m_request_handler;
 
 		const std::string m_address;
 		const std::string m_port;
 		
-		std::atomic<std::uint64_t> m_session_counter;
+		std::atomic<std::uint64_t> m_session_counter = 0;
+
+		tls_resumption_config m_resumption_config;
+		std::shared_ptr<tls_ticket_key_ring> m_ticket_keys;
+		asio::basic_waitable_timer<std::chrono::steady_clock> m_ticket_key_timer;
+		tls_handshake_counters m_handshake_counters;
+		server_metrics m_metrics;
+		// empty when the metrics endpoint is disabled
+		std::string m_metrics_path;
+		// accept into ktls_stream instead of asio::ssl::stream
+		bool m_socket_bio_streams = false;
+		std::shared_ptr<buffer_pool> m_read_buffers;
+		std::uint32_t m_keep_alive_timeout_seconds = 75;
+
+		std::unique_ptr<asio::thread_pool> m_crypto_pool;
+
+		using sni_context_map = std::unordered_map<std::string, std::shared_ptr<asio::ssl::context>>;
+		// copied on write and swapped with std::atomic_store, the handshake path only does an atomic load
+		std::shared_ptr<const sni_context_map> m_sni_contexts;
+		std::mutex m_sni_update_mutex;
+
+		std::uint32_t m_io_lag_interval_ms = 0;
+		asio::basic_waitable_timer<std::chrono::steady_clock> m_io_lag_timer;
+		std::atomic<std::uint64_t> m_io_lag_samples = 0;
+		std::atomic<std::uint64_t> m_io_lag_total_us = 0;
+		std::atomic<std::uint64_t> m_io_lag_max_us = 0;
 	protected:
 		std::shared_ptr<spdlog::logger> m_logger;
 	};
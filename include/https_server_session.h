@@ -3,16 +3,38 @@
 
 #include <array>
 #include <memory>
+#include <atomic>
+#include <optional>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include "http_request_parser.h"
 #include "http_session_manager.h"
+#include "ktls_stream.h"
+#include "buffer_pool.h"
+#include "http2_server_session.h"
+#include "websocket_session.h"
+#include "sse_session.h"
+#include "metrics.h"
 #include <spdlog/logger.h>
 
 namespace spiritsaway::http_utils
 {
 	namespace asio = boost::asio;
 	using asio_ec = boost::system::error_code;
+	struct tls_handshake_counters
+	{
+		std::atomic<std::uint64_t> full_handshakes = 0;
+		std::atomic<std::uint64_t> resumed_handshakes = 0;
+		std::atomic<std::uint64_t> failed_handshakes = 0;
+		// handshakes after which the kernel took over record encryption
+		std::atomic<std::uint64_t> ktls_handshakes = 0;
+		// handshakes run on the crypto thread pool
+		std::atomic<std::uint64_t> offloaded_handshakes = 0;
+		// offloaded handshakes not yet handed back to the io thread
+		std::atomic<std::uint64_t> queued_handshakes = 0;
+		std::atomic<std::uint64_t> max_queued_handshakes = 0;
+	};
+
 	/// Represents a single https_server_session from a client.
 	class https_server_session
 		: public std::enable_shared_from_this<https_server_session>
@@ -22,7 +44,28 @@ namespace spiritsaway::http_utils
 		https_server_session &operator=(const https_server_session &) = delete;
 
 		/// Construct a https_server_session with the given socket.
-		explicit https_server_session(std::unique_ptr<asio::ssl::stream<asio::ip::tcp::socket>>&& socket, std::shared_ptr<spdlog::logger> in_logger, std::uint64_t in_session_idx, http_session_manager<https_server_session>& session_mgr, const request_handler &handler);
+		explicit https_server_session(std::unique_ptr<asio::ssl::stream<asio::ip::tcp::socket>>&& socket, std::shared_ptr<spdlog::logger> in_logger, std::uint64_t in_session_idx, http_session_manager<https_server_session>& session_mgr, const request_handler &handler, tls_handshake_counters& handshake_counters, server_metrics& metrics, std::shared_ptr<buffer_pool> read_buffers);
+
+		/// Construct a https_server_session that lets OpenSSL enable kTLS on the socket.
+		explicit https_server_session(std::unique_ptr<ktls_stream>&& socket, std::shared_ptr<spdlog::logger> in_logger, std::uint64_t in_session_idx, http_session_manager<https_server_session>& session_mgr, const request_handler &handler, tls_handshake_counters& handshake_counters, server_metrics& metrics, std::shared_ptr<buffer_pool> read_buffers);
+
+		~https_server_session();
+
+		/// Close keep-alive connections without a new request for seconds, call before start.
+		void set_keep_alive_timeout(std::uint32_t seconds);
+
+		/// Run the handshake on a strand of the crypto pool instead of the socket executor, call before start.
+		/// Only the sessions using asio::ssl::stream are offloaded.
+		void set_handshake_executor(asio::thread_pool::executor_type executor);
+
+		/// Pass connections negotiating "h2" by alpn on to the handoff of their stream type, call before start.
+		void set_http2_handoff(http2_handoff<asio::ssl::stream<asio::ip::tcp::socket>> ssl_handoff, http2_handoff<ktls_stream> ktls_handoff);
+
+		/// Answer websocket upgrades and pass the stream to the handoff of its type, call before start.
+		void set_websocket_handoff(websocket_handoff<asio::ssl::stream<asio::ip::tcp::socket>> ssl_handoff, websocket_handoff<ktls_stream> ktls_handoff);
+
+		/// Pass the stream to the handoff of its type when the handler replies with an event_hub, call before start.
+		void set_sse_handoff(sse_handoff<asio::ssl::stream<asio::ip::tcp::socket>> ssl_handoff, sse_handoff<ktls_stream> ktls_handoff);
 
 		/// Start the first asynchronous operation for the https_server_session.
 		void start();
@@ -32,6 +75,12 @@ namespace spiritsaway::http_utils
 
 	private:
 		void do_handshake();
+		void do_offload_handshake();
+		void on_handshake(const asio_ec& error);
+		// whether the client picked h2 by alpn, the stream is then handed off
+		bool hand_off_http2();
+		// write the 101 reply for the upgrade request in m_request, then pass the stream on
+		void do_websocket_upgrade();
 		/// Perform an asynchronous read operation.
 		void do_read();
 
@@ -40,19 +89,42 @@ namespace spiritsaway::http_utils
 		void do_write();
 		bool should_close() const;
 		
+		// read into a pooled buffer once the stream has something to read
+		void do_read_buffer();
+		// parse the unparsed bytes of m_buffer
+		void parse_buffer();
+		// release the state of the finished request before reading the next one
+		void on_write_finish();
+
 		void handle_request();
 		void on_timeout(const std::string& reason);
 
+		// forward to m_socket or m_ktls_socket
+		void async_handshake_impl(std::function<void(const asio_ec&)> handler);
+		void async_read_some_impl(std::function<void(const asio_ec&, std::size_t)> handler);
+		// write m_reply_str followed by the content file when it is sent with sendfile
+		void async_write_impl(std::function<void(const asio_ec&, std::size_t)> handler);
+		SSL* native_ssl();
+
 		/// Socket for the https_server_session.
 		std::unique_ptr<asio::ssl::stream<asio::ip::tcp::socket>> m_socket;
+		std::unique_ptr<ktls_stream> m_ktls_socket;
+		// opened content file of the reply sent with sendfile
+		int m_content_file_fd = -1;
+		std::size_t m_content_file_size = 0;
 
 		/// The manager for this https_server_session.
 
 		/// The handler used to process the incoming request.
 		const request_handler m_request_handler;
 
-		/// Buffer for incoming data.
-		std::array<char, 8192> m_buffer;
+		/// Buffer for incoming data, only held while reading or while it keeps pipelined bytes.
+		std::shared_ptr<buffer_pool> m_read_buffers;
+		buffer_pool::buffer m_buffer;
+		// unparsed bytes of m_buffer following the request being handled
+		std::size_t m_buffer_begin = 0;
+		std::size_t m_buffer_end = 0;
+		bool m_keep_alive = false;
 
 		/// The incoming request.
 		request m_request;
@@ -62,15 +134,50 @@ namespace spiritsaway::http_utils
 
 		http_session_manager<https_server_session>& m_session_mgr;
 
+		tls_handshake_counters& m_handshake_counters;
+
+		server_metrics& m_metrics;
+		// the phase histograms of m_request, set by handle_request
+		request_phase_histograms* m_phases = nullptr;
+		std::chrono::steady_clock::time_point m_accept_ts;
+		// start of the phase in progress
+		std::chrono::steady_clock::time_point m_phase_ts;
+		std::uint64_t m_read_us = 0;
+		std::uint64_t m_handler_us = 0;
+		// the span of m_request when m_traced
+		trace_span m_trace_span;
+		bool m_traced = false;
+		bool m_first_byte_pending = true;
+		// what the io callbacks allocated for m_request so far, with HTTP_UTILS_ALLOC_ACCOUNTING
+		alloc_counters m_request_allocs;
+		// the bytes the finished requests left allocated, counted in m_heap_bytes_gauge
+		std::int64_t m_heap_bytes = 0;
+		metrics_gauge* const m_heap_bytes_gauge;
+		// parsing of the next request has begun and m_phase_ts is its first byte
+		bool m_request_started = false;
+
 		/// The reply to be sent back to the client.
 		reply m_reply;
 
 		std::string m_reply_str;
 		bool m_stopped = false;
 
+		http2_handoff<asio::ssl::stream<asio::ip::tcp::socket>> m_ssl_http2_handoff;
+		http2_handoff<ktls_stream> m_ktls_http2_handoff;
+		websocket_handoff<asio::ssl::stream<asio::ip::tcp::socket>> m_ssl_websocket_handoff;
+		websocket_handoff<ktls_stream> m_ktls_websocket_handoff;
+		sse_handoff<asio::ssl::stream<asio::ip::tcp::socket>> m_ssl_sse_handoff;
+		sse_handoff<ktls_stream> m_ktls_sse_handoff;
+
+		std::optional<asio::strand<asio::thread_pool::executor_type>> m_handshake_strand;
+		// the stream and the timer belong to m_handshake_strand until the handshake is handed back
+		bool m_handshake_offloaded = false;
+
 		// timeout timer
 		asio::basic_waitable_timer<std::chrono::steady_clock> m_con_timer;
 		const std::size_t m_timeout_seconds = 5;
+		// wait for the next request on a keep-alive connection, which may idle much longer than a request takes
+		std::uint32_t m_keep_alive_timeout_seconds = 75;
 		std::shared_ptr<spdlog::logger> m_logger;
 		const std::uint64_t m_session_idx;
 	};
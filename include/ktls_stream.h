@@ -0,0 +1,105 @@
+#pragma once
+
+#include <memory>
+#include <functional>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+namespace spiritsaway::http_utils
+{
+	namespace asio = boost::asio;
+	using asio_ec = boost::system::error_code;
+
+	/// Server side TLS stream driving OpenSSL directly on the socket instead of through the memory bios
+	/// of asio::ssl::stream, so that OpenSSL can hand record encryption over to the kernel (kTLS).
+	/// When the kernel or the negotiated cipher does not support kTLS it keeps working through SSL_read/SSL_write.
+	/// Without the bio pair and record vectors of asio::ssl::stream an idle connection only keeps the SSL object,
+	/// OpenSSL frees its own record buffers in between when SSL_MODE_RELEASE_BUFFERS is set.
+	class ktls_stream
+	{
+	public:
+		using handshake_handler = std::function<void(const asio_ec&)>;
+		using io_handler = std::function<void(const asio_ec&, std::size_t)>;
+
+		ktls_stream(const ktls_stream&) = delete;
+		ktls_stream& operator=(const ktls_stream&) = delete;
+
+		ktls_stream(asio::ip::tcp::socket&& socket, asio::ssl::context& ssl_ctx);
+		~ktls_stream();
+
+		asio::ip::tcp::socket& lowest_layer()
+		{
+			return m_socket;
+		}
+		SSL* native_handle()
+		{
+			return m_ssl;
+		}
+		asio::ip::tcp::socket::executor_type get_executor()
+		{
+			return m_socket.get_executor();
+		}
+
+		void async_handshake(handshake_handler handler);
+		void async_read_some(asio::mutable_buffer buffer, io_handler handler);
+		/// Complete once async_read_some has something to work on, without holding a buffer meanwhile.
+		void async_wait_readable(handshake_handler handler);
+		/// Write the whole buffer.
+		void async_write(asio::const_buffer buffer, io_handler handler);
+		/// Send size bytes of file_fd from offset with sendfile, only valid when ktls_send_enabled.
+		void async_sendfile(int file_fd, std::int64_t offset, std::size_t size, io_handler handler);
+
+		/// Whether the kernel encrypts the records written to the socket.
+		bool ktls_send_enabled() const;
+		bool ktls_recv_enabled() const;
+
+		/// Send close_notify without waiting for the peer and shut down the socket.
+		void shutdown(asio_ec& ec);
+
+	private:
+		// false when ssl_error is not a retryable want read/write, the socket readiness then runs retry_handler
+		bool wait_socket(int ssl_error, std::function<void(const asio_ec&)> retry_handler);
+		asio_ec make_error(int ssl_error) const;
+		void write_some(asio::const_buffer buffer, std::size_t written, io_handler handler);
+
+		asio::ip::tcp::socket m_socket;
+		SSL* m_ssl;
+	};
+
+	/// Overloads of the stream helpers used by the http2, websocket and sse sessions.
+	inline void async_write_all(ktls_stream& stream, asio::const_buffer buffer, std::function<void(const asio_ec&, std::size_t)> handler)
+	{
+		stream.async_write(buffer, std::move(handler));
+	}
+
+	inline void async_write_buffers(ktls_stream& stream, const std::vector<asio::const_buffer>& buffers, std::function<void(const asio_ec&, std::size_t)> handler, std::size_t index = 0, std::size_t written = 0)
+	{
+		if (index == 0 && stream.ktls_send_enabled())
+		{
+			asio::async_write(stream.lowest_layer(), buffers, handler);
+			return;
+		}
+		if (index == buffers.size())
+		{
+			handler(asio_ec(), written);
+			return;
+		}
+		// SSL_write takes one buffer at a time
+		stream.async_write(buffers[index], [&stream, &buffers, handler, index, written](const asio_ec& ec, std::size_t n)
+			{
+				if (ec)
+				{
+					handler(ec, written + n);
+					return;
+				}
+				async_write_buffers(stream, buffers, handler, index + 1, written + n);
+			});
+	}
+
+	inline void close_stream(ktls_stream& stream)
+	{
+		asio_ec ignored_ec;
+		stream.shutdown(ignored_ec);
+	}
+}
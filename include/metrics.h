@@ -0,0 +1,437 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <initializer_list>
+#include <cstdint>
+#include "http_packet.h"
+#include "alloc_accounting.h"
+#include "access_log.h"
+#include "tracing.h"
+
+namespace spiritsaway::http_utils
+{
+	constexpr std::size_t metrics_cache_line_size = 64;
+	constexpr std::size_t metrics_max_slots = 1024;
+
+	enum class metrics_type
+	{
+		counter,
+		gauge,
+	};
+
+	/// The values one thread adds to every metric of a registry. Only that thread writes them, so an
+	/// increment is a plain load and store, and threads never share a cache line.
+	struct alignas(metrics_cache_line_size) metrics_shard
+	{
+		std::array<std::atomic<std::int64_t>, metrics_max_slots> values;
+
+		metrics_shard()
+		{
+			for (auto& one_value : values)
+			{
+				one_value.store(0, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	class metrics_registry;
+
+	/// Log-linear buckets like HdrHistogram: values below 2^histogram_sub_bucket_bits have a bucket each,
+	/// above that every power of two is split into 2^histogram_sub_bucket_bits buckets, so a bucket is at
+	/// most 12.5% wide relative to its values. Values at or above 2^histogram_max_value_bits share the last one.
+	constexpr std::size_t histogram_sub_bucket_bits = 3;
+	constexpr std::size_t histogram_sub_bucket_count = std::size_t(1) << histogram_sub_bucket_bits;
+	constexpr std::size_t histogram_max_value_bits = 40;
+	constexpr std::size_t histogram_bucket_count = (histogram_max_value_bits - histogram_sub_bucket_bits + 1) * histogram_sub_bucket_count;
+
+	std::size_t histogram_bucket_index(std::uint64_t value);
+
+	/// The smallest and largest value falling into bucket.
+	std::uint64_t histogram_bucket_lower(std::size_t bucket);
+	std::uint64_t histogram_bucket_upper(std::size_t bucket);
+
+	/// The buckets one thread records into, only that thread writes them.
+	struct alignas(metrics_cache_line_size) histogram_shard
+	{
+		std::array<std::atomic<std::uint64_t>, histogram_bucket_count> buckets;
+		std::atomic<std::uint64_t> count;
+		std::atomic<std::uint64_t> sum;
+
+		histogram_shard()
+		{
+			for (auto& one_bucket : buckets)
+			{
+				one_bucket.store(0, std::memory_order_relaxed);
+			}
+			count.store(0, std::memory_order_relaxed);
+			sum.store(0, std::memory_order_relaxed);
+		}
+	};
+
+	/// The merged buckets of a histogram.
+	struct histogram_snapshot
+	{
+		std::vector<std::uint64_t> buckets;
+		std::uint64_t count = 0;
+		std::uint64_t sum = 0;
+
+		/// The upper bound of the bucket holding the q quantile, q in [0, 1]. 0 when empty.
+		std::uint64_t percentile(double q) const;
+
+		void merge(const histogram_snapshot& other);
+	};
+
+	/// A distribution of values, like latencies in microseconds, recorded into per-thread shards.
+	class metrics_histogram
+	{
+	public:
+		metrics_histogram(const metrics_histogram&) = delete;
+		metrics_histogram& operator=(const metrics_histogram&) = delete;
+
+		metrics_histogram();
+
+		void record(std::uint64_t value)
+		{
+			auto& cur_shard = local_shard();
+			auto& cur_bucket = cur_shard.buckets[histogram_bucket_index(value)];
+			cur_bucket.store(cur_bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			cur_shard.count.store(cur_shard.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			cur_shard.sum.store(cur_shard.sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+
+		/// Merge the shards of all threads.
+		histogram_snapshot snapshot();
+
+		/// Zero the shards, records racing with it may be lost.
+		void reset();
+
+	private:
+		histogram_shard& local_shard()
+		{
+			thread_local std::vector<histogram_shard*> cur_shards;
+			if (m_id < cur_shards.size() && cur_shards[m_id])
+			{
+				return *cur_shards[m_id];
+			}
+			return add_local_shard(cur_shards);
+		}
+
+		histogram_shard& add_local_shard(std::vector<histogram_shard*>& thread_shards);
+
+		// ids are never reused, like the ones of metrics_registry
+		const std::size_t m_id;
+		std::mutex m_mutex;
+		std::vector<std::unique_ptr<histogram_shard>> m_shards;
+	};
+
+	/// The microseconds since begin_ts, what the latency histograms record.
+	inline std::uint64_t elapsed_microseconds(std::chrono::steady_clock::time_point begin_ts)
+	{
+		return std::uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin_ts).count());
+	}
+
+	struct histogram_sample
+	{
+		std::string name;
+		std::string help;
+		std::string labels;
+		histogram_snapshot value;
+	};
+
+	/// A monotonically increasing count, summed over the threads on scrape.
+	class metrics_counter
+	{
+	public:
+		metrics_counter(metrics_registry& registry, std::size_t slot)
+			: m_registry(registry)
+			, m_slot(slot)
+		{
+
+		}
+
+		void add(std::uint64_t n = 1);
+
+		std::uint64_t value() const;
+
+	private:
+		metrics_registry& m_registry;
+		const std::size_t m_slot;
+	};
+
+	/// A value going up and down, like the open connections. Threads add their deltas, the sum is the value.
+	class metrics_gauge
+	{
+	public:
+		metrics_gauge(metrics_registry& registry, std::size_t slot)
+			: m_registry(registry)
+			, m_slot(slot)
+		{
+
+		}
+
+		void add(std::int64_t n);
+
+		void sub(std::int64_t n)
+		{
+			add(-n);
+		}
+
+		std::int64_t value() const;
+
+	private:
+		metrics_registry& m_registry;
+		const std::size_t m_slot;
+	};
+
+	struct metrics_sample
+	{
+		std::string name;
+		std::string help;
+		/// Already formatted, like server="127.0.0.1:8080",phase="read".
+		std::string labels;
+		metrics_type type;
+		std::int64_t value;
+	};
+
+	/// Format label pairs as name="value", escaping the values.
+	std::string metrics_labels(std::initializer_list<std::pair<std::string_view, std::string_view>> labels);
+
+	/// Append more_labels to the already formatted labels.
+	std::string with_labels(const std::string& labels, std::initializer_list<std::pair<std::string_view, std::string_view>> more_labels);
+
+	/// Owns named counters, gauges and histograms with per-thread shards that are only aggregated by collect.
+	class metrics_registry
+	{
+	public:
+		metrics_registry(const metrics_registry&) = delete;
+		metrics_registry& operator=(const metrics_registry&) = delete;
+
+		metrics_registry();
+
+		/// The registry the servers report to.
+		static metrics_registry& global();
+
+		/// The same name and labels return the same counter, throws std::length_error past metrics_max_slots
+		/// counters, gauges and callback gauges registered and not released.
+		metrics_counter& counter(const std::string& name, const std::string& help, const std::string& labels = std::string());
+
+		metrics_gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = std::string());
+
+		/// A gauge read by calling value_fn on scrape, for values that already exist elsewhere.
+		void gauge_callback(const std::string& name, const std::string& help, const std::string& labels, std::function<std::int64_t()> value_fn);
+
+		/// The same name and labels return the same histogram.
+		metrics_histogram& histogram(const std::string& name, const std::string& help, const std::string& labels = std::string());
+
+		/// Remove the callback gauges with these labels, call before what value_fn reads goes away.
+		void remove_callbacks(const std::string& labels);
+
+		/// Unregister the counters, gauges, callback gauges and histograms whose labels are labels or extend them,
+		/// like the ones of a destroyed server. Their slots are handed out again once the never used ones run out
+		/// and their histograms once a new one is registered, the references returned for them must not be used
+		/// afterwards.
+		void release(const std::string& labels);
+
+		/// Sum the shards of every metric, sorted by name.
+		std::vector<metrics_sample> collect();
+
+		/// Merge the shards of every histogram, sorted by name.
+		std::vector<histogram_sample> collect_histograms();
+
+		// the shard of the calling thread, created on first use
+		metrics_shard& local_shard()
+		{
+			thread_local std::vector<metrics_shard*> cur_shards;
+			if (m_id < cur_shards.size() && cur_shards[m_id])
+			{
+				return *cur_shards[m_id];
+			}
+			return add_local_shard(cur_shards);
+		}
+
+		std::int64_t sum_slot(std::size_t slot);
+
+	private:
+		struct metrics_descriptor
+		{
+			std::string name;
+			std::string help;
+			std::string labels;
+			metrics_type type;
+			std::size_t slot;
+			metrics_counter* counter = nullptr;
+			metrics_gauge* gauge = nullptr;
+			std::function<std::int64_t()> value_fn;
+		};
+
+		metrics_shard& add_local_shard(std::vector<metrics_shard*>& thread_shards);
+		// index of the descriptor, registered with a new slot when missing
+		std::size_t find_or_register(const std::string& name, const std::string& help, const std::string& labels, metrics_type type);
+
+		// ids are never reused, a stale pointer cached by a thread is never looked up again
+		const std::size_t m_id;
+		std::mutex m_mutex;
+		std::vector<std::unique_ptr<metrics_shard>> m_shards;
+		std::vector<metrics_descriptor> m_descriptors;
+		std::unordered_map<std::string, std::size_t> m_descriptor_indexes;
+		// deques keep the handed out references stable
+		std::deque<metrics_counter> m_counters;
+		std::deque<metrics_gauge> m_gauges;
+		std::size_t m_next_slot = 0;
+		// released descriptors keeping their slot and the counter or gauge bound to it, oldest first
+		std::deque<metrics_descriptor> m_released;
+
+		struct histogram_descriptor
+		{
+			std::string name;
+			std::string help;
+			std::string labels;
+			std::unique_ptr<metrics_histogram> histogram;
+		};
+		std::vector<histogram_descriptor> m_histograms;
+		std::unordered_map<std::string, std::size_t> m_histogram_indexes;
+		// released histograms, kept alive for late records and reused oldest first
+		std::deque<std::unique_ptr<metrics_histogram>> m_released_histograms;
+	};
+
+	inline void metrics_counter::add(std::uint64_t n)
+	{
+		auto& cur_value = m_registry.local_shard().values[m_slot];
+		cur_value.store(cur_value.load(std::memory_order_relaxed) + std::int64_t(n), std::memory_order_relaxed);
+	}
+
+	inline std::uint64_t metrics_counter::value() const
+	{
+		return std::uint64_t(m_registry.sum_slot(m_slot));
+	}
+
+	inline void metrics_gauge::add(std::int64_t n)
+	{
+		auto& cur_value = m_registry.local_shard().values[m_slot];
+		cur_value.store(cur_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	inline std::int64_t metrics_gauge::value() const
+	{
+		return m_registry.sum_slot(m_slot);
+	}
+
+	/// Write every metric and histogram of registry to out in the Prometheus text format, replacing its
+	/// content but keeping its capacity. Histograms get a bucket per power of two.
+	void render_prometheus_text(metrics_registry& registry, std::string& out);
+
+	/// A 200 reply with the Prometheus text of registry, rendered into a per-thread buffer reserved to the size of
+	/// the previous scrape and moved into the reply.
+	reply make_prometheus_reply(metrics_registry& registry);
+
+	/// The latency histograms of the phases of a request, in microseconds.
+	struct request_phase_histograms
+	{
+		/// From the first byte of the request to the end of its parsing.
+		metrics_histogram& read;
+		/// From handle_request to the reply.
+		metrics_histogram& handler;
+		/// Writing the reply.
+		metrics_histogram& write;
+	};
+
+	/// The counters of one server, shared by all its sessions.
+	struct server_metrics
+	{
+		server_metrics(const server_metrics&) = delete;
+		server_metrics& operator=(const server_metrics&) = delete;
+
+		/// labels tell the servers of one registry apart.
+		server_metrics(metrics_registry& registry, const std::string& labels);
+
+		/// Release the counters and gauges of labels so that creating servers again does not run out of slots.
+		~server_metrics();
+
+		/// Count a session closed by its timer in phase, the reasons passed to on_timeout.
+		void on_timeout(const std::string& phase);
+
+		/// Key the phase histograms by routes, route_fn returns the index of the route of a request and
+		/// anything past the last route for the unrouted histograms. Call before the server runs.
+		void set_routes(const std::vector<std::string>& routes, std::function<std::size_t(const request&)> route_fn);
+
+		/// The histograms req records its phases into, the unrouted ones without a route function.
+		request_phase_histograms& phase_histograms(const request& req);
+
+		/// Start the span of req when tracer is set, started_us before now.
+		bool begin_trace(const request& req, trace_span& span, std::uint64_t started_us)
+		{
+			if (!tracer)
+			{
+				return false;
+			}
+			begin_server_span(req, span);
+			span.start_us -= started_us;
+			return true;
+		}
+
+		/// Finish a span started by begin_trace, its duration is the sum of the phases.
+		void end_trace(trace_span&& span, std::uint32_t status, std::uint64_t read_us, std::uint64_t handler_us, std::uint64_t write_us, const std::string& error);
+
+		/// Queue a record of a written reply when access_log is set.
+		void log_access(const request& req, std::uint32_t status, std::uint64_t reply_bytes, std::uint64_t read_us, std::uint64_t handler_us, std::uint64_t write_us)
+		{
+			if (access_log)
+			{
+				log_access_impl(req, status, reply_bytes, read_us, handler_us, write_us);
+			}
+		}
+
+		/// Record the allocations of a finished request with HTTP_UTILS_ALLOC_ACCOUNTING and reset them. The
+		/// bytes the request left allocated are added to connection_bytes and count as held by the connection
+		/// until the session subtracts them from connection_heap_bytes.
+		void end_request_allocs(alloc_counters& request_allocs, std::int64_t& connection_bytes)
+		{
+			if constexpr (alloc_accounting_enabled)
+			{
+				end_request_allocs_impl(request_allocs, connection_bytes);
+			}
+		}
+
+		metrics_registry& registry;
+		const std::string labels;
+		metrics_counter& accepted_connections;
+		metrics_counter& requests;
+		metrics_counter& received_bytes;
+		metrics_counter& sent_bytes;
+		metrics_counter& parse_errors;
+		metrics_counter& tls_handshake_failures;
+		/// From accepting the connection to its first byte, tls handshakes included.
+		metrics_histogram& first_byte;
+		/// Set before the server runs, shared by the servers writing to the same file.
+		std::shared_ptr<access_logger> access_log;
+		/// Set before the server runs, sessions then record a span per request into it.
+		std::shared_ptr<trace_recorder> tracer;
+		/// Registered only with HTTP_UTILS_ALLOC_ACCOUNTING. The registry owns it, so sessions outliving
+		/// their server can still release what they held.
+		metrics_gauge* connection_heap_bytes = nullptr;
+
+	private:
+		request_phase_histograms make_phase_histograms(const std::string& route);
+		void log_access_impl(const request& req, std::uint32_t status, std::uint64_t reply_bytes, std::uint64_t read_us, std::uint64_t handler_us, std::uint64_t write_us);
+		void end_request_allocs_impl(alloc_counters& request_allocs, std::int64_t& connection_bytes);
+
+		request_phase_histograms m_default_phases;
+		std::function<std::size_t(const request&)> m_route_fn;
+		// registered up front and indexed by route_fn, the request path neither locks nor hashes
+		std::vector<request_phase_histograms> m_route_phases;
+
+		// registered only with HTTP_UTILS_ALLOC_ACCOUNTING
+		metrics_histogram* m_request_allocations = nullptr;
+		metrics_histogram* m_request_alloc_bytes = nullptr;
+	};
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include "http_packet.h"
+
+namespace spiritsaway::http_utils
+{
+	/// One server-sent event, serialized as the text/event-stream fields.
+	struct sse_event
+	{
+		/// Single line fields, CR and LF are dropped since they would end the field and start another.
+		std::string id;
+		std::string event;
+		/// Split into one "data:" line per line.
+		std::string data;
+		/// Reconnection delay for the client, 0 leaves it out.
+		std::uint32_t retry_ms = 0;
+	};
+
+	struct sse_config
+	{
+		/// Subscribers whose unwritten events exceed this are dropped instead of buffering without bound.
+		std::size_t max_queued_bytes = 4 * 1024 * 1024;
+		/// A comment line is sent on streams idle this long so that dead peers and proxies notice, 0 disables.
+		std::uint32_t heartbeat_seconds = 15;
+	};
+
+	std::string format_sse_event(const sse_event& event);
+
+	/// Something an sse_hub delivers serialized events to, the buffer is shared by all subscribers.
+	class sse_subscriber
+	{
+	public:
+		virtual ~sse_subscriber() = default;
+		/// Queue the event for writing, called from the thread of the broadcast.
+		virtual void push(std::shared_ptr<const std::string> event) = 0;
+	};
+
+	/// Fan-out of events to every subscribed stream, each event is serialized once and the same buffer
+	/// is queued on all subscribers. Thread safe, the hub only keeps weak references.
+	class sse_hub
+	{
+	public:
+		sse_hub(const sse_hub&) = delete;
+		sse_hub& operator=(const sse_hub&) = delete;
+		sse_hub() = default;
+
+		void subscribe(std::shared_ptr<sse_subscriber> subscriber);
+
+		void unsubscribe(const sse_subscriber* subscriber);
+
+		/// The number of subscribers the event was queued on.
+		std::size_t broadcast(const sse_event& event);
+
+		/// Queue text that is already in text/event-stream format, like a comment line.
+		std::size_t broadcast_raw(std::shared_ptr<const std::string> data);
+
+		std::size_t subscriber_count();
+
+	private:
+		std::mutex m_mutex;
+		std::vector<std::weak_ptr<sse_subscriber>> m_subscribers;
+	};
+
+	/// A reply that turns the HTTP/1.1 connection into an event stream subscribed to hub.
+	reply make_sse_reply(std::shared_ptr<sse_hub> hub);
+}
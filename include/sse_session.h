@@ -0,0 +1,225 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <functional>
+#include <boost/asio.hpp>
+#include <spdlog/logger.h>
+#include "sse_hub.h"
+#include "http2_server_session.h"
+#include "http_session_manager.h"
+#include "http_log.h"
+
+namespace spiritsaway::http_utils
+{
+	namespace asio = boost::asio;
+	using asio_ec = boost::system::error_code;
+
+	/// Called by an HTTP/1.1 session whose handler replied with an event_hub, with the stream and that reply.
+	template <typename Stream>
+	using sse_handoff = std::function<void(std::unique_ptr<Stream>&& stream, reply&& head)>;
+
+	/// An event stream over Stream. Broadcast events are queued as shared buffers from any thread
+	/// and everything queued while a write is in flight goes out with the next gather write.
+	template <typename Stream>
+	class sse_session
+		: public sse_subscriber
+		, public std::enable_shared_from_this<sse_session<Stream>>
+	{
+	public:
+		sse_session(const sse_session&) = delete;
+		sse_session& operator=(const sse_session&) = delete;
+
+		sse_session(std::unique_ptr<Stream>&& stream, std::shared_ptr<spdlog::logger> in_logger, std::uint64_t in_session_idx, http_session_manager<sse_session>& session_mgr, reply&& head, const sse_config& config)
+			: m_stream(std::move(stream))
+			, m_logger(std::move(in_logger))
+			, m_session_idx(in_session_idx)
+			, m_session_mgr(session_mgr)
+			, m_config(config)
+			, m_hub(std::move(head.event_hub))
+			, m_con_timer(m_stream->get_executor())
+		{
+			auto cur_head = std::make_shared<const std::string>(head.stream_head_to_string());
+			m_queued_bytes = cur_head->size();
+			m_queue.push_back(std::move(cur_head));
+		}
+
+		void start()
+		{
+			HTTP_UTILS_LOG_DEBUG(m_logger, "sse session {} start", m_session_idx);
+			m_hub->subscribe(this->shared_from_this());
+			arm_heartbeat_timer();
+			do_read();
+			flush();
+		}
+
+		void stop()
+		{
+			HTTP_UTILS_LOG_DEBUG(m_logger, "sse session {} stop", m_session_idx);
+			if (m_stopped)
+			{
+				return;
+			}
+			m_stopped = true;
+			m_con_timer.cancel();
+			m_hub->unsubscribe(this);
+			close_stream(*m_stream);
+		}
+
+		void push(std::shared_ptr<const std::string> event) override
+		{
+			{
+				std::lock_guard<std::mutex> guard(m_queue_mutex);
+				if (m_overflow)
+				{
+					return;
+				}
+				if (m_queued_bytes + event->size() > m_config.max_queued_bytes)
+				{
+					m_overflow = true;
+				}
+				else
+				{
+					m_queued_bytes += event->size();
+					m_queue.push_back(std::move(event));
+				}
+				if (m_flush_posted)
+				{
+					return;
+				}
+				m_flush_posted = true;
+			}
+			// one post per batch of events, not per event
+			asio::post(m_stream->get_executor(), [self = this->shared_from_this()]()
+				{
+					self->flush();
+				});
+		}
+
+	private:
+		// nothing is expected from the client, the read only notices when it goes away
+		void do_read()
+		{
+			auto self(this->shared_from_this());
+			m_stream->async_read_some(asio::buffer(m_read_buffer), [self, this](const asio_ec& ec, std::size_t)
+				{
+					if (ec)
+					{
+						if (ec != asio::error::operation_aborted && ec != asio::error::eof)
+						{
+							m_logger->error("sse session {} error {}", m_session_idx, ec.message());
+						}
+						m_session_mgr.stop(self);
+						return;
+					}
+					if (!m_stopped)
+					{
+						do_read();
+					}
+				});
+		}
+
+		void flush()
+		{
+			auto self(this->shared_from_this());
+			{
+				std::lock_guard<std::mutex> guard(m_queue_mutex);
+				m_flush_posted = false;
+				if (m_writing || m_stopped || (m_queue.empty() && !m_overflow))
+				{
+					return;
+				}
+				if (!m_overflow)
+				{
+					m_write_events.swap(m_queue);
+				}
+			}
+			if (m_write_events.empty())
+			{
+				m_logger->warn("sse session {} dropped, more than {} bytes queued", m_session_idx, m_config.max_queued_bytes);
+				m_session_mgr.stop(self);
+				return;
+			}
+			m_write_buffers.clear();
+			m_writing_bytes = 0;
+			for (const auto& one_event : m_write_events)
+			{
+				m_write_buffers.push_back(asio::buffer(*one_event));
+				m_writing_bytes += one_event->size();
+			}
+			m_writing = true;
+			m_idle = false;
+			async_write_buffers(*m_stream, m_write_buffers, [self, this](const asio_ec& ec, std::size_t)
+				{
+					m_writing = false;
+					m_write_buffers.clear();
+					m_write_events.clear();
+					{
+						std::lock_guard<std::mutex> guard(m_queue_mutex);
+						m_queued_bytes -= m_writing_bytes;
+					}
+					if (ec)
+					{
+						if (ec != asio::error::operation_aborted)
+						{
+							m_logger->error("sse session {} error {}", m_session_idx, ec.message());
+						}
+						m_session_mgr.stop(self);
+						return;
+					}
+					flush();
+				});
+		}
+
+		void arm_heartbeat_timer()
+		{
+			if (!m_config.heartbeat_seconds)
+			{
+				return;
+			}
+			auto self(this->shared_from_this());
+			m_con_timer.expires_from_now(std::chrono::seconds(m_config.heartbeat_seconds));
+			m_con_timer.async_wait([self, this](const asio_ec& error)
+				{
+					if (error == asio::error::operation_aborted || m_stopped)
+					{
+						return;
+					}
+					if (m_idle)
+					{
+						static const auto heartbeat = std::make_shared<const std::string>(":\n\n");
+						push(heartbeat);
+					}
+					m_idle = true;
+					arm_heartbeat_timer();
+				});
+		}
+
+		std::unique_ptr<Stream> m_stream;
+		std::shared_ptr<spdlog::logger> m_logger;
+		const std::uint64_t m_session_idx;
+		http_session_manager<sse_session>& m_session_mgr;
+		const sse_config m_config;
+		const std::shared_ptr<sse_hub> m_hub;
+
+		// filled by push from any thread
+		std::mutex m_queue_mutex;
+		std::vector<std::shared_ptr<const std::string>> m_queue;
+		std::size_t m_queued_bytes = 0;
+		bool m_flush_posted = false;
+		bool m_overflow = false;
+
+		// the events of the write in flight
+		std::vector<std::shared_ptr<const std::string>> m_write_events;
+		std::vector<asio::const_buffer> m_write_buffers;
+		std::size_t m_writing_bytes = 0;
+		bool m_writing = false;
+		bool m_idle = true;
+		bool m_stopped = false;
+		std::array<char, 256> m_read_buffer;
+
+		asio::basic_waitable_timer<std::chrono::steady_clock> m_con_timer;
+	};
+}
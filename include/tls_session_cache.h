@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <openssl/ssl.h>
+
+namespace spiritsaway::http_utils
+{
+	/// SSL_SESSIONs of finished https_client requests keyed by (host, port), shared by
+	/// clients so that repeated calls to the same upstream resume instead of doing a full handshake.
+	class tls_session_cache
+	{
+	public:
+		tls_session_cache(const tls_session_cache&) = delete;
+		tls_session_cache& operator=(const tls_session_cache&) = delete;
+
+		explicit tls_session_cache(std::size_t max_size = 1024);
+		~tls_session_cache();
+
+		/// Return a new reference the caller releases with SSL_SESSION_free, nullptr when missing.
+		SSL_SESSION* get(const std::string& server_url, const std::string& server_port);
+
+		/// Take over the reference to session, replacing the previous one for the upstream.
+		void put(const std::string& server_url, const std::string& server_port, SSL_SESSION* session);
+
+		void remove(const std::string& server_url, const std::string& server_port);
+
+		std::uint64_t get_hit_count() const
+		{
+			return m_hit_counter.load();
+		}
+		std::uint64_t get_miss_count() const
+		{
+			return m_miss_counter.load();
+		}
+
+	private:
+		const std::size_t m_max_size;
+		std::mutex m_mutex;
+		std::unordered_map<std::string, SSL_SESSION*> m_sessions;
+		std::atomic<std::uint64_t> m_hit_counter = 0;
+		std::atomic<std::uint64_t> m_miss_counter = 0;
+	};
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "http_packet.h"
+
+namespace spiritsaway::http_utils
+{
+	using trace_id_type = std::array<std::uint8_t, 16>;
+	using span_id_type = std::array<std::uint8_t, 8>;
+
+	/// The ids carried by a W3C traceparent header.
+	struct trace_context
+	{
+		trace_id_type trace_id{};
+		span_id_type span_id{};
+		std::uint8_t flags = 0;
+
+		/// All zero ids are invalid by the spec.
+		bool valid() const;
+
+		bool sampled() const
+		{
+			return flags & 1;
+		}
+	};
+
+	/// Parse "00-<32 hex trace id>-<16 hex span id>-<2 hex flags>", false when malformed.
+	bool parse_traceparent(std::string_view value, trace_context& ctx);
+	std::string format_traceparent(const trace_context& ctx);
+
+	std::string to_hex(const std::uint8_t* data, std::size_t size);
+
+	/// A new random span id, and a new trace id for roots.
+	span_id_type new_span_id();
+	trace_id_type new_trace_id();
+
+	enum class span_kind
+	{
+		server,
+		client,
+	};
+
+	struct trace_span
+	{
+		trace_id_type trace_id{};
+		span_id_type span_id{};
+		/// All zero for a root span.
+		span_id_type parent_span_id{};
+		span_kind kind = span_kind::server;
+		/// Like "GET /path" for servers and "GET 127.0.0.1:8080 /path" for clients.
+		std::string name;
+		/// Microseconds since the unix epoch.
+		std::uint64_t start_us = 0;
+		std::uint64_t duration_us = 0;
+		std::uint32_t status = 0;
+		std::string error;
+		/// The phases of a server span, see server_metrics.
+		std::uint64_t read_us = 0;
+		std::uint64_t handler_us = 0;
+		std::uint64_t write_us = 0;
+		/// Unsampled spans only propagate their ids and are not recorded.
+		bool sampled = true;
+
+		trace_context context() const;
+	};
+
+	/// Append span as one line of json.
+	void append_span_json(const trace_span& span, std::string& out);
+
+	/// Keeps the last capacity finished spans, older ones are overwritten and counted as dropped.
+	class trace_recorder
+	{
+	public:
+		trace_recorder(const trace_recorder&) = delete;
+		trace_recorder& operator=(const trace_recorder&) = delete;
+
+		explicit trace_recorder(std::size_t capacity = 65536);
+
+		/// Unsampled spans are ignored.
+		void record(trace_span&& span);
+
+		/// The buffered spans, oldest first.
+		std::vector<trace_span> snapshot() const;
+
+		/// Append the buffered spans to path as json lines and clear the buffer. False when path can not be opened.
+		bool export_to_file(const std::string& path);
+
+		std::uint64_t dropped() const
+		{
+			return m_dropped.load(std::memory_order_relaxed);
+		}
+
+	private:
+		const std::size_t m_capacity;
+		mutable std::mutex m_mutex;
+		std::vector<trace_span> m_spans;
+		// where the next span goes once m_spans is full
+		std::size_t m_next = 0;
+		std::atomic<std::uint64_t> m_dropped = 0;
+	};
+
+	/// The span a server handler runs in on this thread.
+	struct active_trace
+	{
+		trace_context context;
+		trace_recorder* recorder = nullptr;
+	};
+
+	/// Empty outside of a trace_scope.
+	const active_trace& current_trace();
+
+	/// Make ctx the current trace of this thread until destroyed, so that the clients created by a
+	/// handler join it. Does nothing when recorder is null.
+	class trace_scope
+	{
+	public:
+		trace_scope(const trace_scope&) = delete;
+		trace_scope& operator=(const trace_scope&) = delete;
+
+		trace_scope(const trace_context& ctx, trace_recorder* recorder);
+		~trace_scope();
+
+	private:
+		active_trace m_previous;
+		bool m_active = false;
+	};
+
+	/// Fill span as the server span of req, a child of its traceparent header or a new sampled root.
+	void begin_server_span(const request& req, trace_span& span);
+
+	/// The span of an outgoing request, active only when created inside a trace_scope.
+	class client_span
+	{
+	public:
+		/// Start a child of the current trace and add its traceparent to the serialized request,
+		/// unless the request already carries one.
+		void begin(std::string& req_str, const std::string& server_url, const std::string& server_port);
+
+		/// Record the span, status is 0 when no reply arrived.
+		void end(std::uint32_t status, const std::string& error);
+
+	private:
+		trace_recorder* m_recorder = nullptr;
+		trace_span m_span;
+		std::chrono::steady_clock::time_point m_begin_ts;
+	};
+}
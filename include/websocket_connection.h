@@ -0,0 +1,167 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <random>
+#include <cstdint>
+#include "http_packet.h"
+
+namespace spiritsaway::http_utils
+{
+	enum class websocket_opcode : std::uint8_t
+	{
+		continuation = 0x0,
+		text = 0x1,
+		binary = 0x2,
+		close = 0x8,
+		ping = 0x9,
+		pong = 0xa,
+	};
+
+	enum class websocket_role
+	{
+		server,
+		client,
+	};
+
+	/// A complete, reassembled text or binary message.
+	struct websocket_message
+	{
+		websocket_opcode opcode;
+		std::string payload;
+	};
+
+	struct websocket_config
+	{
+		/// Messages above this size close the connection with 1009.
+		std::size_t max_message_size = 16 * 1024 * 1024;
+		/// Ping idle connections this often and close them when nothing came back for a whole interval, 0 disables.
+		std::uint32_t ping_interval_seconds = 30;
+	};
+
+	/// Whether req asks for a websocket (RFC 6455) with a version we speak.
+	bool is_websocket_upgrade(const request& req);
+
+	/// The 101 reply accepting the websocket upgrade of req.
+	std::string websocket_handshake_reply(const request& req);
+
+	/// Sec-WebSocket-Accept for the Sec-WebSocket-Key of the client.
+	std::string websocket_accept_key(std::string_view client_key);
+
+	/// XOR data with the 4 byte mask starting at mask_offset of the mask, 16 or 32 bytes at a time with SSE2/AVX2.
+	void websocket_unmask(char* data, std::size_t len, const std::array<std::uint8_t, 4>& mask, std::size_t mask_offset = 0);
+
+	/// Checks that text arrives as UTF-8, fed piece by piece as the fragments of a message come in.
+	class websocket_utf8_validator
+	{
+	public:
+		/// False once a byte can not continue valid UTF-8, like overlong forms, surrogates or code points past U+10FFFF.
+		bool feed(const char* data, std::size_t len);
+
+		/// Whether the bytes fed so far end on a complete code point.
+		bool complete() const
+		{
+			return m_need == 0;
+		}
+
+		void reset()
+		{
+			m_need = 0;
+			m_lower = 0x80;
+			m_upper = 0xbf;
+		}
+
+	private:
+		// continuation bytes still expected and the range the next one must fall in
+		std::uint8_t m_need = 0;
+		std::uint8_t m_lower = 0x80;
+		std::uint8_t m_upper = 0xbf;
+	};
+
+	/// Transport independent websocket framing of one connection. Bytes read from the peer are fed in, complete
+	/// messages are taken out, pings are answered and the frames to send pile up in output() until written.
+	class websocket_connection
+	{
+	public:
+		websocket_connection(const websocket_connection&) = delete;
+		websocket_connection& operator=(const websocket_connection&) = delete;
+
+		explicit websocket_connection(websocket_role role = websocket_role::server, std::size_t max_message_size = websocket_config().max_message_size);
+
+		/// Parse bytes from the peer, false once the connection failed and only the queued close frame remains.
+		bool feed(const char* data, std::size_t len);
+
+		/// Messages completed by the previous feed calls.
+		std::vector<websocket_message> take_messages();
+
+		/// Queue a single frame message, or a ping/pong with a payload of up to 125 bytes. Dropped after close.
+		void send(websocket_opcode opcode, std::string_view payload);
+
+		/// Start the close handshake.
+		void close(std::uint16_t code, std::string_view reason);
+
+		/// Frames waiting to be written.
+		std::string& output()
+		{
+			return m_output;
+		}
+
+		bool close_sent() const
+		{
+			return m_close_sent;
+		}
+
+		/// Close frames went both ways or the connection failed, the transport closes once the output is written.
+		bool finished() const
+		{
+			return m_failed || (m_close_sent && m_close_received);
+		}
+
+		/// Code of the close frame received, 1005 when it had none and 1006 when no close frame came. Text
+		/// that is not UTF-8 fails the connection with 1007, close frames with a reserved code with 1002.
+		std::uint16_t close_code() const
+		{
+			return m_close_code;
+		}
+
+		const std::string& close_reason() const
+		{
+			return m_close_reason;
+		}
+
+		/// Frames received since the last call, a liveness check for idle pings.
+		bool take_activity()
+		{
+			auto result = m_activity;
+			m_activity = false;
+			return result;
+		}
+
+	private:
+		bool on_frame(bool fin, websocket_opcode opcode, char* payload, std::size_t len);
+		bool fail(std::uint16_t code, std::string_view reason);
+		void write_frame(websocket_opcode opcode, std::string_view payload);
+
+		const websocket_role m_role;
+		const std::size_t m_max_message_size;
+		std::mt19937 m_mask_generator;
+
+		std::string m_input;
+		std::string m_output;
+		// the fragmented message being assembled
+		std::string m_message;
+		websocket_opcode m_message_opcode = websocket_opcode::continuation;
+		bool m_message_started = false;
+		websocket_utf8_validator m_message_utf8;
+		std::vector<websocket_message> m_ready_messages;
+
+		bool m_close_sent = false;
+		bool m_close_received = false;
+		bool m_failed = false;
+		bool m_activity = false;
+		std::uint16_t m_close_code = 1006;
+		std::string m_close_reason;
+	};
+}
@@ -0,0 +1,339 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <functional>
+#include <boost/asio.hpp>
+#include <spdlog/logger.h>
+#include "websocket_connection.h"
+#include "http2_server_session.h"
+#include "http_session_manager.h"
+#include "http_log.h"
+
+namespace spiritsaway::http_utils
+{
+	namespace asio = boost::asio;
+	using asio_ec = boost::system::error_code;
+
+	/// One accepted websocket, independent of the stream it runs on.
+	class websocket_channel
+	{
+	public:
+		using message_handler = std::function<void(websocket_opcode opcode, const std::string& payload)>;
+		using close_handler = std::function<void(std::uint16_t code, const std::string& reason)>;
+
+		virtual ~websocket_channel() = default;
+
+		/// The handlers are called on the io thread, set them before handle_websocket returns.
+		void set_message_handler(message_handler handler)
+		{
+			m_message_handler = std::move(handler);
+		}
+
+		/// Called once when the connection is gone, with 1006 when it dropped without a close frame.
+		void set_close_handler(close_handler handler)
+		{
+			m_close_handler = std::move(handler);
+		}
+
+		/// The request that asked for the upgrade.
+		const request& upgrade_request() const
+		{
+			return m_request;
+		}
+
+		/// Queue a text, binary or ping message, callable from any thread.
+		virtual void send(websocket_opcode opcode, std::string_view payload) = 0;
+
+		/// Start the close handshake, callable from any thread.
+		virtual void close(std::uint16_t code = 1000, std::string_view reason = std::string_view()) = 0;
+
+	protected:
+		message_handler m_message_handler;
+		close_handler m_close_handler;
+		request m_request;
+	};
+
+	using websocket_handler = std::function<void(std::shared_ptr<websocket_channel> channel)>;
+
+	/// Called by an HTTP/1.1 session after answering a websocket upgrade with 101: the stream, the
+	/// bytes read after the upgrade request and the request itself.
+	template <typename Stream>
+	using websocket_handoff = std::function<void(std::unique_ptr<Stream>&& stream, std::string&& received, request&& upgrade_req)>;
+
+	/// A websocket over Stream, frames are parsed by websocket_connection and queued messages are
+	/// coalesced into one write while the previous one is in flight.
+	template <typename Stream>
+	class websocket_session
+		: public websocket_channel
+		, public std::enable_shared_from_this<websocket_session<Stream>>
+	{
+	public:
+		websocket_session(const websocket_session&) = delete;
+		websocket_session& operator=(const websocket_session&) = delete;
+
+		websocket_session(std::unique_ptr<Stream>&& stream, std::shared_ptr<spdlog::logger> in_logger, std::uint64_t in_session_idx, http_session_manager<websocket_session>& session_mgr, request&& upgrade_req, const websocket_handler& handler, const websocket_config& config)
+			: m_stream(std::move(stream))
+			, m_logger(std::move(in_logger))
+			, m_session_idx(in_session_idx)
+			, m_session_mgr(session_mgr)
+			, m_websocket_handler(handler)
+			, m_config(config)
+			, m_connection(websocket_role::server, config.max_message_size)
+			, m_con_timer(m_stream->get_executor())
+		{
+			m_request = std::move(upgrade_req);
+		}
+
+		/// Bytes already read from the stream with the upgrade request, call before start.
+		void set_received(std::string&& received)
+		{
+			m_received = std::move(received);
+		}
+
+		void start()
+		{
+			HTTP_UTILS_LOG_DEBUG(m_logger, "websocket session {} start", m_session_idx);
+			m_callback_thread = std::this_thread::get_id();
+			m_websocket_handler(this->shared_from_this());
+			m_callback_thread = std::thread::id();
+			if (m_stopped)
+			{
+				return;
+			}
+			arm_ping_timer();
+			if (!m_received.empty())
+			{
+				auto cur_received = std::move(m_received);
+				if (!on_received(cur_received.data(), cur_received.size()))
+				{
+					return;
+				}
+			}
+			else
+			{
+				do_write();
+			}
+			do_read();
+		}
+
+		void stop()
+		{
+			HTTP_UTILS_LOG_DEBUG(m_logger, "websocket session {} stop", m_session_idx);
+			if (m_stopped)
+			{
+				return;
+			}
+			m_stopped = true;
+			m_con_timer.cancel();
+			close_stream(*m_stream);
+			if (m_close_handler)
+			{
+				auto cur_handler = std::move(m_close_handler);
+				m_close_handler = close_handler();
+				cur_handler(m_connection.close_code(), m_connection.close_reason());
+			}
+			// the handlers may hold the channel
+			m_message_handler = message_handler();
+		}
+
+		void send(websocket_opcode opcode, std::string_view payload) override
+		{
+			if (m_callback_thread == std::this_thread::get_id())
+			{
+				// replies from inside a handler need no copy
+				m_connection.send(opcode, payload);
+				do_write();
+				return;
+			}
+			asio::post(m_stream->get_executor(), [self = this->shared_from_this(), opcode, cur_payload = std::string(payload)]()
+				{
+					if (!self->m_stopped)
+					{
+						self->m_connection.send(opcode, cur_payload);
+						self->do_write();
+					}
+				});
+		}
+
+		void close(std::uint16_t code, std::string_view reason) override
+		{
+			asio::post(m_stream->get_executor(), [self = this->shared_from_this(), code, cur_reason = std::string(reason)]()
+				{
+					if (!self->m_stopped && !self->m_connection.close_sent())
+					{
+						self->m_connection.close(code, cur_reason);
+						self->arm_close_timer();
+						self->do_write();
+					}
+				});
+		}
+
+	private:
+		void do_read()
+		{
+			auto self(this->shared_from_this());
+			m_stream->async_read_some(asio::buffer(m_read_buffer), [self, this](const asio_ec& ec, std::size_t bytes_transferred)
+				{
+					if (ec)
+					{
+						if (ec != asio::error::operation_aborted && ec != asio::error::eof)
+						{
+							m_logger->error("websocket session {} error {}", m_session_idx, ec.message());
+						}
+						m_session_mgr.stop(self);
+						return;
+					}
+					if (m_stopped)
+					{
+						return;
+					}
+					if (on_received(m_read_buffer.data(), bytes_transferred))
+					{
+						do_read();
+					}
+				});
+		}
+
+		// false when the connection is closing and reads stop
+		bool on_received(const char* data, std::size_t len)
+		{
+			auto cur_close_sent = m_connection.close_sent();
+			if (!m_connection.feed(data, len))
+			{
+				m_logger->warn("websocket session {} protocol error", m_session_idx);
+			}
+			auto cur_messages = m_connection.take_messages();
+			if (!cur_messages.empty() && m_message_handler)
+			{
+				m_callback_thread = std::this_thread::get_id();
+				for (const auto& one_message : cur_messages)
+				{
+					m_message_handler(one_message.opcode, one_message.payload);
+					if (m_stopped)
+					{
+						break;
+					}
+				}
+				m_callback_thread = std::thread::id();
+			}
+			if (m_stopped)
+			{
+				return false;
+			}
+			if (!cur_close_sent && m_connection.close_sent())
+			{
+				arm_close_timer();
+			}
+			do_write();
+			return !m_connection.finished();
+		}
+
+		void do_write()
+		{
+			if (m_writing || m_stopped)
+			{
+				return;
+			}
+			auto self(this->shared_from_this());
+			if (m_connection.output().empty())
+			{
+				if (m_connection.finished())
+				{
+					m_session_mgr.stop(self);
+				}
+				return;
+			}
+			// messages queued while writing go out with the next write
+			m_write_buffer.clear();
+			m_write_buffer.swap(m_connection.output());
+			m_writing = true;
+			async_write_all(*m_stream, asio::buffer(m_write_buffer), [self, this](const asio_ec& ec, std::size_t)
+				{
+					m_writing = false;
+					if (ec)
+					{
+						if (ec != asio::error::operation_aborted)
+						{
+							m_logger->error("websocket session {} error {}", m_session_idx, ec.message());
+						}
+						m_session_mgr.stop(self);
+						return;
+					}
+					do_write();
+				});
+		}
+
+		// ping quiet connections and drop them when the ping got no answer within an interval
+		void arm_ping_timer()
+		{
+			if (!m_config.ping_interval_seconds)
+			{
+				return;
+			}
+			auto self(this->shared_from_this());
+			m_con_timer.expires_from_now(std::chrono::seconds(m_config.ping_interval_seconds));
+			m_con_timer.async_wait([self, this](const asio_ec& error)
+				{
+					if (error == asio::error::operation_aborted || m_stopped || m_connection.close_sent())
+					{
+						return;
+					}
+					if (m_connection.take_activity())
+					{
+						m_ping_pending = false;
+					}
+					else if (m_ping_pending)
+					{
+						m_logger->warn("websocket session {} timeout for pong", m_session_idx);
+						m_session_mgr.stop(self);
+						return;
+					}
+					else
+					{
+						m_ping_pending = true;
+						m_connection.send(websocket_opcode::ping, std::string_view());
+						do_write();
+					}
+					arm_ping_timer();
+				});
+		}
+
+		// the peer has m_timeout_seconds to answer our close frame
+		void arm_close_timer()
+		{
+			auto self(this->shared_from_this());
+			m_con_timer.expires_from_now(std::chrono::seconds(m_timeout_seconds));
+			m_con_timer.async_wait([self, this](const asio_ec& error)
+				{
+					if (error != asio::error::operation_aborted && !m_stopped)
+					{
+						HTTP_UTILS_LOG_DEBUG(m_logger, "websocket session {} timeout for close", m_session_idx);
+						m_session_mgr.stop(self);
+					}
+				});
+		}
+
+		std::unique_ptr<Stream> m_stream;
+		std::shared_ptr<spdlog::logger> m_logger;
+		const std::uint64_t m_session_idx;
+		http_session_manager<websocket_session>& m_session_mgr;
+		const websocket_handler m_websocket_handler;
+		const websocket_config m_config;
+
+		websocket_connection m_connection;
+		std::array<char, 16384> m_read_buffer;
+		std::string m_received;
+		std::string m_write_buffer;
+		bool m_writing = false;
+		bool m_stopped = false;
+		bool m_ping_pending = false;
+		// the thread running our handlers, sends from it skip the post
+		std::atomic<std::thread::id> m_callback_thread;
+
+		asio::basic_waitable_timer<std::chrono::steady_clock> m_con_timer;
+		const std::size_t m_timeout_seconds = 5;
+	};
+}
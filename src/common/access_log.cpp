@@ -0,0 +1,272 @@
+#include "access_log.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace spiritsaway::http_utils
+{
+	namespace
+	{
+		std::atomic<std::size_t> access_logger_counter = 0;
+
+		constexpr std::string_view access_log_magic = "HUAL";
+		constexpr std::uint32_t access_log_version = 1;
+
+		std::size_t round_up_power_of_two(std::size_t value)
+		{
+			std::size_t result = 1;
+			while (result < value)
+			{
+				result <<= 1;
+			}
+			return result;
+		}
+
+		template <typename T>
+		void append_little_endian(std::string& out, T value)
+		{
+			for (std::size_t i = 0; i < sizeof(T); i++)
+			{
+				out += char((std::uint64_t(value) >> (8 * i)) & 0xff);
+			}
+		}
+
+		template <typename T>
+		bool read_little_endian(std::istream& in, T& value)
+		{
+			std::array<unsigned char, sizeof(T)> cur_bytes;
+			if (!in.read(reinterpret_cast<char*>(cur_bytes.data()), cur_bytes.size()))
+			{
+				return false;
+			}
+			std::uint64_t result = 0;
+			for (std::size_t i = 0; i < sizeof(T); i++)
+			{
+				result |= std::uint64_t(cur_bytes[i]) << (8 * i);
+			}
+			value = T(result);
+			return true;
+		}
+	}
+
+	void access_log_record::set_request(std::string_view in_method, std::string_view in_uri)
+	{
+		method_size = std::uint8_t(std::min(in_method.size(), access_log_max_method_size));
+		std::memcpy(method.data(), in_method.data(), method_size);
+		uri_size = std::uint8_t(std::min(in_uri.size(), access_log_max_uri_size));
+		std::memcpy(uri.data(), in_uri.data(), uri_size);
+	}
+
+	access_log_ring::access_log_ring(std::size_t capacity)
+		: m_records(round_up_power_of_two(std::max<std::size_t>(capacity, 1)))
+		, m_mask(m_records.size() - 1)
+		, m_head(0)
+		, m_tail(0)
+	{
+
+	}
+
+	access_logger::access_logger(const access_log_config& config)
+		: m_config(config)
+		, m_id(access_logger_counter++)
+	{
+		if (m_config.format == access_log_format::binary)
+		{
+			m_file.open(m_config.path, std::ios::binary | std::ios::trunc);
+			append_access_log_header(m_write_buffer);
+		}
+		else
+		{
+			m_file.open(m_config.path, std::ios::trunc);
+			m_write_buffer = access_log_csv_header();
+			m_write_buffer += '\n';
+		}
+		if (!m_file.is_open())
+		{
+			return;
+		}
+		m_file.write(m_write_buffer.data(), m_write_buffer.size());
+		m_writer = std::thread([this]()
+			{
+				run_writer();
+			});
+	}
+
+	access_logger::~access_logger()
+	{
+		{
+			std::lock_guard<std::mutex> guard(m_stop_mutex);
+			m_stopped = true;
+		}
+		m_stop_cv.notify_all();
+		if (m_writer.joinable())
+		{
+			m_writer.join();
+		}
+		flush();
+	}
+
+	access_log_ring& access_logger::add_local_ring(std::vector<access_log_ring*>& thread_rings)
+	{
+		auto cur_ring = std::make_unique<access_log_ring>(m_config.ring_capacity);
+		auto* result = cur_ring.get();
+		{
+			std::lock_guard<std::mutex> guard(m_rings_mutex);
+			m_rings.push_back(std::move(cur_ring));
+		}
+		if (thread_rings.size() <= m_id)
+		{
+			thread_rings.resize(m_id + 1, nullptr);
+		}
+		thread_rings[m_id] = result;
+		return *result;
+	}
+
+	void access_logger::run_writer()
+	{
+		std::unique_lock<std::mutex> stop_lock(m_stop_mutex);
+		while (!m_stopped)
+		{
+			m_stop_cv.wait_for(stop_lock, std::chrono::milliseconds(m_config.flush_interval_ms));
+			stop_lock.unlock();
+			flush();
+			stop_lock.lock();
+		}
+	}
+
+	void access_logger::flush()
+	{
+		std::lock_guard<std::mutex> guard(m_write_mutex);
+		if (m_file.is_open())
+		{
+			write_rings();
+		}
+	}
+
+	void access_logger::write_rings()
+	{
+		std::vector<access_log_ring*> cur_rings;
+		{
+			std::lock_guard<std::mutex> guard(m_rings_mutex);
+			for (const auto& one_ring : m_rings)
+			{
+				cur_rings.push_back(one_ring.get());
+			}
+		}
+		m_write_buffer.clear();
+		std::uint64_t cur_count = 0;
+		for (auto* one_ring : cur_rings)
+		{
+			if (m_config.format == access_log_format::binary)
+			{
+				cur_count += one_ring->drain([this](const access_log_record& record)
+					{
+						append_access_log_binary(record, m_write_buffer);
+					});
+			}
+			else
+			{
+				cur_count += one_ring->drain([this](const access_log_record& record)
+					{
+						append_access_log_csv(record, m_write_buffer);
+					});
+			}
+		}
+		if (!cur_count)
+		{
+			return;
+		}
+		m_file.write(m_write_buffer.data(), m_write_buffer.size());
+		m_file.flush();
+		m_written.fetch_add(cur_count, std::memory_order_relaxed);
+	}
+
+	void append_access_log_header(std::string& out)
+	{
+		out += access_log_magic;
+		append_little_endian(out, access_log_version);
+	}
+
+	void append_access_log_binary(const access_log_record& record, std::string& out)
+	{
+		append_little_endian(out, record.timestamp_us);
+		append_little_endian(out, record.request_bytes);
+		append_little_endian(out, record.reply_bytes);
+		append_little_endian(out, record.status);
+		append_little_endian(out, record.read_us);
+		append_little_endian(out, record.handler_us);
+		append_little_endian(out, record.write_us);
+		append_little_endian(out, record.method_size);
+		out.append(record.method.data(), record.method_size);
+		append_little_endian(out, record.uri_size);
+		out.append(record.uri.data(), record.uri_size);
+	}
+
+	std::string_view access_log_csv_header()
+	{
+		return "timestamp_us,method,uri,status,request_bytes,reply_bytes,read_us,handler_us,write_us";
+	}
+
+	void append_access_log_csv(const access_log_record& record, std::string& out)
+	{
+		out += std::to_string(record.timestamp_us);
+		out += ',';
+		out += record.method_view();
+		out += ',';
+		auto cur_uri = record.uri_view();
+		if (cur_uri.find_first_of(",\"") == std::string_view::npos)
+		{
+			out += cur_uri;
+		}
+		else
+		{
+			out += '"';
+			for (auto one_char : cur_uri)
+			{
+				if (one_char == '"')
+				{
+					out += '"';
+				}
+				out += one_char;
+			}
+			out += '"';
+		}
+		for (auto one_value : { std::uint64_t(record.status), record.request_bytes, record.reply_bytes, std::uint64_t(record.read_us), std::uint64_t(record.handler_us), std::uint64_t(record.write_us) })
+		{
+			out += ',';
+			out += std::to_string(one_value);
+		}
+		out += '\n';
+	}
+
+	bool read_access_log_header(std::istream& in)
+	{
+		std::array<char, 4> cur_magic;
+		std::uint32_t cur_version = 0;
+		if (!in.read(cur_magic.data(), cur_magic.size()) || std::string_view(cur_magic.data(), cur_magic.size()) != access_log_magic)
+		{
+			return false;
+		}
+		return read_little_endian(in, cur_version) && cur_version == access_log_version;
+	}
+
+	bool read_access_log_record(std::istream& in, access_log_record& record)
+	{
+		if (!read_little_endian(in, record.timestamp_us))
+		{
+			return false;
+		}
+		return read_little_endian(in, record.request_bytes)
+			&& read_little_endian(in, record.reply_bytes)
+			&& read_little_endian(in, record.status)
+			&& read_little_endian(in, record.read_us)
+			&& read_little_endian(in, record.handler_us)
+			&& read_little_endian(in, record.write_us)
+			&& read_little_endian(in, record.method_size)
+			&& record.method_size <= access_log_max_method_size
+			&& in.read(record.method.data(), record.method_size)
+			&& read_little_endian(in, record.uri_size)
+			&& record.uri_size <= access_log_max_uri_size
+			&& in.read(record.uri.data(), record.uri_size);
+	}
+}
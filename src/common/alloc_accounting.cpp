@@ -0,0 +1,350 @@
+#include "alloc_accounting.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#if HTTP_UTILS_ALLOC_ACCOUNTING
+#if defined(_WIN32)
+#include <malloc.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+#endif
+
+namespace spiritsaway::http_utils
+{
+	namespace
+	{
+		// threads share these round robin, the totals are only summed on scrape
+		struct alignas(64) alloc_shard
+		{
+			std::atomic<std::uint64_t> allocs;
+			std::atomic<std::uint64_t> frees;
+			std::atomic<std::uint64_t> alloc_bytes;
+			std::atomic<std::uint64_t> free_bytes;
+		};
+
+		constexpr std::size_t alloc_shard_count = 64;
+		alloc_shard alloc_shards[alloc_shard_count];
+		std::atomic<std::size_t> alloc_shard_counter = 0;
+
+		// plain data so that operator new can use them on any thread without initializing anything
+		thread_local alloc_counters cur_thread_counters;
+
+#if HTTP_UTILS_ALLOC_ACCOUNTING
+		thread_local alloc_shard* cur_thread_shard = nullptr;
+		thread_local bool cur_scope_active = false;
+
+		alloc_shard& local_shard()
+		{
+			if (!cur_thread_shard)
+			{
+				cur_thread_shard = &alloc_shards[alloc_shard_counter.fetch_add(1, std::memory_order_relaxed) % alloc_shard_count];
+			}
+			return *cur_thread_shard;
+		}
+
+		void count_alloc(std::size_t size)
+		{
+			cur_thread_counters.allocs++;
+			cur_thread_counters.alloc_bytes += size;
+			auto& cur_shard = local_shard();
+			cur_shard.allocs.fetch_add(1, std::memory_order_relaxed);
+			cur_shard.alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+		}
+
+		void count_free(std::size_t size)
+		{
+			cur_thread_counters.frees++;
+			cur_thread_counters.free_bytes += size;
+			auto& cur_shard = local_shard();
+			cur_shard.frees.fetch_add(1, std::memory_order_relaxed);
+			cur_shard.free_bytes.fetch_add(size, std::memory_order_relaxed);
+		}
+
+		std::size_t usable_size(void* ptr)
+		{
+#if defined(_WIN32)
+			return _msize(ptr);
+#elif defined(__APPLE__)
+			return malloc_size(ptr);
+#else
+			return malloc_usable_size(ptr);
+#endif
+		}
+
+		std::size_t aligned_usable_size(void* ptr, std::size_t alignment)
+		{
+#if defined(_WIN32)
+			return _aligned_msize(ptr, alignment, 0);
+#else
+			return usable_size(ptr);
+#endif
+		}
+
+		void* counted_malloc(std::size_t size)
+		{
+			auto* result = std::malloc(size ? size : 1);
+			if (result)
+			{
+				count_alloc(usable_size(result));
+			}
+			return result;
+		}
+
+		void* counted_aligned_malloc(std::size_t size, std::size_t alignment)
+		{
+#if defined(_WIN32)
+			auto* result = _aligned_malloc(size ? size : 1, alignment);
+#else
+			// aligned_alloc wants a multiple of the alignment
+			auto* result = std::aligned_alloc(alignment, (std::max<std::size_t>(size, 1) + alignment - 1) / alignment * alignment);
+#endif
+			if (result)
+			{
+				count_alloc(aligned_usable_size(result, alignment));
+			}
+			return result;
+		}
+
+		void counted_free(void* ptr)
+		{
+			if (ptr)
+			{
+				count_free(usable_size(ptr));
+				std::free(ptr);
+			}
+		}
+
+		void counted_aligned_free(void* ptr, std::size_t alignment)
+		{
+			if (!ptr)
+			{
+				return;
+			}
+			count_free(aligned_usable_size(ptr, alignment));
+#if defined(_WIN32)
+			_aligned_free(ptr);
+#else
+			std::free(ptr);
+#endif
+		}
+
+		template <typename Alloc>
+		void* new_or_throw(Alloc&& alloc)
+		{
+			while (true)
+			{
+				if (auto* result = alloc())
+				{
+					return result;
+				}
+				auto cur_handler = std::get_new_handler();
+				if (!cur_handler)
+				{
+					throw std::bad_alloc();
+				}
+				cur_handler();
+			}
+		}
+#endif
+	}
+
+	alloc_counters& alloc_counters::operator+=(const alloc_counters& other)
+	{
+		allocs += other.allocs;
+		frees += other.frees;
+		alloc_bytes += other.alloc_bytes;
+		free_bytes += other.free_bytes;
+		return *this;
+	}
+
+	alloc_counters alloc_counters::operator-(const alloc_counters& other) const
+	{
+		alloc_counters result;
+		result.allocs = allocs - other.allocs;
+		result.frees = frees - other.frees;
+		result.alloc_bytes = alloc_bytes - other.alloc_bytes;
+		result.free_bytes = free_bytes - other.free_bytes;
+		return result;
+	}
+
+	alloc_counters thread_alloc_counters()
+	{
+		return cur_thread_counters;
+	}
+
+	alloc_counters process_alloc_counters()
+	{
+		alloc_counters result;
+		for (const auto& one_shard : alloc_shards)
+		{
+			result.allocs += one_shard.allocs.load(std::memory_order_relaxed);
+			result.frees += one_shard.frees.load(std::memory_order_relaxed);
+			result.alloc_bytes += one_shard.alloc_bytes.load(std::memory_order_relaxed);
+			result.free_bytes += one_shard.free_bytes.load(std::memory_order_relaxed);
+		}
+		return result;
+	}
+
+#if HTTP_UTILS_ALLOC_ACCOUNTING
+	alloc_scope::alloc_scope(alloc_counters& target)
+	{
+		if (cur_scope_active)
+		{
+			return;
+		}
+		cur_scope_active = true;
+		m_target = &target;
+		m_begin = cur_thread_counters;
+	}
+
+	alloc_scope::~alloc_scope()
+	{
+		if (m_target)
+		{
+			flush();
+			cur_scope_active = false;
+		}
+	}
+
+	void alloc_scope::flush()
+	{
+		if (!m_target)
+		{
+			return;
+		}
+		auto cur_counters = cur_thread_counters;
+		*m_target += cur_counters - m_begin;
+		m_begin = cur_counters;
+	}
+#endif
+}
+
+#if HTTP_UTILS_ALLOC_ACCOUNTING
+// the replacements are linked in with alloc_scope, which every server session uses
+using namespace spiritsaway::http_utils;
+
+void* operator new(std::size_t size)
+{
+	return new_or_throw([size]()
+		{
+			return counted_malloc(size);
+		});
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return operator new(size);
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	return new_or_throw([size, alignment]()
+		{
+			return counted_aligned_malloc(size, std::size_t(alignment));
+		});
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return operator new(size, alignment);
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t& tag) noexcept
+{
+	return operator new(size, alignment, tag);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	counted_free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	counted_free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+	counted_free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+	counted_free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	counted_free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	counted_free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t alignment) noexcept
+{
+	counted_aligned_free(ptr, std::size_t(alignment));
+}
+
+void operator delete[](void* ptr, std::align_val_t alignment) noexcept
+{
+	counted_aligned_free(ptr, std::size_t(alignment));
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t alignment) noexcept
+{
+	counted_aligned_free(ptr, std::size_t(alignment));
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t alignment) noexcept
+{
+	counted_aligned_free(ptr, std::size_t(alignment));
+}
+
+void operator delete(void* ptr, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	counted_aligned_free(ptr, std::size_t(alignment));
+}
+
+void operator delete[](void* ptr, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	counted_aligned_free(ptr, std::size_t(alignment));
+}
+#endif
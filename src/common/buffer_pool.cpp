@@ -0,0 +1,109 @@
+#include "buffer_pool.h"
+
+namespace spiritsaway::http_utils
+{
+	buffer_pool::buffer::buffer(std::shared_ptr<buffer_pool> pool, char* data)
+		: m_pool(std::move(pool))
+		, m_data(data)
+	{
+
+	}
+
+	buffer_pool::buffer::buffer(buffer&& other) noexcept
+		: m_pool(std::move(other.m_pool))
+		, m_data(other.m_data)
+	{
+		other.m_data = nullptr;
+	}
+
+	buffer_pool::buffer& buffer_pool::buffer::operator=(buffer&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			m_pool = std::move(other.m_pool);
+			m_data = other.m_data;
+			other.m_data = nullptr;
+		}
+		return *this;
+	}
+
+	buffer_pool::buffer::~buffer()
+	{
+		reset();
+	}
+
+	std::size_t buffer_pool::buffer::size() const
+	{
+		return m_data ? m_pool->buffer_size() : 0;
+	}
+
+	void buffer_pool::buffer::reset()
+	{
+		if (m_data)
+		{
+			m_pool->release(m_data);
+			m_data = nullptr;
+			m_pool.reset();
+		}
+	}
+
+	buffer_pool::buffer_pool(std::size_t buffer_size, std::size_t max_free_count)
+		: m_buffer_size(buffer_size)
+		, m_max_free_count(max_free_count)
+	{
+
+	}
+
+	buffer_pool::~buffer_pool()
+	{
+		for (auto one_buffer : m_free_buffers)
+		{
+			delete[] one_buffer;
+		}
+	}
+
+	buffer_pool::buffer buffer_pool::acquire()
+	{
+		char* cur_data = nullptr;
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			if (!m_free_buffers.empty())
+			{
+				cur_data = m_free_buffers.back();
+				m_free_buffers.pop_back();
+			}
+		}
+		if (!cur_data)
+		{
+			cur_data = new char[m_buffer_size];
+			m_alloc_counter++;
+		}
+		m_in_use_counter++;
+		return buffer(shared_from_this(), cur_data);
+	}
+
+	void buffer_pool::release(char* data)
+	{
+		m_in_use_counter--;
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			if (m_free_buffers.size() < m_max_free_count)
+			{
+				m_free_buffers.push_back(data);
+				return;
+			}
+		}
+		delete[] data;
+	}
+
+	buffer_pool_stats buffer_pool::get_stats() const
+	{
+		buffer_pool_stats result;
+		result.in_use_buffers = m_in_use_counter.load();
+		result.allocated_buffers = m_alloc_counter.load();
+		std::lock_guard<std::mutex> guard(m_mutex);
+		result.free_buffers = m_free_buffers.size();
+		return result;
+	}
+}
@@ -0,0 +1,608 @@
+#include "hpack.h"
+#include <array>
+#include <memory>
+
+namespace spiritsaway::http_utils
+{
+	namespace
+	{
+		const std::vector<header>& static_table()
+		{
+			static const std::vector<header> result = {
+			{ ":authority", "" },
+			{ ":method", "GET" },
+			{ ":method", "POST" },
+			{ ":path", "/" },
+			{ ":path", "/index.html" },
+			{ ":scheme", "http" },
+			{ ":scheme", "https" },
+			{ ":status", "200" },
+			{ ":status", "204" },
+			{ ":status", "206" },
+			{ ":status", "304" },
+			{ ":status", "400" },
+			{ ":status", "404" },
+			{ ":status", "500" },
+			{ "accept-charset", "" },
+			{ "accept-encoding", "gzip, deflate" },
+			{ "accept-language", "" },
+			{ "accept-ranges", "" },
+			{ "accept", "" },
+			{ "access-control-allow-origin", "" },
+			{ "age", "" },
+			{ "allow", "" },
+			{ "authorization", "" },
+			{ "cache-control", "" },
+			{ "content-disposition", "" },
+			{ "content-encoding", "" },
+			{ "content-language", "" },
+			{ "content-length", "" },
+			{ "content-location", "" },
+			{ "content-range", "" },
+			{ "content-type", "" },
+			{ "cookie", "" },
+			{ "date", "" },
+			{ "etag", "" },
+			{ "expect", "" },
+			{ "expires", "" },
+			{ "from", "" },
+			{ "host", "" },
+			{ "if-match", "" },
+			{ "if-modified-since", "" },
+			{ "if-none-match", "" },
+			{ "if-range", "" },
+			{ "if-unmodified-since", "" },
+			{ "last-modified", "" },
+			{ "link", "" },
+			{ "location", "" },
+			{ "max-forwards", "" },
+			{ "proxy-authenticate", "" },
+			{ "proxy-authorization", "" },
+			{ "range", "" },
+			{ "referer", "" },
+			{ "refresh", "" },
+			{ "retry-after", "" },
+			{ "server", "" },
+			{ "set-cookie", "" },
+			{ "strict-transport-security", "" },
+			{ "transfer-encoding", "" },
+			{ "user-agent", "" },
+			{ "vary", "" },
+			{ "via", "" },
+			{ "www-authenticate", "" },
+			};
+			return result;
+		}
+
+		struct huffman_code
+		{
+			std::uint32_t code;
+			std::uint8_t len;
+		};
+
+		// RFC 7541 Appendix B, the eos code is only used as padding
+		const std::array<huffman_code, 256> huffman_codes = { {
+			{ 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 }, { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+			{ 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 }, { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+			{ 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 }, { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+			{ 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 }, { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+			{ 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 }, { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+			{ 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 }, { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+			{ 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 }, { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+			{ 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 }, { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+			{ 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 }, { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+			{ 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 }, { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+			{ 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 }, { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+			{ 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 }, { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+			{ 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 }, { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+			{ 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 }, { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+			{ 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 }, { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+			{ 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 }, { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+			{ 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 }, { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+			{ 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 }, { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+			{ 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 }, { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+			{ 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 }, { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+			{ 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 }, { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+			{ 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 }, { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+			{ 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 }, { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+			{ 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 }, { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+			{ 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 }, { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+			{ 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 }, { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+			{ 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 }, { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+			{ 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 }, { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+			{ 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 }, { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+			{ 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 }, { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+			{ 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 }, { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+			{ 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 }, { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+		} };
+
+		// a node consumes the next 8 bits, leaves are shared by all the entries starting with their code
+		struct huffman_node
+		{
+			std::vector<const huffman_node*> children;
+			std::uint8_t sym = 0;
+			std::uint8_t code_len = 0;
+		};
+
+		class huffman_tree
+		{
+		public:
+			huffman_tree()
+			{
+				m_root = new_internal();
+				for (std::size_t i = 0; i < huffman_codes.size(); i++)
+				{
+					add(std::uint8_t(i), huffman_codes[i].code, huffman_codes[i].len);
+				}
+			}
+
+			const huffman_node* root() const
+			{
+				return m_root;
+			}
+
+		private:
+			huffman_node* new_internal()
+			{
+				m_nodes.push_back(std::make_unique<huffman_node>());
+				m_nodes.back()->children.resize(256, nullptr);
+				return m_nodes.back().get();
+			}
+
+			void add(std::uint8_t sym, std::uint32_t code, std::uint8_t len)
+			{
+				auto cur_node = m_root;
+				while (len > 8)
+				{
+					len -= 8;
+					auto cur_idx = (code >> len) & 0xff;
+					if (!cur_node->children[cur_idx])
+					{
+						cur_node->children[cur_idx] = new_internal();
+					}
+					cur_node = const_cast<huffman_node*>(cur_node->children[cur_idx]);
+				}
+				m_nodes.push_back(std::make_unique<huffman_node>());
+				auto cur_leaf = m_nodes.back().get();
+				cur_leaf->sym = sym;
+				cur_leaf->code_len = len;
+				auto shift = 8 - len;
+				auto start = (code << shift) & 0xff;
+				for (std::uint32_t i = start; i < start + (1u << shift); i++)
+				{
+					cur_node->children[i] = cur_leaf;
+				}
+			}
+
+			std::vector<std::unique_ptr<huffman_node>> m_nodes;
+			huffman_node* m_root;
+		};
+
+		const huffman_tree& get_huffman_tree()
+		{
+			static const huffman_tree result;
+			return result;
+		}
+
+		void encode_integer(std::uint64_t value, std::uint8_t prefix_bits, std::uint8_t flags, std::string& dest)
+		{
+			std::uint64_t max_prefix = (1u << prefix_bits) - 1;
+			if (value < max_prefix)
+			{
+				dest.push_back(char(flags | value));
+				return;
+			}
+			dest.push_back(char(flags | max_prefix));
+			value -= max_prefix;
+			while (value >= 128)
+			{
+				dest.push_back(char((value & 0x7f) | 0x80));
+				value >>= 7;
+			}
+			dest.push_back(char(value));
+		}
+
+		bool decode_integer(const std::uint8_t*& cur, const std::uint8_t* end, std::uint8_t prefix_bits, std::uint64_t& value)
+		{
+			if (cur == end)
+			{
+				return false;
+			}
+			std::uint64_t max_prefix = (1u << prefix_bits) - 1;
+			value = *cur & max_prefix;
+			cur++;
+			if (value < max_prefix)
+			{
+				return true;
+			}
+			std::uint32_t shift = 0;
+			while (cur != end)
+			{
+				auto cur_byte = *cur;
+				cur++;
+				value += std::uint64_t(cur_byte & 0x7f) << shift;
+				if (!(cur_byte & 0x80))
+				{
+					return true;
+				}
+				shift += 7;
+				// nothing we accept needs more than 4 continuation bytes
+				if (shift > 28)
+				{
+					return false;
+				}
+			}
+			return false;
+		}
+
+		bool decode_string(const std::uint8_t*& cur, const std::uint8_t* end, std::string& dest)
+		{
+			if (cur == end)
+			{
+				return false;
+			}
+			bool is_huffman = (*cur & 0x80) != 0;
+			std::uint64_t str_len = 0;
+			if (!decode_integer(cur, end, 7, str_len) || str_len > std::uint64_t(end - cur))
+			{
+				return false;
+			}
+			dest.clear();
+			if (is_huffman)
+			{
+				if (!huffman_decode(cur, std::size_t(str_len), dest))
+				{
+					return false;
+				}
+			}
+			else
+			{
+				dest.assign(reinterpret_cast<const char*>(cur), std::size_t(str_len));
+			}
+			cur += str_len;
+			return true;
+		}
+
+		void encode_string(const std::string& src, std::string& dest)
+		{
+			auto huffman_size = huffman_encoded_size(src);
+			if (huffman_size < src.size())
+			{
+				encode_integer(huffman_size, 7, 0x80, dest);
+				huffman_encode(src, dest);
+			}
+			else
+			{
+				encode_integer(src.size(), 7, 0, dest);
+				dest += src;
+			}
+		}
+
+		std::size_t entry_size(const std::string& name, const std::string& value)
+		{
+			return name.size() + value.size() + 32;
+		}
+	}
+
+	bool huffman_decode(const std::uint8_t* src, std::size_t len, std::string& dest)
+	{
+		const auto root = get_huffman_tree().root();
+		auto cur_node = root;
+		std::uint64_t cur = 0;
+		std::uint32_t cur_bits = 0;
+		// bits read since the last complete symbol
+		std::uint32_t sym_bits = 0;
+		for (std::size_t i = 0; i < len; i++)
+		{
+			cur = (cur << 8) | src[i];
+			cur_bits += 8;
+			sym_bits += 8;
+			while (cur_bits >= 8)
+			{
+				cur_node = cur_node->children[(cur >> (cur_bits - 8)) & 0xff];
+				if (!cur_node)
+				{
+					return false;
+				}
+				if (cur_node->children.empty())
+				{
+					dest.push_back(char(cur_node->sym));
+					cur_bits -= cur_node->code_len;
+					cur_node = root;
+					sym_bits = cur_bits;
+				}
+				else
+				{
+					cur_bits -= 8;
+				}
+			}
+		}
+		while (cur_bits > 0)
+		{
+			cur_node = cur_node->children[(cur << (8 - cur_bits)) & 0xff];
+			if (!cur_node || !cur_node->children.empty() || cur_node->code_len > cur_bits)
+			{
+				break;
+			}
+			dest.push_back(char(cur_node->sym));
+			cur_bits -= cur_node->code_len;
+			cur_node = root;
+			sym_bits = cur_bits;
+		}
+		// the padding is the most significant bits of eos and shorter than a byte
+		if (sym_bits > 7)
+		{
+			return false;
+		}
+		std::uint64_t mask = (1u << cur_bits) - 1;
+		return (cur & mask) == mask;
+	}
+
+	void huffman_encode(std::string_view src, std::string& dest)
+	{
+		std::uint64_t cur = 0;
+		std::uint32_t cur_bits = 0;
+		for (auto one_char : src)
+		{
+			const auto& cur_code = huffman_codes[std::uint8_t(one_char)];
+			cur = (cur << cur_code.len) | cur_code.code;
+			cur_bits += cur_code.len;
+			while (cur_bits >= 8)
+			{
+				cur_bits -= 8;
+				dest.push_back(char(cur >> cur_bits));
+			}
+		}
+		if (cur_bits > 0)
+		{
+			cur = (cur << (8 - cur_bits)) | (0xff >> cur_bits);
+			dest.push_back(char(cur));
+		}
+	}
+
+	std::size_t huffman_encoded_size(std::string_view src)
+	{
+		std::size_t total_bits = 0;
+		for (auto one_char : src)
+		{
+			total_bits += huffman_codes[std::uint8_t(one_char)].len;
+		}
+		return (total_bits + 7) / 8;
+	}
+
+	hpack_table::hpack_table(std::size_t max_size)
+		: m_max_size(max_size)
+	{
+
+	}
+
+	void hpack_table::set_max_size(std::size_t max_size)
+	{
+		m_max_size = max_size;
+		evict(max_size);
+	}
+
+	void hpack_table::evict(std::size_t target_size)
+	{
+		while (m_size > target_size && !m_entries.empty())
+		{
+			m_size -= entry_size(m_entries.back().name, m_entries.back().value);
+			m_entries.pop_back();
+		}
+	}
+
+	void hpack_table::add(const std::string& name, const std::string& value)
+	{
+		auto cur_size = entry_size(name, value);
+		if (cur_size > m_max_size)
+		{
+			// an entry larger than the table empties it
+			evict(0);
+			return;
+		}
+		evict(m_max_size - cur_size);
+		m_entries.push_front(header{ name, value });
+		m_size += cur_size;
+	}
+
+	const header* hpack_table::get(std::size_t index) const
+	{
+		const auto& cur_static = static_table();
+		if (index == 0)
+		{
+			return nullptr;
+		}
+		if (index <= cur_static.size())
+		{
+			return &cur_static[index - 1];
+		}
+		index -= cur_static.size() + 1;
+		if (index < m_entries.size())
+		{
+			return &m_entries[index];
+		}
+		return nullptr;
+	}
+
+	std::size_t hpack_table::find(const std::string& name, const std::string& value, std::size_t& name_index) const
+	{
+		name_index = 0;
+		const auto& cur_static = static_table();
+		for (std::size_t i = 0; i < cur_static.size(); i++)
+		{
+			if (cur_static[i].name != name)
+			{
+				continue;
+			}
+			if (cur_static[i].value == value)
+			{
+				return i + 1;
+			}
+			if (!name_index)
+			{
+				name_index = i + 1;
+			}
+		}
+		for (std::size_t i = 0; i < m_entries.size(); i++)
+		{
+			if (m_entries[i].name != name)
+			{
+				continue;
+			}
+			if (m_entries[i].value == value)
+			{
+				return cur_static.size() + i + 1;
+			}
+			if (!name_index)
+			{
+				name_index = cur_static.size() + i + 1;
+			}
+		}
+		return 0;
+	}
+
+	hpack_decoder::hpack_decoder(std::size_t max_table_size, std::size_t max_list_size)
+		: m_table(max_table_size)
+		, m_max_table_size(max_table_size)
+		, m_max_list_size(max_list_size)
+	{
+
+	}
+
+	bool hpack_decoder::decode(const std::uint8_t* data, std::size_t len, std::vector<header>& result)
+	{
+		auto cur = data;
+		auto end = data + len;
+		std::size_t list_size = 0;
+		while (cur != end)
+		{
+			if (!result.empty())
+			{
+				list_size += entry_size(result.back().name, result.back().value);
+				if (list_size > m_max_list_size)
+				{
+					return false;
+				}
+			}
+			auto cur_byte = *cur;
+			std::uint64_t cur_index = 0;
+			if (cur_byte & 0x80)
+			{
+				// indexed header field
+				if (!decode_integer(cur, end, 7, cur_index))
+				{
+					return false;
+				}
+				auto cur_entry = m_table.get(std::size_t(cur_index));
+				if (!cur_entry)
+				{
+					return false;
+				}
+				result.push_back(*cur_entry);
+				continue;
+			}
+			if ((cur_byte & 0xe0) == 0x20)
+			{
+				// dynamic table size update
+				if (!decode_integer(cur, end, 5, cur_index) || cur_index > m_max_table_size)
+				{
+					return false;
+				}
+				m_table.set_max_size(std::size_t(cur_index));
+				continue;
+			}
+			// literal with incremental indexing, without indexing or never indexed
+			bool add_to_table = (cur_byte & 0x40) != 0;
+			if (!decode_integer(cur, end, add_to_table ? 6 : 4, cur_index))
+			{
+				return false;
+			}
+			header cur_header;
+			if (cur_index)
+			{
+				auto cur_entry = m_table.get(std::size_t(cur_index));
+				if (!cur_entry)
+				{
+					return false;
+				}
+				cur_header.name = cur_entry->name;
+			}
+			else if (!decode_string(cur, end, cur_header.name))
+			{
+				return false;
+			}
+			if (!decode_string(cur, end, cur_header.value))
+			{
+				return false;
+			}
+			if (add_to_table)
+			{
+				m_table.add(cur_header.name, cur_header.value);
+			}
+			result.push_back(std::move(cur_header));
+		}
+		if (!result.empty())
+		{
+			list_size += entry_size(result.back().name, result.back().value);
+		}
+		return list_size <= m_max_list_size;
+	}
+
+	hpack_encoder::hpack_encoder()
+		: m_table(4096)
+	{
+
+	}
+
+	void hpack_encoder::set_max_table_size(std::size_t max_size)
+	{
+		// the peer only bounds our table, a larger one is not worth the memory
+		m_table.set_max_size(std::min<std::size_t>(max_size, 4096));
+		m_table_size_update = true;
+	}
+
+	void hpack_encoder::encode(const std::vector<header>& headers, std::string& dest)
+	{
+		if (m_table_size_update)
+		{
+			encode_integer(m_table.max_size(), 5, 0x20, dest);
+			m_table_size_update = false;
+		}
+		for (const auto& one_header : headers)
+		{
+			encode_header(one_header.name, one_header.value, dest);
+		}
+	}
+
+	void hpack_encoder::encode_header(const std::string& name, const std::string& value, std::string& dest)
+	{
+		std::size_t name_index = 0;
+		auto cur_index = m_table.find(name, value, name_index);
+		if (cur_index)
+		{
+			encode_integer(cur_index, 7, 0x80, dest);
+			return;
+		}
+		bool sensitive = name == "authorization" || name == "cookie" || name == "set-cookie";
+		// values that change with every reply would only push the useful entries out
+		bool add_to_table = !sensitive && name != ":path" && name != "content-length" && name != "date"
+			&& name != "etag" && name != "last-modified" && entry_size(name, value) <= m_table.max_size() / 2;
+		if (add_to_table)
+		{
+			encode_integer(name_index, 6, 0x40, dest);
+		}
+		else
+		{
+			encode_integer(name_index, 4, sensitive ? 0x10 : 0x00, dest);
+		}
+		if (!name_index)
+		{
+			encode_string(name, dest);
+		}
+		encode_string(value, dest);
+		if (add_to_table)
+		{
+			m_table.add(name, value);
+		}
+	}
+}
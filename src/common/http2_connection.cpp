@@ -0,0 +1,1070 @@
+#include "http2_connection.h"
+#include <algorithm>
+#include <cctype>
+
+namespace spiritsaway::http_utils
+{
+	const std::string_view http2_preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+	namespace
+	{
+		enum frame_type : std::uint8_t
+		{
+			frame_data = 0x0,
+			frame_headers = 0x1,
+			frame_priority = 0x2,
+			frame_rst_stream = 0x3,
+			frame_settings = 0x4,
+			frame_push_promise = 0x5,
+			frame_ping = 0x6,
+			frame_goaway = 0x7,
+			frame_window_update = 0x8,
+			frame_continuation = 0x9,
+		};
+
+		enum frame_flag : std::uint8_t
+		{
+			flag_end_stream = 0x1,
+			flag_ack = 0x1,
+			flag_end_headers = 0x4,
+			flag_padded = 0x8,
+			flag_priority = 0x20,
+		};
+
+		enum settings_id : std::uint16_t
+		{
+			settings_header_table_size = 0x1,
+			settings_enable_push = 0x2,
+			settings_max_concurrent_streams = 0x3,
+			settings_initial_window_size = 0x4,
+			settings_max_frame_size = 0x5,
+			settings_max_header_list_size = 0x6,
+		};
+
+		const std::size_t frame_header_size = 9;
+		const std::int64_t max_window_size = 0x7fffffff;
+		// the connection window is raised to this at start, many streams share it
+		const std::int64_t connection_window_target = 1 << 20;
+
+		std::uint32_t read_u32(const std::uint8_t* data)
+		{
+			return (std::uint32_t(data[0]) << 24) | (std::uint32_t(data[1]) << 16) | (std::uint32_t(data[2]) << 8) | std::uint32_t(data[3]);
+		}
+
+		void write_u32(std::string& dest, std::uint32_t value)
+		{
+			dest.push_back(char(value >> 24));
+			dest.push_back(char(value >> 16));
+			dest.push_back(char(value >> 8));
+			dest.push_back(char(value));
+		}
+
+		void write_setting(std::string& dest, std::uint16_t id, std::uint32_t value)
+		{
+			dest.push_back(char(id >> 8));
+			dest.push_back(char(id));
+			write_u32(dest, value);
+		}
+
+		// headers that only make sense for one http/1 connection
+		bool is_connection_header(const std::string& lower_name)
+		{
+			return lower_name == "connection" || lower_name == "keep-alive" || lower_name == "proxy-connection"
+				|| lower_name == "transfer-encoding" || lower_name == "upgrade";
+		}
+	}
+
+	bool decode_http2_settings(std::string_view header_value, std::string& payload)
+	{
+		std::uint32_t cur_bits = 0;
+		int cur_bit_count = 0;
+		payload.clear();
+		for (auto one_char : header_value)
+		{
+			int cur_value;
+			if (one_char >= 'A' && one_char <= 'Z')
+			{
+				cur_value = one_char - 'A';
+			}
+			else if (one_char >= 'a' && one_char <= 'z')
+			{
+				cur_value = one_char - 'a' + 26;
+			}
+			else if (one_char >= '0' && one_char <= '9')
+			{
+				cur_value = one_char - '0' + 52;
+			}
+			else if (one_char == '-' || one_char == '+')
+			{
+				cur_value = 62;
+			}
+			else if (one_char == '_' || one_char == '/')
+			{
+				cur_value = 63;
+			}
+			else if (one_char == '=')
+			{
+				break;
+			}
+			else
+			{
+				return false;
+			}
+			cur_bits = (cur_bits << 6) | std::uint32_t(cur_value);
+			cur_bit_count += 6;
+			if (cur_bit_count >= 8)
+			{
+				cur_bit_count -= 8;
+				payload.push_back(char((cur_bits >> cur_bit_count) & 0xff));
+			}
+		}
+		return payload.size() % 6 == 0;
+	}
+
+	http2_connection::http2_connection(const http2_settings& local_settings, http2_role role)
+		: m_local_settings(local_settings)
+		, m_role(role)
+		, m_decoder(local_settings.header_table_size, local_settings.max_header_list_size)
+	{
+		// the server preface is its SETTINGS frame
+		m_preface_received = role == http2_role::client;
+	}
+
+	void http2_connection::start()
+	{
+		std::string payload;
+		if (m_role == http2_role::client)
+		{
+			m_output.append(http2_preface.data(), http2_preface.size());
+			write_setting(payload, settings_enable_push, 0);
+		}
+		if (m_local_settings.header_table_size != 4096)
+		{
+			write_setting(payload, settings_header_table_size, m_local_settings.header_table_size);
+		}
+		write_setting(payload, settings_max_concurrent_streams, m_local_settings.max_concurrent_streams);
+		if (m_local_settings.initial_window_size != 65535)
+		{
+			write_setting(payload, settings_initial_window_size, m_local_settings.initial_window_size);
+		}
+		if (m_local_settings.max_frame_size != 16384)
+		{
+			write_setting(payload, settings_max_frame_size, m_local_settings.max_frame_size);
+		}
+		write_setting(payload, settings_max_header_list_size, m_local_settings.max_header_list_size);
+		write_frame_header(payload.size(), frame_settings, 0, 0);
+		m_output += payload;
+		write_window_update(0, std::uint32_t(connection_window_target - m_recv_window));
+		m_recv_window = connection_window_target;
+	}
+
+	bool http2_connection::start_upgraded(request&& req, std::string_view settings_payload)
+	{
+		// the 101 reply acknowledges these settings, the client still sends the preface and a SETTINGS frame
+		if (settings_payload.size() % 6 != 0)
+		{
+			return connection_error(http2_error_code::protocol_error);
+		}
+		if (!apply_settings(reinterpret_cast<const std::uint8_t*>(settings_payload.data()), settings_payload.size()))
+		{
+			return false;
+		}
+		start();
+		stream_state cur_stream;
+		cur_stream.remote_closed = true;
+		cur_stream.head_request = req.method == "HEAD";
+		cur_stream.send_window = m_peer_settings.initial_window_size;
+		cur_stream.recv_window = m_local_settings.initial_window_size;
+		m_streams.emplace(1, std::move(cur_stream));
+		m_last_peer_stream_id = 1;
+		m_ready_requests.emplace_back(1, std::move(req));
+		return true;
+	}
+
+	bool http2_connection::feed(const char* data, std::size_t len)
+	{
+		if (m_failed)
+		{
+			return false;
+		}
+		m_input.append(data, len);
+		std::size_t offset = 0;
+		if (!m_preface_received)
+		{
+			auto cur_len = std::min(m_input.size(), http2_preface.size());
+			if (std::string_view(m_input.data(), cur_len) != http2_preface.substr(0, cur_len))
+			{
+				return connection_error(http2_error_code::protocol_error);
+			}
+			if (cur_len < http2_preface.size())
+			{
+				return true;
+			}
+			m_preface_received = true;
+			offset = http2_preface.size();
+		}
+		while (m_input.size() - offset >= frame_header_size)
+		{
+			auto cur_header = reinterpret_cast<const std::uint8_t*>(m_input.data() + offset);
+			std::size_t cur_len = (std::size_t(cur_header[0]) << 16) | (std::size_t(cur_header[1]) << 8) | std::size_t(cur_header[2]);
+			std::uint8_t cur_type = cur_header[3];
+			std::uint8_t cur_flags = cur_header[4];
+			std::uint32_t cur_stream_id = read_u32(cur_header + 5) & 0x7fffffff;
+			if (cur_len > m_local_settings.max_frame_size)
+			{
+				return connection_error(http2_error_code::frame_size_error);
+			}
+			if (m_input.size() - offset - frame_header_size < cur_len)
+			{
+				break;
+			}
+			if (!m_settings_received && cur_type != frame_settings)
+			{
+				return connection_error(http2_error_code::protocol_error);
+			}
+			if (m_continuation_stream && (cur_type != frame_continuation || cur_stream_id != m_continuation_stream))
+			{
+				return connection_error(http2_error_code::protocol_error);
+			}
+			if (!on_frame(cur_type, cur_flags, cur_stream_id, cur_header + frame_header_size, cur_len))
+			{
+				return false;
+			}
+			offset += frame_header_size + cur_len;
+		}
+		m_input.erase(0, offset);
+		return true;
+	}
+
+	std::vector<std::pair<std::uint32_t, request>> http2_connection::take_requests()
+	{
+		std::vector<std::pair<std::uint32_t, request>> result;
+		result.swap(m_ready_requests);
+		return result;
+	}
+
+	bool http2_connection::on_frame(std::uint8_t type, std::uint8_t flags, std::uint32_t stream_id, const std::uint8_t* payload, std::size_t len)
+	{
+		switch (type)
+		{
+		case frame_data:
+			return on_data(flags, stream_id, payload, len);
+		case frame_headers:
+			return on_headers(flags, stream_id, payload, len);
+		case frame_priority:
+			if (stream_id == 0)
+			{
+				return connection_error(http2_error_code::protocol_error);
+			}
+			return true;
+		case frame_rst_stream:
+			if (stream_id == 0 || is_idle_stream(stream_id))
+			{
+				return connection_error(http2_error_code::protocol_error);
+			}
+			if (len != 4)
+			{
+				return connection_error(http2_error_code::frame_size_error);
+			}
+			if (m_role == http2_role::client)
+			{
+				auto cur_error_code = http2_error_code(read_u32(payload));
+				fail_stream(stream_id, cur_error_code, cur_error_code == http2_error_code::refused_stream);
+			}
+			close_stream(stream_id);
+			return true;
+		case frame_settings:
+			return on_settings(flags, stream_id, payload, len);
+		case frame_push_promise:
+			// clients never push
+			return connection_error(http2_error_code::protocol_error);
+		case frame_ping:
+			if (stream_id != 0)
+			{
+				return connection_error(http2_error_code::protocol_error);
+			}
+			if (len != 8)
+			{
+				return connection_error(http2_error_code::frame_size_error);
+			}
+			if (!(flags & flag_ack))
+			{
+				write_frame_header(8, frame_ping, flag_ack, 0);
+				m_output.append(reinterpret_cast<const char*>(payload), 8);
+			}
+			return true;
+		case frame_goaway:
+			if (stream_id != 0)
+			{
+				return connection_error(http2_error_code::protocol_error);
+			}
+			return on_go_away(payload, len);
+		case frame_window_update:
+			return on_window_update(stream_id, payload, len);
+		case frame_continuation:
+			return on_continuation(flags, stream_id, payload, len);
+		default:
+			// unknown frame types are ignored
+			return true;
+		}
+	}
+
+	bool http2_connection::on_data(std::uint8_t flags, std::uint32_t stream_id, const std::uint8_t* payload, std::size_t len)
+	{
+		if (stream_id == 0)
+		{
+			return connection_error(http2_error_code::protocol_error);
+		}
+		std::size_t pad_len = 0;
+		std::size_t data_begin = 0;
+		if (flags & flag_padded)
+		{
+			if (len < 1 || std::size_t(payload[0]) >= len)
+			{
+				return connection_error(http2_error_code::protocol_error);
+			}
+			pad_len = payload[0];
+			data_begin = 1;
+		}
+		// padding counts against flow control too
+		m_recv_window -= std::int64_t(len);
+		if (m_recv_window < 0)
+		{
+			return connection_error(http2_error_code::flow_control_error);
+		}
+		if (m_recv_window <= connection_window_target / 2)
+		{
+			write_window_update(0, std::uint32_t(connection_window_target - m_recv_window));
+			m_recv_window = connection_window_target;
+		}
+		auto cur_iter = m_streams.find(stream_id);
+		if (cur_iter == m_streams.end() || cur_iter->second.remote_closed)
+		{
+			if (is_idle_stream(stream_id))
+			{
+				return connection_error(http2_error_code::protocol_error);
+			}
+			reset_stream(stream_id, http2_error_code::stream_closed);
+			return true;
+		}
+		auto& cur_stream = cur_iter->second;
+		if (m_role == http2_role::client && !cur_stream.headers_received)
+		{
+			// DATA before the reply headers
+			reset_stream(stream_id, http2_error_code::protocol_error);
+			fail_stream(stream_id, http2_error_code::protocol_error, false);
+			close_stream(stream_id);
+			return true;
+		}
+		cur_stream.recv_window -= std::int64_t(len);
+		if (cur_stream.recv_window < 0)
+		{
+			reset_stream(stream_id, http2_error_code::flow_control_error);
+			close_stream(stream_id);
+			return true;
+		}
+		cur_stream.body.append(reinterpret_cast<const char*>(payload + data_begin), len - data_begin - pad_len);
+		if (flags & flag_end_stream)
+		{
+			cur_stream.remote_closed = true;
+			return on_remote_end(stream_id);
+		}
+		std::int64_t stream_window_target = m_local_settings.initial_window_size;
+		if (cur_stream.recv_window <= stream_window_target / 2)
+		{
+			write_window_update(stream_id, std::uint32_t(stream_window_target - cur_stream.recv_window));
+			cur_stream.recv_window = stream_window_target;
+		}
+		return true;
+	}
+
+	bool http2_connection::on_headers(std::uint8_t flags, std::uint32_t stream_id, const std::uint8_t* payload, std::size_t len)
+	{
+		if (stream_id == 0)
+		{
+			return connection_error(http2_error_code::protocol_error);
+		}
+		std::size_t block_begin = 0;
+		std::size_t pad_len = 0;
+		if (flags & flag_padded)
+		{
+			if (len < 1)
+			{
+				return connection_error(http2_error_code::protocol_error);
+			}
+			pad_len = payload[0];
+			block_begin = 1;
+		}
+		if (flags & flag_priority)
+		{
+			block_begin += 5;
+		}
+		if (block_begin + pad_len > len)
+		{
+			return connection_error(http2_error_code::protocol_error);
+		}
+		m_header_block.assign(reinterpret_cast<const char*>(payload + block_begin), len - block_begin - pad_len);
+		if (flags & flag_end_headers)
+		{
+			return on_header_block(stream_id, flags & flag_end_stream);
+		}
+		m_continuation_stream = stream_id;
+		m_continuation_end_stream = flags & flag_end_stream;
+		return true;
+	}
+
+	bool http2_connection::on_continuation(std::uint8_t flags, std::uint32_t stream_id, const std::uint8_t* payload, std::size_t len)
+	{
+		if (!m_continuation_stream)
+		{
+			return connection_error(http2_error_code::protocol_error);
+		}
+		m_header_block.append(reinterpret_cast<const char*>(payload), len);
+		if (m_header_block.size() > m_local_settings.max_header_list_size)
+		{
+			return connection_error(http2_error_code::enhance_your_calm);
+		}
+		if (!(flags & flag_end_headers))
+		{
+			return true;
+		}
+		m_continuation_stream = 0;
+		return on_header_block(stream_id, m_continuation_end_stream);
+	}
+
+	bool http2_connection::on_header_block(std::uint32_t stream_id, bool end_stream)
+	{
+		// the block is decoded even for refused streams to keep the hpack tables in sync
+		std::vector<header> cur_headers;
+		if (!m_decoder.decode(reinterpret_cast<const std::uint8_t*>(m_header_block.data()), m_header_block.size(), cur_headers))
+		{
+			return connection_error(http2_error_code::compression_error);
+		}
+		m_header_block.clear();
+		if (m_role == http2_role::client)
+		{
+			return on_reply_headers(stream_id, end_stream, std::move(cur_headers));
+		}
+		auto cur_iter = m_streams.find(stream_id);
+		if (cur_iter != m_streams.end())
+		{
+			// trailers end the request, their fields are not passed on
+			if (cur_iter->second.remote_closed)
+			{
+				reset_stream(stream_id, http2_error_code::stream_closed);
+				close_stream(stream_id);
+				return true;
+			}
+			if (!end_stream)
+			{
+				reset_stream(stream_id, http2_error_code::protocol_error);
+				close_stream(stream_id);
+				return true;
+			}
+			cur_iter->second.remote_closed = true;
+			return finish_request(stream_id);
+		}
+		if (stream_id % 2 == 0 || stream_id <= m_last_peer_stream_id)
+		{
+			return connection_error(http2_error_code::protocol_error);
+		}
+		m_last_peer_stream_id = stream_id;
+		if (m_going_away || m_streams.size() >= m_local_settings.max_concurrent_streams)
+		{
+			reset_stream(stream_id, http2_error_code::refused_stream);
+			return true;
+		}
+		stream_state cur_stream;
+		cur_stream.headers = std::move(cur_headers);
+		cur_stream.remote_closed = end_stream;
+		cur_stream.send_window = m_peer_settings.initial_window_size;
+		cur_stream.recv_window = m_local_settings.initial_window_size;
+		m_streams.emplace(stream_id, std::move(cur_stream));
+		if (end_stream)
+		{
+			return finish_request(stream_id);
+		}
+		return true;
+	}
+
+	bool http2_connection::finish_request(std::uint32_t stream_id)
+	{
+		auto& cur_stream = m_streams[stream_id];
+		request cur_req;
+		cur_req.http_version_major = 2;
+		cur_req.http_version_minor = 0;
+		std::string cur_authority;
+		bool regular_seen = false;
+		bool malformed = false;
+		for (auto& one_header : cur_stream.headers)
+		{
+			if (!one_header.name.empty() && one_header.name[0] == ':')
+			{
+				// pseudo headers come first
+				if (regular_seen)
+				{
+					malformed = true;
+				}
+				else if (one_header.name == ":method")
+				{
+					cur_req.method = std::move(one_header.value);
+				}
+				else if (one_header.name == ":path")
+				{
+					cur_req.uri = std::move(one_header.value);
+				}
+				else if (one_header.name == ":authority")
+				{
+					cur_authority = std::move(one_header.value);
+				}
+				else if (one_header.name != ":scheme")
+				{
+					malformed = true;
+				}
+				continue;
+			}
+			regular_seen = true;
+			if (std::any_of(one_header.name.begin(), one_header.name.end(), [](unsigned char c)
+				{
+					return std::isupper(c);
+				}) || is_connection_header(one_header.name))
+			{
+				malformed = true;
+			}
+			cur_req.headers.push_back(std::move(one_header));
+		}
+		if (malformed || cur_req.method.empty() || (cur_req.uri.empty() && cur_req.method != "CONNECT"))
+		{
+			reset_stream(stream_id, http2_error_code::protocol_error);
+			close_stream(stream_id);
+			return true;
+		}
+		if (!cur_authority.empty())
+		{
+			cur_req.headers.insert(cur_req.headers.begin(), header{ "Host", std::move(cur_authority) });
+		}
+		cur_stream.headers.clear();
+		cur_stream.head_request = cur_req.method == "HEAD";
+		cur_req.body = std::move(cur_stream.body);
+		m_ready_requests.emplace_back(stream_id, std::move(cur_req));
+		return true;
+	}
+
+	void http2_connection::submit_reply(std::uint32_t stream_id, const reply& rep)
+	{
+		auto cur_iter = m_streams.find(stream_id);
+		if (cur_iter == m_streams.end() || cur_iter->second.local_submitted || m_failed)
+		{
+			return;
+		}
+		auto& cur_stream = cur_iter->second;
+		std::string cur_content;
+		std::vector<header> cur_headers;
+		if (rep.event_hub)
+		{
+			// event streams need the HTTP/1.1 connection, here the client would take the head for a finished empty reply
+			auto not_implemented_rep = reply::stock_reply(reply::status_type::not_implemented);
+			cur_content = not_implemented_rep.content;
+			cur_headers.push_back(header{ ":status", "501" });
+		}
+		else if (!rep.read_content(cur_content))
+		{
+			auto not_found_rep = reply::stock_reply(reply::status_type::not_found);
+			cur_content = not_found_rep.content;
+			cur_headers.push_back(header{ ":status", "404" });
+		}
+		else
+		{
+			cur_headers.push_back(header{ ":status", std::to_string(rep.status_code) });
+			for (const auto& one_header : rep.headers)
+			{
+				header cur_header{ one_header.name, one_header.value };
+				std::transform(cur_header.name.begin(), cur_header.name.end(), cur_header.name.begin(), [](unsigned char c)
+					{
+						return char(std::tolower(c));
+					});
+				if (is_connection_header(cur_header.name) || cur_header.name == "content-length")
+				{
+					continue;
+				}
+				cur_headers.push_back(std::move(cur_header));
+			}
+		}
+		cur_headers.push_back(header{ "content-length", std::to_string(cur_content.size()) });
+		if (cur_stream.head_request)
+		{
+			// the headers describe the content a GET would get, none of it is sent
+			cur_content.clear();
+		}
+		write_header_block(stream_id, cur_headers, cur_content.empty());
+		cur_stream.local_submitted = true;
+		cur_stream.pending_data = std::move(cur_content);
+		cur_stream.pending_offset = 0;
+		flush_stream(stream_id);
+	}
+
+	bool http2_connection::can_open_stream() const
+	{
+		return !m_failed && !m_going_away && !m_peer_going_away && m_streams.size() < m_peer_settings.max_concurrent_streams
+			&& m_next_stream_id < 0x7fffffff;
+	}
+
+	std::uint32_t http2_connection::submit_request(const request& req, const std::string& scheme, const std::string& authority)
+	{
+		if (m_role != http2_role::client || !can_open_stream())
+		{
+			return 0;
+		}
+		auto stream_id = m_next_stream_id;
+		m_next_stream_id += 2;
+		std::vector<header> cur_headers;
+		cur_headers.push_back(header{ ":method", req.method });
+		cur_headers.push_back(header{ ":scheme", scheme });
+		cur_headers.push_back(header{ ":authority", authority });
+		cur_headers.push_back(header{ ":path", req.uri.empty() ? "/" : req.uri });
+		for (const auto& one_header : req.headers)
+		{
+			header cur_header{ one_header.name, one_header.value };
+			std::transform(cur_header.name.begin(), cur_header.name.end(), cur_header.name.begin(), [](unsigned char c)
+				{
+					return char(std::tolower(c));
+				});
+			if (is_connection_header(cur_header.name) || cur_header.name == "host" || cur_header.name == "content-length")
+			{
+				continue;
+			}
+			cur_headers.push_back(std::move(cur_header));
+		}
+		if (!req.body.empty() || req.method == "POST" || req.method == "PUT")
+		{
+			cur_headers.push_back(header{ "content-length", std::to_string(req.body.size()) });
+		}
+		stream_state cur_stream;
+		cur_stream.send_window = m_peer_settings.initial_window_size;
+		cur_stream.recv_window = m_local_settings.initial_window_size;
+		cur_stream.local_submitted = true;
+		cur_stream.pending_data = req.body;
+		m_streams.emplace(stream_id, std::move(cur_stream));
+		write_header_block(stream_id, cur_headers, req.body.empty());
+		flush_stream(stream_id);
+		return stream_id;
+	}
+
+	std::vector<std::pair<std::uint32_t, reply>> http2_connection::take_replies()
+	{
+		std::vector<std::pair<std::uint32_t, reply>> result;
+		result.swap(m_ready_replies);
+		return result;
+	}
+
+	std::vector<http2_stream_error> http2_connection::take_stream_errors()
+	{
+		std::vector<http2_stream_error> result;
+		result.swap(m_stream_errors);
+		return result;
+	}
+
+	void http2_connection::cancel_stream(std::uint32_t stream_id)
+	{
+		if (m_streams.erase(stream_id) && !m_failed)
+		{
+			reset_stream(stream_id, http2_error_code::cancel);
+		}
+	}
+
+	bool http2_connection::on_reply_headers(std::uint32_t stream_id, bool end_stream, std::vector<header>&& headers)
+	{
+		auto cur_iter = m_streams.find(stream_id);
+		if (cur_iter == m_streams.end())
+		{
+			// pushes are disabled, anything else belongs to a stream we cancelled
+			if (is_idle_stream(stream_id))
+			{
+				return connection_error(http2_error_code::protocol_error);
+			}
+			return true;
+		}
+		auto& cur_stream = cur_iter->second;
+		if (cur_stream.remote_closed)
+		{
+			reset_stream(stream_id, http2_error_code::stream_closed);
+			fail_stream(stream_id, http2_error_code::stream_closed, false);
+			close_stream(stream_id);
+			return true;
+		}
+		if (!cur_stream.headers_received)
+		{
+			std::uint32_t cur_status = 0;
+			bool malformed = false;
+			for (auto& one_header : headers)
+			{
+				if (!one_header.name.empty() && one_header.name[0] == ':')
+				{
+					if (one_header.name != ":status" || one_header.value.size() != 3 || !std::all_of(one_header.value.begin(), one_header.value.end(), [](unsigned char c)
+						{
+							return std::isdigit(c);
+						}))
+					{
+						malformed = true;
+						break;
+					}
+					cur_status = std::uint32_t(std::stoul(one_header.value));
+					continue;
+				}
+				cur_stream.rep.headers.push_back(std::move(one_header));
+			}
+			// informational replies precede the final one
+			bool informational = cur_status >= 100 && cur_status < 200;
+			if (malformed || cur_status == 0 || (informational && end_stream))
+			{
+				reset_stream(stream_id, http2_error_code::protocol_error);
+				fail_stream(stream_id, http2_error_code::protocol_error, false);
+				close_stream(stream_id);
+				return true;
+			}
+			if (informational)
+			{
+				cur_stream.rep.headers.clear();
+				return true;
+			}
+			cur_stream.rep.status_code = cur_status;
+			cur_stream.headers_received = true;
+		}
+		else if (!end_stream)
+		{
+			// trailers have to end the stream, their fields are not passed on
+			reset_stream(stream_id, http2_error_code::protocol_error);
+			fail_stream(stream_id, http2_error_code::protocol_error, false);
+			close_stream(stream_id);
+			return true;
+		}
+		if (end_stream)
+		{
+			cur_stream.remote_closed = true;
+			return finish_reply(stream_id);
+		}
+		return true;
+	}
+
+	bool http2_connection::on_remote_end(std::uint32_t stream_id)
+	{
+		if (m_role == http2_role::client)
+		{
+			return finish_reply(stream_id);
+		}
+		return finish_request(stream_id);
+	}
+
+	bool http2_connection::finish_reply(std::uint32_t stream_id)
+	{
+		auto cur_iter = m_streams.find(stream_id);
+		auto& cur_stream = cur_iter->second;
+		cur_stream.rep.content = std::move(cur_stream.body);
+		m_ready_replies.emplace_back(stream_id, std::move(cur_stream.rep));
+		if (cur_stream.pending_offset < cur_stream.pending_data.size())
+		{
+			// the server answered before reading the whole body, the rest is not sent
+			reset_stream(stream_id, http2_error_code::cancel);
+		}
+		close_stream(stream_id);
+		return true;
+	}
+
+	void http2_connection::fail_stream(std::uint32_t stream_id, http2_error_code error_code, bool retryable)
+	{
+		if (m_role != http2_role::client || m_streams.find(stream_id) == m_streams.end())
+		{
+			return;
+		}
+		m_stream_errors.push_back(http2_stream_error{ stream_id, error_code, retryable });
+	}
+
+	bool http2_connection::on_go_away(const std::uint8_t* payload, std::size_t len)
+	{
+		if (len < 8)
+		{
+			return connection_error(http2_error_code::frame_size_error);
+		}
+		m_peer_going_away = true;
+		if (m_role != http2_role::client)
+		{
+			return true;
+		}
+		// streams above the last one the server processes can be sent again on another connection
+		auto cur_last_stream_id = read_u32(payload) & 0x7fffffff;
+		std::vector<std::uint32_t> refused_streams;
+		for (const auto& one_pair : m_streams)
+		{
+			if (one_pair.first > cur_last_stream_id)
+			{
+				refused_streams.push_back(one_pair.first);
+			}
+		}
+		for (auto one_stream : refused_streams)
+		{
+			fail_stream(one_stream, http2_error_code::refused_stream, true);
+			close_stream(one_stream);
+		}
+		return true;
+	}
+
+	bool http2_connection::is_idle_stream(std::uint32_t stream_id) const
+	{
+		// neither side pushes, even streams are never opened
+		if (stream_id % 2 == 0)
+		{
+			return true;
+		}
+		if (m_role == http2_role::client)
+		{
+			return stream_id >= m_next_stream_id;
+		}
+		return stream_id > m_last_peer_stream_id;
+	}
+
+	void http2_connection::write_header_block(std::uint32_t stream_id, const std::vector<header>& headers, bool end_stream)
+	{
+		std::string cur_block;
+		m_encoder.encode(headers, cur_block);
+
+		// split the block into HEADERS and CONTINUATION frames
+		std::size_t block_offset = 0;
+		bool first_frame = true;
+		do
+		{
+			auto cur_len = std::min<std::size_t>(cur_block.size() - block_offset, m_peer_settings.max_frame_size);
+			std::uint8_t cur_flags = 0;
+			if (block_offset + cur_len == cur_block.size())
+			{
+				cur_flags |= flag_end_headers;
+			}
+			if (first_frame && end_stream)
+			{
+				cur_flags |= flag_end_stream;
+			}
+			write_frame_header(cur_len, first_frame ? frame_headers : frame_continuation, cur_flags, stream_id);
+			m_output.append(cur_block, block_offset, cur_len);
+			block_offset += cur_len;
+			first_frame = false;
+		} while (block_offset < cur_block.size());
+	}
+
+	void http2_connection::flush_stream(std::uint32_t stream_id)
+	{
+		auto cur_iter = m_streams.find(stream_id);
+		if (cur_iter == m_streams.end() || !cur_iter->second.local_submitted)
+		{
+			return;
+		}
+		auto& cur_stream = cur_iter->second;
+		while (cur_stream.pending_offset < cur_stream.pending_data.size())
+		{
+			auto cur_window = std::min(m_send_window, cur_stream.send_window);
+			if (cur_window <= 0)
+			{
+				return;
+			}
+			auto cur_len = std::min<std::size_t>({ cur_stream.pending_data.size() - cur_stream.pending_offset, std::size_t(cur_window), std::size_t(m_peer_settings.max_frame_size) });
+			bool end_stream = cur_stream.pending_offset + cur_len == cur_stream.pending_data.size();
+			write_frame_header(cur_len, frame_data, end_stream ? flag_end_stream : 0, stream_id);
+			m_output.append(cur_stream.pending_data, cur_stream.pending_offset, cur_len);
+			cur_stream.pending_offset += cur_len;
+			m_send_window -= std::int64_t(cur_len);
+			cur_stream.send_window -= std::int64_t(cur_len);
+		}
+		if (cur_stream.remote_closed)
+		{
+			close_stream(stream_id);
+		}
+	}
+
+	void http2_connection::flush_all()
+	{
+		std::vector<std::uint32_t> blocked_streams;
+		for (const auto& one_pair : m_streams)
+		{
+			if (one_pair.second.local_submitted)
+			{
+				blocked_streams.push_back(one_pair.first);
+			}
+		}
+		for (auto one_stream : blocked_streams)
+		{
+			if (m_send_window <= 0)
+			{
+				break;
+			}
+			flush_stream(one_stream);
+		}
+	}
+
+	void http2_connection::close_stream(std::uint32_t stream_id)
+	{
+		m_streams.erase(stream_id);
+	}
+
+	bool http2_connection::on_settings(std::uint8_t flags, std::uint32_t stream_id, const std::uint8_t* payload, std::size_t len)
+	{
+		if (stream_id != 0)
+		{
+			return connection_error(http2_error_code::protocol_error);
+		}
+		if (flags & flag_ack)
+		{
+			if (len != 0)
+			{
+				return connection_error(http2_error_code::frame_size_error);
+			}
+			return true;
+		}
+		if (len % 6 != 0)
+		{
+			return connection_error(http2_error_code::frame_size_error);
+		}
+		m_settings_received = true;
+		if (!apply_settings(payload, len))
+		{
+			return false;
+		}
+		write_frame_header(0, frame_settings, flag_ack, 0);
+		flush_all();
+		return true;
+	}
+
+	bool http2_connection::apply_settings(const std::uint8_t* payload, std::size_t len)
+	{
+		for (std::size_t i = 0; i + 6 <= len; i += 6)
+		{
+			std::uint16_t cur_id = std::uint16_t((payload[i] << 8) | payload[i + 1]);
+			std::uint32_t cur_value = read_u32(payload + i + 2);
+			switch (cur_id)
+			{
+			case settings_header_table_size:
+				m_peer_settings.header_table_size = cur_value;
+				m_encoder.set_max_table_size(cur_value);
+				break;
+			case settings_enable_push:
+				if (cur_value > 1)
+				{
+					return connection_error(http2_error_code::protocol_error);
+				}
+				m_peer_settings.enable_push = cur_value;
+				break;
+			case settings_max_concurrent_streams:
+				m_peer_settings.max_concurrent_streams = cur_value;
+				break;
+			case settings_initial_window_size:
+			{
+				if (cur_value > max_window_size)
+				{
+					return connection_error(http2_error_code::flow_control_error);
+				}
+				// the change applies to the windows of all open streams
+				auto cur_delta = std::int64_t(cur_value) - std::int64_t(m_peer_settings.initial_window_size);
+				for (auto& one_pair : m_streams)
+				{
+					one_pair.second.send_window += cur_delta;
+					if (one_pair.second.send_window > max_window_size)
+					{
+						return connection_error(http2_error_code::flow_control_error);
+					}
+				}
+				m_peer_settings.initial_window_size = cur_value;
+				break;
+			}
+			case settings_max_frame_size:
+				if (cur_value < 16384 || cur_value > 16777215)
+				{
+					return connection_error(http2_error_code::protocol_error);
+				}
+				m_peer_settings.max_frame_size = cur_value;
+				break;
+			case settings_max_header_list_size:
+				m_peer_settings.max_header_list_size = cur_value;
+				break;
+			default:
+				break;
+			}
+		}
+		return true;
+	}
+
+	bool http2_connection::on_window_update(std::uint32_t stream_id, const std::uint8_t* payload, std::size_t len)
+	{
+		if (len != 4)
+		{
+			return connection_error(http2_error_code::frame_size_error);
+		}
+		auto cur_increment = read_u32(payload) & 0x7fffffff;
+		if (stream_id == 0)
+		{
+			if (cur_increment == 0)
+			{
+				return connection_error(http2_error_code::protocol_error);
+			}
+			m_send_window += cur_increment;
+			if (m_send_window > max_window_size)
+			{
+				return connection_error(http2_error_code::flow_control_error);
+			}
+			flush_all();
+			return true;
+		}
+		auto cur_iter = m_streams.find(stream_id);
+		if (cur_iter == m_streams.end())
+		{
+			return true;
+		}
+		cur_iter->second.send_window += cur_increment;
+		if (cur_increment == 0 || cur_iter->second.send_window > max_window_size)
+		{
+			reset_stream(stream_id, cur_increment == 0 ? http2_error_code::protocol_error : http2_error_code::flow_control_error);
+			close_stream(stream_id);
+			return true;
+		}
+		flush_stream(stream_id);
+		return true;
+	}
+
+	void http2_connection::go_away(http2_error_code error_code)
+	{
+		if (m_going_away)
+		{
+			return;
+		}
+		m_going_away = true;
+		write_frame_header(8, frame_goaway, 0, 0);
+		write_u32(m_output, m_last_peer_stream_id);
+		write_u32(m_output, std::uint32_t(error_code));
+	}
+
+	bool http2_connection::connection_error(http2_error_code error_code)
+	{
+		go_away(error_code);
+		m_failed = true;
+		m_input.clear();
+		return false;
+	}
+
+	void http2_connection::reset_stream(std::uint32_t stream_id, http2_error_code error_code)
+	{
+		write_frame_header(4, frame_rst_stream, 0, stream_id);
+		write_u32(m_output, std::uint32_t(error_code));
+	}
+
+	void http2_connection::write_frame_header(std::size_t len, std::uint8_t type, std::uint8_t flags, std::uint32_t stream_id)
+	{
+		m_output.push_back(char(len >> 16));
+		m_output.push_back(char(len >> 8));
+		m_output.push_back(char(len));
+		m_output.push_back(char(type));
+		m_output.push_back(char(flags));
+		write_u32(m_output, stream_id);
+	}
+
+	void http2_connection::write_window_update(std::uint32_t stream_id, std::uint32_t increment)
+	{
+		write_frame_header(4, frame_window_update, 0, stream_id);
+		write_u32(m_output, increment);
+	}
+}
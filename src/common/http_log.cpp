@@ -0,0 +1,23 @@
+#include "http_log.h"
+#include <mutex>
+#include <spdlog/async.h>
+
+namespace spiritsaway::http_utils
+{
+	std::shared_ptr<spdlog::logger> make_async_logger(const std::string& name, std::vector<spdlog::sink_ptr> sinks, std::size_t queue_size)
+	{
+		static std::mutex pool_mutex;
+		std::shared_ptr<spdlog::details::thread_pool> cur_pool;
+		{
+			std::lock_guard<std::mutex> guard(pool_mutex);
+			// the spdlog registry keeps the pool alive, async loggers only hold a weak pointer to it
+			cur_pool = spdlog::thread_pool();
+			if (!cur_pool)
+			{
+				spdlog::init_thread_pool(queue_size, 1);
+				cur_pool = spdlog::thread_pool();
+			}
+		}
+		return std::make_shared<spdlog::async_logger>(name, sinks.begin(), sinks.end(), std::move(cur_pool), spdlog::async_overflow_policy::overrun_oldest);
+	}
+}
@@ -1,42 +1,46 @@
 #include "http_packet.h"
 #include <sstream>
+#include <fstream>
+#include <charconv>
+#include <algorithm>
+#include <cctype>
 namespace spiritsaway::http_utils
 {
 	namespace status_strings
 	{
 
 		const std::string ok =
-			"HTTP/1.0 200 OK\r\n";
+			"HTTP/1.1 200 OK\r\n";
 		const std::string created =
-			"HTTP/1.0 201 Created\r\n";
+			"HTTP/1.1 201 Created\r\n";
 		const std::string accepted =
-			"HTTP/1.0 202 Accepted\r\n";
+			"HTTP/1.1 202 Accepted\r\n";
 		const std::string no_content =
-			"HTTP/1.0 204 No Content\r\n";
+			"HTTP/1.1 204 No Content\r\n";
 		const std::string multiple_choices =
-			"HTTP/1.0 300 Multiple Choices\r\n";
+			"HTTP/1.1 300 Multiple Choices\r\n";
 		const std::string moved_permanently =
-			"HTTP/1.0 301 Moved Permanently\r\n";
+			"HTTP/1.1 301 Moved Permanently\r\n";
 		const std::string moved_temporarily =
-			"HTTP/1.0 302 Moved Temporarily\r\n";
+			"HTTP/1.1 302 Moved Temporarily\r\n";
 		const std::string not_modified =
-			"HTTP/1.0 304 Not Modified\r\n";
+			"HTTP/1.1 304 Not Modified\r\n";
 		const std::string bad_request =
-			"HTTP/1.0 400 Bad Request\r\n";
+			"HTTP/1.1 400 Bad Request\r\n";
 		const std::string unauthorized =
-			"HTTP/1.0 401 Unauthorized\r\n";
+			"HTTP/1.1 401 Unauthorized\r\n";
 		const std::string forbidden =
-			"HTTP/1.0 403 Forbidden\r\n";
+			"HTTP/1.1 403 Forbidden\r\n";
 		const std::string not_found =
-			"HTTP/1.0 404 Not Found\r\n";
+			"HTTP/1.1 404 Not Found\r\n";
 		const std::string internal_server_error =
-			"HTTP/1.0 500 Internal Server Error\r\n";
+			"HTTP/1.1 500 Internal Server Error\r\n";
 		const std::string not_implemented =
-			"HTTP/1.0 501 Not Implemented\r\n";
+			"HTTP/1.1 501 Not Implemented\r\n";
 		const std::string bad_gateway =
-			"HTTP/1.0 502 Bad Gateway\r\n";
+			"HTTP/1.1 502 Bad Gateway\r\n";
 		const std::string service_unavailable =
-			"HTTP/1.0 503 Service Unavailable\r\n";
+			"HTTP/1.1 503 Service Unavailable\r\n";
 
 		std::string to_string(reply::status_type status)
 		{
@@ -93,7 +97,22 @@ namespace spiritsaway::http_utils
 	{
 		headers.emplace_back(header{key, value});
 	}
-	std::string reply::to_string() const
+	const header* reply::find_header(const std::string& name) const
+	{
+		for (const auto& one_header : headers)
+		{
+			if (one_header.name.size() == name.size() && std::equal(name.begin(), name.end(), one_header.name.begin(), [](unsigned char a, unsigned char b)
+				{
+					return std::tolower(a) == std::tolower(b);
+				}))
+			{
+				return &one_header;
+			}
+		}
+		return nullptr;
+	}
+
+	std::string reply::head_to_string(std::size_t content_length) const
 	{
 		std::vector<std::string> buffers;
 		buffers.push_back(status_strings::to_string(reply::status_type(status_code)));
@@ -107,18 +126,17 @@ namespace spiritsaway::http_utils
 		}
 		buffers.push_back("Content-Length");
 		buffers.push_back(misc_strings::name_value_separator);
-		buffers.push_back(std::to_string(content.size()));
+		buffers.push_back(std::to_string(content_length));
 		buffers.push_back(misc_strings::crlf);
 
 		buffers.push_back(misc_strings::crlf);
-		buffers.push_back(content);
 		std::size_t total_sz = 0;
 		for (const auto& one_str : buffers)
 		{
 			total_sz += one_str.size();
 		}
 		std::string result;
-		result.reserve(total_sz);
+		result.reserve(total_sz + content_length);
 		for (const auto& one_str : buffers)
 		{
 			result += one_str;
@@ -126,6 +144,70 @@ namespace spiritsaway::http_utils
 		return result;
 	}
 
+	std::string reply::stream_head_to_string() const
+	{
+		std::string result = status_strings::to_string(reply::status_type(status_code));
+		for (const auto& one_header : headers)
+		{
+			result += one_header.name;
+			result += misc_strings::name_value_separator;
+			result += one_header.value;
+			result += misc_strings::crlf;
+		}
+		if (!find_header("Connection"))
+		{
+			result += "Connection: close\r\n";
+		}
+		result += misc_strings::crlf;
+		return result;
+	}
+
+	std::string reply::to_string() const
+	{
+		if (!content_file.empty())
+		{
+			std::string file_content;
+			if (!read_content(file_content))
+			{
+				return stock_reply(status_type::not_found).to_string();
+			}
+			return head_to_string(file_content.size()) + file_content;
+		}
+		auto result = head_to_string(content.size());
+		result += content;
+		return result;
+	}
+
+	std::string reply::to_head_string() const
+	{
+		if (!content_file.empty())
+		{
+			std::ifstream file_stream(content_file, std::ios::binary | std::ios::ate);
+			if (!file_stream)
+			{
+				return stock_reply(status_type::not_found).to_head_string();
+			}
+			return head_to_string(std::size_t(file_stream.tellg()));
+		}
+		return head_to_string(content.size());
+	}
+
+	bool reply::read_content(std::string& dest) const
+	{
+		if (content_file.empty())
+		{
+			dest = content;
+			return true;
+		}
+		std::ifstream file_stream(content_file, std::ios::binary);
+		if (!file_stream)
+		{
+			return false;
+		}
+		dest.assign(std::istreambuf_iterator<char>(file_stream), std::istreambuf_iterator<char>());
+		return true;
+	}
+
 	namespace stock_replies
 	{
 
@@ -254,11 +336,10 @@ namespace spiritsaway::http_utils
 		reply rep;
 		rep.status_code = int(status);
 		rep.content = stock_replies::to_string(status);
-		rep.headers.resize(2);
-		rep.headers[0].name = "Content-Length";
-		rep.headers[0].value = std::to_string(rep.content.size());
-		rep.headers[1].name = "Content-Type";
-		rep.headers[1].value = "text/html";
+		// Content-Length is added when the reply is serialized
+		rep.headers.resize(1);
+		rep.headers[0].name = "Content-Type";
+		rep.headers[0].value = "text/html";
 		return rep;
 	}
 
@@ -277,6 +358,43 @@ namespace spiritsaway::http_utils
 		request_stream << body;
 		return request_stream.str();
 	}
+	request_template::request_template(const request& req, const std::string& server_url)
+	{
+		m_head_prefix = req.method + " " + req.uri;
+		m_head_suffix = " HTTP/" + std::to_string(req.http_version_major) + "." + std::to_string(req.http_version_minor) + "\r\n";
+		m_head_suffix += "Host: " + server_url + "\r\n";
+		m_head_suffix += "Accept: */*\r\n";
+		for (const auto& one_header : req.headers)
+		{
+			m_head_suffix += one_header.name;
+			m_head_suffix += misc_strings::name_value_separator;
+			m_head_suffix += one_header.value;
+			m_head_suffix += misc_strings::crlf;
+		}
+		m_head_suffix += "Connection: close\r\n";
+		m_head_suffix += "Content-Length: ";
+	}
+
+	const std::string& request_template::build(std::string_view uri_suffix, std::string_view body)
+	{
+		build(m_buffer, uri_suffix, body);
+		return m_buffer;
+	}
+
+	void request_template::build(std::string& buffer, std::string_view uri_suffix, std::string_view body) const
+	{
+		char length_buffer[24];
+		auto length_end = std::to_chars(std::begin(length_buffer), std::end(length_buffer), body.size()).ptr;
+		buffer.clear();
+		buffer.reserve(m_head_prefix.size() + uri_suffix.size() + m_head_suffix.size() + (length_end - length_buffer) + 4 + body.size());
+		buffer.append(m_head_prefix);
+		buffer.append(uri_suffix);
+		buffer.append(m_head_suffix);
+		buffer.append(length_buffer, length_end);
+		buffer.append("\r\n\r\n");
+		buffer.append(body);
+	}
+
 	std::string parse_uri(const std::string& full_path, std::string& server_url, std::string& server_port, std::string& resource_path)
 	{
 		std::string_view path_view(full_path);
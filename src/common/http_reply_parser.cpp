@@ -21,33 +21,46 @@ namespace spiritsaway::http_utils
 		int on_body_cb(http_parser *parser, const char *at, std::size_t length)
 		{
 			auto &t = *reinterpret_cast<http_reply_parser *>(parser->data);
-
+			if (t.m_body_handler)
+			{
+				t.m_body_handler(std::string_view(at, length));
+				return 0;
+			}
 			t.m_reply.content.append(at, length);
 			return 0;
 		}
 		int on_header_field_cb(http_parser *parser, const char *at, std::size_t length)
 		{
 			auto &t = *reinterpret_cast<http_reply_parser *>(parser->data);
-			header temp_header;
-			temp_header.name = std::string(at, length);
-			t.m_reply.headers.push_back(temp_header);
+			// a name split across reads arrives in several callbacks
+			if (t.m_reply.headers.empty() || t.m_in_header_value)
+			{
+				t.m_reply.headers.emplace_back();
+				t.m_in_header_value = false;
+			}
+			t.m_reply.headers.back().name.append(at, length);
 			return 0;
 		}
 		int on_header_value_cb(http_parser *parser, const char *at, std::size_t length)
 		{
 			auto &t = *reinterpret_cast<http_reply_parser *>(parser->data);
 
-			t.m_reply.headers.back().value = std::string(at, length);
+			t.m_in_header_value = true;
+			t.m_reply.headers.back().value.append(at, length);
 			return 0;
 		}
 		int on_header_complete_cb(http_parser *parser)
 		{
-			return 0;
+			auto &t = *reinterpret_cast<http_reply_parser *>(parser->data);
+			t.m_header_complete = true;
+			// 1 tells http_parser the reply has no body whatever its content length says
+			return t.m_head_request ? 1 : 0;
 		}
 		int on_message_complete_cb(http_parser *parser)
 		{
 			auto &t = *reinterpret_cast<http_reply_parser *>(parser->data);
 			t.m_reply_complete = true;
+			t.m_keep_alive = http_should_keep_alive(parser);
 			return 0;
 		}
 	} // namespace
@@ -65,6 +78,17 @@ namespace spiritsaway::http_utils
 		m_parser_settings.on_chunk_complete = on_chunk_complete_cb;
 		m_parser_settings.on_status = on_status_cb;
 	}
+	void http_reply_parser::reset()
+	{
+		m_reply = reply();
+		m_header_complete = false;
+		m_reply_complete = false;
+		m_keep_alive = false;
+		m_in_header_value = false;
+		http_parser_init(&m_parser, http_parser_type::HTTP_RESPONSE);
+		m_parser.data = reinterpret_cast<void *>(this);
+	}
+
 	http_reply_parser::result_type http_reply_parser::parse(const char *input, std::size_t len)
 	{
 		std::size_t nparsed = http_parser_execute(&m_parser, &m_parser_settings, input, len);
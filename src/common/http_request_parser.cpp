@@ -20,16 +20,21 @@ namespace spiritsaway::http_utils
 		int on_header_field_cb(http_parser *parser, const char *at, std::size_t length)
 		{
 			auto &t = *reinterpret_cast<http_request_parser *>(parser->data);
-			header temp_header;
-			temp_header.name = std::string(at, length);
-			t.m_req.headers.push_back(temp_header);
+			// a name split across reads arrives in several callbacks
+			if (t.m_req.headers.empty() || t.m_in_header_value)
+			{
+				t.m_req.headers.emplace_back();
+				t.m_in_header_value = false;
+			}
+			t.m_req.headers.back().name.append(at, length);
 			return 0;
 		}
 		int on_header_value_cb(http_parser *parser, const char *at, std::size_t length)
 		{
 			auto &t = *reinterpret_cast<http_request_parser *>(parser->data);
 
-			t.m_req.headers.back().value = std::string(at, length);
+			t.m_in_header_value = true;
+			t.m_req.headers.back().value.append(at, length);
 			return 0;
 		}
 		int on_header_complete_cb(http_parser *parser)
@@ -37,13 +42,17 @@ namespace spiritsaway::http_utils
 			auto& t = *reinterpret_cast<http_request_parser*>(parser->data);
 			t.m_req.http_version_major = parser->http_major;
 			t.m_req.http_version_minor = parser->http_minor;
+			t.m_req.method = http_method_str(http_method(parser->method));
 			return 0;
 		}
 		int on_message_complete_cb(http_parser *parser)
 		{
 			auto &t = *reinterpret_cast<http_request_parser *>(parser->data);
 			t.m_req_complete = true;
-
+			// after an upgrade the connection carries the other protocol
+			t.m_keep_alive = http_should_keep_alive(parser) && !parser->upgrade;
+			// stop at the end of the request, following bytes are parsed after reset
+			http_parser_pause(parser, 1);
 			return 0;
 		}
 	} // namespace
@@ -62,9 +71,14 @@ namespace spiritsaway::http_utils
 	http_request_parser::result_type http_request_parser::parse(const char *input, std::size_t len)
 	{
 		std::size_t nparsed = http_parser_execute(&m_parser, &m_parse_settings, input, len);
-		if (m_parser.upgrade)
+		m_consumed = nparsed;
+		if (m_parser.upgrade && m_req_complete)
 		{
-			return http_request_parser::result_type::bad;
+			return http_request_parser::result_type::upgrade;
+		}
+		if (m_req_complete && HTTP_PARSER_ERRNO(&m_parser) == HPE_PAUSED)
+		{
+			return http_request_parser::result_type::good;
 		}
 		if (nparsed != len)
 		{
@@ -84,4 +98,15 @@ namespace spiritsaway::http_utils
 		dest = std::move(m_req);
 	}
 
+	void http_request_parser::reset()
+	{
+		m_req = request();
+		m_req_complete = false;
+		m_keep_alive = false;
+		m_in_header_value = false;
+		m_consumed = 0;
+		http_parser_init(&m_parser, http_parser_type::HTTP_REQUEST);
+		m_parser.data = reinterpret_cast<void *>(this);
+	}
+
 } // namespace spiritsaway::http_server
@@ -0,0 +1,680 @@
+#include "metrics.h"
+#include <algorithm>
+#include <stdexcept>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace spiritsaway::http_utils
+{
+	namespace
+	{
+		std::atomic<std::size_t> registry_counter = 0;
+		std::atomic<std::size_t> histogram_counter = 0;
+
+		std::size_t highest_bit(std::uint64_t value)
+		{
+#ifdef _MSC_VER
+			unsigned long result;
+			_BitScanReverse64(&result, value);
+			return result;
+#else
+			return 63 - __builtin_clzll(value);
+#endif
+		}
+	}
+
+	std::size_t histogram_bucket_index(std::uint64_t value)
+	{
+		if (value < histogram_sub_bucket_count)
+		{
+			return std::size_t(value);
+		}
+		auto cur_bit = highest_bit(value);
+		if (cur_bit >= histogram_max_value_bits)
+		{
+			return histogram_bucket_count - 1;
+		}
+		// the bits below the leading one pick the sub bucket
+		auto cur_shift = cur_bit - histogram_sub_bucket_bits;
+		auto cur_sub = std::size_t(value >> cur_shift) & (histogram_sub_bucket_count - 1);
+		return (cur_shift + 1) * histogram_sub_bucket_count + cur_sub;
+	}
+
+	std::uint64_t histogram_bucket_lower(std::size_t bucket)
+	{
+		if (bucket < histogram_sub_bucket_count)
+		{
+			return bucket;
+		}
+		auto cur_shift = bucket / histogram_sub_bucket_count - 1;
+		auto cur_sub = bucket % histogram_sub_bucket_count;
+		return std::uint64_t(histogram_sub_bucket_count + cur_sub) << cur_shift;
+	}
+
+	std::uint64_t histogram_bucket_upper(std::size_t bucket)
+	{
+		if (bucket + 1 == histogram_bucket_count)
+		{
+			return UINT64_MAX;
+		}
+		return histogram_bucket_lower(bucket + 1) - 1;
+	}
+
+	std::uint64_t histogram_snapshot::percentile(double q) const
+	{
+		if (!count)
+		{
+			return 0;
+		}
+		auto cur_rank = std::uint64_t(q * double(count));
+		if (cur_rank >= count)
+		{
+			cur_rank = count - 1;
+		}
+		std::uint64_t cur_seen = 0;
+		for (std::size_t i = 0; i < buckets.size(); i++)
+		{
+			cur_seen += buckets[i];
+			if (cur_seen > cur_rank)
+			{
+				return histogram_bucket_upper(i);
+			}
+		}
+		return histogram_bucket_upper(buckets.size() - 1);
+	}
+
+	void histogram_snapshot::merge(const histogram_snapshot& other)
+	{
+		if (buckets.size() < other.buckets.size())
+		{
+			buckets.resize(other.buckets.size(), 0);
+		}
+		for (std::size_t i = 0; i < other.buckets.size(); i++)
+		{
+			buckets[i] += other.buckets[i];
+		}
+		count += other.count;
+		sum += other.sum;
+	}
+
+	metrics_histogram::metrics_histogram()
+		: m_id(histogram_counter++)
+	{
+
+	}
+
+	histogram_shard& metrics_histogram::add_local_shard(std::vector<histogram_shard*>& thread_shards)
+	{
+		auto cur_shard = std::make_unique<histogram_shard>();
+		auto* result = cur_shard.get();
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			m_shards.push_back(std::move(cur_shard));
+		}
+		if (thread_shards.size() <= m_id)
+		{
+			thread_shards.resize(m_id + 1, nullptr);
+		}
+		thread_shards[m_id] = result;
+		return *result;
+	}
+
+	histogram_snapshot metrics_histogram::snapshot()
+	{
+		histogram_snapshot result;
+		result.buckets.resize(histogram_bucket_count, 0);
+		std::lock_guard<std::mutex> guard(m_mutex);
+		for (const auto& one_shard : m_shards)
+		{
+			for (std::size_t i = 0; i < histogram_bucket_count; i++)
+			{
+				result.buckets[i] += one_shard->buckets[i].load(std::memory_order_relaxed);
+			}
+			result.count += one_shard->count.load(std::memory_order_relaxed);
+			result.sum += one_shard->sum.load(std::memory_order_relaxed);
+		}
+		return result;
+	}
+
+	void metrics_histogram::reset()
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		for (auto& one_shard : m_shards)
+		{
+			for (auto& one_bucket : one_shard->buckets)
+			{
+				one_bucket.store(0, std::memory_order_relaxed);
+			}
+			one_shard->count.store(0, std::memory_order_relaxed);
+			one_shard->sum.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	std::string metrics_labels(std::initializer_list<std::pair<std::string_view, std::string_view>> labels)
+	{
+		std::string result;
+		for (const auto& one_label : labels)
+		{
+			if (!result.empty())
+			{
+				result += ',';
+			}
+			result += one_label.first;
+			result += "=\"";
+			for (auto one_char : one_label.second)
+			{
+				if (one_char == '\\' || one_char == '"')
+				{
+					result += '\\';
+					result += one_char;
+				}
+				else if (one_char == '\n')
+				{
+					result += "\\n";
+				}
+				else
+				{
+					result += one_char;
+				}
+			}
+			result += '"';
+		}
+		return result;
+	}
+
+	std::string with_labels(const std::string& labels, std::initializer_list<std::pair<std::string_view, std::string_view>> more_labels)
+	{
+		auto result = labels;
+		if (!result.empty())
+		{
+			result += ',';
+		}
+		result += metrics_labels(more_labels);
+		return result;
+	}
+
+	metrics_registry::metrics_registry()
+		: m_id(registry_counter++)
+	{
+
+	}
+
+	metrics_registry& metrics_registry::global()
+	{
+		static metrics_registry the_registry;
+		return the_registry;
+	}
+
+	metrics_shard& metrics_registry::add_local_shard(std::vector<metrics_shard*>& thread_shards)
+	{
+		auto cur_shard = std::make_unique<metrics_shard>();
+		auto* result = cur_shard.get();
+		{
+			// shards outlive their thread so that the counts stay
+			std::lock_guard<std::mutex> guard(m_mutex);
+			m_shards.push_back(std::move(cur_shard));
+		}
+		if (thread_shards.size() <= m_id)
+		{
+			thread_shards.resize(m_id + 1, nullptr);
+		}
+		thread_shards[m_id] = result;
+		return *result;
+	}
+
+	std::size_t metrics_registry::find_or_register(const std::string& name, const std::string& help, const std::string& labels, metrics_type type)
+	{
+		auto cur_key = name + "{" + labels + "}";
+		auto cur_iter = m_descriptor_indexes.find(cur_key);
+		if (cur_iter != m_descriptor_indexes.end())
+		{
+			return cur_iter->second;
+		}
+		metrics_descriptor cur_descriptor;
+		if (m_next_slot < metrics_max_slots)
+		{
+			cur_descriptor.slot = m_next_slot++;
+		}
+		else if (!m_released.empty())
+		{
+			// the oldest released slot, the longest time for late writes through its old handles to stop
+			cur_descriptor = std::move(m_released.front());
+			m_released.pop_front();
+			for (auto& one_shard : m_shards)
+			{
+				one_shard->values[cur_descriptor.slot].store(0, std::memory_order_relaxed);
+			}
+		}
+		else
+		{
+			throw std::length_error("too many metrics, registering " + cur_key);
+		}
+		cur_descriptor.name = name;
+		cur_descriptor.help = help;
+		cur_descriptor.labels = labels;
+		cur_descriptor.type = type;
+		m_descriptors.push_back(std::move(cur_descriptor));
+		m_descriptor_indexes[cur_key] = m_descriptors.size() - 1;
+		return m_descriptors.size() - 1;
+	}
+
+	metrics_counter& metrics_registry::counter(const std::string& name, const std::string& help, const std::string& labels)
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		auto& cur_descriptor = m_descriptors[find_or_register(name, help, labels, metrics_type::counter)];
+		if (!cur_descriptor.counter)
+		{
+			m_counters.emplace_back(*this, cur_descriptor.slot);
+			cur_descriptor.counter = &m_counters.back();
+		}
+		return *cur_descriptor.counter;
+	}
+
+	metrics_gauge& metrics_registry::gauge(const std::string& name, const std::string& help, const std::string& labels)
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		auto& cur_descriptor = m_descriptors[find_or_register(name, help, labels, metrics_type::gauge)];
+		if (!cur_descriptor.gauge)
+		{
+			m_gauges.emplace_back(*this, cur_descriptor.slot);
+			cur_descriptor.gauge = &m_gauges.back();
+		}
+		return *cur_descriptor.gauge;
+	}
+
+	void metrics_registry::gauge_callback(const std::string& name, const std::string& help, const std::string& labels, std::function<std::int64_t()> value_fn)
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		m_descriptors[find_or_register(name, help, labels, metrics_type::gauge)].value_fn = std::move(value_fn);
+	}
+
+	void metrics_registry::remove_callbacks(const std::string& labels)
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		for (auto& one_descriptor : m_descriptors)
+		{
+			if (one_descriptor.value_fn && one_descriptor.labels == labels)
+			{
+				// the slot stays reserved, the gauge reads 0 from now on
+				one_descriptor.value_fn = nullptr;
+			}
+		}
+	}
+
+	void metrics_registry::release(const std::string& labels)
+	{
+		// labels of the same server, or followed by more like the phase of a timeout counter
+		auto cur_kept = [&labels](const std::string& one_labels)
+		{
+			bool cur_extended = one_labels.size() > labels.size() && one_labels.compare(0, labels.size(), labels) == 0
+				&& one_labels[labels.size()] == ',';
+			return one_labels != labels && !cur_extended;
+		};
+		std::lock_guard<std::mutex> guard(m_mutex);
+		auto cur_released = std::stable_partition(m_descriptors.begin(), m_descriptors.end(), [&](const metrics_descriptor& one_descriptor)
+			{
+				return cur_kept(one_descriptor.labels);
+			});
+		for (auto cur_iter = cur_released; cur_iter != m_descriptors.end(); cur_iter++)
+		{
+			// the counter and gauge objects stay bound to the slot and are handed out with it again
+			cur_iter->value_fn = nullptr;
+			m_released.push_back(std::move(*cur_iter));
+		}
+		m_descriptors.erase(cur_released, m_descriptors.end());
+		m_descriptor_indexes.clear();
+		for (std::size_t i = 0; i < m_descriptors.size(); i++)
+		{
+			m_descriptor_indexes[m_descriptors[i].name + "{" + m_descriptors[i].labels + "}"] = i;
+		}
+
+		auto cur_released_histograms = std::stable_partition(m_histograms.begin(), m_histograms.end(), [&](const histogram_descriptor& one_descriptor)
+			{
+				return cur_kept(one_descriptor.labels);
+			});
+		for (auto cur_iter = cur_released_histograms; cur_iter != m_histograms.end(); cur_iter++)
+		{
+			m_released_histograms.push_back(std::move(cur_iter->histogram));
+		}
+		m_histograms.erase(cur_released_histograms, m_histograms.end());
+		m_histogram_indexes.clear();
+		for (std::size_t i = 0; i < m_histograms.size(); i++)
+		{
+			m_histogram_indexes[m_histograms[i].name + "{" + m_histograms[i].labels + "}"] = i;
+		}
+	}
+
+	metrics_histogram& metrics_registry::histogram(const std::string& name, const std::string& help, const std::string& labels)
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		auto cur_key = name + "{" + labels + "}";
+		auto cur_iter = m_histogram_indexes.find(cur_key);
+		if (cur_iter != m_histogram_indexes.end())
+		{
+			return *m_histograms[cur_iter->second].histogram;
+		}
+		histogram_descriptor cur_descriptor;
+		cur_descriptor.name = name;
+		cur_descriptor.help = help;
+		cur_descriptor.labels = labels;
+		if (!m_released_histograms.empty())
+		{
+			// the oldest released one, like the slots of counters and gauges
+			cur_descriptor.histogram = std::move(m_released_histograms.front());
+			m_released_histograms.pop_front();
+			cur_descriptor.histogram->reset();
+		}
+		else
+		{
+			cur_descriptor.histogram = std::make_unique<metrics_histogram>();
+		}
+		m_histograms.push_back(std::move(cur_descriptor));
+		m_histogram_indexes[cur_key] = m_histograms.size() - 1;
+		return *m_histograms.back().histogram;
+	}
+
+	std::int64_t metrics_registry::sum_slot(std::size_t slot)
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		std::int64_t result = 0;
+		for (const auto& one_shard : m_shards)
+		{
+			result += one_shard->values[slot].load(std::memory_order_relaxed);
+		}
+		return result;
+	}
+
+	std::vector<metrics_sample> metrics_registry::collect()
+	{
+		std::vector<metrics_sample> result;
+		std::vector<std::function<std::int64_t()>> cur_value_fns;
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			result.reserve(m_descriptors.size());
+			for (const auto& one_descriptor : m_descriptors)
+			{
+				std::int64_t cur_value = 0;
+				for (const auto& one_shard : m_shards)
+				{
+					cur_value += one_shard->values[one_descriptor.slot].load(std::memory_order_relaxed);
+				}
+				result.push_back(metrics_sample{ one_descriptor.name, one_descriptor.help, one_descriptor.labels, one_descriptor.type, cur_value });
+				cur_value_fns.push_back(one_descriptor.value_fn);
+			}
+		}
+		// callbacks may take locks of their own, they run outside of m_mutex
+		for (std::size_t i = 0; i < result.size(); i++)
+		{
+			if (cur_value_fns[i])
+			{
+				result[i].value = cur_value_fns[i]();
+			}
+		}
+		std::stable_sort(result.begin(), result.end(), [](const metrics_sample& a, const metrics_sample& b)
+			{
+				return a.name < b.name;
+			});
+		return result;
+	}
+
+	std::vector<histogram_sample> metrics_registry::collect_histograms()
+	{
+		std::vector<histogram_sample> result;
+		std::vector<metrics_histogram*> cur_histograms;
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			result.reserve(m_histograms.size());
+			for (const auto& one_descriptor : m_histograms)
+			{
+				result.push_back(histogram_sample{ one_descriptor.name, one_descriptor.help, one_descriptor.labels, histogram_snapshot{} });
+				cur_histograms.push_back(one_descriptor.histogram.get());
+			}
+		}
+		// histograms are never destroyed, released ones are only reused, their own locks are enough for the merge
+		for (std::size_t i = 0; i < result.size(); i++)
+		{
+			result[i].value = cur_histograms[i]->snapshot();
+		}
+		std::stable_sort(result.begin(), result.end(), [](const histogram_sample& a, const histogram_sample& b)
+			{
+				return a.name < b.name;
+			});
+		return result;
+	}
+
+	namespace
+	{
+		void render_sample_name(std::string& out, const std::string& name, const char* suffix, const std::string& labels, const std::string& more_labels)
+		{
+			out += name;
+			out += suffix;
+			if (labels.empty() && more_labels.empty())
+			{
+				out += ' ';
+				return;
+			}
+			out += '{';
+			out += labels;
+			if (!labels.empty() && !more_labels.empty())
+			{
+				out += ',';
+			}
+			out += more_labels;
+			out += "} ";
+		}
+
+		void render_help(std::string& out, const std::string& name, const std::string& help, const char* type)
+		{
+			out += "# HELP ";
+			out += name;
+			out += ' ';
+			for (auto one_char : help)
+			{
+				if (one_char == '\\')
+				{
+					out += "\\\\";
+				}
+				else if (one_char == '\n')
+				{
+					out += "\\n";
+				}
+				else
+				{
+					out += one_char;
+				}
+			}
+			out += "\n# TYPE ";
+			out += name;
+			out += ' ';
+			out += type;
+			out += '\n';
+		}
+	}
+
+	void render_prometheus_text(metrics_registry& registry, std::string& out)
+	{
+		out.clear();
+		const std::string* pre_name = nullptr;
+		auto cur_samples = registry.collect();
+		for (const auto& one_sample : cur_samples)
+		{
+			if (!pre_name || *pre_name != one_sample.name)
+			{
+				render_help(out, one_sample.name, one_sample.help, one_sample.type == metrics_type::counter ? "counter" : "gauge");
+				pre_name = &one_sample.name;
+			}
+			render_sample_name(out, one_sample.name, "", one_sample.labels, std::string());
+			out += std::to_string(one_sample.value);
+			out += '\n';
+		}
+		pre_name = nullptr;
+		auto cur_histograms = registry.collect_histograms();
+		std::string cur_le;
+		for (const auto& one_sample : cur_histograms)
+		{
+			if (!pre_name || *pre_name != one_sample.name)
+			{
+				render_help(out, one_sample.name, one_sample.help, "histogram");
+				pre_name = &one_sample.name;
+			}
+			const auto& cur_value = one_sample.value;
+			std::uint64_t cur_cumulative = 0;
+			std::size_t cur_bucket = 0;
+			// the le bounds are the values just below the powers of two, each the upper bound of a bucket
+			for (std::size_t i = 0; i < histogram_max_value_bits; i++)
+			{
+				auto cur_bound = (std::uint64_t(1) << i) - 1;
+				while (cur_bucket < cur_value.buckets.size() && histogram_bucket_upper(cur_bucket) <= cur_bound)
+				{
+					cur_cumulative += cur_value.buckets[cur_bucket++];
+				}
+				cur_le = "le=\"" + std::to_string(cur_bound) + "\"";
+				render_sample_name(out, one_sample.name, "_bucket", one_sample.labels, cur_le);
+				out += std::to_string(cur_cumulative);
+				out += '\n';
+			}
+			render_sample_name(out, one_sample.name, "_bucket", one_sample.labels, "le=\"+Inf\"");
+			out += std::to_string(cur_value.count);
+			out += '\n';
+			render_sample_name(out, one_sample.name, "_sum", one_sample.labels, std::string());
+			out += std::to_string(cur_value.sum);
+			out += '\n';
+			render_sample_name(out, one_sample.name, "_count", one_sample.labels, std::string());
+			out += std::to_string(cur_value.count);
+			out += '\n';
+		}
+	}
+
+	reply make_prometheus_reply(metrics_registry& registry)
+	{
+		// scrapes of similar sizes render without growing the buffer again
+		thread_local std::string cur_buffer;
+		render_prometheus_text(registry, cur_buffer);
+		reply result;
+		result.status_code = std::uint32_t(reply::status_type::ok);
+		// the text moves into the reply, the next scrape gets a buffer of the same capacity in one allocation
+		auto cur_capacity = cur_buffer.capacity();
+		result.content = std::move(cur_buffer);
+		cur_buffer.clear();
+		cur_buffer.reserve(cur_capacity);
+		result.add_header("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+		return result;
+	}
+
+	server_metrics::server_metrics(metrics_registry& in_registry, const std::string& in_labels)
+		: registry(in_registry)
+		, labels(in_labels)
+		, accepted_connections(in_registry.counter("http_server_accepted_connections_total", "Connections accepted.", in_labels))
+		, requests(in_registry.counter("http_server_requests_total", "Requests passed to the handler.", in_labels))
+		, received_bytes(in_registry.counter("http_server_received_bytes_total", "Bytes read from clients, after tls decryption.", in_labels))
+		, sent_bytes(in_registry.counter("http_server_sent_bytes_total", "Bytes written to clients, before tls encryption.", in_labels))
+		, parse_errors(in_registry.counter("http_server_parse_errors_total", "Requests or frames rejected as malformed.", in_labels))
+		, tls_handshake_failures(in_registry.counter("http_server_tls_handshake_failures_total", "Failed or timed out tls handshakes.", in_labels))
+		, first_byte(in_registry.histogram("http_server_phase_microseconds", "Latency of the phases of a request in microseconds.", with_labels(in_labels, { { "phase", "first_byte" } })))
+		, m_default_phases(make_phase_histograms(std::string()))
+	{
+		if (!alloc_accounting_enabled)
+		{
+			return;
+		}
+		m_request_allocations = &in_registry.histogram("http_server_request_allocations", "Heap allocations made while serving a request.", in_labels);
+		m_request_alloc_bytes = &in_registry.histogram("http_server_request_alloc_bytes", "Heap bytes allocated while serving a request.", in_labels);
+		connection_heap_bytes = &in_registry.gauge("http_server_connection_heap_bytes", "Heap bytes left allocated by the requests of the open connections.", in_labels);
+		// the same for every server, registering them again only replaces the callback
+		in_registry.gauge_callback("http_utils_heap_allocations", "Heap allocations of the process so far.", std::string(), []()
+			{
+				return std::int64_t(process_alloc_counters().allocs);
+			});
+		in_registry.gauge_callback("http_utils_heap_live_bytes", "Heap bytes of the process currently allocated through operator new.", std::string(), []()
+			{
+				return process_alloc_counters().live_bytes();
+			});
+	}
+
+	server_metrics::~server_metrics()
+	{
+		registry.release(labels);
+	}
+
+	request_phase_histograms server_metrics::make_phase_histograms(const std::string& route)
+	{
+		const std::string cur_name = "http_server_phase_microseconds";
+		const std::string cur_help = "Latency of the phases of a request in microseconds.";
+		if (route.empty())
+		{
+			return request_phase_histograms{ registry.histogram(cur_name, cur_help, with_labels(labels, { { "phase", "read" } }))
+				, registry.histogram(cur_name, cur_help, with_labels(labels, { { "phase", "handler" } }))
+				, registry.histogram(cur_name, cur_help, with_labels(labels, { { "phase", "write" } })) };
+		}
+		return request_phase_histograms{ registry.histogram(cur_name, cur_help, with_labels(labels, { { "phase", "read" }, { "route", route } }))
+			, registry.histogram(cur_name, cur_help, with_labels(labels, { { "phase", "handler" }, { "route", route } }))
+			, registry.histogram(cur_name, cur_help, with_labels(labels, { { "phase", "write" }, { "route", route } })) };
+	}
+
+	void server_metrics::set_routes(const std::vector<std::string>& routes, std::function<std::size_t(const request&)> route_fn)
+	{
+		m_route_phases.clear();
+		m_route_phases.reserve(routes.size());
+		for (const auto& one_route : routes)
+		{
+			m_route_phases.push_back(make_phase_histograms(one_route));
+		}
+		m_route_fn = std::move(route_fn);
+	}
+
+	void server_metrics::log_access_impl(const request& req, std::uint32_t status, std::uint64_t reply_bytes, std::uint64_t read_us, std::uint64_t handler_us, std::uint64_t write_us)
+	{
+		access_log_record cur_record;
+		cur_record.timestamp_us = std::uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+		cur_record.set_request(req.method, req.uri);
+		cur_record.status = status;
+		cur_record.request_bytes = req.body.size();
+		cur_record.reply_bytes = reply_bytes;
+		cur_record.read_us = std::uint32_t(std::min<std::uint64_t>(read_us, UINT32_MAX));
+		cur_record.handler_us = std::uint32_t(std::min<std::uint64_t>(handler_us, UINT32_MAX));
+		cur_record.write_us = std::uint32_t(std::min<std::uint64_t>(write_us, UINT32_MAX));
+		access_log->log(cur_record);
+	}
+
+	void server_metrics::end_request_allocs_impl(alloc_counters& request_allocs, std::int64_t& connection_bytes)
+	{
+		m_request_allocations->record(request_allocs.allocs);
+		m_request_alloc_bytes->record(request_allocs.alloc_bytes);
+		auto cur_live_bytes = request_allocs.live_bytes();
+		connection_heap_bytes->add(cur_live_bytes);
+		connection_bytes += cur_live_bytes;
+		request_allocs = alloc_counters();
+	}
+
+	void server_metrics::end_trace(trace_span&& span, std::uint32_t status, std::uint64_t read_us, std::uint64_t handler_us, std::uint64_t write_us, const std::string& error)
+	{
+		span.status = status;
+		span.read_us = read_us;
+		span.handler_us = handler_us;
+		span.write_us = write_us;
+		span.duration_us = read_us + handler_us + write_us;
+		span.error = error;
+		tracer->record(std::move(span));
+	}
+
+	request_phase_histograms& server_metrics::phase_histograms(const request& req)
+	{
+		if (!m_route_fn)
+		{
+			return m_default_phases;
+		}
+		auto cur_route = m_route_fn(req);
+		if (cur_route >= m_route_phases.size())
+		{
+			return m_default_phases;
+		}
+		return m_route_phases[cur_route];
+	}
+
+	void server_metrics::on_timeout(const std::string& phase)
+	{
+		// timeouts are rare, the lookup under the registry lock is fine here
+		registry.counter("http_server_timeouts_total", "Sessions closed by their timer, by phase.", with_labels(labels, { { "phase", phase } })).add();
+	}
+}
@@ -0,0 +1,122 @@
+#include "sse_hub.h"
+#include <algorithm>
+
+namespace spiritsaway::http_utils
+{
+	namespace
+	{
+		// a line break in the value would let it inject fields or end the event
+		void append_single_line_field(std::string& dest, std::string_view name, std::string_view value)
+		{
+			dest += name;
+			for (auto one_char : value)
+			{
+				if (one_char != '\r' && one_char != '\n')
+				{
+					dest.push_back(one_char);
+				}
+			}
+			dest += '\n';
+		}
+	}
+
+	std::string format_sse_event(const sse_event& event)
+	{
+		std::string result;
+		result.reserve(event.id.size() + event.event.size() + event.data.size() + 32);
+		if (!event.id.empty())
+		{
+			append_single_line_field(result, "id: ", event.id);
+		}
+		if (!event.event.empty())
+		{
+			append_single_line_field(result, "event: ", event.event);
+		}
+		if (event.retry_ms)
+		{
+			result += "retry: ";
+			result += std::to_string(event.retry_ms);
+			result += '\n';
+		}
+		std::size_t cur_begin = 0;
+		while (true)
+		{
+			// a line break inside the data would end the field
+			auto cur_end = event.data.find('\n', cur_begin);
+			auto cur_line = std::string_view(event.data).substr(cur_begin, cur_end == std::string::npos ? std::string::npos : cur_end - cur_begin);
+			if (!cur_line.empty() && cur_line.back() == '\r')
+			{
+				cur_line.remove_suffix(1);
+			}
+			result += "data: ";
+			result += cur_line;
+			result += '\n';
+			if (cur_end == std::string::npos)
+			{
+				break;
+			}
+			cur_begin = cur_end + 1;
+		}
+		result += '\n';
+		return result;
+	}
+
+	void sse_hub::subscribe(std::shared_ptr<sse_subscriber> subscriber)
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		m_subscribers.push_back(subscriber);
+	}
+
+	void sse_hub::unsubscribe(const sse_subscriber* subscriber)
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		m_subscribers.erase(std::remove_if(m_subscribers.begin(), m_subscribers.end(), [subscriber](const std::weak_ptr<sse_subscriber>& one_subscriber)
+			{
+				auto cur_subscriber = one_subscriber.lock();
+				return !cur_subscriber || cur_subscriber.get() == subscriber;
+			}), m_subscribers.end());
+	}
+
+	std::size_t sse_hub::broadcast(const sse_event& event)
+	{
+		return broadcast_raw(std::make_shared<const std::string>(format_sse_event(event)));
+	}
+
+	std::size_t sse_hub::broadcast_raw(std::shared_ptr<const std::string> data)
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		std::size_t result = 0;
+		for (std::size_t i = 0; i < m_subscribers.size();)
+		{
+			auto cur_subscriber = m_subscribers[i].lock();
+			if (!cur_subscriber)
+			{
+				// order does not matter, swap the dead subscriber out
+				m_subscribers[i] = std::move(m_subscribers.back());
+				m_subscribers.pop_back();
+				continue;
+			}
+			// push only queues and posts, it never writes under the lock
+			cur_subscriber->push(data);
+			result++;
+			i++;
+		}
+		return result;
+	}
+
+	std::size_t sse_hub::subscriber_count()
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		return m_subscribers.size();
+	}
+
+	reply make_sse_reply(std::shared_ptr<sse_hub> hub)
+	{
+		reply result;
+		result.status_code = 200;
+		result.add_header("Content-Type", "text/event-stream");
+		result.add_header("Cache-Control", "no-cache");
+		result.event_hub = std::move(hub);
+		return result;
+	}
+}
@@ -0,0 +1,388 @@
+#include "tracing.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <random>
+#include <thread>
+
+namespace spiritsaway::http_utils
+{
+	namespace
+	{
+		thread_local active_trace cur_active_trace;
+
+		bool iequals(std::string_view a, std::string_view b)
+		{
+			return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](unsigned char x, unsigned char y)
+				{
+					return std::tolower(x) == std::tolower(y);
+				});
+		}
+
+		std::mt19937_64& local_random()
+		{
+			thread_local std::mt19937_64 cur_random(std::random_device{}() ^ std::hash<std::thread::id>{}(std::this_thread::get_id()));
+			return cur_random;
+		}
+
+		template <std::size_t N>
+		void fill_random(std::array<std::uint8_t, N>& id)
+		{
+			do
+			{
+				for (std::size_t i = 0; i < N; i += 8)
+				{
+					auto cur_value = local_random()();
+					for (std::size_t j = 0; j < 8 && i + j < N; j++)
+					{
+						id[i + j] = std::uint8_t(cur_value >> (8 * j));
+					}
+				}
+			} while (id == std::array<std::uint8_t, N>{});
+		}
+
+		int hex_value(char c)
+		{
+			if (c >= '0' && c <= '9')
+			{
+				return c - '0';
+			}
+			if (c >= 'a' && c <= 'f')
+			{
+				return c - 'a' + 10;
+			}
+			return -1;
+		}
+
+		// lower case hex only, as the spec requires
+		bool parse_hex(std::string_view text, std::uint8_t* data, std::size_t size)
+		{
+			if (text.size() != size * 2)
+			{
+				return false;
+			}
+			for (std::size_t i = 0; i < size; i++)
+			{
+				auto high = hex_value(text[2 * i]);
+				auto low = hex_value(text[2 * i + 1]);
+				if (high < 0 || low < 0)
+				{
+					return false;
+				}
+				data[i] = std::uint8_t(high * 16 + low);
+			}
+			return true;
+		}
+
+		std::uint64_t now_us()
+		{
+			return std::uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+		}
+
+		void append_json_string(std::string_view text, std::string& out)
+		{
+			static const char hex_chars[] = "0123456789abcdef";
+			out += '"';
+			for (auto one_char : text)
+			{
+				if (one_char == '"' || one_char == '\\')
+				{
+					out += '\\';
+					out += one_char;
+				}
+				else if (std::uint8_t(one_char) < 0x20)
+				{
+					out += "\\u00";
+					out += hex_chars[std::uint8_t(one_char) >> 4];
+					out += hex_chars[std::uint8_t(one_char) & 0xf];
+				}
+				else
+				{
+					out += one_char;
+				}
+			}
+			out += '"';
+		}
+	}
+
+	bool trace_context::valid() const
+	{
+		return trace_id != trace_id_type{} && span_id != span_id_type{};
+	}
+
+	bool parse_traceparent(std::string_view value, trace_context& ctx)
+	{
+		// version 00 is 55 characters, later versions may append fields after another dash
+		if (value.size() < 55 || value[2] != '-' || value[35] != '-' || value[52] != '-')
+		{
+			return false;
+		}
+		std::uint8_t cur_version = 0;
+		if (!parse_hex(value.substr(0, 2), &cur_version, 1) || cur_version == 0xff)
+		{
+			return false;
+		}
+		if (cur_version == 0 && value.size() != 55)
+		{
+			return false;
+		}
+		if (value.size() > 55 && value[55] != '-')
+		{
+			return false;
+		}
+		trace_context cur_ctx;
+		if (!parse_hex(value.substr(3, 32), cur_ctx.trace_id.data(), 16)
+			|| !parse_hex(value.substr(36, 16), cur_ctx.span_id.data(), 8)
+			|| !parse_hex(value.substr(53, 2), &cur_ctx.flags, 1)
+			|| !cur_ctx.valid())
+		{
+			return false;
+		}
+		ctx = cur_ctx;
+		return true;
+	}
+
+	std::string to_hex(const std::uint8_t* data, std::size_t size)
+	{
+		static const char hex_chars[] = "0123456789abcdef";
+		std::string result;
+		result.reserve(size * 2);
+		for (std::size_t i = 0; i < size; i++)
+		{
+			result += hex_chars[data[i] >> 4];
+			result += hex_chars[data[i] & 0xf];
+		}
+		return result;
+	}
+
+	std::string format_traceparent(const trace_context& ctx)
+	{
+		return "00-" + to_hex(ctx.trace_id.data(), ctx.trace_id.size()) + "-" + to_hex(ctx.span_id.data(), ctx.span_id.size()) + "-" + to_hex(&ctx.flags, 1);
+	}
+
+	span_id_type new_span_id()
+	{
+		span_id_type result;
+		fill_random(result);
+		return result;
+	}
+
+	trace_id_type new_trace_id()
+	{
+		trace_id_type result;
+		fill_random(result);
+		return result;
+	}
+
+	trace_context trace_span::context() const
+	{
+		trace_context result;
+		result.trace_id = trace_id;
+		result.span_id = span_id;
+		result.flags = sampled ? 1 : 0;
+		return result;
+	}
+
+	void append_span_json(const trace_span& span, std::string& out)
+	{
+		out += "{\"trace_id\":\"";
+		out += to_hex(span.trace_id.data(), span.trace_id.size());
+		out += "\",\"span_id\":\"";
+		out += to_hex(span.span_id.data(), span.span_id.size());
+		out += "\",\"parent_span_id\":\"";
+		if (span.parent_span_id != span_id_type{})
+		{
+			out += to_hex(span.parent_span_id.data(), span.parent_span_id.size());
+		}
+		out += "\",\"kind\":\"";
+		out += span.kind == span_kind::server ? "server" : "client";
+		out += "\",\"name\":";
+		append_json_string(span.name, out);
+		out += ",\"start_us\":" + std::to_string(span.start_us);
+		out += ",\"duration_us\":" + std::to_string(span.duration_us);
+		out += ",\"status\":" + std::to_string(span.status);
+		out += ",\"error\":";
+		append_json_string(span.error, out);
+		if (span.kind == span_kind::server)
+		{
+			out += ",\"read_us\":" + std::to_string(span.read_us);
+			out += ",\"handler_us\":" + std::to_string(span.handler_us);
+			out += ",\"write_us\":" + std::to_string(span.write_us);
+		}
+		out += "}\n";
+	}
+
+	trace_recorder::trace_recorder(std::size_t capacity)
+		: m_capacity(std::max<std::size_t>(capacity, 1))
+	{
+
+	}
+
+	void trace_recorder::record(trace_span&& span)
+	{
+		if (!span.sampled)
+		{
+			return;
+		}
+		std::lock_guard<std::mutex> guard(m_mutex);
+		if (m_spans.size() < m_capacity)
+		{
+			m_spans.push_back(std::move(span));
+			return;
+		}
+		m_spans[m_next] = std::move(span);
+		m_next = (m_next + 1) % m_capacity;
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	std::vector<trace_span> trace_recorder::snapshot() const
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		std::vector<trace_span> result;
+		result.reserve(m_spans.size());
+		for (std::size_t i = 0; i < m_spans.size(); i++)
+		{
+			result.push_back(m_spans[(m_next + i) % m_spans.size()]);
+		}
+		return result;
+	}
+
+	bool trace_recorder::export_to_file(const std::string& path)
+	{
+		std::ofstream cur_file(path, std::ios::app);
+		if (!cur_file.is_open())
+		{
+			return false;
+		}
+		std::vector<trace_span> cur_spans;
+		std::size_t cur_oldest = 0;
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			cur_spans.swap(m_spans);
+			cur_oldest = m_next;
+			m_next = 0;
+		}
+		// ordered and formatted outside the lock, handlers keep recording meanwhile
+		std::rotate(cur_spans.begin(), cur_spans.begin() + cur_oldest, cur_spans.end());
+		std::string cur_text;
+		for (const auto& one_span : cur_spans)
+		{
+			append_span_json(one_span, cur_text);
+		}
+		cur_file.write(cur_text.data(), cur_text.size());
+		return bool(cur_file);
+	}
+
+	const active_trace& current_trace()
+	{
+		return cur_active_trace;
+	}
+
+	trace_scope::trace_scope(const trace_context& ctx, trace_recorder* recorder)
+	{
+		if (!recorder)
+		{
+			return;
+		}
+		m_active = true;
+		m_previous = cur_active_trace;
+		cur_active_trace.context = ctx;
+		cur_active_trace.recorder = recorder;
+	}
+
+	trace_scope::~trace_scope()
+	{
+		if (m_active)
+		{
+			cur_active_trace = m_previous;
+		}
+	}
+
+	void begin_server_span(const request& req, trace_span& span)
+	{
+		trace_context cur_parent;
+		for (const auto& one_header : req.headers)
+		{
+			if (iequals(one_header.name, "traceparent"))
+			{
+				parse_traceparent(one_header.value, cur_parent);
+				break;
+			}
+		}
+		if (cur_parent.valid())
+		{
+			// the sampling decision of the caller is passed on to our upstream calls
+			span.trace_id = cur_parent.trace_id;
+			span.parent_span_id = cur_parent.span_id;
+			span.sampled = cur_parent.sampled();
+		}
+		else
+		{
+			span.trace_id = new_trace_id();
+			span.parent_span_id = span_id_type{};
+			span.sampled = true;
+		}
+		span.span_id = new_span_id();
+		span.kind = span_kind::server;
+		span.name = req.method;
+		span.name += ' ';
+		span.name.append(req.uri, 0, req.uri.find('?'));
+		span.start_us = now_us();
+	}
+
+	void client_span::begin(std::string& req_str, const std::string& server_url, const std::string& server_port)
+	{
+		const auto& cur_trace = current_trace();
+		if (!cur_trace.recorder)
+		{
+			return;
+		}
+		auto request_line_end = req_str.find("\r\n");
+		if (request_line_end == std::string::npos)
+		{
+			return;
+		}
+		auto head_end = req_str.find("\r\n\r\n");
+		for (auto cur_pos = req_str.find("\r\n"); cur_pos < head_end; cur_pos = req_str.find("\r\n", cur_pos + 2))
+		{
+			if (iequals(std::string_view(req_str).substr(cur_pos + 2, 12), "traceparent:"))
+			{
+				// the caller propagates a context of its own
+				return;
+			}
+		}
+		m_recorder = cur_trace.recorder;
+		m_span.trace_id = cur_trace.context.trace_id;
+		m_span.parent_span_id = cur_trace.context.span_id;
+		m_span.span_id = new_span_id();
+		m_span.kind = span_kind::client;
+		m_span.sampled = cur_trace.context.sampled();
+		// "GET /path HTTP/1.1" named "GET 127.0.0.1:8080 /path"
+		std::string_view cur_line(req_str.data(), request_line_end);
+		auto method_end = cur_line.find(' ');
+		auto uri_end = cur_line.rfind(' ');
+		if (method_end != std::string_view::npos && uri_end > method_end)
+		{
+			auto cur_uri = cur_line.substr(method_end + 1, uri_end - method_end - 1);
+			m_span.name = std::string(cur_line.substr(0, method_end)) + " " + server_url + ":" + server_port + " ";
+			m_span.name += cur_uri.substr(0, cur_uri.find('?'));
+		}
+		req_str.insert(request_line_end + 2, "traceparent: " + format_traceparent(m_span.context()) + "\r\n");
+		m_span.start_us = now_us();
+		m_begin_ts = std::chrono::steady_clock::now();
+	}
+
+	void client_span::end(std::uint32_t status, const std::string& error)
+	{
+		if (!m_recorder)
+		{
+			return;
+		}
+		m_span.duration_us = std::uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_begin_ts).count());
+		m_span.status = status;
+		m_span.error = error;
+		auto* cur_recorder = m_recorder;
+		m_recorder = nullptr;
+		cur_recorder->record(std::move(m_span));
+	}
+}
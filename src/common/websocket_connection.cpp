@@ -0,0 +1,551 @@
+#include "websocket_connection.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define HTTP_UTILS_WEBSOCKET_SSE2 1
+#endif
+
+namespace spiritsaway::http_utils
+{
+	namespace
+	{
+		const std::string_view websocket_guid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+		bool iequals(std::string_view a, std::string_view b)
+		{
+			return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](unsigned char x, unsigned char y)
+				{
+					return std::tolower(x) == std::tolower(y);
+				});
+		}
+
+		const header* find_request_header(const request& req, std::string_view name)
+		{
+			for (const auto& one_header : req.headers)
+			{
+				if (iequals(one_header.name, name))
+				{
+					return &one_header;
+				}
+			}
+			return nullptr;
+		}
+
+		std::uint32_t rotate_left(std::uint32_t value, int bits)
+		{
+			return (value << bits) | (value >> (32 - bits));
+		}
+
+		// only used for the 60 byte handshake input, the tls libraries are not linked into every target
+		std::array<std::uint8_t, 20> sha1(std::string_view data)
+		{
+			std::uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+			std::string padded(data);
+			padded.push_back(char(0x80));
+			while (padded.size() % 64 != 56)
+			{
+				padded.push_back(0);
+			}
+			std::uint64_t bit_len = std::uint64_t(data.size()) * 8;
+			for (int i = 7; i >= 0; i--)
+			{
+				padded.push_back(char((bit_len >> (i * 8)) & 0xff));
+			}
+			for (std::size_t chunk = 0; chunk < padded.size(); chunk += 64)
+			{
+				std::uint32_t w[80];
+				for (int i = 0; i < 16; i++)
+				{
+					const auto* p = reinterpret_cast<const unsigned char*>(padded.data() + chunk + i * 4);
+					w[i] = (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16) | (std::uint32_t(p[2]) << 8) | p[3];
+				}
+				for (int i = 16; i < 80; i++)
+				{
+					w[i] = rotate_left(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+				}
+				std::uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+				for (int i = 0; i < 80; i++)
+				{
+					std::uint32_t f, k;
+					if (i < 20)
+					{
+						f = (b & c) | (~b & d);
+						k = 0x5A827999;
+					}
+					else if (i < 40)
+					{
+						f = b ^ c ^ d;
+						k = 0x6ED9EBA1;
+					}
+					else if (i < 60)
+					{
+						f = (b & c) | (b & d) | (c & d);
+						k = 0x8F1BBCDC;
+					}
+					else
+					{
+						f = b ^ c ^ d;
+						k = 0xCA62C1D6;
+					}
+					auto temp = rotate_left(a, 5) + f + e + k + w[i];
+					e = d;
+					d = c;
+					c = rotate_left(b, 30);
+					b = a;
+					a = temp;
+				}
+				h[0] += a;
+				h[1] += b;
+				h[2] += c;
+				h[3] += d;
+				h[4] += e;
+			}
+			std::array<std::uint8_t, 20> result;
+			for (int i = 0; i < 5; i++)
+			{
+				result[i * 4] = std::uint8_t(h[i] >> 24);
+				result[i * 4 + 1] = std::uint8_t(h[i] >> 16);
+				result[i * 4 + 2] = std::uint8_t(h[i] >> 8);
+				result[i * 4 + 3] = std::uint8_t(h[i]);
+			}
+			return result;
+		}
+
+		std::string base64_encode(const std::uint8_t* data, std::size_t len)
+		{
+			static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+			std::string result;
+			result.reserve((len + 2) / 3 * 4);
+			for (std::size_t i = 0; i < len; i += 3)
+			{
+				std::uint32_t cur_value = std::uint32_t(data[i]) << 16;
+				if (i + 1 < len)
+				{
+					cur_value |= std::uint32_t(data[i + 1]) << 8;
+				}
+				if (i + 2 < len)
+				{
+					cur_value |= data[i + 2];
+				}
+				result.push_back(alphabet[(cur_value >> 18) & 0x3f]);
+				result.push_back(alphabet[(cur_value >> 12) & 0x3f]);
+				result.push_back(i + 1 < len ? alphabet[(cur_value >> 6) & 0x3f] : '=');
+				result.push_back(i + 2 < len ? alphabet[cur_value & 0x3f] : '=');
+			}
+			return result;
+		}
+
+		bool is_control(websocket_opcode opcode)
+		{
+			return std::uint8_t(opcode) & 0x8;
+		}
+
+		// codes a peer may put in a close frame, 1004-1006 and 1015 are reserved and the rest up to 2999 is unassigned
+		bool is_valid_close_code(std::uint16_t code)
+		{
+			return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1014) || (code >= 3000 && code <= 4999);
+		}
+	}
+
+	bool is_websocket_upgrade(const request& req)
+	{
+		auto upgrade_header = find_request_header(req, "Upgrade");
+		auto version_header = find_request_header(req, "Sec-WebSocket-Version");
+		auto key_header = find_request_header(req, "Sec-WebSocket-Key");
+		return req.method == "GET" && upgrade_header && iequals(upgrade_header->value, "websocket") && version_header && version_header->value == "13" && key_header && !key_header->value.empty();
+	}
+
+	std::string websocket_handshake_reply(const request& req)
+	{
+		auto key_header = find_request_header(req, "Sec-WebSocket-Key");
+		std::string result = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ";
+		result += websocket_accept_key(key_header ? key_header->value : std::string());
+		result += "\r\n\r\n";
+		return result;
+	}
+
+	std::string websocket_accept_key(std::string_view client_key)
+	{
+		std::string cur_input(client_key);
+		cur_input += websocket_guid;
+		auto cur_digest = sha1(cur_input);
+		return base64_encode(cur_digest.data(), cur_digest.size());
+	}
+
+	void websocket_unmask(char* data, std::size_t len, const std::array<std::uint8_t, 4>& mask, std::size_t mask_offset)
+	{
+		// rotate the mask so that byte 0 of data lines up with byte 0 of the key
+		std::uint8_t cur_mask[4];
+		for (std::size_t i = 0; i < 4; i++)
+		{
+			cur_mask[i] = mask[(mask_offset + i) % 4];
+		}
+		std::uint32_t key32;
+		std::memcpy(&key32, cur_mask, 4);
+		std::size_t i = 0;
+#if defined(__AVX2__)
+		auto key256 = _mm256_set1_epi32(int(key32));
+		for (; i + 32 <= len; i += 32)
+		{
+			auto cur_block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_xor_si256(cur_block, key256));
+		}
+#endif
+#ifdef HTTP_UTILS_WEBSOCKET_SSE2
+		auto key128 = _mm_set1_epi32(int(key32));
+		for (; i + 16 <= len; i += 16)
+		{
+			auto cur_block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(cur_block, key128));
+		}
+#endif
+		std::uint64_t key64 = (std::uint64_t(key32) << 32) | key32;
+		for (; i + 8 <= len; i += 8)
+		{
+			std::uint64_t cur_word;
+			std::memcpy(&cur_word, data + i, 8);
+			cur_word ^= key64;
+			std::memcpy(data + i, &cur_word, 8);
+		}
+		// i is a multiple of 4 here
+		for (; i < len; i++)
+		{
+			data[i] ^= cur_mask[i % 4];
+		}
+	}
+
+	bool websocket_utf8_validator::feed(const char* data, std::size_t len)
+	{
+		auto* cur_data = reinterpret_cast<const std::uint8_t*>(data);
+		for (std::size_t i = 0; i < len; i++)
+		{
+			auto cur_byte = cur_data[i];
+			if (m_need)
+			{
+				if (cur_byte < m_lower || cur_byte > m_upper)
+				{
+					return false;
+				}
+				m_need--;
+				m_lower = 0x80;
+				m_upper = 0xbf;
+				continue;
+			}
+			if (cur_byte < 0x80)
+			{
+				continue;
+			}
+			if (cur_byte >= 0xc2 && cur_byte <= 0xdf)
+			{
+				m_need = 1;
+			}
+			else if (cur_byte >= 0xe0 && cur_byte <= 0xef)
+			{
+				m_need = 2;
+				// no overlong forms and no surrogates
+				if (cur_byte == 0xe0)
+				{
+					m_lower = 0xa0;
+				}
+				else if (cur_byte == 0xed)
+				{
+					m_upper = 0x9f;
+				}
+			}
+			else if (cur_byte >= 0xf0 && cur_byte <= 0xf4)
+			{
+				m_need = 3;
+				// no overlong forms and nothing past U+10FFFF
+				if (cur_byte == 0xf0)
+				{
+					m_lower = 0x90;
+				}
+				else if (cur_byte == 0xf4)
+				{
+					m_upper = 0x8f;
+				}
+			}
+			else
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	websocket_connection::websocket_connection(websocket_role role, std::size_t max_message_size)
+		: m_role(role)
+		, m_max_message_size(max_message_size)
+		, m_mask_generator(role == websocket_role::client ? std::random_device()() : 0)
+	{
+
+	}
+
+	bool websocket_connection::feed(const char* data, std::size_t len)
+	{
+		if (m_failed || m_close_received)
+		{
+			return !m_failed;
+		}
+		m_input.append(data, len);
+		std::size_t cur_offset = 0;
+		while (!m_failed && !m_close_received)
+		{
+			auto cur_remain = m_input.size() - cur_offset;
+			if (cur_remain < 2)
+			{
+				break;
+			}
+			auto* cur_head = reinterpret_cast<unsigned char*>(m_input.data() + cur_offset);
+			bool cur_fin = cur_head[0] & 0x80;
+			auto cur_opcode = websocket_opcode(cur_head[0] & 0x0f);
+			bool cur_masked = cur_head[1] & 0x80;
+			std::uint64_t cur_len = cur_head[1] & 0x7f;
+			std::size_t cur_head_len = 2;
+			if (cur_len == 126)
+			{
+				cur_head_len += 2;
+			}
+			else if (cur_len == 127)
+			{
+				cur_head_len += 8;
+			}
+			if (cur_masked)
+			{
+				cur_head_len += 4;
+			}
+			if (cur_remain < cur_head_len)
+			{
+				break;
+			}
+			if (cur_head[0] & 0x70)
+			{
+				// no extension was negotiated
+				return fail(1002, "reserved bits set");
+			}
+			if (cur_masked != (m_role == websocket_role::server))
+			{
+				return fail(1002, m_role == websocket_role::server ? "unmasked client frame" : "masked server frame");
+			}
+			if (cur_len == 126)
+			{
+				cur_len = (std::uint64_t(cur_head[2]) << 8) | cur_head[3];
+			}
+			else if (cur_len == 127)
+			{
+				cur_len = 0;
+				for (int i = 0; i < 8; i++)
+				{
+					cur_len = (cur_len << 8) | cur_head[2 + i];
+				}
+			}
+			if (is_control(cur_opcode) && (!cur_fin || cur_len > 125))
+			{
+				return fail(1002, "invalid control frame");
+			}
+			if (cur_len > m_max_message_size || m_message.size() + cur_len > m_max_message_size)
+			{
+				return fail(1009, "message too big");
+			}
+			if (cur_remain - cur_head_len < cur_len)
+			{
+				break;
+			}
+			auto* cur_payload = m_input.data() + cur_offset + cur_head_len;
+			if (cur_masked)
+			{
+				std::array<std::uint8_t, 4> cur_mask;
+				std::memcpy(cur_mask.data(), cur_head + cur_head_len - 4, 4);
+				websocket_unmask(cur_payload, std::size_t(cur_len), cur_mask);
+			}
+			cur_offset += cur_head_len + std::size_t(cur_len);
+			m_activity = true;
+			if (!on_frame(cur_fin, cur_opcode, cur_payload, std::size_t(cur_len)))
+			{
+				return false;
+			}
+		}
+		m_input.erase(0, cur_offset);
+		return !m_failed;
+	}
+
+	bool websocket_connection::on_frame(bool fin, websocket_opcode opcode, char* payload, std::size_t len)
+	{
+		switch (opcode)
+		{
+		case websocket_opcode::text:
+		case websocket_opcode::binary:
+			if (m_message_started)
+			{
+				return fail(1002, "new message inside a fragmented message");
+			}
+			m_message_utf8.reset();
+			if (opcode == websocket_opcode::text && (!m_message_utf8.feed(payload, len) || (fin && !m_message_utf8.complete())))
+			{
+				return fail(1007, "invalid utf-8");
+			}
+			if (fin)
+			{
+				// unfragmented messages skip the assembly buffer
+				m_ready_messages.push_back(websocket_message{ opcode, std::string(payload, len) });
+				return true;
+			}
+			m_message_started = true;
+			m_message_opcode = opcode;
+			m_message.assign(payload, len);
+			return true;
+		case websocket_opcode::continuation:
+			if (!m_message_started)
+			{
+				return fail(1002, "continuation without a message");
+			}
+			// fragments are checked as they come, a code point may span two of them
+			if (m_message_opcode == websocket_opcode::text && (!m_message_utf8.feed(payload, len) || (fin && !m_message_utf8.complete())))
+			{
+				return fail(1007, "invalid utf-8");
+			}
+			m_message.append(payload, len);
+			if (fin)
+			{
+				m_message_started = false;
+				m_ready_messages.push_back(websocket_message{ m_message_opcode, std::move(m_message) });
+				m_message = std::string();
+			}
+			return true;
+		case websocket_opcode::ping:
+			if (!m_close_sent)
+			{
+				write_frame(websocket_opcode::pong, std::string_view(payload, len));
+			}
+			return true;
+		case websocket_opcode::pong:
+			return true;
+		case websocket_opcode::close:
+		{
+			m_close_received = true;
+			if (len == 1)
+			{
+				return fail(1002, "invalid close payload");
+			}
+			if (len >= 2)
+			{
+				auto* cur_code = reinterpret_cast<unsigned char*>(payload);
+				auto cur_close_code = std::uint16_t((cur_code[0] << 8) | cur_code[1]);
+				if (!is_valid_close_code(cur_close_code))
+				{
+					return fail(1002, "invalid close code");
+				}
+				websocket_utf8_validator cur_reason_utf8;
+				if (!cur_reason_utf8.feed(payload + 2, len - 2) || !cur_reason_utf8.complete())
+				{
+					return fail(1007, "invalid utf-8 in close reason");
+				}
+				m_close_code = cur_close_code;
+				m_close_reason.assign(payload + 2, len - 2);
+			}
+			else
+			{
+				m_close_code = 1005;
+			}
+			if (!m_close_sent)
+			{
+				// echo the code to complete the handshake
+				close(len >= 2 ? m_close_code : 1000, std::string_view());
+			}
+			return true;
+		}
+		default:
+			return fail(1002, "unknown opcode");
+		}
+	}
+
+	bool websocket_connection::fail(std::uint16_t code, std::string_view reason)
+	{
+		if (!m_close_sent)
+		{
+			close(code, reason);
+		}
+		m_failed = true;
+		return false;
+	}
+
+	std::vector<websocket_message> websocket_connection::take_messages()
+	{
+		std::vector<websocket_message> result;
+		result.swap(m_ready_messages);
+		return result;
+	}
+
+	void websocket_connection::send(websocket_opcode opcode, std::string_view payload)
+	{
+		if (m_close_sent || opcode == websocket_opcode::close || opcode == websocket_opcode::continuation)
+		{
+			return;
+		}
+		if (is_control(opcode) && payload.size() > 125)
+		{
+			payload = payload.substr(0, 125);
+		}
+		write_frame(opcode, payload);
+	}
+
+	void websocket_connection::close(std::uint16_t code, std::string_view reason)
+	{
+		if (m_close_sent)
+		{
+			return;
+		}
+		m_close_sent = true;
+		std::string cur_payload;
+		cur_payload.push_back(char(code >> 8));
+		cur_payload.push_back(char(code & 0xff));
+		cur_payload.append(reason.substr(0, 123));
+		write_frame(websocket_opcode::close, cur_payload);
+	}
+
+	void websocket_connection::write_frame(websocket_opcode opcode, std::string_view payload)
+	{
+		char cur_head[14];
+		std::size_t cur_head_len = 2;
+		cur_head[0] = char(0x80 | std::uint8_t(opcode));
+		std::uint8_t cur_mask_bit = m_role == websocket_role::client ? 0x80 : 0;
+		if (payload.size() < 126)
+		{
+			cur_head[1] = char(cur_mask_bit | payload.size());
+		}
+		else if (payload.size() <= 0xffff)
+		{
+			cur_head[1] = char(cur_mask_bit | 126);
+			cur_head[2] = char(payload.size() >> 8);
+			cur_head[3] = char(payload.size() & 0xff);
+			cur_head_len = 4;
+		}
+		else
+		{
+			cur_head[1] = char(cur_mask_bit | 127);
+			std::uint64_t cur_len = payload.size();
+			for (int i = 0; i < 8; i++)
+			{
+				cur_head[2 + i] = char((cur_len >> ((7 - i) * 8)) & 0xff);
+			}
+			cur_head_len = 10;
+		}
+		if (m_role == websocket_role::server)
+		{
+			m_output.append(cur_head, cur_head_len);
+			m_output.append(payload);
+			return;
+		}
+		std::array<std::uint8_t, 4> cur_mask;
+		std::uint32_t cur_random = m_mask_generator();
+		std::memcpy(cur_mask.data(), &cur_random, 4);
+		std::memcpy(cur_head + cur_head_len, cur_mask.data(), 4);
+		cur_head_len += 4;
+		m_output.append(cur_head, cur_head_len);
+		auto cur_begin = m_output.size();
+		m_output.append(payload);
+		websocket_unmask(m_output.data() + cur_begin, payload.size(), cur_mask);
+	}
+}
@@ -0,0 +1,80 @@
+#include "http2_client.h"
+#include <mutex>
+
+namespace spiritsaway::http_utils
+{
+	namespace
+	{
+		const std::uint32_t connect_timeout_seconds = 5;
+	}
+
+	std::shared_ptr<h2c_client> make_h2c_client(asio::io_context& io_context, std::shared_ptr<spdlog::logger> in_logger, const std::string& server_url, const std::string& server_port, const http2_settings& settings)
+	{
+		auto cur_connector = [server_url, server_port](h2c_client::executor_type executor, h2c_client::connect_handler handler)
+		{
+			auto cur_resolver = std::make_shared<asio::ip::tcp::resolver>(executor);
+			auto cur_socket = std::make_shared<asio::ip::tcp::socket>(executor);
+			auto cur_timer = std::make_shared<asio::steady_timer>(executor, std::chrono::seconds(connect_timeout_seconds));
+			cur_timer->async_wait([cur_resolver, cur_socket](const asio_ec& error)
+				{
+					if (error != asio::error::operation_aborted)
+					{
+						cur_resolver->cancel();
+						asio_ec ignored_ec;
+						cur_socket->close(ignored_ec);
+					}
+				});
+			cur_resolver->async_resolve(server_url, server_port, [cur_resolver, cur_socket, cur_timer, handler](const asio_ec& error, asio::ip::tcp::resolver::results_type results)
+				{
+					if (error)
+					{
+						cur_timer->cancel();
+						handler(error.message(), nullptr);
+						return;
+					}
+					asio::async_connect(*cur_socket, results, [cur_socket, cur_timer, handler](const asio_ec& error, const asio::ip::tcp::endpoint&)
+						{
+							cur_timer->cancel();
+							if (error)
+							{
+								handler(error.message(), nullptr);
+								return;
+							}
+							asio_ec ignored_ec;
+							// frames are written as soon as they are queued
+							cur_socket->set_option(asio::ip::tcp::no_delay(true), ignored_ec);
+							handler(std::string(), std::make_unique<asio::ip::tcp::socket>(std::move(*cur_socket)));
+						});
+				});
+		};
+		return std::make_shared<h2c_client>(io_context, in_logger, "http", server_url + ":" + server_port, cur_connector, settings);
+	}
+
+	client_launcher make_h2c_client_launcher(asio::io_context& io_context, std::shared_ptr<spdlog::logger> in_logger, const http2_settings& settings)
+	{
+		struct launcher_state
+		{
+			std::mutex mutex;
+			std::unordered_map<std::string, std::shared_ptr<h2c_client>> clients;
+		};
+		auto cur_state = std::make_shared<launcher_state>();
+		return [&io_context, in_logger, settings, cur_state](const std::string& server_url, const std::string& server_port, const request& req, reply_callback callback, std::uint32_t timeout_second) -> std::function<void()>
+		{
+			std::shared_ptr<h2c_client> cur_client;
+			{
+				std::lock_guard<std::mutex> guard(cur_state->mutex);
+				auto& cur_slot = cur_state->clients[server_url + ":" + server_port];
+				if (!cur_slot)
+				{
+					cur_slot = make_h2c_client(io_context, in_logger, server_url, server_port, settings);
+				}
+				cur_client = cur_slot;
+			}
+			auto cur_handle = cur_client->async_request(req, callback, timeout_second);
+			return [cur_client, cur_handle]()
+			{
+				cur_client->cancel(cur_handle);
+			};
+		};
+	}
+}
@@ -1,4 +1,5 @@
 ﻿#include "http_client.h"
+#include "http_log.h"
 #include <sstream>
 
 namespace spiritsaway::http_utils
@@ -12,8 +13,34 @@ namespace spiritsaway::http_utils
 		, m_server_port(server_port)
 		, m_logger(in_logger)
 	{
-		
+		m_trace_span.begin(m_req_str, server_url, server_port);
+		m_rep_parser.m_head_request = req.method == "HEAD";
+	}
+
+	http_client::http_client(asio::io_context &io_context, std::shared_ptr<spdlog::logger> in_logger, const std::string &server_url, const std::string &server_port, std::string req_str, std::function<void(const std::string &, const reply &)> callback, std::uint32_t timeout_second)
+		: m_socket(io_context), m_resolver(io_context), m_callback(callback)
+		, m_req_str(std::move(req_str))
+		, m_timer(io_context)
+		, m_timeout_seconds(timeout_second)
+		, m_server_url(server_url)
+		, m_server_port(server_port)
+		, m_logger(in_logger)
+	{
+		m_trace_span.begin(m_req_str, server_url, server_port);
+		m_rep_parser.m_head_request = m_req_str.compare(0, 5, "HEAD ") == 0;
+	}
 
+	http_client::http_client(asio::io_context &io_context, std::shared_ptr<spdlog::logger> in_logger, const std::string &server_url, const std::string &server_port, const request &req, const reply_stream_handler &stream_handler, std::uint32_t timeout_second)
+		: http_client(io_context, in_logger, server_url, server_port, req, stream_handler.on_finish, timeout_second)
+	{
+		m_stream_handler = stream_handler;
+		if (m_stream_handler.on_body)
+		{
+			m_rep_parser.m_body_handler = [this](std::string_view chunk)
+			{
+				m_pending_chunks.push_back(chunk);
+			};
+		}
 	}
 
 	void http_client::run()
@@ -22,8 +49,14 @@ namespace spiritsaway::http_utils
 		asio::ip::tcp::resolver::query query(m_server_url, m_server_port);
 		m_resolver.async_resolve(query, [self, this](const asio_ec& error, asio::ip::tcp::resolver::iterator iterator)
 								{ handle_resolve(error, iterator); });
+		arm_timer();
+	}
+
+	void http_client::arm_timer()
+	{
+		// a pending wait is cancelled and ends with operation_aborted
 		m_timer.expires_from_now(std::chrono::seconds(m_timeout_seconds));
-		m_timer.async_wait([self, this](const asio_ec& error)
+		m_timer.async_wait([self = shared_from_this(), this](const asio_ec& error)
 		{
 			on_timeout(error);
 		});
@@ -31,6 +64,11 @@ namespace spiritsaway::http_utils
 
 	void http_client::handle_resolve(const asio_ec& error, asio::ip::tcp::resolver::iterator iterator)
 	{
+		if (m_finished)
+		{
+			// cancelled after the resolve completed, connecting would reopen the closed socket
+			return;
+		}
 		if (error)
 		{
 
@@ -44,6 +82,10 @@ namespace spiritsaway::http_utils
 
 	void http_client::handle_connect(const asio_ec &err)
 	{
+		if (m_finished)
+		{
+			return;
+		}
 		if (err)
 		{
 
@@ -63,19 +105,79 @@ namespace spiritsaway::http_utils
 			invoke_callback(err.message());
 			return;
 		}
+		read_content();
+	}
+
+	void http_client::read_content()
+	{
+		if (m_stream_handler.on_body)
+		{
+			// a streamed download may take any time, only each wait for the server is bounded
+			arm_timer();
+		}
 		m_socket.async_read_some(asio::buffer(m_content_read_buffer.data(), m_content_read_buffer.size()), [self = shared_from_this(), this](const asio_ec& err, std::size_t n)
 		{
 			handle_read_content(err, n);
 		});
 	}
+
+	void http_client::deliver_body_chunk()
+	{
+		if (m_finished)
+		{
+			return;
+		}
+		if (m_delivered_chunk_num == m_pending_chunks.size())
+		{
+			m_pending_chunks.clear();
+			m_delivered_chunk_num = 0;
+			if (m_rep_parser.m_reply_complete)
+			{
+				// finish without waiting for the server to close the connection
+				invoke_callback("");
+			}
+			else
+			{
+				read_content();
+			}
+			return;
+		}
+		auto cur_chunk = m_pending_chunks[m_delivered_chunk_num++];
+		m_stream_handler.on_body(cur_chunk, [self = shared_from_this(), this, cur_seq = m_resumed_chunk_seq]()
+		{
+			asio::dispatch(m_socket.get_executor(), [self, this, cur_seq]()
+			{
+				// a second call would start another read on the same socket
+				if (cur_seq != m_resumed_chunk_seq)
+				{
+					return;
+				}
+				m_resumed_chunk_seq++;
+				deliver_body_chunk();
+			});
+		});
+	}
 	
 	void http_client::handle_read_content(const asio_ec &err, std::size_t n)
 	{
+		if (m_stream_handler.on_body)
+		{
+			// the time the consumer holds the chunks back is not counted
+			m_timer.cancel();
+		}
 		if(err)
 		{
 			if(err == asio::error::eof)
 			{
-				invoke_callback("");
+				// a reply without content length ends with the connection
+				if (m_rep_parser.parse(nullptr, 0) == http_reply_parser::result_type::good)
+				{
+					invoke_callback("");
+				}
+				else
+				{
+					invoke_callback("connection closed before reply complete");
+				}
 			}
 			else
 			{
@@ -84,26 +186,54 @@ namespace spiritsaway::http_utils
 			return;
 		}
 
-		m_logger->trace("read content: {}", std::string_view(m_content_read_buffer.data(), n));
+		HTTP_UTILS_LOG_TRACE(m_logger, "read content: {}", std::string_view(m_content_read_buffer.data(), n));
 		auto temp_parse_result = m_rep_parser.parse(m_content_read_buffer.data(), n);
 		if (temp_parse_result == http_reply_parser::result_type::bad)
 		{
 			invoke_callback("invalid reply");
 			return;
 		}
-		m_socket.async_read_some(asio::buffer(m_content_read_buffer.data(), m_content_read_buffer.size()),  [self=shared_from_this(), this](const asio_ec& err, std::size_t bytes_transferred)
+		if (!m_header_notified && m_rep_parser.m_header_complete)
 		{
-			handle_read_content(err, bytes_transferred);
-		});
+			m_header_notified = true;
+			if (m_stream_handler.on_header)
+			{
+				m_stream_handler.on_header(m_rep_parser.m_reply);
+			}
+		}
+		deliver_body_chunk();
 
 	}
 	void http_client::invoke_callback(const std::string& err)
 	{
+		if (m_finished)
+		{
+			return;
+		}
+		m_finished = true;
 		m_timer.cancel();
+		m_trace_span.end(m_rep_parser.m_reply.status_code, err);
 		m_callback(err, m_rep_parser.m_reply);
 		m_socket.close();
 
 	}
+
+	void http_client::cancel()
+	{
+		asio::post(m_socket.get_executor(), [self = shared_from_this(), this]()
+		{
+			if (m_finished)
+			{
+				return;
+			}
+			m_finished = true;
+			m_timer.cancel();
+			m_trace_span.end(0, "cancelled");
+			m_resolver.cancel();
+			asio_ec ignore_ec;
+			m_socket.close(ignore_ec);
+		});
+	}
 	
 	void http_client::on_timeout(const asio_ec& err)
 	{
@@ -0,0 +1,322 @@
+#include "http_client_engine.h"
+#include "http_client.h"
+#include "http_log.h"
+#include <algorithm>
+#include <limits>
+#include <cctype>
+
+namespace spiritsaway::http_utils
+{
+	namespace
+	{
+		// recent latencies kept per upstream for the hedge percentile
+		const std::size_t latency_window_size = 256;
+	}
+
+	struct http_client_engine::request_task
+	{
+		request req;
+		std::string server_url;
+		std::string server_port;
+		std::string upstream_key;
+		reply_callback callback;
+		std::uint32_t timeout_second;
+		bool retryable;
+
+		// every event of the task is serialized on this strand
+		asio::strand<asio::io_context::executor_type> strand;
+		asio::basic_waitable_timer<std::chrono::steady_clock> hedge_timer;
+		std::vector<std::function<void()>> attempt_cancels;
+		std::vector<std::chrono::steady_clock::time_point> attempt_begin_ts;
+		std::size_t running_attempts = 0;
+		std::size_t hedge_attempt_idx = std::numeric_limits<std::size_t>::max();
+		std::uint32_t retry_count = 0;
+		bool finished = false;
+
+		request_task(asio::io_context& io_context)
+			: strand(asio::make_strand(io_context))
+			, hedge_timer(strand)
+		{
+
+		}
+	};
+
+	client_launcher make_http_client_launcher(asio::io_context& io_context, std::shared_ptr<spdlog::logger> in_logger)
+	{
+		return [&io_context, in_logger](const std::string& server_url, const std::string& server_port, const request& req, reply_callback callback, std::uint32_t timeout_second) -> std::function<void()>
+		{
+			auto cur_client = std::make_shared<http_client>(io_context, in_logger, server_url, server_port, req, callback, timeout_second);
+			cur_client->run();
+			return [cur_client]()
+			{
+				cur_client->cancel();
+			};
+		};
+	}
+
+	http_client_engine::http_client_engine(asio::io_context& io_context, std::shared_ptr<spdlog::logger> in_logger, client_launcher launcher, const http_client_policy& policy)
+		: m_ioc(io_context)
+		, m_logger(in_logger)
+		, m_launcher(launcher)
+		, m_policy(policy)
+	{
+
+	}
+
+	bool http_client_engine::is_idempotent_method(const std::string& method)
+	{
+		return method == "GET" || method == "HEAD" || method == "PUT" || method == "DELETE" || method == "OPTIONS" || method == "TRACE";
+	}
+
+	void http_client_engine::async_request(const std::string& server_url, const std::string& server_port, const request& req, reply_callback callback, std::uint32_t timeout_second)
+	{
+		auto cur_key = coalesce_key(server_url, server_port, req);
+		if (!cur_key.empty())
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			auto cur_iter = m_coalesced_callbacks.find(cur_key);
+			if (cur_iter != m_coalesced_callbacks.end())
+			{
+				cur_iter->second.push_back(std::move(callback));
+				m_coalesced_counter++;
+				return;
+			}
+			m_coalesced_callbacks[cur_key].push_back(std::move(callback));
+			callback = [this, cur_key](const std::string& err, const reply& rep)
+			{
+				finish_coalesced(cur_key, err, rep);
+			};
+		}
+		auto task = std::make_shared<request_task>(m_ioc);
+		task->req = req;
+		task->server_url = server_url;
+		task->server_port = server_port;
+		task->upstream_key = server_url + ":" + server_port;
+		task->callback = std::move(callback);
+		task->timeout_second = timeout_second;
+		task->retryable = is_idempotent_method(req.method);
+		m_request_counter++;
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			m_retry_tokens = std::min(m_policy.retry_budget_max, m_retry_tokens + m_policy.retry_budget_ratio);
+		}
+		asio::dispatch(task->strand, [this, task]()
+		{
+			start_attempt(task);
+			if (!m_policy.hedge_enabled || !task->retryable)
+			{
+				return;
+			}
+			auto cur_delay = hedge_delay(task->upstream_key);
+			if (cur_delay.count() == 0)
+			{
+				return;
+			}
+			task->hedge_timer.expires_after(cur_delay);
+			task->hedge_timer.async_wait([this, task](const asio_ec& error)
+			{
+				if (error != asio::error::operation_aborted)
+				{
+					on_hedge_timeout(task);
+				}
+			});
+		});
+	}
+
+	void http_client_engine::start_attempt(std::shared_ptr<request_task> task)
+	{
+		auto attempt_idx = task->attempt_cancels.size();
+		task->attempt_cancels.emplace_back();
+		task->attempt_begin_ts.push_back(std::chrono::steady_clock::now());
+		task->running_attempts++;
+		auto cur_cancel = m_launcher(task->server_url, task->server_port, task->req, [this, task, attempt_idx](const std::string& err, const reply& rep)
+		{
+			asio::dispatch(task->strand, [this, task, attempt_idx, err, rep]()
+			{
+				on_attempt_finish(task, attempt_idx, err, rep);
+			});
+		}, task->timeout_second);
+		if (task->finished)
+		{
+			cur_cancel();
+			return;
+		}
+		task->attempt_cancels[attempt_idx] = cur_cancel;
+	}
+
+	void http_client_engine::on_hedge_timeout(std::shared_ptr<request_task> task)
+	{
+		// the delay was picked for the first attempt, a retry replacing it is not hedged
+		if (task->finished || task->running_attempts != 1 || task->attempt_cancels.size() != 1)
+		{
+			return;
+		}
+		if (!withdraw_retry_token())
+		{
+			m_budget_exhausted_counter++;
+			return;
+		}
+		m_hedge_counter++;
+		HTTP_UTILS_LOG_DEBUG(m_logger, "hedge request {} {} after {}ms", task->upstream_key, task->req.uri, std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - task->attempt_begin_ts[0]).count());
+		task->hedge_attempt_idx = task->attempt_cancels.size();
+		start_attempt(task);
+	}
+
+	void http_client_engine::on_attempt_finish(std::shared_ptr<request_task> task, std::size_t attempt_idx, const std::string& err, const reply& rep)
+	{
+		if (task->finished)
+		{
+			return;
+		}
+		task->running_attempts--;
+		task->attempt_cancels[attempt_idx] = nullptr;
+		bool failed = !err.empty() || rep.status_code == 502 || rep.status_code == 503 || rep.status_code == 504;
+		if (!failed)
+		{
+			record_latency(task->upstream_key, std::chrono::steady_clock::now() - task->attempt_begin_ts[attempt_idx]);
+			finish_task(task, attempt_idx, err, rep);
+			return;
+		}
+		if (task->running_attempts > 0)
+		{
+			// the other attempt may still succeed
+			return;
+		}
+		if (task->retryable && task->retry_count < m_policy.max_retries)
+		{
+			if (withdraw_retry_token())
+			{
+				task->retry_count++;
+				m_retry_counter++;
+				task->hedge_timer.cancel();
+				HTTP_UTILS_LOG_DEBUG(m_logger, "retry request {} {} for {} status {}", task->upstream_key, task->req.uri, err, rep.status_code);
+				start_attempt(task);
+				return;
+			}
+			m_budget_exhausted_counter++;
+		}
+		finish_task(task, attempt_idx, err, rep);
+	}
+
+	void http_client_engine::finish_task(std::shared_ptr<request_task> task, std::size_t attempt_idx, const std::string& err, const reply& rep)
+	{
+		task->finished = true;
+		task->hedge_timer.cancel();
+		if (attempt_idx == task->hedge_attempt_idx && err.empty())
+		{
+			m_hedge_win_counter++;
+		}
+		for (auto& one_cancel : task->attempt_cancels)
+		{
+			if (one_cancel)
+			{
+				one_cancel();
+			}
+		}
+		task->attempt_cancels.clear();
+		task->callback(err, rep);
+	}
+
+	std::string http_client_engine::coalesce_key(const std::string& server_url, const std::string& server_port, const request& req) const
+	{
+		if (!m_policy.coalesce_enabled || req.method != "GET" || !req.body.empty())
+		{
+			return {};
+		}
+		std::string result = req.method + " " + server_url + ":" + server_port + " " + req.uri;
+		for (const auto& one_name : m_policy.coalesce_headers)
+		{
+			result += "\r\n";
+			result += one_name;
+			for (const auto& one_header : req.headers)
+			{
+				if (one_header.name.size() == one_name.size() && std::equal(one_name.begin(), one_name.end(), one_header.name.begin(), [](char a, char b)
+					{
+						return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+					}))
+				{
+					// only present headers get the separator, a missing header differs from an empty one
+					result += ": ";
+					result += one_header.value;
+					break;
+				}
+			}
+		}
+		return result;
+	}
+
+	void http_client_engine::finish_coalesced(const std::string& key, const std::string& err, const reply& rep)
+	{
+		std::vector<reply_callback> waiting_callbacks;
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			auto cur_iter = m_coalesced_callbacks.find(key);
+			if (cur_iter == m_coalesced_callbacks.end())
+			{
+				return;
+			}
+			waiting_callbacks.swap(cur_iter->second);
+			m_coalesced_callbacks.erase(cur_iter);
+		}
+		for (const auto& one_callback : waiting_callbacks)
+		{
+			one_callback(err, rep);
+		}
+	}
+
+	bool http_client_engine::withdraw_retry_token()
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		if (m_retry_tokens < 1)
+		{
+			return false;
+		}
+		m_retry_tokens -= 1;
+		return true;
+	}
+
+	void http_client_engine::record_latency(const std::string& upstream_key, std::chrono::steady_clock::duration latency)
+	{
+		auto latency_us = std::uint32_t(std::min<std::int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(latency).count(), std::numeric_limits<std::uint32_t>::max()));
+		std::lock_guard<std::mutex> guard(m_mutex);
+		auto& cur_window = m_latency_windows[upstream_key];
+		if (cur_window.latency_us.size() < latency_window_size)
+		{
+			cur_window.latency_us.push_back(latency_us);
+		}
+		else
+		{
+			cur_window.latency_us[cur_window.next_idx] = latency_us;
+			cur_window.next_idx = (cur_window.next_idx + 1) % latency_window_size;
+		}
+	}
+
+	std::chrono::microseconds http_client_engine::hedge_delay(const std::string& upstream_key)
+	{
+		std::vector<std::uint32_t> samples;
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			auto cur_iter = m_latency_windows.find(upstream_key);
+			if (cur_iter == m_latency_windows.end() || cur_iter->second.latency_us.size() < std::max<std::size_t>(1, m_policy.hedge_min_samples))
+			{
+				return std::chrono::microseconds(0);
+			}
+			samples = cur_iter->second.latency_us;
+		}
+		auto nth_idx = std::size_t(std::clamp(m_policy.hedge_percentile, 0.0, 1.0) * (samples.size() - 1));
+		std::nth_element(samples.begin(), samples.begin() + nth_idx, samples.end());
+		return std::max<std::chrono::microseconds>(std::chrono::microseconds(samples[nth_idx]), std::chrono::milliseconds(m_policy.hedge_min_delay_ms));
+	}
+
+	http_client_engine_stats http_client_engine::get_stats() const
+	{
+		http_client_engine_stats result;
+		result.requests = m_request_counter.load();
+		result.hedges_sent = m_hedge_counter.load();
+		result.hedges_won = m_hedge_win_counter.load();
+		result.retries = m_retry_counter.load();
+		result.budget_exhausted = m_budget_exhausted_counter.load();
+		result.coalesced = m_coalesced_counter.load();
+		return result;
+	}
+}
@@ -12,8 +12,17 @@ namespace spiritsaway::http_utils
 		, m_session_mgr()
 		, m_address(address)
 		, m_port(port)
+		, m_metrics(metrics_registry::global(), metrics_labels({ { "server", address + ":" + port } }))
 	{
+		m_metrics.registry.gauge_callback("http_server_active_connections", "Connections open, including the ones switched to http2, websocket or sse.", m_metrics.labels, [this]()
+			{
+				return std::int64_t(get_session_count());
+			});
+	}
 
+	http_server::~http_server()
+	{
+		m_metrics.registry.remove_callbacks(m_metrics.labels);
 	}
 
 	void http_server::run()
@@ -42,11 +51,45 @@ namespace spiritsaway::http_utils
 
 				if (!ec)
 				{
-					m_session_mgr.start(std::make_shared<http_server_session>(
+					m_metrics.accepted_connections.add();
+					auto cur_session = std::make_shared<http_server_session>(
 						std::move(socket), m_logger, m_session_counter++, m_session_mgr, [this](const request& req, reply_handler rep_cb)
 						{
-							return handle_request(req, rep_cb);
-						}));
+							return dispatch_request(req, rep_cb);
+						}, m_metrics);
+					if (m_http2_enabled)
+					{
+						cur_session->set_http2_handoff([this](std::unique_ptr<asio::ip::tcp::socket>&& socket, std::string&& received, std::unique_ptr<request>&& upgraded_req, std::string&& settings_payload)
+							{
+								auto cur_http2_session = std::make_shared<http2_server_session<asio::ip::tcp::socket>>(std::move(socket), m_logger, m_session_counter++, m_http2_session_mgr, [this](const request& req, reply_handler rep_cb)
+									{
+										return dispatch_request(req, rep_cb);
+									}, m_metrics, m_http2_settings);
+								cur_http2_session->set_received(std::move(received));
+								if (upgraded_req && !cur_http2_session->set_upgrade(std::move(*upgraded_req), settings_payload))
+								{
+									m_logger->warn("invalid HTTP2-Settings in h2c upgrade");
+								}
+								m_http2_session_mgr.start(cur_http2_session);
+							});
+					}
+					if (m_websocket_enabled)
+					{
+						cur_session->set_websocket_handoff([this](std::unique_ptr<asio::ip::tcp::socket>&& socket, std::string&& received, request&& upgrade_req)
+							{
+								auto cur_websocket_session = std::make_shared<websocket_session<asio::ip::tcp::socket>>(std::move(socket), m_logger, m_session_counter++, m_websocket_session_mgr, std::move(upgrade_req), [this](std::shared_ptr<websocket_channel> channel)
+									{
+										handle_websocket(channel);
+									}, m_websocket_config);
+								cur_websocket_session->set_received(std::move(received));
+								m_websocket_session_mgr.start(cur_websocket_session);
+							});
+					}
+					cur_session->set_sse_handoff([this](std::unique_ptr<asio::ip::tcp::socket>&& socket, reply&& head)
+						{
+							m_sse_session_mgr.start(std::make_shared<sse_session<asio::ip::tcp::socket>>(std::move(socket), m_logger, m_session_counter++, m_sse_session_mgr, std::move(head), m_sse_config));
+						});
+					m_session_mgr.start(cur_session);
 				}
 
 				do_accept();
@@ -54,14 +97,69 @@ namespace spiritsaway::http_utils
 	}
 
 
+	void http_server::enable_http2(const http2_settings& settings)
+	{
+		m_http2_enabled = true;
+		m_http2_settings = settings;
+	}
+
+	void http_server::enable_websocket(const websocket_config& config)
+	{
+		m_websocket_enabled = true;
+		m_websocket_config = config;
+	}
+
+	void http_server::set_metrics_routes(const std::vector<std::string>& routes, std::function<std::size_t(const request&)> route_fn)
+	{
+		m_metrics.set_routes(routes, std::move(route_fn));
+	}
+
+	void http_server::enable_metrics_endpoint(const std::string& path)
+	{
+		m_metrics_path = path;
+	}
+
+	void http_server::set_access_log(std::shared_ptr<access_logger> log)
+	{
+		m_metrics.access_log = std::move(log);
+	}
+
+	void http_server::set_trace_recorder(std::shared_ptr<trace_recorder> recorder)
+	{
+		m_metrics.tracer = std::move(recorder);
+	}
+
+	void http_server::dispatch_request(const request& req, reply_handler rep_cb)
+	{
+		if (!m_metrics_path.empty() && req.method == "GET" && std::string_view(req.uri).substr(0, req.uri.find('?')) == m_metrics_path)
+		{
+			rep_cb(make_prometheus_reply(m_metrics.registry));
+			return;
+		}
+		handle_request(req, rep_cb);
+	}
+
+	void http_server::set_sse_config(const sse_config& config)
+	{
+		m_sse_config = config;
+	}
+
+	void http_server::handle_websocket(std::shared_ptr<websocket_channel> channel)
+	{
+		channel->close(1008, "websocket not handled");
+	}
+
 	void http_server::stop()
 	{
 		m_acceptor.close();
 		m_session_mgr.stop_all();
+		m_http2_session_mgr.stop_all();
+		m_websocket_session_mgr.stop_all();
+		m_sse_session_mgr.stop_all();
 	}
 
 	std::size_t http_server::get_session_count()
 	{
-		return m_session_mgr.get_session_count();
+		return m_session_mgr.get_session_count() + m_http2_session_mgr.get_session_count() + m_websocket_session_mgr.get_session_count() + m_sse_session_mgr.get_session_count();
 	}
 } // namespace spiritsaway::http_http_server
@@ -3,29 +3,70 @@
 #include <utility>
 #include <vector>
 #include "http_session_manager.h"
+#include "http_log.h"
 #include <iostream>
+#include <algorithm>
+#include <cctype>
 
 namespace spiritsaway::http_utils {
 
-	http_server_session::http_server_session(asio::ip::tcp::socket socket, std::shared_ptr<spdlog::logger> in_logger, std::uint64_t in_session_idx, http_session_manager<http_server_session>& session_mgr, const request_handler& handler)
+	namespace
+	{
+		bool iequals(const std::string& a, const std::string& b)
+		{
+			return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](unsigned char x, unsigned char y)
+				{
+					return std::tolower(x) == std::tolower(y);
+				});
+		}
+	}
+
+	http_server_session::http_server_session(asio::ip::tcp::socket socket, std::shared_ptr<spdlog::logger> in_logger, std::uint64_t in_session_idx, http_session_manager<http_server_session>& session_mgr, const request_handler& handler, server_metrics& metrics)
 		: m_socket(std::move(socket))
-		, m_session_mgr(session_mgr)
-		, m_request_handler(handler)
 		, m_logger(in_logger)
+		, m_request_handler(handler)
+		, m_session_mgr(session_mgr)
+		, m_metrics(metrics)
+		, m_accept_ts(std::chrono::steady_clock::now())
+		, m_heap_bytes_gauge(metrics.connection_heap_bytes)
 		, m_con_timer(m_socket.get_executor())
 		, m_session_idx(in_session_idx)
 	{
 	}
 
+	http_server_session::~http_server_session()
+	{
+		if (m_heap_bytes_gauge)
+		{
+			// the server and its metrics may be gone already
+			m_heap_bytes_gauge->sub(m_heap_bytes);
+		}
+	}
+
+	void http_server_session::set_http2_handoff(http2_handoff<asio::ip::tcp::socket> handoff)
+	{
+		m_http2_handoff = std::move(handoff);
+	}
+
+	void http_server_session::set_websocket_handoff(websocket_handoff<asio::ip::tcp::socket> handoff)
+	{
+		m_websocket_handoff = std::move(handoff);
+	}
+
+	void http_server_session::set_sse_handoff(sse_handoff<asio::ip::tcp::socket> handoff)
+	{
+		m_sse_handoff = std::move(handoff);
+	}
+
 	void http_server_session::start()
 	{
-		m_logger->debug("session {} start", m_session_idx);
+		HTTP_UTILS_LOG_DEBUG(m_logger, "session {} start", m_session_idx);
 		do_read();
 	}
 
 	void http_server_session::stop()
 	{
-		m_logger->debug("session {} stop", m_session_idx);
+		HTTP_UTILS_LOG_DEBUG(m_logger, "session {} stop", m_session_idx);
 		asio_ec ignored_ec;
 		m_socket.shutdown(asio::ip::tcp::socket::shutdown_both,
 			ignored_ec);
@@ -52,26 +93,20 @@ namespace spiritsaway::http_utils {
 		m_socket.async_read_some(asio::buffer(m_buffer),
 			[this, self](asio_ec ec, std::size_t bytes_transferred)
 			{
+				alloc_scope cur_allocs(m_request_allocs);
 				m_con_timer.cancel();
 
 				if (!ec)
 				{
-					auto result = m_request_parser.parse(m_buffer.data(), bytes_transferred);
-
-					if (result == http_request_parser::result_type::good)
+					m_metrics.received_bytes.add(bytes_transferred);
+					if (m_first_byte_pending)
 					{
-						handle_request();
-					}
-					else if (result == http_request_parser::result_type::bad)
-					{
-						m_stopped = true;
-						m_reply = reply::stock_reply(reply::status_type::bad_request);
-						do_write();
-					}
-					else
-					{
-						do_read();
+						// one request per connection, its first byte is the one of the connection
+						m_first_byte_pending = false;
+						m_metrics.first_byte.record(elapsed_microseconds(m_accept_ts));
+						m_phase_ts = std::chrono::steady_clock::now();
 					}
+					on_received(m_buffer.data(), bytes_transferred);
 				}
 				else if (ec != asio::error::operation_aborted)
 				{
@@ -80,6 +115,117 @@ namespace spiritsaway::http_utils {
 			});
 	}
 
+	void http_server_session::on_received(const char* data, std::size_t len)
+	{
+		if (m_http2_handoff && m_preface_pending)
+		{
+			// http2 with prior knowledge starts with the preface instead of a request
+			m_received.append(data, len);
+			auto cur_len = std::min(m_received.size(), http2_preface.size());
+			if (std::string_view(m_received).substr(0, cur_len) == http2_preface.substr(0, cur_len))
+			{
+				if (cur_len == http2_preface.size())
+				{
+					hand_off(std::move(m_received), nullptr, std::string());
+				}
+				else
+				{
+					do_read();
+				}
+				return;
+			}
+			m_preface_pending = false;
+			auto cur_received = std::move(m_received);
+			on_received(cur_received.data(), cur_received.size());
+			return;
+		}
+		auto result = m_request_parser.parse(data, len);
+		if (result == http_request_parser::result_type::upgrade)
+		{
+			const auto& cur_req = m_request_parser.m_req;
+			auto cur_consumed = m_request_parser.consumed();
+			if (m_websocket_handoff && is_websocket_upgrade(cur_req))
+			{
+				auto upgrade_req = std::make_shared<request>();
+				m_request_parser.move_req(*upgrade_req);
+				auto cur_received = std::make_shared<std::string>(data + cur_consumed, len - cur_consumed);
+				do_upgrade(websocket_handshake_reply(*upgrade_req), [this, upgrade_req, cur_received]()
+					{
+						m_con_timer.cancel();
+						m_session_mgr.remove(shared_from_this());
+						m_websocket_handoff(std::make_unique<asio::ip::tcp::socket>(std::move(m_socket)), std::move(*cur_received), std::move(*upgrade_req));
+					});
+				return;
+			}
+			const header* upgrade_header = nullptr;
+			const header* settings_header = nullptr;
+			for (const auto& one_header : cur_req.headers)
+			{
+				if (iequals(one_header.name, "Upgrade"))
+				{
+					upgrade_header = &one_header;
+				}
+				else if (iequals(one_header.name, "HTTP2-Settings"))
+				{
+					settings_header = &one_header;
+				}
+			}
+			std::string settings_payload;
+			if (m_http2_handoff && upgrade_header && settings_header && iequals(upgrade_header->value, "h2c") && decode_http2_settings(settings_header->value, settings_payload))
+			{
+				auto upgraded_req = std::make_shared<request>();
+				m_request_parser.move_req(*upgraded_req);
+				do_upgrade("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n", [this, upgraded_req, settings_payload, cur_received = std::string(data + cur_consumed, len - cur_consumed)]() mutable
+					{
+						hand_off(std::move(cur_received), std::make_unique<request>(std::move(*upgraded_req)), std::move(settings_payload));
+					});
+				return;
+			}
+			// other protocols are not switched to, the request is answered as usual
+			result = http_request_parser::result_type::good;
+		}
+
+		if (result == http_request_parser::result_type::good)
+		{
+			handle_request();
+		}
+		else if (result == http_request_parser::result_type::bad)
+		{
+			m_metrics.parse_errors.add();
+			m_stopped = true;
+			m_reply = reply::stock_reply(reply::status_type::bad_request);
+			do_write();
+		}
+		else
+		{
+			do_read();
+		}
+	}
+
+	void http_server_session::do_upgrade(std::string&& reply_str, std::function<void()> on_switched)
+	{
+		auto self(shared_from_this());
+		m_reply_str = std::move(reply_str);
+		asio::async_write(m_socket, asio::buffer(m_reply_str),
+			[this, self, on_switched = std::move(on_switched)](asio_ec ec, std::size_t bytes_transferred)
+			{
+				m_metrics.sent_bytes.add(bytes_transferred);
+				if (ec)
+				{
+					m_session_mgr.stop(shared_from_this());
+					return;
+				}
+				on_switched();
+			});
+	}
+
+	void http_server_session::hand_off(std::string&& received, std::unique_ptr<request>&& upgraded_req, std::string&& settings_payload)
+	{
+		m_con_timer.cancel();
+		m_session_mgr.remove(shared_from_this());
+		m_http2_handoff(std::make_unique<asio::ip::tcp::socket>(std::move(m_socket)), std::move(received), std::move(upgraded_req), std::move(settings_payload));
+	}
+
 	void http_server_session::do_write()
 	{
 		auto self(shared_from_this());
@@ -96,11 +242,33 @@ namespace spiritsaway::http_utils {
 					on_timeout("write reply");
 				}
 			});
-		m_reply_str = m_reply.to_string();
+		if (!m_reply.find_header("Connection"))
+		{
+			// the session is closed after every reply
+			m_reply.add_header("Connection", "close");
+		}
+		// a HEAD reply carries the head of the GET reply without its body
+		m_reply_str = m_request.method == "HEAD" ? m_reply.to_head_string() : m_reply.to_string();
+		m_phase_ts = std::chrono::steady_clock::now();
 		asio::async_write(m_socket, asio::buffer(m_reply_str),
-			[this, self](asio_ec ec, std::size_t)
+			[this, self](asio_ec ec, std::size_t bytes_transferred)
 			{
+				alloc_scope cur_allocs(m_request_allocs);
 				m_con_timer.cancel();
+				m_metrics.sent_bytes.add(bytes_transferred);
+				auto cur_write_us = elapsed_microseconds(m_phase_ts);
+				if (m_phases)
+				{
+					m_phases->write.record(cur_write_us);
+				}
+				m_metrics.log_access(m_request, m_reply.status_code, bytes_transferred, m_read_us, m_handler_us, cur_write_us);
+				if (m_traced)
+				{
+					m_traced = false;
+					m_metrics.end_trace(std::move(m_trace_span), m_reply.status_code, m_read_us, m_handler_us, cur_write_us, ec ? ec.message() : std::string());
+				}
+				cur_allocs.flush();
+				m_metrics.end_request_allocs(m_request_allocs, m_heap_bytes);
 				if (!ec)
 				{
 					// Initiate graceful http_server_session closure.
@@ -121,7 +289,21 @@ namespace spiritsaway::http_utils {
 		{
 			return;
 		}
+		// handlers may reply later from a callback of their own
+		alloc_scope cur_allocs(m_request_allocs);
 		m_con_timer.cancel();
+		if (m_phases)
+		{
+			m_handler_us = elapsed_microseconds(m_phase_ts);
+			m_phases->handler.record(m_handler_us);
+		}
+		if (in_reply.event_hub && m_sse_handoff)
+		{
+			// the connection stays open as an event stream
+			m_session_mgr.remove(shared_from_this());
+			m_sse_handoff(std::make_unique<asio::ip::tcp::socket>(std::move(m_socket)), reply(in_reply));
+			return;
+		}
 		m_reply = in_reply;
 		do_write();
 
@@ -130,6 +312,7 @@ namespace spiritsaway::http_utils {
 	{
 		m_stopped = true;
 		m_logger->warn("session {} timeout for {} ", m_session_idx, reason);
+		m_metrics.on_timeout(reason);
 		m_session_mgr.stop(shared_from_this());
 	}
 	void http_server_session::handle_request()
@@ -137,6 +320,12 @@ namespace spiritsaway::http_utils {
 		m_con_timer.cancel();
 		auto self = shared_from_this();
 		m_request_parser.move_req(m_request);
+		m_metrics.requests.add();
+		m_phases = &m_metrics.phase_histograms(m_request);
+		m_read_us = elapsed_microseconds(m_phase_ts);
+		m_phases->read.record(m_read_us);
+		m_traced = m_metrics.begin_trace(m_request, m_trace_span, m_read_us);
+		m_phase_ts = std::chrono::steady_clock::now();
 		if (m_con_timer.expires_from_now(std::chrono::seconds(m_timeout_seconds)) != 0)
 		{
 			m_session_mgr.stop(self);
@@ -151,6 +340,8 @@ namespace spiritsaway::http_utils {
 			});
 
 
+		// clients created by the handler join the trace of the request
+		trace_scope cur_trace_scope(m_trace_span.context(), m_traced ? m_metrics.tracer.get() : nullptr);
 		m_request_handler(m_request, [self, this](const reply& in_reply) {
 			on_reply(in_reply); 
 			});
@@ -0,0 +1,132 @@
+#include "https_client.h"
+#include <mutex>
+#include <cstring>
+
+namespace spiritsaway::http_utils
+{
+	namespace
+	{
+		const std::uint32_t connect_timeout_seconds = 5;
+	}
+
+	std::shared_ptr<h2_client> make_h2_client(asio::io_context& io_context, asio::ssl::context& ssl_context, std::shared_ptr<spdlog::logger> in_logger, const std::string& server_url, const std::string& server_port, std::shared_ptr<tls_session_cache> session_cache, const http2_settings& settings)
+	{
+		auto cur_connector = [&ssl_context, server_url, server_port, session_cache](h2_client::executor_type executor, h2_client::connect_handler handler)
+		{
+			auto cur_resolver = std::make_shared<asio::ip::tcp::resolver>(executor);
+			auto cur_stream = std::make_shared<std::unique_ptr<asio::ssl::stream<asio::ip::tcp::socket>>>(std::make_unique<asio::ssl::stream<asio::ip::tcp::socket>>(executor, ssl_context));
+			auto cur_timer = std::make_shared<asio::steady_timer>(executor, std::chrono::seconds(connect_timeout_seconds));
+			cur_timer->async_wait([cur_resolver, cur_stream](const asio_ec& error)
+				{
+					if (error != asio::error::operation_aborted && *cur_stream)
+					{
+						cur_resolver->cancel();
+						asio_ec ignored_ec;
+						(*cur_stream)->lowest_layer().close(ignored_ec);
+					}
+				});
+			auto fail = [cur_timer, handler](const std::string& err)
+			{
+				cur_timer->cancel();
+				handler(err, nullptr);
+			};
+			cur_resolver->async_resolve(server_url, server_port, [=](const asio_ec& error, asio::ip::tcp::resolver::results_type results)
+				{
+					if (error)
+					{
+						fail(error.message());
+						return;
+					}
+					asio::async_connect((*cur_stream)->lowest_layer(), results, [=](const asio_ec& error, const asio::ip::tcp::endpoint&)
+						{
+							if (error)
+							{
+								fail(error.message());
+								return;
+							}
+							auto ssl_handle = (*cur_stream)->native_handle();
+							asio_ec ignored_ec;
+							(*cur_stream)->lowest_layer().set_option(asio::ip::tcp::no_delay(true), ignored_ec);
+							asio_ec address_ec;
+							asio::ip::make_address(server_url, address_ec);
+							if (address_ec)
+							{
+								// server name indication is only sent for host names
+								SSL_set_tlsext_host_name(ssl_handle, server_url.c_str());
+							}
+							static const unsigned char client_protocols[] = "\x02h2";
+							SSL_set_alpn_protos(ssl_handle, client_protocols, sizeof(client_protocols) - 1);
+							if (session_cache)
+							{
+								auto cur_session = session_cache->get(server_url, server_port);
+								if (cur_session)
+								{
+									SSL_set_session(ssl_handle, cur_session);
+									SSL_SESSION_free(cur_session);
+								}
+							}
+							(*cur_stream)->async_handshake(asio::ssl::stream_base::client, [=](const asio_ec& error)
+								{
+									if (error)
+									{
+										fail(error.message());
+										return;
+									}
+									const unsigned char* cur_protocol = nullptr;
+									unsigned int cur_protocol_len = 0;
+									SSL_get0_alpn_selected(ssl_handle, &cur_protocol, &cur_protocol_len);
+									if (cur_protocol_len != 2 || std::memcmp(cur_protocol, "h2", 2) != 0)
+									{
+										fail("server did not select h2 by alpn");
+										return;
+									}
+									if (session_cache)
+									{
+										// tls 1.3 tickets arrive later, only sessions already resumable are kept
+										auto cur_session = SSL_get1_session(ssl_handle);
+										if (cur_session && SSL_SESSION_is_resumable(cur_session))
+										{
+											session_cache->put(server_url, server_port, cur_session);
+										}
+										else if (cur_session)
+										{
+											SSL_SESSION_free(cur_session);
+										}
+									}
+									cur_timer->cancel();
+									handler(std::string(), std::move(*cur_stream));
+								});
+						});
+				});
+		};
+		return std::make_shared<h2_client>(io_context, in_logger, "https", server_url + ":" + server_port, cur_connector, settings);
+	}
+
+	client_launcher make_h2_client_launcher(asio::io_context& io_context, asio::ssl::context& ssl_context, std::shared_ptr<spdlog::logger> in_logger, std::shared_ptr<tls_session_cache> session_cache, const http2_settings& settings)
+	{
+		struct launcher_state
+		{
+			std::mutex mutex;
+			std::unordered_map<std::string, std::shared_ptr<h2_client>> clients;
+		};
+		auto cur_state = std::make_shared<launcher_state>();
+		return [&io_context, &ssl_context, in_logger, session_cache, settings, cur_state](const std::string& server_url, const std::string& server_port, const request& req, reply_callback callback, std::uint32_t timeout_second) -> std::function<void()>
+		{
+			std::shared_ptr<h2_client> cur_client;
+			{
+				std::lock_guard<std::mutex> guard(cur_state->mutex);
+				auto& cur_slot = cur_state->clients[server_url + ":" + server_port];
+				if (!cur_slot)
+				{
+					cur_slot = make_h2_client(io_context, ssl_context, in_logger, server_url, server_port, session_cache, settings);
+				}
+				cur_client = cur_slot;
+			}
+			auto cur_handle = cur_client->async_request(req, callback, timeout_second);
+			return [cur_client, cur_handle]()
+			{
+				cur_client->cancel(cur_handle);
+			};
+		};
+	}
+}
@@ -1,4 +1,5 @@
 ﻿#include "https_client.h"
+#include "http_log.h"
 #include <sstream>
 
 namespace spiritsaway::http_utils
@@ -12,24 +13,66 @@ namespace spiritsaway::http_utils
 		, m_server_port(server_port)
 		, m_logger(in_logger)
 	{
+		m_trace_span.begin(m_req_str, server_url, server_port);
+		m_rep_parser.m_head_request = req.method == "HEAD";
+	}
+	https_client::https_client(asio::io_context& io_context, asio::ssl::context& ssl_context, std::shared_ptr<spdlog::logger> in_logger, const std::string& server_url, const std::string& server_port, std::string req_str, std::function<void(const std::string&, const reply&)> callback, std::uint32_t timeout_second)
+		: m_socket(io_context, ssl_context), m_resolver(io_context), m_callback(callback)
+		, m_req_str(std::move(req_str))
+		, m_timer(io_context)
+		, m_timeout_seconds(timeout_second)
+		, m_server_url(server_url)
+		, m_server_port(server_port)
+		, m_logger(in_logger)
+	{
+		m_trace_span.begin(m_req_str, server_url, server_port);
+		m_rep_parser.m_head_request = m_req_str.compare(0, 5, "HEAD ") == 0;
+	}
 
+	https_client::https_client(asio::io_context& io_context, asio::ssl::context& ssl_context, std::shared_ptr<spdlog::logger> in_logger, const std::string& server_url, const std::string& server_port, const request& req, const reply_stream_handler& stream_handler, std::uint32_t timeout_second)
+		: https_client(io_context, ssl_context, in_logger, server_url, server_port, req, stream_handler.on_finish, timeout_second)
+	{
+		m_stream_handler = stream_handler;
+		if (m_stream_handler.on_body)
+		{
+			m_rep_parser.m_body_handler = [this](std::string_view chunk)
+			{
+				m_pending_chunks.push_back(chunk);
+			};
+		}
+	}
 
+	void https_client::set_session_cache(std::shared_ptr<tls_session_cache> session_cache)
+	{
+		m_session_cache = session_cache;
 	}
+
 	void https_client::run()
 	{
 		auto self = shared_from_this();
 		asio::ip::tcp::resolver::query query(m_server_url, m_server_port);
 		m_resolver.async_resolve(query, [self, this](const asio_ec& error, asio::ip::tcp::resolver::results_type results)
 			{ handle_resolve(error, results); });
+		arm_timer();
+	}
+
+	void https_client::arm_timer()
+	{
+		// a pending wait is cancelled and ends with operation_aborted
 		m_timer.expires_from_now(std::chrono::seconds(m_timeout_seconds));
-		m_timer.async_wait([self, this](const asio_ec& error)
-			{
-				on_timeout(error);
-			});
+		m_timer.async_wait([self = shared_from_this(), this](const asio_ec& error)
+		{
+			on_timeout(error);
+		});
 	}
 
 	void https_client::handle_resolve(const asio_ec& error, asio::ip::tcp::resolver::results_type results)
 	{
+		if (m_finished)
+		{
+			// cancelled after the resolve completed, connecting would reopen the closed socket
+			return;
+		}
 		if (error)
 		{
 
@@ -44,6 +87,10 @@ namespace spiritsaway::http_utils
 	
 	void https_client::handle_connect(const asio_ec& err, asio::ip::tcp::resolver::results_type::endpoint_type)
 	{
+		if (m_finished)
+		{
+			return;
+		}
 		if (err)
 		{
 
@@ -51,6 +98,25 @@ namespace spiritsaway::http_utils
 			return;
 		}
 
+		asio_ec ignored_ec;
+		// the request right after the handshake finished must not wait for the ack of the finished message
+		m_socket.lowest_layer().set_option(asio::ip::tcp::no_delay(true), ignored_ec);
+		asio_ec address_ec;
+		asio::ip::make_address(m_server_url, address_ec);
+		if (address_ec)
+		{
+			// server name indication is only sent for host names
+			SSL_set_tlsext_host_name(m_socket.native_handle(), m_server_url.c_str());
+		}
+		if (m_session_cache)
+		{
+			auto cur_session = m_session_cache->get(m_server_url, m_server_port);
+			if (cur_session)
+			{
+				SSL_set_session(m_socket.native_handle(), cur_session);
+				SSL_SESSION_free(cur_session);
+			}
+		}
 		auto self = shared_from_this();
 		m_socket.async_handshake(asio::ssl::stream_base::client, [self, this](const asio_ec& err)
 			{
@@ -78,19 +144,79 @@ namespace spiritsaway::http_utils
 			invoke_callback(err.message());
 			return;
 		}
+		read_content();
+	}
+
+	void https_client::read_content()
+	{
+		if (m_stream_handler.on_body)
+		{
+			// a streamed download may take any time, only each wait for the server is bounded
+			arm_timer();
+		}
 		m_socket.async_read_some(asio::buffer(m_content_read_buffer.data(), m_content_read_buffer.size()), [self = shared_from_this(), this](const asio_ec& err, std::size_t n)
 		{
 			handle_read_content(err, n);
 		});
 	}
 
+	void https_client::deliver_body_chunk()
+	{
+		if (m_finished)
+		{
+			return;
+		}
+		if (m_delivered_chunk_num == m_pending_chunks.size())
+		{
+			m_pending_chunks.clear();
+			m_delivered_chunk_num = 0;
+			if (m_rep_parser.m_reply_complete)
+			{
+				// finish without waiting for the server to close the connection
+				invoke_callback("");
+			}
+			else
+			{
+				read_content();
+			}
+			return;
+		}
+		auto cur_chunk = m_pending_chunks[m_delivered_chunk_num++];
+		m_stream_handler.on_body(cur_chunk, [self = shared_from_this(), this, cur_seq = m_resumed_chunk_seq]()
+		{
+			asio::dispatch(m_socket.get_executor(), [self, this, cur_seq]()
+			{
+				// a second call would start another read on the same socket
+				if (cur_seq != m_resumed_chunk_seq)
+				{
+					return;
+				}
+				m_resumed_chunk_seq++;
+				deliver_body_chunk();
+			});
+		});
+	}
+
 	void https_client::handle_read_content(const asio_ec& err, std::size_t n)
 	{
+		if (m_stream_handler.on_body)
+		{
+			// the time the consumer holds the chunks back is not counted
+			m_timer.cancel();
+		}
 		if (err)
 		{
 			if (err == asio::error::eof)
 			{
-				invoke_callback("");
+				// a reply without content length ends with the connection
+				if (m_rep_parser.parse(nullptr, 0) == http_reply_parser::result_type::good)
+				{
+					invoke_callback("");
+				}
+				else
+				{
+					invoke_callback("connection closed before reply complete");
+				}
 			}
 			else
 			{
@@ -98,28 +224,73 @@ namespace spiritsaway::http_utils
 			}
 			return;
 		}
-		m_logger->trace("read content {}", std::string_view(m_content_read_buffer.data(), n));
+		HTTP_UTILS_LOG_TRACE(m_logger, "read content {}", std::string_view(m_content_read_buffer.data(), n));
 		auto temp_parse_result = m_rep_parser.parse(m_content_read_buffer.data(), n);
 		if (temp_parse_result == http_reply_parser::result_type::bad)
 		{
 			invoke_callback("invalid reply");
 			return;
 		}
-		m_socket.async_read_some(asio::buffer(m_content_read_buffer.data(), m_content_read_buffer.size()), [self = shared_from_this(), this](const asio_ec& err, std::size_t bytes_transferred)
+		if (!m_header_notified && m_rep_parser.m_header_complete)
 		{
-			handle_read_content(err, bytes_transferred);
-		});
+			m_header_notified = true;
+			if (m_stream_handler.on_header)
+			{
+				m_stream_handler.on_header(m_rep_parser.m_reply);
+			}
+		}
+		deliver_body_chunk();
 
 	}
 	void https_client::invoke_callback(const std::string& err)
 	{
+		if (m_finished)
+		{
+			return;
+		}
+		m_finished = true;
 		m_timer.cancel();
+		m_trace_span.end(m_rep_parser.m_reply.status_code, err);
+		if (m_session_cache && err.empty())
+		{
+			// tls 1.3 tickets arrive after the handshake, so the session is taken once the reply is read
+			auto cur_session = SSL_get1_session(m_socket.native_handle());
+			if (cur_session && SSL_SESSION_is_resumable(cur_session))
+			{
+				m_session_cache->put(m_server_url, m_server_port, cur_session);
+			}
+			else if (cur_session)
+			{
+				SSL_SESSION_free(cur_session);
+			}
+		}
 		m_callback(err, m_rep_parser.m_reply);
+		// mark the connection shut down without waiting for the close_notify of the server,
+		// a connection freed without shutdown would invalidate its session
+		SSL_set_shutdown(m_socket.native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
 		asio_ec ignore_ec;
-		m_socket.shutdown(ignore_ec);
+		m_socket.lowest_layer().close(ignore_ec);
 
 	}
 
+	void https_client::cancel()
+	{
+		asio::post(m_socket.get_executor(), [self = shared_from_this(), this]()
+		{
+			if (m_finished)
+			{
+				return;
+			}
+			m_finished = true;
+			m_timer.cancel();
+			m_trace_span.end(0, "cancelled");
+			m_resolver.cancel();
+			SSL_set_shutdown(m_socket.native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+			asio_ec ignore_ec;
+			m_socket.lowest_layer().close(ignore_ec);
+		});
+	}
+
 	void https_client::on_timeout(const asio_ec& err)
 	{
 		if (err != asio::error::operation_aborted)
@@ -129,4 +300,18 @@ namespace spiritsaway::http_utils
 	}
 
 
+	client_launcher make_https_client_launcher(asio::io_context& io_context, asio::ssl::context& ssl_context, std::shared_ptr<spdlog::logger> in_logger, std::shared_ptr<tls_session_cache> session_cache)
+	{
+		return [&io_context, &ssl_context, in_logger, session_cache](const std::string& server_url, const std::string& server_port, const request& req, reply_callback callback, std::uint32_t timeout_second) -> std::function<void()>
+		{
+			auto cur_client = std::make_shared<https_client>(io_context, ssl_context, in_logger, server_url, server_port, req, callback, timeout_second);
+			cur_client->set_session_cache(session_cache);
+			cur_client->run();
+			return [cur_client]()
+			{
+				cur_client->cancel();
+			};
+		};
+	}
+
 }
\ No newline at end of file
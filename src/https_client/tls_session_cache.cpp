@@ -0,0 +1,85 @@
+#include "tls_session_cache.h"
+
+namespace spiritsaway::http_utils
+{
+	tls_session_cache::tls_session_cache(std::size_t max_size)
+		: m_max_size(max_size)
+	{
+
+	}
+
+	tls_session_cache::~tls_session_cache()
+	{
+		for (auto& one_pair : m_sessions)
+		{
+			SSL_SESSION_free(one_pair.second);
+		}
+	}
+
+	SSL_SESSION* tls_session_cache::get(const std::string& server_url, const std::string& server_port)
+	{
+		auto cur_key = server_url + ":" + server_port;
+		std::lock_guard<std::mutex> guard(m_mutex);
+		auto cur_iter = m_sessions.find(cur_key);
+		if (cur_iter == m_sessions.end())
+		{
+			m_miss_counter++;
+			return nullptr;
+		}
+		if (!SSL_SESSION_is_resumable(cur_iter->second))
+		{
+			m_miss_counter++;
+			SSL_SESSION_free(cur_iter->second);
+			m_sessions.erase(cur_iter);
+			return nullptr;
+		}
+		m_hit_counter++;
+		SSL_SESSION_up_ref(cur_iter->second);
+		return cur_iter->second;
+	}
+
+	void tls_session_cache::put(const std::string& server_url, const std::string& server_port, SSL_SESSION* session)
+	{
+		auto cur_key = server_url + ":" + server_port;
+		SSL_SESSION* pre_session = nullptr;
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			auto cur_iter = m_sessions.find(cur_key);
+			if (cur_iter != m_sessions.end())
+			{
+				pre_session = cur_iter->second;
+				cur_iter->second = session;
+			}
+			else
+			{
+				if (m_sessions.size() >= m_max_size)
+				{
+					pre_session = m_sessions.begin()->second;
+					m_sessions.erase(m_sessions.begin());
+				}
+				m_sessions.emplace(cur_key, session);
+			}
+		}
+		if (pre_session)
+		{
+			SSL_SESSION_free(pre_session);
+		}
+	}
+
+	void tls_session_cache::remove(const std::string& server_url, const std::string& server_port)
+	{
+		auto cur_key = server_url + ":" + server_port;
+		SSL_SESSION* pre_session = nullptr;
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			auto cur_iter = m_sessions.find(cur_key);
+			if (cur_iter == m_sessions.end())
+			{
+				return;
+			}
+			pre_session = cur_iter->second;
+			m_sessions.erase(cur_iter);
+		}
+		SSL_SESSION_free(pre_session);
+	}
+}
@@ -1,9 +1,166 @@
 ﻿
 #include "https_server.h"
 #include <utility>
+#include <deque>
+#include <array>
+#include <cstring>
+#include <algorithm>
+#include <cctype>
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
 
 namespace spiritsaway::http_utils
 {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	using ticket_mac_ctx = EVP_MAC_CTX;
+#else
+	// openssl 1.1 only has the hmac flavour of the ticket key callback
+	using ticket_mac_ctx = HMAC_CTX;
+#endif
+
+	/// Keys sealing the session tickets, the front one is used for new tickets.
+	class tls_ticket_key_ring
+	{
+	public:
+		void rotate()
+		{
+			ticket_key new_key;
+			RAND_bytes(new_key.name.data(), int(new_key.name.size()));
+			RAND_bytes(new_key.aes_key.data(), int(new_key.aes_key.size()));
+			RAND_bytes(new_key.hmac_key.data(), int(new_key.hmac_key.size()));
+			std::lock_guard<std::mutex> guard(m_mutex);
+			m_keys.push_front(new_key);
+			// tickets sealed with the previous key stay valid until the next rotation
+			while (m_keys.size() > 2)
+			{
+				m_keys.pop_back();
+			}
+		}
+
+		int on_ticket_key(bool is_tls13, unsigned char* key_name, unsigned char* iv, EVP_CIPHER_CTX* cipher_ctx, ticket_mac_ctx* mac_ctx, int enc)
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			if (m_keys.empty())
+			{
+				return 0;
+			}
+			if (enc)
+			{
+				const auto& cur_key = m_keys.front();
+				std::memcpy(key_name, cur_key.name.data(), cur_key.name.size());
+				if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) <= 0)
+				{
+					return -1;
+				}
+				if (!EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr, cur_key.aes_key.data(), iv) || !set_mac_key(mac_ctx, cur_key))
+				{
+					return -1;
+				}
+				return 1;
+			}
+			for (std::size_t i = 0; i < m_keys.size(); i++)
+			{
+				const auto& cur_key = m_keys[i];
+				if (std::memcmp(key_name, cur_key.name.data(), cur_key.name.size()) != 0)
+				{
+					continue;
+				}
+				if (!EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr, cur_key.aes_key.data(), iv) || !set_mac_key(mac_ctx, cur_key))
+				{
+					return -1;
+				}
+				// 2 asks for a new ticket sealed with the current key, tls 1.3 clients use each ticket only once
+				return (i == 0 && !is_tls13) ? 1 : 2;
+			}
+			// unknown key, fall back to a full handshake
+			return 0;
+		}
+
+	private:
+		struct ticket_key
+		{
+			std::array<unsigned char, 16> name;
+			std::array<unsigned char, 32> aes_key;
+			std::array<unsigned char, 32> hmac_key;
+		};
+
+		static bool set_mac_key(ticket_mac_ctx* mac_ctx, const ticket_key& cur_key)
+		{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+			char digest_name[] = "SHA256";
+			OSSL_PARAM params[] = {
+				OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char*>(cur_key.hmac_key.data()), cur_key.hmac_key.size()),
+				OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest_name, 0),
+				OSSL_PARAM_construct_end()
+			};
+			return EVP_MAC_CTX_set_params(mac_ctx, params);
+#else
+			return HMAC_Init_ex(mac_ctx, cur_key.hmac_key.data(), int(cur_key.hmac_key.size()), EVP_sha256(), nullptr);
+#endif
+		}
+
+		std::mutex m_mutex;
+		std::deque<ticket_key> m_keys;
+	};
+
+	namespace
+	{
+		const unsigned char session_id_ctx[] = "http_utils";
+
+		int ticket_key_ex_idx()
+		{
+			static const int result = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+			return result;
+		}
+
+		// server names are case insensitive
+		std::string lower_server_name(std::string server_name)
+		{
+			std::transform(server_name.begin(), server_name.end(), server_name.begin(), [](unsigned char c)
+				{
+					return char(std::tolower(c));
+				});
+			return server_name;
+		}
+
+		void free_sni_context(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*)
+		{
+			delete reinterpret_cast<std::shared_ptr<asio::ssl::context>*>(ptr);
+		}
+
+		// the selected context stays alive as long as the connection, even when swapped out meanwhile
+		int sni_context_ex_idx()
+		{
+			static const int result = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, free_sni_context);
+			return result;
+		}
+
+		// prefer h2 when the client offers it
+		int on_alpn_select_cb(SSL*, const unsigned char** out, unsigned char* out_len, const unsigned char* in, unsigned int in_len, void*)
+		{
+			static const unsigned char server_protocols[] = "\x02h2\x08http/1.1";
+			if (SSL_select_next_proto(const_cast<unsigned char**>(out), out_len, server_protocols, sizeof(server_protocols) - 1, in, in_len) != OPENSSL_NPN_NEGOTIATED)
+			{
+				return SSL_TLSEXT_ERR_NOACK;
+			}
+			return SSL_TLSEXT_ERR_OK;
+		}
+
+		int on_ticket_key_cb(SSL* ssl, unsigned char* key_name, unsigned char* iv, EVP_CIPHER_CTX* cipher_ctx, ticket_mac_ctx* mac_ctx, int enc)
+		{
+			auto cur_key_ring = reinterpret_cast<tls_ticket_key_ring*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ticket_key_ex_idx()));
+			if (!cur_key_ring)
+			{
+				return 0;
+			}
+			return cur_key_ring->on_ticket_key(SSL_version(ssl) == TLS1_3_VERSION, key_name, iv, cipher_ctx, mac_ctx, enc);
+		}
+	}
 
 	https_server::https_server(asio::io_context& io_context, asio::ssl::context& in_ssl_ctx, std::shared_ptr<spdlog::logger> in_logger, const std::string& address, const std::string& port)
 		: m_ioc(io_context)
@@ -12,8 +169,21 @@ namespace spiritsaway::http_utils
 		, m_session_mgr()
 		, m_address(address)
 		, m_port(port)
+		, m_ticket_key_timer(io_context)
+		, m_metrics(metrics_registry::global(), metrics_labels({ { "server", address + ":" + port } }))
+		, m_read_buffers(std::make_shared<buffer_pool>(tls_buffer_config().read_buffer_size, tls_buffer_config().max_free_buffers))
+		, m_io_lag_timer(io_context)
 		, m_logger(in_logger)
 	{
+		m_metrics.registry.gauge_callback("http_server_active_connections", "Connections open, including the ones switched to http2, websocket or sse.", m_metrics.labels, [this]()
+			{
+				return std::int64_t(get_session_count());
+			});
+	}
+
+	https_server::~https_server()
+	{
+		m_metrics.registry.remove_callbacks(m_metrics.labels);
 	}
 
 	void https_server::run()
@@ -26,9 +196,374 @@ namespace spiritsaway::http_utils
 		m_acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
 		m_acceptor.bind(endpoint);
 		m_acceptor.listen();
+		if (m_ticket_keys)
+		{
+			rotate_ticket_key();
+		}
+		if (m_io_lag_interval_ms)
+		{
+			probe_io_lag();
+		}
 		do_accept();
 	}
 
+	void https_server::enable_session_resumption(const tls_resumption_config& config)
+	{
+		m_resumption_config = config;
+		auto cur_ctx = m_ssl_ctx.native_handle();
+		// sessions are only resumed inside the same id context
+		SSL_CTX_set_session_id_context(cur_ctx, session_id_ctx, sizeof(session_id_ctx) - 1);
+		if (config.session_cache_enabled)
+		{
+			SSL_CTX_set_session_cache_mode(cur_ctx, SSL_SESS_CACHE_SERVER);
+			SSL_CTX_sess_set_cache_size(cur_ctx, long(config.session_cache_size));
+			SSL_CTX_set_timeout(cur_ctx, long(config.session_timeout_seconds));
+		}
+		else
+		{
+			SSL_CTX_set_session_cache_mode(cur_ctx, SSL_SESS_CACHE_OFF);
+		}
+		if (config.session_ticket_enabled)
+		{
+			if (!m_ticket_keys)
+			{
+				m_ticket_keys = std::make_shared<tls_ticket_key_ring>();
+				m_ticket_keys->rotate();
+			}
+			SSL_CTX_clear_options(cur_ctx, SSL_OP_NO_TICKET);
+			SSL_CTX_set_ex_data(cur_ctx, ticket_key_ex_idx(), m_ticket_keys.get());
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+			SSL_CTX_set_tlsext_ticket_key_evp_cb(cur_ctx, on_ticket_key_cb);
+#else
+			SSL_CTX_set_tlsext_ticket_key_cb(cur_ctx, on_ticket_key_cb);
+#endif
+		}
+		else
+		{
+			SSL_CTX_set_options(cur_ctx, SSL_OP_NO_TICKET);
+			// without tickets tls 1.3 still resumes from the session cache
+			if (!config.session_cache_enabled)
+			{
+				SSL_CTX_set_num_tickets(cur_ctx, 0);
+			}
+		}
+		std::lock_guard<std::mutex> guard(m_sni_update_mutex);
+		if (m_sni_contexts)
+		{
+			for (const auto& one_pair : *m_sni_contexts)
+			{
+				prepare_sni_context(one_pair.second->native_handle());
+			}
+		}
+	}
+
+	void https_server::enable_ktls()
+	{
+#ifdef SSL_OP_ENABLE_KTLS
+		SSL_CTX_set_options(m_ssl_ctx.native_handle(), SSL_OP_ENABLE_KTLS);
+		m_socket_bio_streams = true;
+#else
+		m_logger->warn("ktls is not supported by this openssl build");
+#endif
+	}
+
+	void https_server::enable_buffer_pooling(const tls_buffer_config& config)
+	{
+		if (config.release_idle_buffers)
+		{
+			SSL_CTX_set_mode(m_ssl_ctx.native_handle(), SSL_MODE_RELEASE_BUFFERS);
+		}
+		m_read_buffers = std::make_shared<buffer_pool>(config.read_buffer_size, config.max_free_buffers);
+		m_socket_bio_streams = true;
+	}
+
+	buffer_pool_stats https_server::get_buffer_pool_stats() const
+	{
+		return m_read_buffers->get_stats();
+	}
+
+	void https_server::enable_handshake_offload(std::size_t thread_num)
+	{
+		m_crypto_pool = std::make_unique<asio::thread_pool>(thread_num);
+	}
+
+	void https_server::set_keep_alive_timeout(std::uint32_t seconds)
+	{
+		m_keep_alive_timeout_seconds = seconds;
+	}
+
+	void https_server::enable_io_lag_probe(std::uint32_t interval_ms)
+	{
+		m_io_lag_interval_ms = interval_ms;
+	}
+
+	void https_server::probe_io_lag()
+	{
+		auto expire_ts = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_io_lag_interval_ms);
+		m_io_lag_timer.expires_at(expire_ts);
+		m_io_lag_timer.async_wait([this, expire_ts](const asio_ec& error)
+			{
+				if (error == asio::error::operation_aborted || !m_acceptor.is_open())
+				{
+					return;
+				}
+				auto cur_lag_us = std::uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - expire_ts).count());
+				m_io_lag_samples++;
+				m_io_lag_total_us += cur_lag_us;
+				if (cur_lag_us > m_io_lag_max_us.load())
+				{
+					m_io_lag_max_us = cur_lag_us;
+				}
+				probe_io_lag();
+			});
+	}
+
+	io_lag_stats https_server::get_io_lag_stats() const
+	{
+		io_lag_stats result;
+		result.sample_count = m_io_lag_samples.load();
+		result.max_lag_us = m_io_lag_max_us.load();
+		if (result.sample_count)
+		{
+			result.avg_lag_us = m_io_lag_total_us.load() / result.sample_count;
+		}
+		return result;
+	}
+
+	void https_server::rotate_ticket_key()
+	{
+		m_ticket_key_timer.expires_from_now(std::chrono::seconds(m_resumption_config.ticket_key_rotate_seconds));
+		m_ticket_key_timer.async_wait([this](const asio_ec& error)
+			{
+				if (error == asio::error::operation_aborted || !m_acceptor.is_open())
+				{
+					return;
+				}
+				m_logger->info("rotate session ticket key");
+				m_ticket_keys->rotate();
+				rotate_ticket_key();
+			});
+	}
+
+	void https_server::prepare_sni_context(SSL_CTX* ssl_ctx)
+	{
+		// the session cache and ticket callback of m_ssl_ctx stay in use after the switch,
+		// but the callback finds the key ring through the current context
+		SSL_CTX_set_session_id_context(ssl_ctx, session_id_ctx, sizeof(session_id_ctx) - 1);
+		if (m_ticket_keys)
+		{
+			SSL_CTX_set_ex_data(ssl_ctx, ticket_key_ex_idx(), m_ticket_keys.get());
+		}
+		// the alpn callback of the switched context is the one consulted
+		if (m_http2_enabled)
+		{
+			SSL_CTX_set_alpn_select_cb(ssl_ctx, on_alpn_select_cb, nullptr);
+		}
+	}
+
+	void https_server::enable_http2(const http2_settings& settings)
+	{
+		m_http2_enabled = true;
+		m_http2_settings = settings;
+		SSL_CTX_set_alpn_select_cb(m_ssl_ctx.native_handle(), on_alpn_select_cb, nullptr);
+		std::lock_guard<std::mutex> guard(m_sni_update_mutex);
+		if (m_sni_contexts)
+		{
+			for (const auto& one_pair : *m_sni_contexts)
+			{
+				prepare_sni_context(one_pair.second->native_handle());
+			}
+		}
+	}
+
+	void https_server::set_http2_handoff(https_server_session& session)
+	{
+		auto cur_handler = [this](const request& req, reply_handler rep_cb)
+		{
+			return dispatch_request(req, rep_cb);
+		};
+		session.set_http2_handoff([this, cur_handler](std::unique_ptr<asio::ssl::stream<asio::ip::tcp::socket>>&& stream, std::string&&, std::unique_ptr<request>&&, std::string&&)
+			{
+				m_http2_session_mgr.start(std::make_shared<http2_server_session<asio::ssl::stream<asio::ip::tcp::socket>>>(std::move(stream), m_logger, m_session_counter++, m_http2_session_mgr, cur_handler, m_metrics, m_http2_settings));
+			}, [this, cur_handler](std::unique_ptr<ktls_stream>&& stream, std::string&&, std::unique_ptr<request>&&, std::string&&)
+			{
+				m_ktls_http2_session_mgr.start(std::make_shared<http2_server_session<ktls_stream>>(std::move(stream), m_logger, m_session_counter++, m_ktls_http2_session_mgr, cur_handler, m_metrics, m_http2_settings));
+			});
+	}
+
+	void https_server::enable_websocket(const websocket_config& config)
+	{
+		m_websocket_enabled = true;
+		m_websocket_config = config;
+	}
+
+	void https_server::handle_websocket(std::shared_ptr<websocket_channel> channel)
+	{
+		channel->close(1008, "websocket not handled");
+	}
+
+	void https_server::set_websocket_handoff(https_server_session& session)
+	{
+		auto cur_handler = [this](std::shared_ptr<websocket_channel> channel)
+		{
+			handle_websocket(channel);
+		};
+		session.set_websocket_handoff([this, cur_handler](std::unique_ptr<asio::ssl::stream<asio::ip::tcp::socket>>&& stream, std::string&& received, request&& upgrade_req)
+			{
+				auto cur_session = std::make_shared<websocket_session<asio::ssl::stream<asio::ip::tcp::socket>>>(std::move(stream), m_logger, m_session_counter++, m_websocket_session_mgr, std::move(upgrade_req), cur_handler, m_websocket_config);
+				cur_session->set_received(std::move(received));
+				m_websocket_session_mgr.start(cur_session);
+			}, [this, cur_handler](std::unique_ptr<ktls_stream>&& stream, std::string&& received, request&& upgrade_req)
+			{
+				auto cur_session = std::make_shared<websocket_session<ktls_stream>>(std::move(stream), m_logger, m_session_counter++, m_ktls_websocket_session_mgr, std::move(upgrade_req), cur_handler, m_websocket_config);
+				cur_session->set_received(std::move(received));
+				m_ktls_websocket_session_mgr.start(cur_session);
+			});
+	}
+
+	void https_server::set_metrics_routes(const std::vector<std::string>& routes, std::function<std::size_t(const request&)> route_fn)
+	{
+		m_metrics.set_routes(routes, std::move(route_fn));
+	}
+
+	void https_server::enable_metrics_endpoint(const std::string& path)
+	{
+		m_metrics_path = path;
+	}
+
+	void https_server::set_access_log(std::shared_ptr<access_logger> log)
+	{
+		m_metrics.access_log = std::move(log);
+	}
+
+	void https_server::set_trace_recorder(std::shared_ptr<trace_recorder> recorder)
+	{
+		m_metrics.tracer = std::move(recorder);
+	}
+
+	void https_server::dispatch_request(const request& req, reply_handler rep_cb)
+	{
+		if (!m_metrics_path.empty() && req.method == "GET" && std::string_view(req.uri).substr(0, req.uri.find('?')) == m_metrics_path)
+		{
+			rep_cb(make_prometheus_reply(m_metrics.registry));
+			return;
+		}
+		handle_request(req, rep_cb);
+	}
+
+	void https_server::set_sse_config(const sse_config& config)
+	{
+		m_sse_config = config;
+	}
+
+	void https_server::set_sse_handoff(https_server_session& session)
+	{
+		session.set_sse_handoff([this](std::unique_ptr<asio::ssl::stream<asio::ip::tcp::socket>>&& stream, reply&& head)
+			{
+				m_sse_session_mgr.start(std::make_shared<sse_session<asio::ssl::stream<asio::ip::tcp::socket>>>(std::move(stream), m_logger, m_session_counter++, m_sse_session_mgr, std::move(head), m_sse_config));
+			}, [this](std::unique_ptr<ktls_stream>&& stream, reply&& head)
+			{
+				m_ktls_sse_session_mgr.start(std::make_shared<sse_session<ktls_stream>>(std::move(stream), m_logger, m_session_counter++, m_ktls_sse_session_mgr, std::move(head), m_sse_config));
+			});
+	}
+
+	void https_server::set_sni_context(const std::string& server_name, std::shared_ptr<asio::ssl::context> ssl_ctx)
+	{
+		auto cur_name = lower_server_name(server_name);
+		std::lock_guard<std::mutex> guard(m_sni_update_mutex);
+		prepare_sni_context(ssl_ctx->native_handle());
+		auto pre_contexts = std::atomic_load(&m_sni_contexts);
+		auto new_contexts = pre_contexts ? std::make_shared<sni_context_map>(*pre_contexts) : std::make_shared<sni_context_map>();
+		(*new_contexts)[cur_name] = ssl_ctx;
+		if (!pre_contexts)
+		{
+			SSL_CTX_set_tlsext_servername_callback(m_ssl_ctx.native_handle(), on_server_name_cb);
+			SSL_CTX_set_tlsext_servername_arg(m_ssl_ctx.native_handle(), this);
+		}
+		std::atomic_store(&m_sni_contexts, std::shared_ptr<const sni_context_map>(new_contexts));
+	}
+
+	bool https_server::load_sni_certificate(const std::string& server_name, const std::string& cert_chain_file, const std::string& key_file)
+	{
+		auto cur_ctx = std::make_shared<asio::ssl::context>(asio::ssl::context::tls_server);
+		asio_ec ec;
+		cur_ctx->use_certificate_chain_file(cert_chain_file, ec);
+		if (!ec)
+		{
+			cur_ctx->use_private_key_file(key_file, asio::ssl::context::pem, ec);
+		}
+		if (ec)
+		{
+			m_logger->error("load certificate {} for {} fail: {}", cert_chain_file, server_name, ec.message());
+			return false;
+		}
+		set_sni_context(server_name, cur_ctx);
+		m_logger->info("load certificate {} for {}", cert_chain_file, server_name);
+		return true;
+	}
+
+	bool https_server::remove_sni_context(const std::string& server_name)
+	{
+		auto cur_name = lower_server_name(server_name);
+		std::lock_guard<std::mutex> guard(m_sni_update_mutex);
+		auto pre_contexts = std::atomic_load(&m_sni_contexts);
+		if (!pre_contexts || pre_contexts->find(cur_name) == pre_contexts->end())
+		{
+			return false;
+		}
+		auto new_contexts = std::make_shared<sni_context_map>(*pre_contexts);
+		new_contexts->erase(cur_name);
+		std::atomic_store(&m_sni_contexts, std::shared_ptr<const sni_context_map>(new_contexts));
+		return true;
+	}
+
+	int https_server::on_server_name_cb(SSL* ssl, int*, void* arg)
+	{
+		auto cur_server = reinterpret_cast<https_server*>(arg);
+		auto cur_name_ptr = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+		if (!cur_name_ptr)
+		{
+			return SSL_TLSEXT_ERR_NOACK;
+		}
+		auto cur_contexts = std::atomic_load(&cur_server->m_sni_contexts);
+		if (!cur_contexts)
+		{
+			return SSL_TLSEXT_ERR_NOACK;
+		}
+		auto cur_name = lower_server_name(cur_name_ptr);
+		auto cur_iter = cur_contexts->find(cur_name);
+		if (cur_iter == cur_contexts->end())
+		{
+			auto dot_pos = cur_name.find('.');
+			if (dot_pos != std::string::npos)
+			{
+				cur_iter = cur_contexts->find("*" + cur_name.substr(dot_pos));
+			}
+		}
+		if (cur_iter == cur_contexts->end())
+		{
+			// keep the default context
+			return SSL_TLSEXT_ERR_OK;
+		}
+		SSL_set_SSL_CTX(ssl, cur_iter->second->native_handle());
+		delete reinterpret_cast<std::shared_ptr<asio::ssl::context>*>(SSL_get_ex_data(ssl, sni_context_ex_idx()));
+		SSL_set_ex_data(ssl, sni_context_ex_idx(), new std::shared_ptr<asio::ssl::context>(cur_iter->second));
+		return SSL_TLSEXT_ERR_OK;
+	}
+
+	tls_handshake_stats https_server::get_handshake_stats() const
+	{
+		tls_handshake_stats result;
+		result.full_handshakes = m_handshake_counters.full_handshakes.load();
+		result.resumed_handshakes = m_handshake_counters.resumed_handshakes.load();
+		result.failed_handshakes = m_handshake_counters.failed_handshakes.load();
+		result.ktls_handshakes = m_handshake_counters.ktls_handshakes.load();
+		result.offloaded_handshakes = m_handshake_counters.offloaded_handshakes.load();
+		result.handshake_queue_depth = m_handshake_counters.queued_handshakes.load();
+		result.max_handshake_queue_depth = m_handshake_counters.max_queued_handshakes.load();
+		return result;
+	}
+
 	void https_server::do_accept()
 	{
 		m_acceptor.async_accept(
@@ -43,13 +578,52 @@ namespace spiritsaway::http_utils
 
 				if (!ec)
 				{
-					m_session_mgr.start(std::make_shared<https_server_session>(
+					m_metrics.accepted_connections.add();
+				}
+				if (!ec && m_socket_bio_streams)
+				{
+					auto cur_session = std::make_shared<https_server_session>(
+						std::make_unique<ktls_stream>(std::move(socket), m_ssl_ctx), m_logger, m_session_counter++,
+						m_session_mgr, [this](const request& req, reply_handler rep_cb)
+						{
+							return dispatch_request(req, rep_cb);
+						}, m_handshake_counters, m_metrics, m_read_buffers);
+					cur_session->set_keep_alive_timeout(m_keep_alive_timeout_seconds);
+					if (m_http2_enabled)
+					{
+						set_http2_handoff(*cur_session);
+					}
+					if (m_websocket_enabled)
+					{
+						set_websocket_handoff(*cur_session);
+					}
+					set_sse_handoff(*cur_session);
+					m_session_mgr.start(cur_session);
+				}
+				else if (!ec)
+				{
+					auto cur_session = std::make_shared<https_server_session>(
 						std::make_unique<asio::ssl::stream<asio::ip::tcp::socket>>(
 							std::move(socket), m_ssl_ctx), m_logger, m_session_counter++,
 						m_session_mgr, [this](const request& req, reply_handler rep_cb)
 						{
-							return handle_request(req, rep_cb);
-						}));
+							return dispatch_request(req, rep_cb);
+						}, m_handshake_counters, m_metrics, m_read_buffers);
+					cur_session->set_keep_alive_timeout(m_keep_alive_timeout_seconds);
+					if (m_crypto_pool)
+					{
+						cur_session->set_handshake_executor(m_crypto_pool->get_executor());
+					}
+					if (m_http2_enabled)
+					{
+						set_http2_handoff(*cur_session);
+					}
+					if (m_websocket_enabled)
+					{
+						set_websocket_handoff(*cur_session);
+					}
+					set_sse_handoff(*cur_session);
+					m_session_mgr.start(cur_session);
 				}
 
 				do_accept();
@@ -59,11 +633,21 @@ namespace spiritsaway::http_utils
 	void https_server::stop()
 	{
 		m_acceptor.close();
+		m_ticket_key_timer.cancel();
+		m_io_lag_timer.cancel();
 		m_session_mgr.stop_all();
+		m_http2_session_mgr.stop_all();
+		m_ktls_http2_session_mgr.stop_all();
+		m_websocket_session_mgr.stop_all();
+		m_ktls_websocket_session_mgr.stop_all();
+		m_sse_session_mgr.stop_all();
+		m_ktls_sse_session_mgr.stop_all();
 	}
 
 	std::size_t https_server::get_session_count()
 	{
-		return m_session_mgr.get_session_count();
+		return m_session_mgr.get_session_count() + m_http2_session_mgr.get_session_count() + m_ktls_http2_session_mgr.get_session_count()
+			+ m_websocket_session_mgr.get_session_count() + m_ktls_websocket_session_mgr.get_session_count()
+			+ m_sse_session_mgr.get_session_count() + m_ktls_sse_session_mgr.get_session_count();
 	}
 } // namespace spiritsaway::http_https_server
@@ -1,35 +1,225 @@
 
 #include "https_server_session.h"
+#include "http_log.h"
 #include <utility>
 #include <vector>
 #include <iostream>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace spiritsaway::http_utils {
 
+	namespace
+	{
+		bool iequals(const std::string& a, const std::string& b)
+		{
+			return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](unsigned char x, unsigned char y)
+				{
+					return std::tolower(x) == std::tolower(y);
+				});
+		}
+	}
+
 	https_server_session::https_server_session(std::unique_ptr<asio::ssl::stream<asio::ip::tcp::socket>>&& socket,
-		std::shared_ptr<spdlog::logger> in_logger, std::uint64_t in_session_idx, http_session_manager<https_server_session>& session_mgr, const request_handler& handler)
+		std::shared_ptr<spdlog::logger> in_logger, std::uint64_t in_session_idx, http_session_manager<https_server_session>& session_mgr, const request_handler& handler, tls_handshake_counters& handshake_counters, server_metrics& metrics, std::shared_ptr<buffer_pool> read_buffers)
 		: m_socket(std::move(socket))
-		, m_session_mgr(session_mgr)
 		, m_request_handler(handler)
+		, m_read_buffers(std::move(read_buffers))
+		, m_session_mgr(session_mgr)
+		, m_handshake_counters(handshake_counters)
+		, m_metrics(metrics)
+		, m_accept_ts(std::chrono::steady_clock::now())
+		, m_heap_bytes_gauge(metrics.connection_heap_bytes)
 		, m_con_timer(m_socket->get_executor())
 		, m_logger(in_logger)
 		, m_session_idx(in_session_idx)
 	{
 	}
 
+	https_server_session::https_server_session(std::unique_ptr<ktls_stream>&& socket,
+		std::shared_ptr<spdlog::logger> in_logger, std::uint64_t in_session_idx, http_session_manager<https_server_session>& session_mgr, const request_handler& handler, tls_handshake_counters& handshake_counters, server_metrics& metrics, std::shared_ptr<buffer_pool> read_buffers)
+		: m_ktls_socket(std::move(socket))
+		, m_request_handler(handler)
+		, m_read_buffers(std::move(read_buffers))
+		, m_session_mgr(session_mgr)
+		, m_handshake_counters(handshake_counters)
+		, m_metrics(metrics)
+		, m_accept_ts(std::chrono::steady_clock::now())
+		, m_heap_bytes_gauge(metrics.connection_heap_bytes)
+		, m_con_timer(m_ktls_socket->get_executor())
+		, m_logger(in_logger)
+		, m_session_idx(in_session_idx)
+	{
+	}
+
+	https_server_session::~https_server_session()
+	{
+		if (m_heap_bytes_gauge)
+		{
+			// the server and its metrics may be gone already
+			m_heap_bytes_gauge->sub(m_heap_bytes);
+		}
+#ifdef __linux__
+		if (m_content_file_fd >= 0)
+		{
+			::close(m_content_file_fd);
+		}
+#endif
+	}
+
+	SSL* https_server_session::native_ssl()
+	{
+		return m_ktls_socket ? m_ktls_socket->native_handle() : m_socket->native_handle();
+	}
+
+	void https_server_session::async_handshake_impl(std::function<void(const asio_ec&)> handler)
+	{
+		if (m_ktls_socket)
+		{
+			m_ktls_socket->async_handshake(handler);
+		}
+		else
+		{
+			m_socket->async_handshake(asio::ssl::stream_base::server, handler);
+		}
+	}
+
+	void https_server_session::async_read_some_impl(std::function<void(const asio_ec&, std::size_t)> handler)
+	{
+		if (m_ktls_socket)
+		{
+			m_ktls_socket->async_read_some(asio::buffer(m_buffer.data(), m_buffer.size()), handler);
+		}
+		else
+		{
+			m_socket->async_read_some(asio::buffer(m_buffer.data(), m_buffer.size()), handler);
+		}
+	}
+
+	void https_server_session::async_write_impl(std::function<void(const asio_ec&, std::size_t)> handler)
+	{
+		if (!m_ktls_socket)
+		{
+			asio::async_write(*m_socket, asio::buffer(m_reply_str), handler);
+			return;
+		}
+		if (m_content_file_fd < 0)
+		{
+			m_ktls_socket->async_write(asio::buffer(m_reply_str), handler);
+			return;
+		}
+		m_ktls_socket->async_write(asio::buffer(m_reply_str), [this, self = shared_from_this(), handler](const asio_ec& ec, std::size_t n)
+			{
+				if (ec)
+				{
+					handler(ec, n);
+					return;
+				}
+				m_ktls_socket->async_sendfile(m_content_file_fd, 0, m_content_file_size, [n, handler](const asio_ec& ec, std::size_t file_n)
+					{
+						handler(ec, n + file_n);
+					});
+			});
+	}
+
+	void https_server_session::set_keep_alive_timeout(std::uint32_t seconds)
+	{
+		m_keep_alive_timeout_seconds = seconds;
+	}
+
+	void https_server_session::set_handshake_executor(asio::thread_pool::executor_type executor)
+	{
+		if (m_socket)
+		{
+			m_handshake_strand.emplace(executor);
+		}
+	}
+
+	void https_server_session::set_http2_handoff(http2_handoff<asio::ssl::stream<asio::ip::tcp::socket>> ssl_handoff, http2_handoff<ktls_stream> ktls_handoff)
+	{
+		m_ssl_http2_handoff = std::move(ssl_handoff);
+		m_ktls_http2_handoff = std::move(ktls_handoff);
+	}
+
+	void https_server_session::set_websocket_handoff(websocket_handoff<asio::ssl::stream<asio::ip::tcp::socket>> ssl_handoff, websocket_handoff<ktls_stream> ktls_handoff)
+	{
+		m_ssl_websocket_handoff = std::move(ssl_handoff);
+		m_ktls_websocket_handoff = std::move(ktls_handoff);
+	}
+
+	void https_server_session::set_sse_handoff(sse_handoff<asio::ssl::stream<asio::ip::tcp::socket>> ssl_handoff, sse_handoff<ktls_stream> ktls_handoff)
+	{
+		m_ssl_sse_handoff = std::move(ssl_handoff);
+		m_ktls_sse_handoff = std::move(ktls_handoff);
+	}
+
 	void https_server_session::start()
 	{
-		m_logger->debug("session {} start", m_session_idx);
-		do_handshake();
+		HTTP_UTILS_LOG_DEBUG(m_logger, "session {} start", m_session_idx);
+		asio_ec ignored_ec;
+		// replies are written in one piece, do not hold the last segment back for an ack
+		if (m_ktls_socket)
+		{
+			m_ktls_socket->lowest_layer().set_option(asio::ip::tcp::no_delay(true), ignored_ec);
+		}
+		else
+		{
+			m_socket->lowest_layer().set_option(asio::ip::tcp::no_delay(true), ignored_ec);
+		}
+		if (m_handshake_strand)
+		{
+			do_offload_handshake();
+		}
+		else
+		{
+			do_handshake();
+		}
 	}
 
 	void https_server_session::stop()
 	{
-		m_logger->debug("session {} stop", m_session_idx);
+		HTTP_UTILS_LOG_DEBUG(m_logger, "session {} stop", m_session_idx);
+		m_stopped = true;
+		auto self = shared_from_this();
+		if (m_handshake_offloaded)
+		{
+			// fail the running handshake, the session is released when it comes back
+			asio::post(*m_handshake_strand, [self, this]()
+				{
+					asio_ec ignored_ec;
+					m_socket->lowest_layer().close(ignored_ec);
+				});
+			return;
+		}
 		m_con_timer.cancel();
 		asio_ec ignored_ec;
-		m_socket->shutdown(ignored_ec);
-		
+		if (m_ktls_socket)
+		{
+			m_ktls_socket->shutdown(ignored_ec);
+			return;
+		}
+		// a blocking shutdown would wait on the io thread for the close_notify of the peer
+		m_con_timer.expires_from_now(std::chrono::seconds(1));
+		m_con_timer.async_wait([self, this](const asio_ec& error)
+			{
+				if (error != asio::error::operation_aborted)
+				{
+					asio_ec ignored_ec;
+					m_socket->lowest_layer().close(ignored_ec);
+				}
+			});
+		m_socket->async_shutdown([self, this](const asio_ec&)
+			{
+				m_con_timer.cancel();
+				asio_ec ignored_ec;
+				m_socket->lowest_layer().close(ignored_ec);
+			});
 	}
 	void https_server_session::do_handshake()
 	{
@@ -47,61 +237,240 @@ namespace spiritsaway::http_utils {
 				}
 
 			});
-		m_socket->async_handshake(asio::ssl::stream_base::server, 
-			[this, self](const asio_ec& error)
+		async_handshake_impl([this, self](const asio_ec& error)
 			{
 				m_con_timer.cancel();
-			if (!error)
+				on_handshake(error);
+			});
+	}
+
+	void https_server_session::do_offload_handshake()
+	{
+		auto self(shared_from_this());
+		m_handshake_offloaded = true;
+		m_handshake_counters.offloaded_handshakes++;
+		auto cur_queued = ++m_handshake_counters.queued_handshakes;
+		auto pre_max = m_handshake_counters.max_queued_handshakes.load();
+		while (pre_max < cur_queued && !m_handshake_counters.max_queued_handshakes.compare_exchange_weak(pre_max, cur_queued))
+		{
+		}
+		asio::post(*m_handshake_strand, [self, this]()
 			{
-				do_read();
+				// the timer only cancels the handshake here, failing it hands the session back
+				m_con_timer.expires_from_now(std::chrono::seconds(m_timeout_seconds));
+				m_con_timer.async_wait(asio::bind_executor(*m_handshake_strand, [self, this](const asio_ec& error)
+					{
+						if (error != asio::error::operation_aborted)
+						{
+							m_logger->warn("session {} timeout for do handshake", m_session_idx);
+							m_metrics.on_timeout("do handshake");
+							asio_ec ignored_ec;
+							m_socket->lowest_layer().close(ignored_ec);
+						}
+					}));
+				// the intermediate steps of the handshake run on the executor bound to the handler
+				m_socket->async_handshake(asio::ssl::stream_base::server, asio::bind_executor(*m_handshake_strand, [self, this](const asio_ec& error)
+					{
+						m_con_timer.cancel();
+						asio::post(m_socket->get_executor(), [self, this, error]()
+							{
+								m_handshake_offloaded = false;
+								m_handshake_counters.queued_handshakes--;
+								on_handshake(error);
+							});
+					}));
+			});
+	}
+
+	void https_server_session::on_handshake(const asio_ec& error)
+	{
+		if (!error && !m_stopped)
+		{
+			if (m_ktls_socket && m_ktls_socket->ktls_send_enabled())
+			{
+				m_handshake_counters.ktls_handshakes++;
+			}
+			if (SSL_session_reused(native_ssl()))
+			{
+				m_handshake_counters.resumed_handshakes++;
 			}
 			else
 			{
-				m_logger->error("session {} handle shake error {}", m_session_idx, error.message());
-				m_session_mgr.stop(shared_from_this());
+				m_handshake_counters.full_handshakes++;
 			}
-			});
+			if (!hand_off_http2())
+			{
+				do_read();
+			}
+		}
+		else if (error)
+		{
+			m_handshake_counters.failed_handshakes++;
+			m_metrics.tls_handshake_failures.add();
+			m_logger->error("session {} handle shake error {}", m_session_idx, error.message());
+			m_session_mgr.stop(shared_from_this());
+		}
 	}
 
-	void https_server_session::do_read()
+	bool https_server_session::hand_off_http2()
 	{
-		auto self(shared_from_this());
+		const unsigned char* cur_protocol = nullptr;
+		unsigned int cur_protocol_len = 0;
+		SSL_get0_alpn_selected(native_ssl(), &cur_protocol, &cur_protocol_len);
+		if (cur_protocol_len != 2 || std::memcmp(cur_protocol, "h2", 2) != 0)
+		{
+			return false;
+		}
+		if (m_ktls_socket ? !m_ktls_http2_handoff : !m_ssl_http2_handoff)
+		{
+			return false;
+		}
+		m_con_timer.cancel();
+		m_session_mgr.remove(shared_from_this());
+		if (m_ktls_socket)
+		{
+			m_ktls_http2_handoff(std::move(m_ktls_socket), std::string(), nullptr, std::string());
+		}
+		else
+		{
+			m_ssl_http2_handoff(std::move(m_socket), std::string(), nullptr, std::string());
+		}
+		return true;
+	}
 
+	void https_server_session::do_websocket_upgrade()
+	{
+		auto self(shared_from_this());
 		if (m_con_timer.expires_from_now(std::chrono::seconds(m_timeout_seconds)) != 0)
 		{
-			m_session_mgr.stop(shared_from_this());
+			m_session_mgr.stop(self);
 			return;
 		}
 		m_con_timer.async_wait([self, this](const asio_ec& error)
 			{
 				if (error != asio::error::operation_aborted)
 				{
-					on_timeout("read_request");
+					on_timeout("websocket upgrade");
 				}
-
 			});
-		m_socket->async_read_some(asio::buffer(m_buffer),
-			[this, self](asio_ec ec, std::size_t bytes_transferred)
+		m_reply_str = websocket_handshake_reply(m_request);
+		async_write_impl([this, self](asio_ec ec, std::size_t bytes_transferred)
 			{
 				m_con_timer.cancel();
+				m_metrics.sent_bytes.add(bytes_transferred);
+				if (ec || m_stopped)
+				{
+					if (ec != asio::error::operation_aborted)
+					{
+						m_session_mgr.stop(shared_from_this());
+					}
+					return;
+				}
+				// frames pipelined behind the upgrade request go to the websocket session
+				std::string cur_received;
+				if (m_buffer)
+				{
+					cur_received.assign(m_buffer.data() + m_buffer_begin, m_buffer_end - m_buffer_begin);
+					m_buffer.reset();
+				}
+				m_session_mgr.remove(shared_from_this());
+				if (m_ktls_socket)
+				{
+					m_ktls_websocket_handoff(std::move(m_ktls_socket), std::move(cur_received), std::move(m_request));
+				}
+				else
+				{
+					m_ssl_websocket_handoff(std::move(m_socket), std::move(cur_received), std::move(m_request));
+				}
+			});
+	}
 
+	void https_server_session::do_read()
+	{
+		auto self(shared_from_this());
+		if (m_buffer_begin < m_buffer_end)
+		{
+			// the next pipelined request is already here
+			parse_buffer();
+			return;
+		}
+
+		// a kept-alive connection waits for the first byte of its next request
+		bool cur_idle = m_keep_alive && !m_request_started;
+		if (m_con_timer.expires_from_now(std::chrono::seconds(cur_idle ? m_keep_alive_timeout_seconds : m_timeout_seconds)) != 0)
+		{
+			m_session_mgr.stop(shared_from_this());
+			return;
+		}
+		m_con_timer.async_wait([self, this, cur_idle](const asio_ec& error)
+			{
+				if (error == asio::error::operation_aborted)
+				{
+					return;
+				}
+				if (cur_idle)
+				{
+					// closing an idle connection is the normal end of keep-alive, not a failure
+					HTTP_UTILS_LOG_DEBUG(m_logger, "https_server_session {} closed after idling for {}s", m_session_idx, m_keep_alive_timeout_seconds);
+					m_stopped = true;
+					m_session_mgr.stop(shared_from_this());
+					return;
+				}
+				on_timeout("read_request");
+			});
+		if (!m_ktls_socket)
+		{
+			// the record buffers of asio::ssl::stream may hold data the socket readiness does not show
+			do_read_buffer();
+			return;
+		}
+		m_ktls_socket->async_wait_readable([this, self](const asio_ec& ec)
+			{
+				alloc_scope cur_allocs(m_request_allocs);
 				if (!ec)
 				{
-					auto result = m_request_parser.parse(m_buffer.data(), bytes_transferred);
+					do_read_buffer();
+					return;
+				}
+				m_con_timer.cancel();
+				if (ec != asio::error::operation_aborted)
+				{
+					m_logger->error("https_server_session {} error {}", m_session_idx, ec.message());
+					m_session_mgr.stop(shared_from_this());
+				}
+			});
+	}
 
-					if (result == http_request_parser::result_type::good)
-					{
-						handle_request();
-					}
-					else if (result == http_request_parser::result_type::bad)
-					{
-						m_reply = reply::stock_reply(reply::status_type::bad_request);
-						do_write();
-					}
-					else
+	void https_server_session::do_read_buffer()
+	{
+		auto self(shared_from_this());
+		if (!m_buffer)
+		{
+			m_buffer = m_read_buffers->acquire();
+		}
+		async_read_some_impl([this, self](asio_ec ec, std::size_t bytes_transferred)
+			{
+				alloc_scope cur_allocs(m_request_allocs);
+				m_con_timer.cancel();
+
+				if (!ec)
+				{
+					m_metrics.received_bytes.add(bytes_transferred);
+					if (m_first_byte_pending)
 					{
-						do_read();
+						m_first_byte_pending = false;
+						m_metrics.first_byte.record(elapsed_microseconds(m_accept_ts));
 					}
+					m_buffer_begin = 0;
+					m_buffer_end = bytes_transferred;
+					parse_buffer();
+					return;
+				}
+				m_buffer.reset();
+				if (ec == asio::error::eof)
+				{
+					HTTP_UTILS_LOG_DEBUG(m_logger, "https_server_session {} closed by peer", m_session_idx);
+					m_session_mgr.stop(shared_from_this());
 				}
 				else if (ec != asio::error::operation_aborted)
 				{
@@ -111,6 +480,60 @@ namespace spiritsaway::http_utils {
 			});
 	}
 
+	void https_server_session::parse_buffer()
+	{
+		if (!m_request_started)
+		{
+			m_request_started = true;
+			m_phase_ts = std::chrono::steady_clock::now();
+		}
+		auto result = m_request_parser.parse(m_buffer.data() + m_buffer_begin, m_buffer_end - m_buffer_begin);
+		if (result == http_request_parser::result_type::upgrade)
+		{
+			bool cur_websocket_enabled = m_ktls_socket ? bool(m_ktls_websocket_handoff) : bool(m_ssl_websocket_handoff);
+			if (cur_websocket_enabled && is_websocket_upgrade(m_request_parser.m_req))
+			{
+				m_buffer_begin += m_request_parser.consumed();
+				m_request_parser.move_req(m_request);
+				do_websocket_upgrade();
+				return;
+			}
+			// http2 is switched to by alpn over tls, the request is answered and the connection closed
+			result = http_request_parser::result_type::good;
+		}
+		if (result == http_request_parser::result_type::good)
+		{
+			m_buffer_begin += m_request_parser.consumed();
+		}
+		else
+		{
+			m_buffer_begin = m_buffer_end;
+		}
+		if (m_buffer_begin == m_buffer_end)
+		{
+			// the parsed request owns copies of the bytes, the buffer is free for other sessions
+			m_buffer.reset();
+			m_buffer_begin = 0;
+			m_buffer_end = 0;
+		}
+
+		if (result == http_request_parser::result_type::good)
+		{
+			handle_request();
+		}
+		else if (result == http_request_parser::result_type::bad)
+		{
+			m_metrics.parse_errors.add();
+			m_keep_alive = false;
+			m_reply = reply::stock_reply(reply::status_type::bad_request);
+			do_write();
+		}
+		else
+		{
+			do_read();
+		}
+	}
+
 	void https_server_session::do_write()
 	{
 		auto self(shared_from_this());
@@ -127,17 +550,80 @@ namespace spiritsaway::http_utils {
 					on_timeout("write reply");
 				}
 			});
-		m_reply_str = m_reply.to_string();
-		asio::async_write(*m_socket, asio::buffer(m_reply_str),
-			[this, self](asio_ec ec, std::size_t)
+		auto connection_header = m_reply.find_header("Connection");
+		if (!connection_header)
+		{
+			// http/1.0 clients only keep the connection when it is announced
+			m_reply.add_header("Connection", m_keep_alive ? "keep-alive" : "close");
+		}
+		else if (iequals(connection_header->value, "close"))
+		{
+			m_keep_alive = false;
+		}
+		m_reply_str.clear();
+		if (m_request.method == "HEAD")
+		{
+			// the client knows no body follows, sending one would be read as the next reply
+			m_reply_str = m_reply.to_head_string();
+		}
+#ifdef __linux__
+		else if (m_ktls_socket && m_ktls_socket->ktls_send_enabled() && !m_reply.content_file.empty())
+		{
+			m_content_file_fd = ::open(m_reply.content_file.c_str(), O_RDONLY);
+			struct stat file_stat;
+			if (m_content_file_fd >= 0 && ::fstat(m_content_file_fd, &file_stat) == 0)
 			{
+				// the kernel encrypts the file pages, only the head is built here
+				m_content_file_size = std::size_t(file_stat.st_size);
+				m_reply_str = m_reply.head_to_string(m_content_file_size);
+			}
+			else if (m_content_file_fd >= 0)
+			{
+				::close(m_content_file_fd);
+				m_content_file_fd = -1;
+			}
+		}
+#endif
+		if (m_reply_str.empty())
+		{
+			m_reply_str = m_reply.to_string();
+		}
+		m_phase_ts = std::chrono::steady_clock::now();
+		async_write_impl([this, self](asio_ec ec, std::size_t bytes_transferred)
+			{
+				alloc_scope cur_allocs(m_request_allocs);
 				m_con_timer.cancel();
-				if (!ec)
+				m_metrics.sent_bytes.add(bytes_transferred);
+				auto cur_write_us = elapsed_microseconds(m_phase_ts);
+				if (m_phases)
+				{
+					m_phases->write.record(cur_write_us);
+				}
+				m_metrics.log_access(m_request, m_reply.status_code, bytes_transferred, m_read_us, m_handler_us, cur_write_us);
+				if (m_traced)
 				{
+					m_traced = false;
+					m_metrics.end_trace(std::move(m_trace_span), m_reply.status_code, m_read_us, m_handler_us, cur_write_us, ec ? ec.message() : std::string());
+				}
+				if (!ec && should_close())
+				{
+					cur_allocs.flush();
+					m_metrics.end_request_allocs(m_request_allocs, m_heap_bytes);
 					// Initiate graceful https_server_session closure.
 					m_session_mgr.stop(shared_from_this());
 					return;
 				}
+				if (!ec)
+				{
+					on_write_finish();
+					// what stays allocated now is held by the idle connection
+					cur_allocs.flush();
+					m_metrics.end_request_allocs(m_request_allocs, m_heap_bytes);
+					do_read();
+					return;
+				}
+				cur_allocs.flush();
+				m_metrics.end_request_allocs(m_request_allocs, m_heap_bytes);
 
 				if (ec != asio::error::operation_aborted)
 				{
@@ -147,13 +633,59 @@ namespace spiritsaway::http_utils {
 			});
 	}
 
+	bool https_server_session::should_close() const
+	{
+		return !m_keep_alive || m_stopped;
+	}
+
+	void https_server_session::on_write_finish()
+	{
+#ifdef __linux__
+		if (m_content_file_fd >= 0)
+		{
+			::close(m_content_file_fd);
+			m_content_file_fd = -1;
+		}
+#endif
+		// an idle connection keeps no request or reply memory
+		m_reply = reply();
+		std::string().swap(m_reply_str);
+		m_request = request();
+		m_phases = nullptr;
+		m_read_us = 0;
+		m_handler_us = 0;
+		m_request_parser.reset();
+	}
+
 	void https_server_session::on_reply(const reply& in_reply)
 	{
 		if (m_stopped)
 		{
 			return;
 		}
+		// handlers may reply later from a callback of their own
+		alloc_scope cur_allocs(m_request_allocs);
 		m_con_timer.cancel();
+		if (m_phases)
+		{
+			m_handler_us = elapsed_microseconds(m_phase_ts);
+			m_phases->handler.record(m_handler_us);
+		}
+		if (in_reply.event_hub && (m_ktls_socket ? bool(m_ktls_sse_handoff) : bool(m_ssl_sse_handoff)))
+		{
+			// the connection stays open as an event stream, pipelined requests behind this one are dropped
+			m_buffer.reset();
+			m_session_mgr.remove(shared_from_this());
+			if (m_ktls_socket)
+			{
+				m_ktls_sse_handoff(std::move(m_ktls_socket), reply(in_reply));
+			}
+			else
+			{
+				m_ssl_sse_handoff(std::move(m_socket), reply(in_reply));
+			}
+			return;
+		}
 		m_reply = in_reply;
 		do_write();
 
@@ -162,6 +694,7 @@ namespace spiritsaway::http_utils {
 	{
 		m_stopped = true;
 		m_logger->warn("session {} timeout for {} ", m_session_idx, reason);
+		m_metrics.on_timeout(reason);
 		m_session_mgr.stop(shared_from_this());
 	}
 	void https_server_session::handle_request()
@@ -169,7 +702,15 @@ namespace spiritsaway::http_utils {
 		
 		m_con_timer.cancel();
 		auto self = shared_from_this();
+		m_keep_alive = m_request_parser.keep_alive();
 		m_request_parser.move_req(m_request);
+		m_metrics.requests.add();
+		m_phases = &m_metrics.phase_histograms(m_request);
+		m_read_us = elapsed_microseconds(m_phase_ts);
+		m_phases->read.record(m_read_us);
+		m_traced = m_metrics.begin_trace(m_request, m_trace_span, m_read_us);
+		m_request_started = false;
+		m_phase_ts = std::chrono::steady_clock::now();
 		if (m_con_timer.expires_from_now(std::chrono::seconds(m_timeout_seconds)) != 0)
 		{
 			m_session_mgr.stop(self);
@@ -184,6 +725,8 @@ namespace spiritsaway::http_utils {
 			});
 
 
+		// clients created by the handler join the trace of the request
+		trace_scope cur_trace_scope(m_trace_span.context(), m_traced ? m_metrics.tracer.get() : nullptr);
 		m_request_handler(m_request, [self, this](const reply& in_reply) {
 			on_reply(in_reply);
 			});
@@ -0,0 +1,257 @@
+#include "ktls_stream.h"
+#include <openssl/err.h>
+#include <cerrno>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+namespace spiritsaway::http_utils
+{
+	ktls_stream::ktls_stream(asio::ip::tcp::socket&& socket, asio::ssl::context& ssl_ctx)
+		: m_socket(std::move(socket))
+		, m_ssl(SSL_new(ssl_ctx.native_handle()))
+	{
+		SSL_set_fd(m_ssl, int(m_socket.native_handle()));
+		SSL_set_accept_state(m_ssl);
+		asio_ec ignore_ec;
+		m_socket.non_blocking(true, ignore_ec);
+	}
+
+	ktls_stream::~ktls_stream()
+	{
+		SSL_free(m_ssl);
+	}
+
+	// openssl before 3.0 has no ktls and does not define the macros
+	bool ktls_stream::ktls_send_enabled() const
+	{
+#ifdef BIO_get_ktls_send
+		return BIO_get_ktls_send(SSL_get_wbio(m_ssl));
+#else
+		return false;
+#endif
+	}
+
+	bool ktls_stream::ktls_recv_enabled() const
+	{
+#ifdef BIO_get_ktls_recv
+		return BIO_get_ktls_recv(SSL_get_rbio(m_ssl));
+#else
+		return false;
+#endif
+	}
+
+	asio_ec ktls_stream::make_error(int ssl_error) const
+	{
+		if (ssl_error == SSL_ERROR_ZERO_RETURN)
+		{
+			return asio::error::eof;
+		}
+		if (ssl_error == SSL_ERROR_SYSCALL)
+		{
+			if (errno == 0)
+			{
+				return asio::error::eof;
+			}
+			return asio_ec(errno, asio::error::get_system_category());
+		}
+		return asio_ec(int(ERR_get_error()), asio::error::get_ssl_category());
+	}
+
+	bool ktls_stream::wait_socket(int ssl_error, std::function<void(const asio_ec&)> retry_handler)
+	{
+		if (ssl_error == SSL_ERROR_WANT_READ)
+		{
+			m_socket.async_wait(asio::ip::tcp::socket::wait_read, retry_handler);
+			return true;
+		}
+		if (ssl_error == SSL_ERROR_WANT_WRITE)
+		{
+			m_socket.async_wait(asio::ip::tcp::socket::wait_write, retry_handler);
+			return true;
+		}
+		return false;
+	}
+
+	void ktls_stream::async_handshake(handshake_handler handler)
+	{
+		ERR_clear_error();
+		errno = 0;
+		auto ret = SSL_do_handshake(m_ssl);
+		if (ret == 1)
+		{
+			asio::post(m_socket.get_executor(), [handler]()
+			{
+				handler(asio_ec());
+			});
+			return;
+		}
+		auto ssl_error = SSL_get_error(m_ssl, ret);
+		if (wait_socket(ssl_error, [this, handler](const asio_ec& ec)
+			{
+				if (ec)
+				{
+					handler(ec);
+					return;
+				}
+				async_handshake(handler);
+			}))
+		{
+			return;
+		}
+		asio::post(m_socket.get_executor(), [handler, ec = make_error(ssl_error)]()
+		{
+			handler(ec);
+		});
+	}
+
+	void ktls_stream::async_read_some(asio::mutable_buffer buffer, io_handler handler)
+	{
+		ERR_clear_error();
+		errno = 0;
+		std::size_t read_sz = 0;
+		auto ret = SSL_read_ex(m_ssl, buffer.data(), buffer.size(), &read_sz);
+		if (ret == 1)
+		{
+			asio::post(m_socket.get_executor(), [handler, read_sz]()
+			{
+				handler(asio_ec(), read_sz);
+			});
+			return;
+		}
+		auto ssl_error = SSL_get_error(m_ssl, ret);
+		if (wait_socket(ssl_error, [this, buffer, handler](const asio_ec& ec)
+			{
+				if (ec)
+				{
+					handler(ec, 0);
+					return;
+				}
+				async_read_some(buffer, handler);
+			}))
+		{
+			return;
+		}
+		asio::post(m_socket.get_executor(), [handler, ec = make_error(ssl_error)]()
+		{
+			handler(ec, 0);
+		});
+	}
+
+	void ktls_stream::async_wait_readable(handshake_handler handler)
+	{
+		if (SSL_has_pending(m_ssl))
+		{
+			asio::post(m_socket.get_executor(), [handler]()
+			{
+				handler(asio_ec());
+			});
+			return;
+		}
+		m_socket.async_wait(asio::ip::tcp::socket::wait_read, handler);
+	}
+
+	void ktls_stream::async_write(asio::const_buffer buffer, io_handler handler)
+	{
+		if (ktls_send_enabled())
+		{
+			// the kernel turns plain socket writes into tls records
+			asio::async_write(m_socket, buffer, handler);
+			return;
+		}
+		write_some(buffer, 0, handler);
+	}
+
+	void ktls_stream::write_some(asio::const_buffer buffer, std::size_t written, io_handler handler)
+	{
+		while (written < buffer.size())
+		{
+			ERR_clear_error();
+			errno = 0;
+			std::size_t cur_written = 0;
+			auto ret = SSL_write_ex(m_ssl, static_cast<const char*>(buffer.data()) + written, buffer.size() - written, &cur_written);
+			if (ret == 1)
+			{
+				written += cur_written;
+				continue;
+			}
+			auto ssl_error = SSL_get_error(m_ssl, ret);
+			if (wait_socket(ssl_error, [this, buffer, written, handler](const asio_ec& ec)
+				{
+					if (ec)
+					{
+						handler(ec, written);
+						return;
+					}
+					write_some(buffer, written, handler);
+				}))
+			{
+				return;
+			}
+			asio::post(m_socket.get_executor(), [handler, written, ec = make_error(ssl_error)]()
+			{
+				handler(ec, written);
+			});
+			return;
+		}
+		asio::post(m_socket.get_executor(), [handler, written]()
+		{
+			handler(asio_ec(), written);
+		});
+	}
+
+	void ktls_stream::async_sendfile(int file_fd, std::int64_t offset, std::size_t size, io_handler handler)
+	{
+#ifdef __linux__
+		std::size_t sent_sz = 0;
+		while (sent_sz < size)
+		{
+			off_t cur_offset = off_t(offset + sent_sz);
+			auto ret = ::sendfile(int(m_socket.native_handle()), file_fd, &cur_offset, size - sent_sz);
+			if (ret > 0)
+			{
+				sent_sz += std::size_t(ret);
+				continue;
+			}
+			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			{
+				m_socket.async_wait(asio::ip::tcp::socket::wait_write, [this, file_fd, offset, size, sent_sz, handler](const asio_ec& ec)
+				{
+					if (ec)
+					{
+						handler(ec, sent_sz);
+						return;
+					}
+					async_sendfile(file_fd, offset + sent_sz, size - sent_sz, [sent_sz, handler](const asio_ec& ec, std::size_t n)
+					{
+						handler(ec, sent_sz + n);
+					});
+				});
+				return;
+			}
+			auto cur_ec = ret == 0 ? asio_ec(asio::error::eof) : asio_ec(errno, asio::error::get_system_category());
+			asio::post(m_socket.get_executor(), [handler, sent_sz, cur_ec]()
+			{
+				handler(cur_ec, sent_sz);
+			});
+			return;
+		}
+		asio::post(m_socket.get_executor(), [handler, sent_sz]()
+		{
+			handler(asio_ec(), sent_sz);
+		});
+#else
+		asio::post(m_socket.get_executor(), [handler]()
+		{
+			handler(asio::error::operation_not_supported, 0);
+		});
+#endif
+	}
+
+	void ktls_stream::shutdown(asio_ec& ec)
+	{
+		ERR_clear_error();
+		SSL_shutdown(m_ssl);
+		m_socket.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+	}
+}
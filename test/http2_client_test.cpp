@@ -0,0 +1,134 @@
+#include <http_server.h>
+#include <https_server.h>
+#include <https_client.h>
+#include <iostream>
+#include <thread>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/logger.h>
+
+using namespace spiritsaway::http_utils;
+
+std::shared_ptr<spdlog::logger> create_logger(const std::string& name)
+{
+	auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+	console_sink->set_level(spdlog::level::warn);
+	std::string pattern = "[" + name + "] [%^%l%$] %v";
+	console_sink->set_pattern(pattern);
+	auto logger = std::make_shared<spdlog::logger>(name, spdlog::sinks_init_list{ console_sink });
+	logger->set_level(spdlog::level::warn);
+	return logger;
+}
+
+class echo_http_server : public http_server
+{
+public:
+	using http_server::http_server;
+protected:
+	void handle_request(const request& req, reply_handler rep_cb) override
+	{
+		reply rep;
+		rep.status_code = 200;
+		rep.content = "echo request uri: " + req.uri + " body: " + req.body;
+		rep.add_header("Content-Type", "text");
+		rep_cb(rep);
+	}
+};
+
+class echo_https_server : public https_server
+{
+public:
+	using https_server::https_server;
+protected:
+	void handle_request(const request& req, reply_handler rep_cb) override
+	{
+		reply rep;
+		rep.status_code = 200;
+		rep.content = "echo request uri: " + req.uri + " body: " + req.body;
+		rep.add_header("Content-Type", "text");
+		rep_cb(rep);
+	}
+};
+
+// issue count requests at once on one client and wait for all the replies
+template <typename Client>
+void run_requests(asio::io_context& ioc, std::shared_ptr<Client> client, const std::string& name, std::size_t count)
+{
+	std::size_t ok_num = 0;
+	std::size_t error_num = 0;
+	std::string last_error;
+	auto begin_ts = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < count; i++)
+	{
+		request cur_req;
+		cur_req.method = i % 2 ? "POST" : "GET";
+		cur_req.uri = "/" + std::to_string(i);
+		cur_req.body = i % 2 ? "body " + std::to_string(i) : std::string();
+		cur_req.http_version_major = 2;
+		cur_req.http_version_minor = 0;
+		cur_req.headers.push_back(header{ "User-Agent", "http2_client_test" });
+		client->async_request(cur_req, [&, i, expected = "echo request uri: " + cur_req.uri + " body: " + cur_req.body](const std::string& err, const reply& rep)
+			{
+				if (err.empty() && rep.status_code == 200 && rep.content == expected)
+				{
+					ok_num++;
+				}
+				else
+				{
+					error_num++;
+					last_error = err;
+				}
+				if (ok_num + error_num == count)
+				{
+					client->close();
+				}
+			}, 10);
+	}
+	ioc.run();
+	ioc.restart();
+	auto cost_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin_ts).count();
+	auto cur_stats = client->get_stats();
+	std::cout << name << ": " << ok_num << " ok " << error_num << " errors " << last_error << " in " << cost_ms << "ms, "
+		<< cur_stats.connections << " connections, max " << cur_stats.max_active_streams << " concurrent streams" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	std::size_t count = 10000;
+	if (argc > 1)
+	{
+		count = std::stoul(argv[1]);
+	}
+	auto cur_logger = create_logger("http2");
+	try
+	{
+		asio::io_context server_ioc;
+		http2_settings server_settings;
+		server_settings.max_concurrent_streams = 1000;
+		echo_http_server h2c_server(server_ioc, cur_logger, "127.0.0.1", "8460");
+		h2c_server.enable_http2(server_settings);
+		h2c_server.run();
+		asio::ssl::context server_ctx{ asio::ssl::context::tls_server };
+		server_ctx.use_certificate_chain_file("../data/keys/server.crt");
+		server_ctx.use_private_key_file("../data/keys/server.key", asio::ssl::context::pem);
+		echo_https_server h2_server(server_ioc, server_ctx, cur_logger, "127.0.0.1", "8461");
+		h2_server.enable_http2(server_settings);
+		h2_server.run();
+		std::thread server_thread([&server_ioc]()
+			{
+				server_ioc.run();
+			});
+
+		asio::io_context client_ioc;
+		run_requests(client_ioc, make_h2c_client(client_ioc, cur_logger, "127.0.0.1", "8460"), "h2c", count);
+		asio::ssl::context client_ctx{ asio::ssl::context::tls_client };
+		run_requests(client_ioc, make_h2_client(client_ioc, client_ctx, cur_logger, "127.0.0.1", "8461"), "h2", count);
+
+		server_ioc.stop();
+		server_thread.join();
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << "exception: " << e.what() << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,629 @@
+#include "http2_connection.h"
+#include "sse_hub.h"
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+using namespace spiritsaway::http_utils;
+
+// checks the framing, hpack and flow control of http2_connection without any socket, frames are
+// written by hand and fed in, the frames it queues are parsed back from output()
+
+std::size_t g_failed_num = 0;
+
+void check(bool ok, const std::string& name)
+{
+	std::cout << (ok ? "ok " : "FAILED ") << name << std::endl;
+	if (!ok)
+	{
+		g_failed_num++;
+	}
+}
+
+std::string from_hex(std::string_view hex)
+{
+	std::string result;
+	for (std::size_t i = 0; i + 1 < hex.size(); i += 2)
+	{
+		result.push_back(char(std::stoi(std::string(hex.substr(i, 2)), nullptr, 16)));
+	}
+	return result;
+}
+
+struct http2_frame
+{
+	std::uint8_t type;
+	std::uint8_t flags;
+	std::uint32_t stream_id;
+	std::string payload;
+};
+
+const std::uint8_t frame_data = 0x0;
+const std::uint8_t frame_headers = 0x1;
+const std::uint8_t frame_rst_stream = 0x3;
+const std::uint8_t frame_settings = 0x4;
+const std::uint8_t frame_ping = 0x6;
+const std::uint8_t frame_goaway = 0x7;
+const std::uint8_t frame_window_update = 0x8;
+const std::uint8_t frame_continuation = 0x9;
+const std::uint8_t flag_end_stream = 0x1;
+const std::uint8_t flag_end_headers = 0x4;
+
+std::uint32_t read_u32(std::string_view data)
+{
+	return (std::uint32_t(std::uint8_t(data[0])) << 24) | (std::uint32_t(std::uint8_t(data[1])) << 16)
+		| (std::uint32_t(std::uint8_t(data[2])) << 8) | std::uint32_t(std::uint8_t(data[3]));
+}
+
+void write_u32(std::string& dest, std::uint32_t value)
+{
+	dest.push_back(char(value >> 24));
+	dest.push_back(char(value >> 16));
+	dest.push_back(char(value >> 8));
+	dest.push_back(char(value));
+}
+
+std::string make_frame(std::uint8_t type, std::uint8_t flags, std::uint32_t stream_id, std::string_view payload)
+{
+	std::string result;
+	result.push_back(char(payload.size() >> 16));
+	result.push_back(char(payload.size() >> 8));
+	result.push_back(char(payload.size()));
+	result.push_back(char(type));
+	result.push_back(char(flags));
+	write_u32(result, stream_id);
+	result += payload;
+	return result;
+}
+
+std::string make_settings(const std::vector<std::pair<std::uint16_t, std::uint32_t>>& settings)
+{
+	std::string payload;
+	for (const auto& one_setting : settings)
+	{
+		payload.push_back(char(one_setting.first >> 8));
+		payload.push_back(char(one_setting.first));
+		write_u32(payload, one_setting.second);
+	}
+	return make_frame(frame_settings, 0, 0, payload);
+}
+
+std::string make_window_update(std::uint32_t stream_id, std::uint32_t increment)
+{
+	std::string payload;
+	write_u32(payload, increment);
+	return make_frame(frame_window_update, 0, stream_id, payload);
+}
+
+// parse and clear the queued output
+std::vector<http2_frame> take_frames(http2_connection& conn)
+{
+	std::vector<http2_frame> result;
+	auto& cur_output = conn.output();
+	std::size_t offset = 0;
+	while (cur_output.size() - offset >= 9)
+	{
+		auto cur_header = reinterpret_cast<const std::uint8_t*>(cur_output.data() + offset);
+		std::size_t cur_len = (std::size_t(cur_header[0]) << 16) | (std::size_t(cur_header[1]) << 8) | std::size_t(cur_header[2]);
+		http2_frame cur_frame;
+		cur_frame.type = cur_header[3];
+		cur_frame.flags = cur_header[4];
+		cur_frame.stream_id = read_u32(std::string_view(cur_output.data() + offset + 5, 4)) & 0x7fffffff;
+		cur_frame.payload = cur_output.substr(offset + 9, cur_len);
+		result.push_back(std::move(cur_frame));
+		offset += 9 + cur_len;
+	}
+	cur_output.clear();
+	return result;
+}
+
+std::size_t count_frames(const std::vector<http2_frame>& frames, std::uint8_t type)
+{
+	return std::count_if(frames.begin(), frames.end(), [=](const http2_frame& one_frame)
+		{
+			return one_frame.type == type;
+		});
+}
+
+std::size_t data_size(const std::vector<http2_frame>& frames, std::uint32_t stream_id)
+{
+	std::size_t result = 0;
+	for (const auto& one_frame : frames)
+	{
+		if (one_frame.type == frame_data && one_frame.stream_id == stream_id)
+		{
+			result += one_frame.payload.size();
+		}
+	}
+	return result;
+}
+
+bool has_goaway(const std::vector<http2_frame>& frames, http2_error_code error_code)
+{
+	return std::any_of(frames.begin(), frames.end(), [=](const http2_frame& one_frame)
+		{
+			return one_frame.type == frame_goaway && read_u32(std::string_view(one_frame.payload).substr(4)) == std::uint32_t(error_code);
+		});
+}
+
+bool has_rst_stream(const std::vector<http2_frame>& frames, std::uint32_t stream_id, http2_error_code error_code)
+{
+	return std::any_of(frames.begin(), frames.end(), [=](const http2_frame& one_frame)
+		{
+			return one_frame.type == frame_rst_stream && one_frame.stream_id == stream_id && read_u32(one_frame.payload) == std::uint32_t(error_code);
+		});
+}
+
+bool same_headers(const std::vector<header>& a, const std::vector<header>& b)
+{
+	return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const header& x, const header& y)
+		{
+			return x.name == y.name && x.value == y.value;
+		});
+}
+
+std::string find_value(const std::vector<header>& headers, const std::string& name)
+{
+	auto cur_iter = std::find_if(headers.begin(), headers.end(), [&](const header& one_header)
+		{
+			return one_header.name == name;
+		});
+	return cur_iter == headers.end() ? std::string() : cur_iter->value;
+}
+
+std::vector<header> request_headers(const std::string& method, const std::string& path)
+{
+	return { { ":method", method }, { ":scheme", "https" }, { ":authority", "www.example.com" }, { ":path", path } };
+}
+
+std::string encode_block(const std::vector<header>& headers)
+{
+	hpack_encoder cur_encoder;
+	std::string result;
+	cur_encoder.encode(headers, result);
+	return result;
+}
+
+// a server connection that got the preface and the client settings, its own frames are dropped
+void start_server(http2_connection& server, const std::vector<std::pair<std::uint16_t, std::uint32_t>>& client_settings = {})
+{
+	server.start();
+	std::string cur_input(http2_preface);
+	cur_input += make_settings(client_settings);
+	server.feed(cur_input.data(), cur_input.size());
+	take_frames(server);
+}
+
+void feed(http2_connection& conn, const std::string& data)
+{
+	conn.feed(data.data(), data.size());
+}
+
+// move the queued frames between both sides until neither has anything to say
+void pump(http2_connection& client, http2_connection& server)
+{
+	while (!client.output().empty() || !server.output().empty())
+	{
+		std::string cur_output;
+		cur_output.swap(client.output());
+		server.feed(cur_output.data(), cur_output.size());
+		cur_output.clear();
+		cur_output.swap(server.output());
+		client.feed(cur_output.data(), cur_output.size());
+	}
+}
+
+void test_hpack_sequence(const std::string& name, std::size_t table_size, const std::vector<std::pair<std::string_view, std::vector<header>>>& blocks)
+{
+	hpack_decoder cur_decoder(table_size);
+	for (std::size_t i = 0; i < blocks.size(); i++)
+	{
+		auto cur_block = from_hex(blocks[i].first);
+		std::vector<header> cur_headers;
+		bool ok = cur_decoder.decode(reinterpret_cast<const std::uint8_t*>(cur_block.data()), cur_block.size(), cur_headers);
+		check(ok && same_headers(cur_headers, blocks[i].second), name + "." + std::to_string(i + 1));
+	}
+}
+
+bool decode_block(const std::string& block, std::vector<header>& result)
+{
+	hpack_decoder cur_decoder;
+	return cur_decoder.decode(reinterpret_cast<const std::uint8_t*>(block.data()), block.size(), result);
+}
+
+bool huffman_decode_string(const std::string& src, std::string& dest)
+{
+	return huffman_decode(reinterpret_cast<const std::uint8_t*>(src.data()), src.size(), dest);
+}
+
+void test_hpack()
+{
+	// RFC 7541 Appendix C
+	std::vector<header> request_1 = { { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" } };
+	auto request_2 = request_1;
+	request_2.push_back({ "cache-control", "no-cache" });
+	std::vector<header> request_3 = { { ":method", "GET" }, { ":scheme", "https" }, { ":path", "/index.html" },
+		{ ":authority", "www.example.com" }, { "custom-key", "custom-value" } };
+	test_hpack_sequence("C.3 requests without huffman", 4096, {
+		{ "828684410f7777772e6578616d706c652e636f6d", request_1 },
+		{ "828684be58086e6f2d6361636865", request_2 },
+		{ "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565", request_3 },
+	});
+	test_hpack_sequence("C.4 requests with huffman", 4096, {
+		{ "828684418cf1e3c2e5f23a6ba0ab90f4ff", request_1 },
+		{ "828684be5886a8eb10649cbf", request_2 },
+		{ "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf", request_3 },
+	});
+
+	// the 256 byte table evicts the oldest entries
+	std::vector<header> response_1 = { { ":status", "302" }, { "cache-control", "private" },
+		{ "date", "Mon, 21 Oct 2013 20:13:21 GMT" }, { "location", "https://www.example.com" } };
+	auto response_2 = response_1;
+	response_2[0].value = "307";
+	std::vector<header> response_3 = { { ":status", "200" }, { "cache-control", "private" },
+		{ "date", "Mon, 21 Oct 2013 20:13:22 GMT" }, { "location", "https://www.example.com" },
+		{ "content-encoding", "gzip" }, { "set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1" } };
+	test_hpack_sequence("C.5 responses without huffman", 256, {
+		{ "4803333032580770726976617465611d4d6f6e2c203231204f637420323031332032303a31333a323120474d546e1768747470733a2f2f7777772e6578616d706c652e636f6d", response_1 },
+		{ "4803333037c1c0bf", response_2 },
+		{ "88c1611d4d6f6e2c203231204f637420323031332032303a31333a323220474d54c05a04677a69707738666f6f3d4153444a4b48514b425a584f5157454f50495541585157454f49553b206d61782d6167653d333630303b2076657273696f6e3d31", response_3 },
+	});
+	test_hpack_sequence("C.6 responses with huffman", 256, {
+		{ "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3", response_1 },
+		{ "4883640effc1c0bf", response_2 },
+		{ "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1ab270fb5291f9587316065c003ed4ee5b1063d5007", response_3 },
+	});
+
+	// what the encoder writes decodes back with the tables in sync
+	hpack_encoder cur_encoder;
+	hpack_decoder cur_decoder;
+	bool round_trip_ok = true;
+	for (const auto& one_headers : { request_1, request_2, request_3, request_3 })
+	{
+		std::string cur_block;
+		cur_encoder.encode(one_headers, cur_block);
+		std::vector<header> cur_headers;
+		round_trip_ok = round_trip_ok && cur_decoder.decode(reinterpret_cast<const std::uint8_t*>(cur_block.data()), cur_block.size(), cur_headers)
+			&& same_headers(cur_headers, one_headers);
+	}
+	check(round_trip_ok, "encoder round trip");
+
+	std::string cur_string;
+	std::string cur_encoded;
+	huffman_encode("www.example.com", cur_encoded);
+	check(cur_encoded == from_hex("f1e3c2e5f23a6ba0ab90f4ff"), "huffman encode");
+	// 'a' is 00011, the 3 padding bits are the most significant bits of eos
+	check(huffman_decode_string(from_hex("1f"), cur_string) && cur_string == "a", "huffman padding of ones");
+	cur_string.clear();
+	check(!huffman_decode_string(from_hex("18"), cur_string), "huffman padding of zeros rejected");
+	cur_string.clear();
+	check(!huffman_decode_string(from_hex("1fff"), cur_string), "huffman padding longer than 7 bits rejected");
+	cur_string.clear();
+	// the 30 bit eos followed by 2 bits of padding
+	check(!huffman_decode_string(from_hex("ffffffff"), cur_string), "huffman eos rejected");
+	cur_string.clear();
+	check(!huffman_decode_string(from_hex("1fffffffff"), cur_string), "huffman eos after a symbol rejected");
+
+	std::vector<header> cur_headers;
+	check(!decode_block(from_hex("418118"), cur_headers), "block with invalid huffman padding rejected");
+	cur_headers.clear();
+	check(!decode_block(from_hex("4184ffffffff"), cur_headers), "block with huffman eos rejected");
+	cur_headers.clear();
+	check(!decode_block(from_hex("80"), cur_headers), "index 0 rejected");
+	cur_headers.clear();
+	check(!decode_block(from_hex("be"), cur_headers), "index past the tables rejected");
+	cur_headers.clear();
+	check(!decode_block(from_hex("3fe13f"), cur_headers), "table size update above the setting rejected");
+	cur_headers.clear();
+	check(!decode_block(from_hex("410f7777"), cur_headers), "truncated string rejected");
+}
+
+void test_continuation()
+{
+	auto cur_headers = request_headers("GET", "/split");
+	cur_headers.push_back({ "x-trace", "continued across frames" });
+	auto cur_block = encode_block(cur_headers);
+
+	// the block split at every byte
+	bool split_ok = true;
+	for (std::size_t i = 1; i < cur_block.size(); i++)
+	{
+		http2_connection server;
+		start_server(server);
+		feed(server, make_frame(frame_headers, flag_end_stream, 1, cur_block.substr(0, i))
+			+ make_frame(frame_continuation, 0, 1, "")
+			+ make_frame(frame_continuation, flag_end_headers, 1, cur_block.substr(i)));
+		auto cur_requests = server.take_requests();
+		split_ok = split_ok && !server.failed() && cur_requests.size() == 1 && cur_requests[0].second.uri == "/split"
+			&& find_value(cur_requests[0].second.headers, "x-trace") == "continued across frames";
+	}
+	check(split_ok, "CONTINUATION reassembled at every split");
+
+	// fed one byte at a time
+	{
+		http2_connection server;
+		start_server(server);
+		auto cur_input = make_frame(frame_headers, flag_end_stream, 1, cur_block.substr(0, 5))
+			+ make_frame(frame_continuation, flag_end_headers, 1, cur_block.substr(5));
+		for (auto one_char : cur_input)
+		{
+			server.feed(&one_char, 1);
+		}
+		auto cur_requests = server.take_requests();
+		check(cur_requests.size() == 1 && cur_requests[0].second.uri == "/split", "CONTINUATION fed byte by byte");
+	}
+
+	// the block of a large header is split by the sender
+	{
+		http2_connection client(http2_settings(), http2_role::client);
+		http2_connection server;
+		client.start();
+		server.start();
+		pump(client, server);
+		request cur_req;
+		cur_req.method = "GET";
+		cur_req.uri = "/large";
+		cur_req.headers.push_back({ "x-large", std::string(50000, 'a') });
+		client.submit_request(cur_req, "https", "www.example.com");
+		std::string cur_output = client.output();
+		auto cur_frames = take_frames(client);
+		client.output() = cur_output;
+		pump(client, server);
+		auto cur_requests = server.take_requests();
+		check(count_frames(cur_frames, frame_continuation) > 0 && cur_requests.size() == 1
+			&& find_value(cur_requests[0].second.headers, "x-large").size() == 50000,
+			"large header block sent in CONTINUATION frames");
+	}
+
+	// nothing else may come between HEADERS and its CONTINUATION
+	{
+		http2_connection server;
+		start_server(server);
+		feed(server, make_frame(frame_headers, flag_end_stream, 1, cur_block.substr(0, 5))
+			+ make_frame(frame_ping, 0, 0, std::string(8, '\0')));
+		check(server.failed() && has_goaway(take_frames(server), http2_error_code::protocol_error), "frame between HEADERS and CONTINUATION rejected");
+	}
+	{
+		http2_connection server;
+		start_server(server);
+		feed(server, make_frame(frame_headers, flag_end_stream, 1, cur_block.substr(0, 5))
+			+ make_frame(frame_continuation, flag_end_headers, 3, cur_block.substr(5)));
+		check(server.failed() && has_goaway(take_frames(server), http2_error_code::protocol_error), "CONTINUATION of another stream rejected");
+	}
+	{
+		http2_connection server;
+		start_server(server);
+		feed(server, make_frame(frame_continuation, flag_end_headers, 1, cur_block));
+		check(server.failed() && has_goaway(take_frames(server), http2_error_code::protocol_error), "CONTINUATION without HEADERS rejected");
+	}
+}
+
+void test_initial_window_size()
+{
+	const std::uint16_t settings_initial_window_size = 0x4;
+	http2_connection server;
+	start_server(server, { { settings_initial_window_size, 1000 } });
+	feed(server, make_frame(frame_headers, flag_end_stream | flag_end_headers, 1, encode_block(request_headers("GET", "/window"))));
+	server.take_requests();
+	reply cur_reply;
+	cur_reply.status_code = 200;
+	cur_reply.content = std::string(5000, 'x');
+	server.submit_reply(1, cur_reply);
+	check(data_size(take_frames(server), 1) == 1000, "reply stops at the initial window");
+
+	// raising the setting grows the window of the open stream
+	feed(server, make_settings({ { settings_initial_window_size, 4000 } }));
+	check(data_size(take_frames(server), 1) == 3000, "larger SETTINGS_INITIAL_WINDOW_SIZE resumes the open stream");
+
+	// lowering it takes the window below zero
+	feed(server, make_settings({ { settings_initial_window_size, 1000 } }));
+	feed(server, make_window_update(1, 3000));
+	check(data_size(take_frames(server), 1) == 0, "smaller SETTINGS_INITIAL_WINDOW_SIZE leaves a negative window");
+	feed(server, make_window_update(1, 1000));
+	auto cur_frames = take_frames(server);
+	check(data_size(cur_frames, 1) == 1000 && (cur_frames.back().flags & flag_end_stream) && server.active_stream_count() == 0,
+		"WINDOW_UPDATE past the negative window finishes the reply");
+
+	{
+		http2_connection server;
+		start_server(server);
+		feed(server, make_settings({ { settings_initial_window_size, 0x80000000u } }));
+		check(server.failed() && has_goaway(take_frames(server), http2_error_code::flow_control_error), "SETTINGS_INITIAL_WINDOW_SIZE above 2^31-1 rejected");
+	}
+	{
+		// a stream whose request body is still coming, its window at the maximum
+		http2_connection server;
+		start_server(server);
+		feed(server, make_frame(frame_headers, flag_end_headers, 1, encode_block(request_headers("POST", "/upload"))));
+		feed(server, make_window_update(1, 0x7fffffff - 65535));
+		check(!server.failed(), "stream window raised to 2^31-1");
+		feed(server, make_settings({ { settings_initial_window_size, 65536 } }));
+		check(server.failed() && has_goaway(take_frames(server), http2_error_code::flow_control_error), "SETTINGS_INITIAL_WINDOW_SIZE overflowing an open stream rejected");
+	}
+}
+
+void test_window_update()
+{
+	{
+		http2_connection server;
+		start_server(server);
+		feed(server, make_window_update(0, 0x7fffffff - 65535));
+		check(!server.failed(), "connection window raised to 2^31-1");
+		feed(server, make_window_update(0, 1));
+		check(server.failed() && has_goaway(take_frames(server), http2_error_code::flow_control_error), "connection WINDOW_UPDATE overflow rejected");
+	}
+	{
+		http2_connection server;
+		start_server(server);
+		feed(server, make_window_update(0, 0));
+		check(server.failed() && has_goaway(take_frames(server), http2_error_code::protocol_error), "connection WINDOW_UPDATE of 0 rejected");
+	}
+	{
+		http2_connection server;
+		start_server(server);
+		feed(server, make_frame(frame_headers, flag_end_headers, 1, encode_block(request_headers("POST", "/upload"))));
+		feed(server, make_window_update(1, 0x7fffffff));
+		auto cur_frames = take_frames(server);
+		check(!server.failed() && has_rst_stream(cur_frames, 1, http2_error_code::flow_control_error) && server.active_stream_count() == 0,
+			"stream WINDOW_UPDATE overflow resets the stream");
+	}
+	{
+		http2_connection server;
+		start_server(server);
+		feed(server, make_frame(frame_headers, flag_end_headers, 1, encode_block(request_headers("POST", "/upload"))));
+		feed(server, make_window_update(1, 0));
+		check(!server.failed() && has_rst_stream(take_frames(server), 1, http2_error_code::protocol_error), "stream WINDOW_UPDATE of 0 resets the stream");
+	}
+}
+
+void test_head_and_empty_body()
+{
+	hpack_decoder reply_decoder;
+	auto decode_reply = [&](const http2_frame& one_frame)
+	{
+		std::vector<header> result;
+		reply_decoder.decode(reinterpret_cast<const std::uint8_t*>(one_frame.payload.data()), one_frame.payload.size(), result);
+		return result;
+	};
+
+	http2_connection server;
+	start_server(server);
+	hpack_encoder request_encoder;
+	std::string cur_block;
+	request_encoder.encode(request_headers("HEAD", "/head"), cur_block);
+	feed(server, make_frame(frame_headers, flag_end_stream | flag_end_headers, 1, cur_block));
+	auto cur_requests = server.take_requests();
+	check(cur_requests.size() == 1 && cur_requests[0].second.method == "HEAD", "HEAD request");
+	reply cur_reply;
+	cur_reply.status_code = 200;
+	cur_reply.content = "hello";
+	server.submit_reply(1, cur_reply);
+	auto cur_frames = take_frames(server);
+	check(cur_frames.size() == 1 && cur_frames[0].type == frame_headers && (cur_frames[0].flags & flag_end_stream)
+		&& find_value(decode_reply(cur_frames[0]), "content-length") == "5" && server.active_stream_count() == 0,
+		"HEAD reply ends with its HEADERS and keeps the content-length");
+
+	cur_block.clear();
+	request_encoder.encode(request_headers("GET", "/empty"), cur_block);
+	feed(server, make_frame(frame_headers, flag_end_stream | flag_end_headers, 3, cur_block));
+	server.take_requests();
+	cur_reply.content.clear();
+	server.submit_reply(3, cur_reply);
+	cur_frames = take_frames(server);
+	check(cur_frames.size() == 1 && cur_frames[0].type == frame_headers && (cur_frames[0].flags & flag_end_stream)
+		&& find_value(decode_reply(cur_frames[0]), "content-length") == "0", "empty reply ends with its HEADERS");
+
+	// a GET after the HEAD still gets its body
+	cur_block.clear();
+	request_encoder.encode(request_headers("GET", "/head"), cur_block);
+	feed(server, make_frame(frame_headers, flag_end_stream | flag_end_headers, 5, cur_block));
+	server.take_requests();
+	cur_reply.content = "hello";
+	server.submit_reply(5, cur_reply);
+	cur_frames = take_frames(server);
+	check(data_size(cur_frames, 5) == 5 && (cur_frames.back().flags & flag_end_stream), "GET reply keeps its DATA");
+
+	// both sides, the client completes the HEAD reply without DATA
+	http2_connection client(http2_settings(), http2_role::client);
+	http2_connection peer_server;
+	client.start();
+	peer_server.start();
+	pump(client, peer_server);
+	request cur_req;
+	cur_req.method = "HEAD";
+	cur_req.uri = "/head";
+	auto head_stream = client.submit_request(cur_req, "https", "www.example.com");
+	cur_req.method = "POST";
+	cur_req.uri = "/empty";
+	auto post_stream = client.submit_request(cur_req, "https", "www.example.com");
+	pump(client, peer_server);
+	auto peer_requests = peer_server.take_requests();
+	check(peer_requests.size() == 2 && peer_requests[1].second.body.empty(), "POST with an empty body");
+	for (const auto& one_request : peer_requests)
+	{
+		peer_server.submit_reply(one_request.first, cur_reply);
+	}
+	pump(client, peer_server);
+	auto cur_replies = client.take_replies();
+	std::sort(cur_replies.begin(), cur_replies.end(), [](const auto& a, const auto& b)
+		{
+			return a.first < b.first;
+		});
+	check(cur_replies.size() == 2 && cur_replies[0].first == head_stream && cur_replies[0].second.status_code == 200
+		&& cur_replies[0].second.content.empty() && cur_replies[1].first == post_stream && cur_replies[1].second.content == "hello"
+		&& client.active_stream_count() == 0, "client gets the HEAD reply without a body");
+}
+
+void test_file_and_event_replies()
+{
+	hpack_decoder reply_decoder;
+	auto decode_reply = [&](const http2_frame& one_frame)
+	{
+		std::vector<header> result;
+		reply_decoder.decode(reinterpret_cast<const std::uint8_t*>(one_frame.payload.data()), one_frame.payload.size(), result);
+		return result;
+	};
+	auto reply_data = [](const std::vector<http2_frame>& frames)
+	{
+		std::string result;
+		for (const auto& one_frame : frames)
+		{
+			if (one_frame.type == frame_data)
+			{
+				result += one_frame.payload;
+			}
+		}
+		return result;
+	};
+
+	http2_connection server;
+	start_server(server);
+	hpack_encoder request_encoder;
+	std::string cur_block;
+	request_encoder.encode(request_headers("GET", "/file"), cur_block);
+	feed(server, make_frame(frame_headers, flag_end_stream | flag_end_headers, 1, cur_block));
+	server.take_requests();
+	std::string cur_file_name = "http2_connection_test.txt";
+	std::string cur_file_content(40000, 'f');
+	{
+		std::ofstream file_stream(cur_file_name, std::ios::binary);
+		file_stream << cur_file_content;
+	}
+	reply cur_reply;
+	cur_reply.status_code = 200;
+	cur_reply.content_file = cur_file_name;
+	server.submit_reply(1, cur_reply);
+	// past the default window of 65535 would need WINDOW_UPDATE, 40000 bytes go out at once
+	auto cur_frames = take_frames(server);
+	std::remove(cur_file_name.c_str());
+	check(!cur_frames.empty() && cur_frames[0].type == frame_headers && find_value(decode_reply(cur_frames[0]), ":status") == "200"
+		&& find_value(decode_reply(cur_frames[0]), "content-length") == "40000" && reply_data(cur_frames) == cur_file_content
+		&& (cur_frames.back().flags & flag_end_stream), "content_file reply sent as DATA");
+
+	// an event stream can not be served over http2, the client gets an error instead of an empty 200
+	cur_block.clear();
+	request_encoder.encode(request_headers("GET", "/events"), cur_block);
+	feed(server, make_frame(frame_headers, flag_end_stream | flag_end_headers, 3, cur_block));
+	server.take_requests();
+	cur_reply = reply();
+	cur_reply.status_code = 200;
+	cur_reply.add_header("Content-Type", "text/event-stream");
+	cur_reply.event_hub = std::make_shared<sse_hub>();
+	server.submit_reply(3, cur_reply);
+	cur_frames = take_frames(server);
+	check(!cur_frames.empty() && cur_frames[0].type == frame_headers && find_value(decode_reply(cur_frames[0]), ":status") == "501"
+		&& find_value(decode_reply(cur_frames[0]), "content-type") != "text/event-stream" && (cur_frames.back().flags & flag_end_stream)
+		&& server.active_stream_count() == 0, "event_hub reply answered with 501");
+}
+
+int main()
+{
+	test_hpack();
+	test_continuation();
+	test_initial_window_size();
+	test_window_update();
+	test_head_and_empty_body();
+	test_file_and_event_replies();
+	std::cout << g_failed_num << " failed" << std::endl;
+	return g_failed_num ? 1 : 0;
+}
@@ -0,0 +1,511 @@
+#include <http_packet.h>
+#include <http_reply_parser.h>
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace spiritsaway::http_utils;
+namespace asio = boost::asio;
+using asio_ec = boost::system::error_code;
+using bench_clock = std::chrono::steady_clock;
+
+// a wrk style load generator: every connection has at most one request in flight
+struct bench_config
+{
+	std::string url;
+	std::string host;
+	std::string port;
+	std::string path;
+	std::string method = "GET";
+	std::string body;
+	std::vector<header> headers;
+	std::size_t connections = 10;
+	std::size_t threads = 1;
+	double duration_seconds = 10;
+	// total requests per second over all connections, 0 for closed loop
+	double rate = 0;
+	bool keep_alive = true;
+	std::uint32_t timeout_seconds = 5;
+};
+
+struct bench_stats
+{
+	// from the intended send time to the end of the reply, so that a stalled server
+	// delays the schedule instead of hiding the requests it should have received
+	std::vector<std::uint32_t> latency_us;
+	std::uint64_t requests = 0;
+	std::uint64_t read_bytes = 0;
+	std::uint64_t connect_errors = 0;
+	std::uint64_t io_errors = 0;
+	std::uint64_t timeouts = 0;
+	std::uint64_t bad_status = 0;
+
+	void merge(const bench_stats& other)
+	{
+		latency_us.insert(latency_us.end(), other.latency_us.begin(), other.latency_us.end());
+		requests += other.requests;
+		read_bytes += other.read_bytes;
+		connect_errors += other.connect_errors;
+		io_errors += other.io_errors;
+		timeouts += other.timeouts;
+		bad_status += other.bad_status;
+	}
+};
+
+class bench_connection : public std::enable_shared_from_this<bench_connection>
+{
+public:
+	bench_connection(asio::io_context& ioc, const bench_config& config, const asio::ip::tcp::endpoint& endpoint, const std::string& req_str, bench_stats& stats, bench_clock::time_point begin_ts, bench_clock::time_point end_ts, bench_clock::duration interval)
+		: m_socket(ioc)
+		, m_pace_timer(ioc)
+		, m_timeout_timer(ioc)
+		, m_config(config)
+		, m_endpoint(endpoint)
+		, m_req_str(req_str)
+		, m_stats(stats)
+		, m_intended_ts(begin_ts)
+		, m_end_ts(end_ts)
+		, m_interval(interval)
+	{
+		m_parser.m_body_handler = [](std::string_view)
+		{
+
+		};
+		m_parser.m_head_request = m_req_str.compare(0, 5, "HEAD ") == 0;
+	}
+
+	void start()
+	{
+		schedule(m_intended_ts);
+	}
+
+private:
+	// send the next request at send_ts, or now when the schedule is behind
+	void schedule(bench_clock::time_point send_ts)
+	{
+		if (send_ts >= m_end_ts)
+		{
+			close();
+			return;
+		}
+		m_intended_ts = send_ts;
+		if (send_ts <= bench_clock::now())
+		{
+			send();
+			return;
+		}
+		m_pace_timer.expires_at(send_ts);
+		m_pace_timer.async_wait([self = shared_from_this(), this](const asio_ec& ec)
+			{
+				if (!ec)
+				{
+					send();
+				}
+			});
+	}
+
+	void next()
+	{
+		if (m_interval.count())
+		{
+			schedule(m_intended_ts + m_interval);
+		}
+		else
+		{
+			schedule(bench_clock::now());
+		}
+	}
+
+	void send()
+	{
+		if (!m_config.rate)
+		{
+			// closed loop, the latency starts when the request is sent
+			m_intended_ts = bench_clock::now();
+		}
+		m_timed_out = false;
+		m_timeout_timer.expires_after(std::chrono::seconds(m_config.timeout_seconds));
+		m_timeout_timer.async_wait([self = shared_from_this(), this](const asio_ec& ec)
+			{
+				if (!ec)
+				{
+					m_timed_out = true;
+					close();
+				}
+			});
+		if (m_connected)
+		{
+			write();
+			return;
+		}
+		m_socket.async_connect(m_endpoint, [self = shared_from_this(), this](const asio_ec& ec)
+			{
+				if (ec)
+				{
+					on_error(m_stats.connect_errors);
+					return;
+				}
+				m_connected = true;
+				asio_ec ignore_ec;
+				m_socket.set_option(asio::ip::tcp::no_delay(true), ignore_ec);
+				write();
+			});
+	}
+
+	void write()
+	{
+		asio::async_write(m_socket, asio::buffer(m_req_str), [self = shared_from_this(), this](const asio_ec& ec, std::size_t)
+			{
+				if (ec)
+				{
+					on_error(m_stats.io_errors);
+					return;
+				}
+				m_parser.reset();
+				read();
+			});
+	}
+
+	void read()
+	{
+		m_socket.async_read_some(asio::buffer(m_buffer), [self = shared_from_this(), this](const asio_ec& ec, std::size_t n)
+			{
+				if (ec && ec != asio::error::eof)
+				{
+					on_error(m_stats.io_errors);
+					return;
+				}
+				m_stats.read_bytes += n;
+				// a reply without content length ends with the connection
+				auto cur_result = m_parser.parse(m_buffer.data(), ec ? 0 : n);
+				if (cur_result == http_reply_parser::result_type::indeterminate && !ec)
+				{
+					read();
+					return;
+				}
+				if (cur_result != http_reply_parser::result_type::good)
+				{
+					on_error(m_stats.io_errors);
+					return;
+				}
+				on_reply(ec == asio::error::eof);
+			});
+	}
+
+	void on_reply(bool closed)
+	{
+		m_timeout_timer.cancel();
+		auto cur_latency = std::chrono::duration_cast<std::chrono::microseconds>(bench_clock::now() - m_intended_ts).count();
+		m_stats.latency_us.push_back(std::uint32_t(std::min<long long>(cur_latency, UINT32_MAX)));
+		m_stats.requests++;
+		auto cur_status = m_parser.m_reply.status_code;
+		if (cur_status < 200 || cur_status >= 400)
+		{
+			m_stats.bad_status++;
+		}
+		if (closed || !m_config.keep_alive || !m_parser.keep_alive())
+		{
+			close();
+		}
+		next();
+	}
+
+	void on_error(std::uint64_t& counter)
+	{
+		m_timeout_timer.cancel();
+		if (m_timed_out)
+		{
+			m_stats.timeouts++;
+		}
+		else
+		{
+			counter++;
+		}
+		close();
+		// a refused connect fails at once, do not spin on it
+		m_pace_timer.expires_after(std::chrono::milliseconds(10));
+		m_pace_timer.async_wait([self = shared_from_this(), this](const asio_ec& ec)
+			{
+				if (!ec)
+				{
+					next();
+				}
+			});
+	}
+
+	void close()
+	{
+		asio_ec ignore_ec;
+		m_socket.close(ignore_ec);
+		m_connected = false;
+	}
+
+	asio::ip::tcp::socket m_socket;
+	asio::steady_timer m_pace_timer;
+	asio::steady_timer m_timeout_timer;
+	const bench_config& m_config;
+	const asio::ip::tcp::endpoint m_endpoint;
+	const std::string& m_req_str;
+	bench_stats& m_stats;
+	http_reply_parser m_parser;
+	std::array<char, 16384> m_buffer;
+	bench_clock::time_point m_intended_ts;
+	const bench_clock::time_point m_end_ts;
+	const bench_clock::duration m_interval;
+	bool m_connected = false;
+	bool m_timed_out = false;
+};
+
+std::string build_request(const bench_config& config)
+{
+	std::string result = config.method + " " + config.path + " HTTP/1.1\r\nHost: " + config.host + "\r\n";
+	for (const auto& one_header : config.headers)
+	{
+		result += one_header.name + ": " + one_header.value + "\r\n";
+	}
+	if (!config.keep_alive)
+	{
+		result += "Connection: close\r\n";
+	}
+	if (!config.body.empty() || config.method == "POST" || config.method == "PUT")
+	{
+		result += "Content-Length: " + std::to_string(config.body.size()) + "\r\n";
+	}
+	result += "\r\n";
+	result += config.body;
+	return result;
+}
+
+std::string format_bytes(double bytes)
+{
+	const char* units[] = { "B", "KB", "MB", "GB" };
+	std::size_t unit_idx = 0;
+	while (bytes >= 1024 && unit_idx + 1 < std::size(units))
+	{
+		bytes /= 1024;
+		unit_idx++;
+	}
+	char buffer[32];
+	std::snprintf(buffer, sizeof(buffer), "%.2f%s", bytes, units[unit_idx]);
+	return buffer;
+}
+
+void print_usage()
+{
+	std::cerr << "Usage: http_bench [options] <url>\n"
+		<< "  -c <n>        connections, default 10\n"
+		<< "  -t <n>        threads, default 1\n"
+		<< "  -d <seconds>  duration, default 10\n"
+		<< "  -R <rate>     total requests/sec with latencies measured from the schedule, default closed loop\n"
+		<< "  -H <header>   extra header like \"Name: value\", repeatable\n"
+		<< "  -m <method>   default GET\n"
+		<< "  -b <body>     request body\n"
+		<< "  --close       a new connection per request instead of keep-alive\n"
+		<< "  --timeout <s> request timeout, default 5\n";
+}
+
+bool parse_args(int argc, char* argv[], bench_config& config)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string cur_arg = argv[i];
+		auto next_value = [&]() -> const char*
+		{
+			return i + 1 < argc ? argv[++i] : nullptr;
+		};
+		const char* cur_value = nullptr;
+		if (cur_arg == "--close")
+		{
+			config.keep_alive = false;
+			continue;
+		}
+		if (cur_arg.size() > 1 && cur_arg[0] == '-')
+		{
+			cur_value = next_value();
+			if (!cur_value)
+			{
+				return false;
+			}
+		}
+		if (cur_arg == "-c")
+		{
+			config.connections = std::max<std::size_t>(1, std::stoul(cur_value));
+		}
+		else if (cur_arg == "-t")
+		{
+			config.threads = std::max<std::size_t>(1, std::stoul(cur_value));
+		}
+		else if (cur_arg == "-d")
+		{
+			config.duration_seconds = std::stod(cur_value);
+		}
+		else if (cur_arg == "-R")
+		{
+			config.rate = std::stod(cur_value);
+		}
+		else if (cur_arg == "-H")
+		{
+			std::string_view cur_header(cur_value);
+			auto colon_pos = cur_header.find(':');
+			if (colon_pos == std::string_view::npos)
+			{
+				return false;
+			}
+			auto cur_header_value = cur_header.substr(colon_pos + 1);
+			while (!cur_header_value.empty() && cur_header_value.front() == ' ')
+			{
+				cur_header_value.remove_prefix(1);
+			}
+			config.headers.push_back(header{ std::string(cur_header.substr(0, colon_pos)), std::string(cur_header_value) });
+		}
+		else if (cur_arg == "-m")
+		{
+			config.method = cur_value;
+		}
+		else if (cur_arg == "-b")
+		{
+			config.body = cur_value;
+		}
+		else if (cur_arg == "--timeout")
+		{
+			config.timeout_seconds = std::stoul(cur_value);
+		}
+		else if (cur_arg[0] == '-')
+		{
+			return false;
+		}
+		else
+		{
+			config.url = cur_arg;
+		}
+	}
+	if (config.url.empty() || config.url.find("https://") == 0)
+	{
+		return false;
+	}
+	parse_uri(config.url, config.host, config.port, config.path);
+	config.threads = std::min(config.threads, config.connections);
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	bench_config cur_config;
+	if (!parse_args(argc, argv, cur_config))
+	{
+		print_usage();
+		return 1;
+	}
+	asio::io_context resolve_ioc;
+	asio::ip::tcp::resolver cur_resolver(resolve_ioc);
+	asio_ec resolve_ec;
+	auto cur_endpoints = cur_resolver.resolve(cur_config.host, cur_config.port, resolve_ec);
+	if (resolve_ec || cur_endpoints.empty())
+	{
+		std::cerr << "can not resolve " << cur_config.host << ":" << cur_config.port << " " << resolve_ec.message() << "\n";
+		return 1;
+	}
+	asio::ip::tcp::endpoint cur_endpoint = *cur_endpoints.begin();
+	const auto req_str = build_request(cur_config);
+
+	std::cout << "Running " << cur_config.duration_seconds << "s test @ " << cur_config.url << "\n"
+		<< "  " << cur_config.threads << " threads and " << cur_config.connections << " connections, "
+		<< (cur_config.keep_alive ? "keep-alive" : "close") << ", ";
+	if (cur_config.rate)
+	{
+		std::cout << "fixed rate " << cur_config.rate << " requests/sec\n";
+	}
+	else
+	{
+		std::cout << "closed loop\n";
+	}
+
+	// every connection sends at rate / connections, staggered so that the sends are spread evenly
+	bench_clock::duration cur_interval(0);
+	if (cur_config.rate)
+	{
+		cur_interval = std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(double(cur_config.connections) / cur_config.rate));
+	}
+	auto begin_ts = bench_clock::now() + std::chrono::milliseconds(10);
+	auto end_ts = begin_ts + std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(cur_config.duration_seconds));
+	std::vector<bench_stats> thread_stats(cur_config.threads);
+	std::vector<std::thread> threads;
+	for (std::size_t i = 0; i < cur_config.threads; i++)
+	{
+		threads.emplace_back([&, i]()
+			{
+				asio::io_context cur_ioc;
+				auto& cur_stats = thread_stats[i];
+				if (cur_config.rate)
+				{
+					cur_stats.latency_us.reserve(std::size_t(cur_config.rate * cur_config.duration_seconds / double(cur_config.threads)) + 16);
+				}
+				for (std::size_t j = i; j < cur_config.connections; j += cur_config.threads)
+				{
+					auto cur_begin = begin_ts + cur_interval * j / cur_config.connections;
+					std::make_shared<bench_connection>(cur_ioc, cur_config, cur_endpoint, req_str, cur_stats, cur_begin, end_ts, cur_interval)->start();
+				}
+				cur_ioc.run();
+			});
+	}
+	for (auto& one_thread : threads)
+	{
+		one_thread.join();
+	}
+	auto cost_seconds = std::chrono::duration<double>(std::max(bench_clock::now(), end_ts) - begin_ts).count();
+
+	bench_stats total_stats;
+	for (const auto& one_stats : thread_stats)
+	{
+		total_stats.merge(one_stats);
+	}
+	auto& latencies = total_stats.latency_us;
+	std::sort(latencies.begin(), latencies.end());
+	double latency_sum = 0;
+	for (auto one_latency : latencies)
+	{
+		latency_sum += one_latency;
+	}
+	double latency_mean = latencies.empty() ? 0 : latency_sum / double(latencies.size());
+	double latency_variance = 0;
+	for (auto one_latency : latencies)
+	{
+		latency_variance += (one_latency - latency_mean) * (one_latency - latency_mean);
+	}
+	double latency_stdev = latencies.empty() ? 0 : std::sqrt(latency_variance / double(latencies.size()));
+
+	std::cout << "  Latency(us)   mean " << std::uint64_t(latency_mean) << "   stdev " << std::uint64_t(latency_stdev)
+		<< "   max " << (latencies.empty() ? 0 : latencies.back()) << "\n";
+	std::cout << "  Latency Distribution\n";
+	for (double one_percentile : { 50.0, 75.0, 90.0, 99.0, 99.9, 99.99, 100.0 })
+	{
+		std::uint32_t cur_value = 0;
+		if (!latencies.empty())
+		{
+			auto cur_rank = std::size_t(std::ceil(one_percentile / 100.0 * double(latencies.size())));
+			cur_value = latencies[std::min(latencies.size(), std::max<std::size_t>(cur_rank, 1)) - 1];
+		}
+		char buffer[64];
+		std::snprintf(buffer, sizeof(buffer), "    %7.3f%%  %10uus\n", one_percentile, cur_value);
+		std::cout << buffer;
+	}
+	std::cout << "  " << total_stats.requests << " requests in " << cost_seconds << "s, " << format_bytes(double(total_stats.read_bytes)) << " read\n";
+	if (total_stats.connect_errors || total_stats.io_errors || total_stats.timeouts)
+	{
+		std::cout << "  Socket errors: connect " << total_stats.connect_errors << ", read/write " << total_stats.io_errors << ", timeout " << total_stats.timeouts << "\n";
+	}
+	if (total_stats.bad_status)
+	{
+		std::cout << "  Non-2xx or 3xx responses: " << total_stats.bad_status << "\n";
+	}
+	std::cout << "Requests/sec: " << std::uint64_t(double(total_stats.requests) / cost_seconds) << "\n"
+		<< "Transfer/sec: " << format_bytes(double(total_stats.read_bytes) / cost_seconds) << "\n";
+	return 0;
+}
@@ -0,0 +1,155 @@
+#include "http_client_engine.h"
+#include "http_server.h"
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/logger.h>
+using namespace spiritsaway::http_utils;
+using namespace std;
+
+std::shared_ptr<spdlog::logger> create_logger(const std::string& name)
+{
+	auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+	console_sink->set_level(spdlog::level::info);
+	std::string pattern = "[" + name + "] [%^%l%$] %v";
+	console_sink->set_pattern(pattern);
+	auto logger = std::make_shared<spdlog::logger>(name, spdlog::sinks_init_list{ console_sink });
+	logger->set_level(spdlog::level::info);
+	return logger;
+}
+
+// replies after 1ms, except one request in ten which stalls for 200ms
+class slow_tail_http_server : public http_server
+{
+public:
+	slow_tail_http_server(asio::io_context& io_context, std::shared_ptr<spdlog::logger> in_logger, const std::string& address, const std::string& port)
+		: http_server(io_context, in_logger, address, port)
+		, m_ioc(io_context)
+	{
+
+	}
+protected:
+	void handle_request(const request& req, reply_handler rep_cb) override
+	{
+		auto cur_delay = (m_request_counter++ % 10 == 9) ? std::chrono::milliseconds(200) : std::chrono::milliseconds(1);
+		auto cur_timer = std::make_shared<asio::steady_timer>(m_ioc, cur_delay);
+		cur_timer->async_wait([cur_timer, uri = req.uri, rep_cb](const asio_ec&)
+		{
+			reply rep;
+			rep.status_code = 200;
+			rep.content = "echo request uri: " + uri;
+			rep.add_header("Content-Type", "text");
+			rep_cb(rep);
+		});
+	}
+private:
+	asio::io_context& m_ioc;
+	std::uint64_t m_request_counter = 0;
+};
+
+void run_requests(asio::io_context& ioc, http_client_engine& engine, std::size_t total_num)
+{
+	std::vector<std::chrono::microseconds> latencies;
+	std::size_t error_num = 0;
+	std::function<void(std::size_t)> send_one;
+	send_one = [&](std::size_t remain_num)
+	{
+		if (remain_num == 0)
+		{
+			return;
+		}
+		request cur_req;
+		cur_req.uri = "/" + std::to_string(remain_num);
+		cur_req.method = "GET";
+		cur_req.http_version_major = 1;
+		cur_req.http_version_minor = 1;
+		auto begin_ts = std::chrono::steady_clock::now();
+		engine.async_request("127.0.0.1", "8081", cur_req, [&, begin_ts, remain_num](const std::string& err, const reply&)
+		{
+			if (!err.empty())
+			{
+				error_num++;
+			}
+			latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin_ts));
+			send_one(remain_num - 1);
+		}, 5);
+	};
+	send_one(total_num);
+	ioc.run_for(std::chrono::seconds(60));
+	ioc.restart();
+	std::sort(latencies.begin(), latencies.end());
+	auto cur_stats = engine.get_stats();
+	std::cout << "requests " << latencies.size() << " errors " << error_num
+		<< " p50 " << latencies[latencies.size() / 2].count() << "us"
+		<< " p99 " << latencies[latencies.size() * 99 / 100].count() << "us"
+		<< " hedges " << cur_stats.hedges_sent << " hedges won " << cur_stats.hedges_won
+		<< " budget exhausted " << cur_stats.budget_exhausted << std::endl;
+}
+
+int main()
+{
+	asio::io_context server_context;
+	auto server_logger = create_logger("http_server");
+	slow_tail_http_server s(server_context, server_logger, "127.0.0.1", "8081");
+	s.run();
+	std::thread server_thread([&]()
+	{
+		server_context.run();
+	});
+
+	auto client_logger = create_logger("http_client");
+	{
+		asio::io_context client_context;
+		http_client_policy cur_policy;
+		http_client_engine cur_engine(client_context, client_logger, make_http_client_launcher(client_context, client_logger), cur_policy);
+		std::cout << "without hedge: ";
+		run_requests(client_context, cur_engine, 400);
+	}
+	{
+		asio::io_context client_context;
+		http_client_policy cur_policy;
+		cur_policy.hedge_enabled = true;
+		cur_policy.hedge_percentile = 0.8;
+		cur_policy.hedge_min_delay_ms = 5;
+		cur_policy.retry_budget_ratio = 0.2;
+		http_client_engine cur_engine(client_context, client_logger, make_http_client_launcher(client_context, client_logger), cur_policy);
+		std::cout << "with hedge: ";
+		run_requests(client_context, cur_engine, 400);
+	}
+	{
+		asio::io_context client_context;
+		http_client_policy cur_policy;
+		cur_policy.coalesce_enabled = true;
+		cur_policy.coalesce_headers.push_back("Accept-Language");
+		http_client_engine cur_engine(client_context, client_logger, make_http_client_launcher(client_context, client_logger), cur_policy);
+		std::size_t reply_num = 0;
+		for (std::size_t i = 0; i < 100; i++)
+		{
+			request cur_req;
+			cur_req.uri = "/coalesce";
+			cur_req.method = "GET";
+			cur_req.http_version_major = 1;
+			cur_req.http_version_minor = 1;
+			// three keys, the request without the header must not share the one with an empty value
+			if (i % 3)
+			{
+				cur_req.headers.push_back(header{ "Accept-Language", i % 3 == 1 ? "en" : "" });
+			}
+			cur_engine.async_request("127.0.0.1", "8081", cur_req, [&](const std::string& err, const reply& rep)
+			{
+				if (err.empty() && rep.status_code == 200)
+				{
+					reply_num++;
+				}
+			}, 5);
+		}
+		client_context.run();
+		auto cur_stats = cur_engine.get_stats();
+		std::cout << "coalesce: replies " << reply_num << " requests " << cur_stats.requests << " coalesced " << cur_stats.coalesced << std::endl;
+	}
+	s.stop();
+	server_context.stop();
+	server_thread.join();
+	return 0;
+}
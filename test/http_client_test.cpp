@@ -42,6 +42,24 @@ int main()
 
 		// Run the server until stopped.
 		cur_client->run();
+
+		std::size_t streamed_bytes = 0;
+		reply_stream_handler cur_stream_handler;
+		cur_stream_handler.on_header = [](const reply& rep)
+		{
+			std::cout << "stream header status is " << rep.status_code << " header count " << rep.headers.size() << std::endl;
+		};
+		cur_stream_handler.on_body = [&streamed_bytes](std::string_view chunk, std::function<void()> resume)
+		{
+			streamed_bytes += chunk.size();
+			resume();
+		};
+		cur_stream_handler.on_finish = [&streamed_bytes](const std::string& err, const reply& rep)
+		{
+			std::cout << "stream err is " << err << " status is " << rep.status_code << " streamed bytes " << streamed_bytes << std::endl;
+		};
+		auto cur_stream_client = std::make_shared<http_client>(cur_context, create_logger("http_stream_client"), address, port, cur_req, cur_stream_handler, 5);
+		cur_stream_client->run();
 		cur_context.run();
 	}
 	catch (std::exception& e)
@@ -1,4 +1,5 @@
 ﻿#include "http_server.h"
+#include "http_log.h"
 #include <iostream>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/sinks/basic_file_sink.h>
@@ -16,7 +17,8 @@ std::shared_ptr<spdlog::logger> create_logger(const std::string& name)
 
 	auto file_sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(name + ".log", true);
 	file_sink->set_level(spdlog::level::trace);
-	auto logger = std::make_shared<spdlog::logger>(name, spdlog::sinks_init_list{ console_sink, file_sink });
+	// the sinks are written by the spdlog thread pool, not by the io thread of the server
+	auto logger = make_async_logger(name, { console_sink, file_sink });
 	logger->set_level(spdlog::level::trace);
 	return logger;
 }
@@ -54,6 +56,10 @@ int main()
 		std::string address = "127.0.0.1";
 		std::string port = "8080";
 		echo_http_server s(cur_context, create_logger("http_server"), address, port);
+		// h2c by prior knowledge or Upgrade, try with curl --http2-prior-knowledge
+		s.enable_http2();
+		// the counters and latency histograms of the server, try with curl http://127.0.0.1:8080/metrics
+		s.enable_metrics_endpoint();
 
 		// Run the server until stopped.
 		s.run();
@@ -0,0 +1,266 @@
+#include <https_server.h>
+#include <https_client.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/logger.h>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace spiritsaway::http_utils;
+
+std::shared_ptr<spdlog::logger> create_logger(const std::string& name)
+{
+	auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+	console_sink->set_level(spdlog::level::warn);
+	std::string pattern = "[" + name + "] [%^%l%$] %v";
+	console_sink->set_pattern(pattern);
+	auto logger = std::make_shared<spdlog::logger>(name, spdlog::sinks_init_list{ console_sink });
+	logger->set_level(spdlog::level::warn);
+	return logger;
+}
+
+class echo_https_server : public https_server
+{
+public:
+	using https_server::https_server;
+protected:
+	void handle_request(const request& req, reply_handler rep_cb) override
+	{
+		reply rep;
+		rep.status_code = 200;
+		rep.content = "echo request uri: " + req.uri + " body: " + req.body;
+		rep.add_header("Content-Type", "text");
+		rep_cb(rep);
+	}
+};
+
+// connect count times to the server, offering the session of the previous connection when resume is set
+void run_handshakes(asio::ssl::context& client_ctx, const std::string& port, bool resume, std::size_t count)
+{
+	asio::io_context ioc;
+	asio::ip::tcp::resolver resolver(ioc);
+	auto endpoints = resolver.resolve("127.0.0.1", port);
+	request cur_req;
+	cur_req.method = "GET";
+	cur_req.uri = "/";
+	cur_req.http_version_major = 1;
+	cur_req.http_version_minor = 1;
+	auto req_str = cur_req.to_string("127.0.0.1", port);
+	SSL_SESSION* saved_session = nullptr;
+	std::size_t resumed_count = 0;
+	std::chrono::steady_clock::duration handshake_time{};
+	auto begin_ts = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < count; i++)
+	{
+		asio::ssl::stream<asio::ip::tcp::socket> cur_stream(ioc, client_ctx);
+		asio::connect(cur_stream.lowest_layer(), endpoints);
+		cur_stream.lowest_layer().set_option(asio::ip::tcp::no_delay(true));
+		if (resume && saved_session)
+		{
+			SSL_set_session(cur_stream.native_handle(), saved_session);
+		}
+		auto handshake_begin_ts = std::chrono::steady_clock::now();
+		cur_stream.handshake(asio::ssl::stream_base::client);
+		handshake_time += std::chrono::steady_clock::now() - handshake_begin_ts;
+		if (SSL_session_reused(cur_stream.native_handle()))
+		{
+			resumed_count++;
+		}
+		asio::write(cur_stream, asio::buffer(req_str));
+		// read the whole reply so that tls 1.3 session tickets are received
+		std::string reply_str;
+		asio_ec ignore_ec;
+		asio::read(cur_stream, asio::dynamic_buffer(reply_str), ignore_ec);
+		// a session is marked not resumable when the connection is not shut down
+		cur_stream.shutdown(ignore_ec);
+		if (resume)
+		{
+			auto cur_session = SSL_get1_session(cur_stream.native_handle());
+			if (cur_session && SSL_SESSION_is_resumable(cur_session))
+			{
+				if (saved_session)
+				{
+					SSL_SESSION_free(saved_session);
+				}
+				saved_session = cur_session;
+			}
+			else if (cur_session)
+			{
+				SSL_SESSION_free(cur_session);
+			}
+		}
+	}
+	if (saved_session)
+	{
+		SSL_SESSION_free(saved_session);
+	}
+	auto total_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin_ts).count();
+	auto handshake_seconds = std::chrono::duration<double>(handshake_time).count();
+	std::cout << (resume ? "with resumption: " : "without resumption: ")
+		<< count / handshake_seconds << " handshakes/sec "
+		<< count / total_seconds << " connections/sec "
+		<< resumed_count << " resumed" << std::endl;
+}
+
+// send count sequential requests through https_client, sharing a tls_session_cache when resume is set
+void run_clients(asio::ssl::context& client_ctx, const std::string& port, bool resume, std::size_t count)
+{
+	asio::io_context ioc;
+	auto cur_logger = create_logger("https_client");
+	auto cur_cache = resume ? std::make_shared<tls_session_cache>() : nullptr;
+	request cur_req;
+	cur_req.method = "GET";
+	cur_req.uri = "/";
+	cur_req.http_version_major = 1;
+	cur_req.http_version_minor = 1;
+	std::size_t error_count = 0;
+	std::function<void(std::size_t)> send_one;
+	send_one = [&](std::size_t remain_count)
+	{
+		if (remain_count == 0)
+		{
+			return;
+		}
+		auto cur_client = std::make_shared<https_client>(ioc, client_ctx, cur_logger, "127.0.0.1", port, cur_req, [&, remain_count](const std::string& err, const reply& rep)
+			{
+				if (!err.empty())
+				{
+					error_count++;
+				}
+				send_one(remain_count - 1);
+			}, 5);
+		cur_client->set_session_cache(cur_cache);
+		cur_client->run();
+	};
+	auto begin_ts = std::chrono::steady_clock::now();
+	send_one(count);
+	ioc.run();
+	auto total_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin_ts).count();
+	std::cout << (resume ? "https_client with session cache: " : "https_client without session cache: ")
+		<< count / total_seconds << " requests/sec " << error_count << " errors";
+	if (cur_cache)
+	{
+		std::cout << " cache hits " << cur_cache->get_hit_count() << " misses " << cur_cache->get_miss_count();
+	}
+	std::cout << std::endl;
+}
+
+// resume through the server session cache, session tickets or both
+void run_server(asio::ssl::context& client_ctx, bool session_cache, bool session_ticket, bool ktls, const std::string& port, std::size_t count)
+{
+	bool resume = session_cache || session_ticket;
+	auto cur_logger = create_logger("https_server");
+	asio::io_context ioc;
+	asio::ssl::context ctx{ asio::ssl::context::tls_server };
+	ctx.use_certificate_chain_file("../data/keys/server.crt");
+	ctx.use_private_key_file("../data/keys/server.key", asio::ssl::context::pem);
+	echo_https_server s(ioc, ctx, cur_logger, "127.0.0.1", port);
+	tls_resumption_config cur_config;
+	cur_config.session_cache_enabled = session_cache;
+	cur_config.session_ticket_enabled = session_ticket;
+	s.enable_session_resumption(cur_config);
+	if (ktls)
+	{
+		s.enable_ktls();
+	}
+	s.run();
+	std::thread server_thread([&ioc]()
+		{
+			ioc.run();
+		});
+	run_handshakes(client_ctx, port, resume, count);
+	run_clients(client_ctx, port, resume, count);
+	asio::post(ioc, [&s, &ioc]()
+		{
+			s.stop();
+			ioc.stop();
+		});
+	server_thread.join();
+	auto cur_stats = s.get_handshake_stats();
+	std::cout << "server full handshakes " << cur_stats.full_handshakes << " resumed " << cur_stats.resumed_handshakes << " failed " << cur_stats.failed_handshakes << " ktls " << cur_stats.ktls_handshakes << std::endl;
+}
+
+// full handshakes from client_num threads at once while the server samples the latency of its single io thread
+void run_storm(bool offload, const std::string& port, std::size_t client_num, std::size_t count)
+{
+	auto cur_logger = create_logger("https_server");
+	asio::io_context ioc;
+	asio::ssl::context ctx{ asio::ssl::context::tls_server };
+	ctx.use_certificate_chain_file("../data/keys/server.crt");
+	ctx.use_private_key_file("../data/keys/server.key", asio::ssl::context::pem);
+	echo_https_server s(ioc, ctx, cur_logger, "127.0.0.1", port);
+	tls_resumption_config cur_config;
+	cur_config.session_cache_enabled = false;
+	cur_config.session_ticket_enabled = false;
+	s.enable_session_resumption(cur_config);
+	if (offload)
+	{
+		s.enable_handshake_offload(2);
+	}
+	s.enable_io_lag_probe(1);
+	s.run();
+	std::thread server_thread([&ioc]()
+		{
+			ioc.run();
+		});
+	auto begin_ts = std::chrono::steady_clock::now();
+	std::vector<std::thread> client_threads;
+	for (std::size_t i = 0; i < client_num; i++)
+	{
+		client_threads.emplace_back([&port, count]()
+			{
+				asio::ssl::context client_ctx{ asio::ssl::context::tlsv13_client };
+				run_handshakes(client_ctx, port, false, count);
+			});
+	}
+	for (auto& one_thread : client_threads)
+	{
+		one_thread.join();
+	}
+	auto total_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin_ts).count();
+	asio::post(ioc, [&s, &ioc]()
+		{
+			s.stop();
+			ioc.stop();
+		});
+	server_thread.join();
+	auto cur_stats = s.get_handshake_stats();
+	auto cur_lag = s.get_io_lag_stats();
+	std::cout << (offload ? "storm with handshake offload: " : "storm without handshake offload: ")
+		<< client_num * count / total_seconds << " connections/sec"
+		<< " full handshakes " << cur_stats.full_handshakes
+		<< " offloaded " << cur_stats.offloaded_handshakes
+		<< " max queue depth " << cur_stats.max_handshake_queue_depth
+		<< " io lag avg " << cur_lag.avg_lag_us << "us max " << cur_lag.max_lag_us << "us" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	std::size_t count = 2000;
+	if (argc > 1)
+	{
+		count = std::stoul(argv[1]);
+	}
+	try
+	{
+		for (auto one_method : { asio::ssl::context::tlsv12_client, asio::ssl::context::tlsv13_client })
+		{
+			asio::ssl::context client_ctx{ one_method };
+			SSL_CTX_set_session_cache_mode(client_ctx.native_handle(), SSL_SESS_CACHE_CLIENT);
+			std::cout << (one_method == asio::ssl::context::tlsv12_client ? "tls 1.2" : "tls 1.3") << std::endl;
+			run_server(client_ctx, false, false, false, "8443", count);
+			run_server(client_ctx, true, true, false, "8444", count);
+			std::cout << "session tickets only" << std::endl;
+			run_server(client_ctx, false, true, false, "8448", count);
+			std::cout << "with ktls" << std::endl;
+			run_server(client_ctx, true, true, true, "8445", count);
+		}
+		run_storm(false, "8446", 8, count / 8);
+		run_storm(true, "8447", 8, count / 8);
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << "exception: " << e.what() << std::endl;
+	}
+	return 0;
+}
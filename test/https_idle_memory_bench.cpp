@@ -0,0 +1,168 @@
+#include <https_server.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/logger.h>
+#include <iostream>
+#include <fstream>
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace spiritsaway::http_utils;
+
+std::shared_ptr<spdlog::logger> create_logger(const std::string& name)
+{
+	auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+	console_sink->set_level(spdlog::level::warn);
+	std::string pattern = "[" + name + "] [%^%l%$] %v";
+	console_sink->set_pattern(pattern);
+	auto logger = std::make_shared<spdlog::logger>(name, spdlog::sinks_init_list{ console_sink });
+	logger->set_level(spdlog::level::warn);
+	return logger;
+}
+
+class echo_https_server : public https_server
+{
+public:
+	using https_server::https_server;
+protected:
+	void handle_request(const request& req, reply_handler rep_cb) override
+	{
+		reply rep;
+		rep.status_code = 200;
+		rep.content = "echo request uri: " + req.uri + " body: " + req.body;
+		rep.add_header("Content-Type", "text");
+		rep_cb(rep);
+	}
+};
+
+std::size_t read_rss_kb(pid_t pid)
+{
+	std::ifstream status_file("/proc/" + std::to_string(pid) + "/status");
+	std::string cur_line;
+	while (std::getline(status_file, cur_line))
+	{
+		if (cur_line.rfind("VmRSS:", 0) == 0)
+		{
+			return std::stoul(cur_line.substr(6));
+		}
+	}
+	return 0;
+}
+
+void run_server(bool pooling, const std::string& port)
+{
+	auto cur_logger = create_logger("https_server");
+	asio::io_context ioc;
+	asio::ssl::context ctx{ asio::ssl::context::tls_server };
+	ctx.use_certificate_chain_file("../data/keys/server.crt");
+	ctx.use_private_key_file("../data/keys/server.key", asio::ssl::context::pem);
+	echo_https_server s(ioc, ctx, cur_logger, "127.0.0.1", port);
+	if (pooling)
+	{
+		s.enable_buffer_pooling(tls_buffer_config());
+	}
+	s.run();
+	ioc.run();
+}
+
+// send one keep-alive request and read its reply, leaving the connection idle afterwards
+bool send_one_request(asio::ssl::stream<asio::ip::tcp::socket>& cur_stream, const std::string& req_str)
+{
+	asio_ec ec;
+	asio::write(cur_stream, asio::buffer(req_str), ec);
+	std::string reply_str;
+	auto head_sz = asio::read_until(cur_stream, asio::dynamic_buffer(reply_str), "\r\n\r\n", ec);
+	if (ec)
+	{
+		return false;
+	}
+	auto length_pos = reply_str.find("Content-Length: ");
+	std::size_t content_length = 0;
+	if (length_pos != std::string::npos)
+	{
+		content_length = std::stoul(reply_str.substr(length_pos + 16));
+	}
+	if (reply_str.size() < head_sz + content_length)
+	{
+		asio::read(cur_stream, asio::dynamic_buffer(reply_str), asio::transfer_exactly(head_sz + content_length - reply_str.size()), ec);
+	}
+	return !ec;
+}
+
+// open count idle keep-alive connections and report how much the server rss grows per connection
+void run_idle(bool pooling, const std::string& port, std::size_t count)
+{
+	auto server_pid = fork();
+	if (server_pid == 0)
+	{
+		run_server(pooling, port);
+		_exit(0);
+	}
+	usleep(300 * 1000);
+	asio::io_context ioc;
+	asio::ssl::context client_ctx{ asio::ssl::context::tls_client };
+	asio::ip::tcp::resolver resolver(ioc);
+	auto endpoints = resolver.resolve("127.0.0.1", port);
+	// request::to_string asks for connection close
+	std::string req_str = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+	std::vector<std::unique_ptr<asio::ssl::stream<asio::ip::tcp::socket>>> streams;
+	std::size_t base_rss = 0;
+	std::size_t error_count = 0;
+	// the server closes connections idle for the keep-alive timeout, count stays small enough to finish before
+	for (std::size_t i = 0; i <= count; i++)
+	{
+		auto cur_stream = std::make_unique<asio::ssl::stream<asio::ip::tcp::socket>>(ioc, client_ctx);
+		asio_ec ec;
+		asio::connect(cur_stream->lowest_layer(), endpoints, ec);
+		if (!ec)
+		{
+			cur_stream->handshake(asio::ssl::stream_base::client, ec);
+		}
+		if (ec || !send_one_request(*cur_stream, req_str))
+		{
+			error_count++;
+		}
+		streams.push_back(std::move(cur_stream));
+		if (i == 0)
+		{
+			// the first connection warms up the allocator and openssl tables
+			base_rss = read_rss_kb(server_pid);
+		}
+	}
+	auto idle_rss = read_rss_kb(server_pid);
+	// idle past the 5 second request timeout, a second request on every connection shows they were kept alive
+	sleep(6);
+	std::size_t reuse_count = 0;
+	for (std::size_t i = 1; i < streams.size(); i++)
+	{
+		if (send_one_request(*streams[i], req_str))
+		{
+			reuse_count++;
+		}
+	}
+	kill(server_pid, SIGKILL);
+	waitpid(server_pid, nullptr, 0);
+	std::cout << (pooling ? "pooled buffers: " : "asio::ssl::stream: ")
+		<< count << " idle connections server rss +" << idle_rss - base_rss << "KB "
+		<< (idle_rss - base_rss) * 1024 / count << " bytes/connection "
+		<< reuse_count << " reused " << error_count << " errors" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	std::size_t count = 1000;
+	if (argc > 1)
+	{
+		count = std::stoul(argv[1]);
+	}
+	try
+	{
+		run_idle(false, "8452", count);
+		run_idle(true, "8453", count);
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << "exception: " << e.what() << std::endl;
+	}
+	return 0;
+}
@@ -63,6 +63,10 @@ int main(int argc, char* argv[])
 		std::string address = "127.0.0.1";
 		std::string port = "443";
 		echo_https_server s(ioc, ctx, cur_logger, address, port);
+		// clients asking for localhost by sni get this certificate, others the default one above
+		s.load_sni_certificate("localhost", "../data/keys/server.crt", "../data/keys/server.key");
+		// clients offering h2 by alpn get http2
+		s.enable_http2();
 
 		// Run the server until stopped.
 		s.run();
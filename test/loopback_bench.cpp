@@ -0,0 +1,515 @@
+#include <http_server.h>
+#include <https_server.h>
+#include <http_reply_parser.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/logger.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <pthread.h>
+#include <time.h>
+
+using namespace spiritsaway::http_utils;
+using bench_clock = std::chrono::steady_clock;
+using tls_stream = asio::ssl::stream<asio::ip::tcp::socket>;
+
+// servers and clients share the process, every scenario starts fresh servers on fresh ports
+
+std::shared_ptr<spdlog::logger> create_logger(const std::string& name)
+{
+	auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+	// clients closing without a tls shutdown at the end of a run are logged as errors, the table counts the real ones
+	console_sink->set_level(spdlog::level::critical);
+	std::string pattern = "[" + name + "] [%^%l%$] %v";
+	console_sink->set_pattern(pattern);
+	auto logger = std::make_shared<spdlog::logger>(name, spdlog::sinks_init_list{ console_sink });
+	logger->set_level(spdlog::level::critical);
+	return logger;
+}
+
+reply make_echo_reply(const request& req)
+{
+	reply rep;
+	rep.status_code = 200;
+	rep.content = "echo request uri: " + req.uri + " body: " + req.body;
+	rep.add_header("Content-Type", "text");
+	return rep;
+}
+
+class echo_http_server : public http_server
+{
+public:
+	using http_server::http_server;
+protected:
+	void handle_request(const request& req, reply_handler rep_cb) override
+	{
+		rep_cb(make_echo_reply(req));
+	}
+};
+
+class echo_https_server : public https_server
+{
+public:
+	using https_server::https_server;
+protected:
+	void handle_request(const request& req, reply_handler rep_cb) override
+	{
+		rep_cb(make_echo_reply(req));
+	}
+};
+
+std::size_t read_rss_kb()
+{
+	std::ifstream status_file("/proc/self/status");
+	std::string cur_line;
+	while (std::getline(status_file, cur_line))
+	{
+		if (cur_line.rfind("VmRSS:", 0) == 0)
+		{
+			return std::stoul(cur_line.substr(6));
+		}
+	}
+	return 0;
+}
+
+// the cpu time used so far by thread, read from another thread
+std::uint64_t thread_cpu_us(std::thread& thread)
+{
+	clockid_t cur_clock;
+	timespec cur_ts;
+	if (pthread_getcpuclockid(thread.native_handle(), &cur_clock) || clock_gettime(cur_clock, &cur_ts))
+	{
+		return 0;
+	}
+	return std::uint64_t(cur_ts.tv_sec) * 1000000 + std::uint64_t(cur_ts.tv_nsec) / 1000;
+}
+
+// the mean allocations per request the servers on ports [base_port, base_port + server_num) counted,
+// 0 without HTTP_UTILS_ALLOC_ACCOUNTING
+double server_allocs_per_request(std::uint16_t base_port, std::size_t server_num)
+{
+	std::vector<std::string> server_labels;
+	for (std::size_t i = 0; i < server_num; i++)
+	{
+		server_labels.push_back(metrics_labels({ { "server", "127.0.0.1:" + std::to_string(base_port + i) } }));
+	}
+	std::uint64_t cur_count = 0;
+	std::uint64_t cur_sum = 0;
+	for (const auto& one_sample : metrics_registry::global().collect_histograms())
+	{
+		if (one_sample.name == "http_server_request_allocations" && std::find(server_labels.begin(), server_labels.end(), one_sample.labels) != server_labels.end())
+		{
+			cur_count += one_sample.value.count;
+			cur_sum += one_sample.value.sum;
+		}
+	}
+	return cur_count ? double(cur_sum) / double(cur_count) : 0;
+}
+
+struct bench_scenario
+{
+	bool tls = false;
+	bool keep_alive = false;
+	std::size_t body_size = 1024;
+	// every thread runs a server of its own on the next port and a client io_context
+	std::size_t thread_num = 1;
+	std::size_t connections = 16;
+	double duration_seconds = 2;
+
+	std::string name() const
+	{
+		std::string result = tls ? "https" : "http";
+		result += keep_alive ? " keep-alive" : " close";
+		result += body_size >= 1024 * 1024 ? " " + std::to_string(body_size / 1024 / 1024) + "MB" : " " + std::to_string(body_size / 1024) + "KB";
+		result += " " + std::to_string(thread_num) + (thread_num == 1 ? " thread" : " threads");
+		return result;
+	}
+};
+
+struct client_stats
+{
+	std::vector<std::uint32_t> latency_us;
+	std::uint64_t requests = 0;
+	std::uint64_t connects = 0;
+	std::uint64_t errors = 0;
+};
+
+// one request in flight per connection, sent again as soon as the reply is read
+template <typename Stream>
+class loopback_connection : public std::enable_shared_from_this<loopback_connection<Stream>>
+{
+public:
+	loopback_connection(asio::io_context& ioc, asio::ssl::context* ssl_ctx, const asio::ip::tcp::endpoint& endpoint, const std::string& req_str, bool keep_alive, bench_clock::time_point end_ts, client_stats& stats)
+		: m_ioc(ioc)
+		, m_ssl_ctx(ssl_ctx)
+		, m_endpoint(endpoint)
+		, m_req_str(req_str)
+		, m_keep_alive(keep_alive)
+		, m_end_ts(end_ts)
+		, m_stats(stats)
+	{
+		// the echoed bodies are only counted, not stored
+		m_parser.m_body_handler = [](std::string_view)
+		{
+
+		};
+	}
+
+	void start()
+	{
+		send();
+	}
+
+private:
+	auto& lowest_layer()
+	{
+		if constexpr (std::is_same_v<Stream, tls_stream>)
+		{
+			return m_stream->lowest_layer();
+		}
+		else
+		{
+			return *m_stream;
+		}
+	}
+
+	void send()
+	{
+		if (bench_clock::now() >= m_end_ts)
+		{
+			close();
+			return;
+		}
+		m_send_ts = bench_clock::now();
+		if (m_stream)
+		{
+			write();
+			return;
+		}
+		if constexpr (std::is_same_v<Stream, tls_stream>)
+		{
+			m_stream = std::make_unique<Stream>(m_ioc, *m_ssl_ctx);
+		}
+		else
+		{
+			m_stream = std::make_unique<Stream>(m_ioc);
+		}
+		m_stats.connects++;
+		lowest_layer().async_connect(m_endpoint, [self = this->shared_from_this(), this](const asio_ec& ec)
+			{
+				if (ec)
+				{
+					on_error();
+					return;
+				}
+				asio_ec ignore_ec;
+				lowest_layer().set_option(asio::ip::tcp::no_delay(true), ignore_ec);
+				if constexpr (std::is_same_v<Stream, tls_stream>)
+				{
+					m_stream->async_handshake(asio::ssl::stream_base::client, [self, this](const asio_ec& ec)
+						{
+							if (ec)
+							{
+								on_error();
+								return;
+							}
+							write();
+						});
+				}
+				else
+				{
+					write();
+				}
+			});
+	}
+
+	void write()
+	{
+		asio::async_write(*m_stream, asio::buffer(m_req_str), [self = this->shared_from_this(), this](const asio_ec& ec, std::size_t)
+			{
+				if (ec)
+				{
+					on_error();
+					return;
+				}
+				m_parser.reset();
+				read();
+			});
+	}
+
+	void read()
+	{
+		m_stream->async_read_some(asio::buffer(m_buffer), [self = this->shared_from_this(), this](const asio_ec& ec, std::size_t n)
+			{
+				if (ec)
+				{
+					on_error();
+					return;
+				}
+				auto cur_result = m_parser.parse(m_buffer.data(), n);
+				if (cur_result == http_reply_parser::result_type::indeterminate)
+				{
+					read();
+					return;
+				}
+				if (cur_result != http_reply_parser::result_type::good || m_parser.m_reply.status_code != 200)
+				{
+					on_error();
+					return;
+				}
+				auto cur_latency = std::chrono::duration_cast<std::chrono::microseconds>(bench_clock::now() - m_send_ts).count();
+				m_stats.latency_us.push_back(std::uint32_t(cur_latency));
+				m_stats.requests++;
+				if (!m_keep_alive || !m_parser.keep_alive())
+				{
+					close();
+				}
+				send();
+			});
+	}
+
+	void on_error()
+	{
+		m_stats.errors++;
+		close();
+		send();
+	}
+
+	void close()
+	{
+		if (m_stream)
+		{
+			asio_ec ignore_ec;
+			lowest_layer().close(ignore_ec);
+			m_stream.reset();
+		}
+	}
+
+	asio::io_context& m_ioc;
+	asio::ssl::context* const m_ssl_ctx;
+	const asio::ip::tcp::endpoint m_endpoint;
+	const std::string& m_req_str;
+	const bool m_keep_alive;
+	const bench_clock::time_point m_end_ts;
+	client_stats& m_stats;
+	std::unique_ptr<Stream> m_stream;
+	http_reply_parser m_parser;
+	std::array<char, 65536> m_buffer;
+	bench_clock::time_point m_send_ts;
+};
+
+// print a line of results and return the allocations per request of the servers
+double run_scenario(const bench_scenario& scenario, std::uint16_t base_port)
+{
+	auto cur_logger = create_logger("loopback_bench");
+	asio::ssl::context server_ctx{ asio::ssl::context::tls_server };
+	asio::ssl::context client_ctx{ asio::ssl::context::tls_client };
+	if (scenario.tls)
+	{
+		server_ctx.use_certificate_chain_file("../data/keys/server.crt");
+		server_ctx.use_private_key_file("../data/keys/server.key", asio::ssl::context::pem);
+	}
+
+	// servers
+	std::vector<std::unique_ptr<asio::io_context>> server_iocs;
+	std::vector<std::unique_ptr<echo_http_server>> http_servers;
+	std::vector<std::unique_ptr<echo_https_server>> https_servers;
+	std::vector<asio::ip::tcp::endpoint> endpoints;
+	for (std::size_t i = 0; i < scenario.thread_num; i++)
+	{
+		auto cur_port = std::uint16_t(base_port + i);
+		server_iocs.push_back(std::make_unique<asio::io_context>());
+		if (scenario.tls)
+		{
+			https_servers.push_back(std::make_unique<echo_https_server>(*server_iocs.back(), server_ctx, cur_logger, "127.0.0.1", std::to_string(cur_port)));
+			https_servers.back()->run();
+		}
+		else
+		{
+			http_servers.push_back(std::make_unique<echo_http_server>(*server_iocs.back(), cur_logger, "127.0.0.1", std::to_string(cur_port)));
+			http_servers.back()->run();
+		}
+		endpoints.emplace_back(asio::ip::make_address("127.0.0.1"), cur_port);
+	}
+	std::vector<std::thread> server_threads;
+	for (auto& one_ioc : server_iocs)
+	{
+		server_threads.emplace_back([&one_ioc]()
+			{
+				auto cur_guard = asio::make_work_guard(*one_ioc);
+				one_ioc->run();
+			});
+	}
+
+	// request::to_string asks for connection close, keep-alive requests are left without the header
+	std::string cur_body(scenario.body_size, 'b');
+	std::string req_str = "POST /echo HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Type: application/octet-stream\r\n";
+	if (!scenario.keep_alive)
+	{
+		req_str += "Connection: close\r\n";
+	}
+	req_str += "Content-Length: " + std::to_string(cur_body.size()) + "\r\n\r\n" + cur_body;
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	auto base_rss = read_rss_kb();
+	std::vector<std::uint64_t> server_cpu_begin;
+	for (auto& one_thread : server_threads)
+	{
+		server_cpu_begin.push_back(thread_cpu_us(one_thread));
+	}
+
+	// clients, a connection to each server in turn
+	auto begin_ts = bench_clock::now();
+	auto end_ts = begin_ts + std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(scenario.duration_seconds));
+	std::vector<client_stats> thread_stats(scenario.thread_num);
+	std::vector<std::thread> client_threads;
+	for (std::size_t i = 0; i < scenario.thread_num; i++)
+	{
+		client_threads.emplace_back([&, i]()
+			{
+				asio::io_context cur_ioc;
+				for (std::size_t j = i; j < scenario.connections; j += scenario.thread_num)
+				{
+					const auto& cur_endpoint = endpoints[j % endpoints.size()];
+					if (scenario.tls)
+					{
+						std::make_shared<loopback_connection<tls_stream>>(cur_ioc, &client_ctx, cur_endpoint, req_str, scenario.keep_alive, end_ts, thread_stats[i])->start();
+					}
+					else
+					{
+						std::make_shared<loopback_connection<asio::ip::tcp::socket>>(cur_ioc, nullptr, cur_endpoint, req_str, scenario.keep_alive, end_ts, thread_stats[i])->start();
+					}
+				}
+				cur_ioc.run();
+			});
+	}
+	// the connections are all open near the end of the run
+	std::this_thread::sleep_until(begin_ts + (end_ts - begin_ts) * 9 / 10);
+	auto busy_rss = read_rss_kb();
+	for (auto& one_thread : client_threads)
+	{
+		one_thread.join();
+	}
+	auto cost_seconds = std::chrono::duration<double>(bench_clock::now() - begin_ts).count();
+	std::uint64_t server_cpu_us = 0;
+	for (std::size_t i = 0; i < server_threads.size(); i++)
+	{
+		server_cpu_us += thread_cpu_us(server_threads[i]) - server_cpu_begin[i];
+	}
+	for (auto& one_server : http_servers)
+	{
+		one_server->stop();
+	}
+	for (auto& one_server : https_servers)
+	{
+		one_server->stop();
+	}
+	for (auto& one_ioc : server_iocs)
+	{
+		one_ioc->stop();
+	}
+	for (auto& one_thread : server_threads)
+	{
+		one_thread.join();
+	}
+
+	client_stats total_stats;
+	for (const auto& one_stats : thread_stats)
+	{
+		total_stats.latency_us.insert(total_stats.latency_us.end(), one_stats.latency_us.begin(), one_stats.latency_us.end());
+		total_stats.requests += one_stats.requests;
+		total_stats.connects += one_stats.connects;
+		total_stats.errors += one_stats.errors;
+	}
+	auto& latencies = total_stats.latency_us;
+	std::sort(latencies.begin(), latencies.end());
+	auto percentile = [&latencies](double q) -> std::uint32_t
+	{
+		if (latencies.empty())
+		{
+			return 0;
+		}
+		return latencies[std::min(latencies.size() - 1, std::size_t(q * double(latencies.size())))];
+	};
+	auto cur_requests = std::max<std::uint64_t>(total_stats.requests, 1);
+	auto cur_allocs = server_allocs_per_request(base_port, scenario.thread_num);
+	char buffer[256];
+	std::snprintf(buffer, sizeof(buffer), "%-34s %9.0f %8u %8u %8u %8u %8u %10.1f %10zu %10.1f %9llu %7llu",
+		scenario.name().c_str(), double(total_stats.requests) / cost_seconds,
+		percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), latencies.empty() ? 0 : latencies.back(),
+		double(server_cpu_us) / double(cur_requests),
+		busy_rss > base_rss ? (busy_rss - base_rss) / scenario.connections : 0,
+		cur_allocs,
+		(unsigned long long)total_stats.connects, (unsigned long long)total_stats.errors);
+	std::cout << buffer << std::endl;
+	return cur_allocs;
+}
+
+int main(int argc, char* argv[])
+{
+	// loopback_bench [seconds per scenario] [max server allocations per request]
+	double duration_seconds = 2;
+	if (argc > 1)
+	{
+		duration_seconds = std::stod(argv[1]);
+	}
+	double max_allocs = 0;
+	if (argc > 2)
+	{
+		max_allocs = std::stod(argv[2]);
+		if (!alloc_accounting_enabled)
+		{
+			std::cerr << "an allocation budget needs a build with HTTP_UTILS_ALLOC_ACCOUNTING" << std::endl;
+			return 1;
+		}
+	}
+	std::size_t over_budget = 0;
+	std::size_t max_threads = std::max(2u, std::thread::hardware_concurrency());
+	std::printf("%-34s %9s %8s %8s %8s %8s %8s %10s %10s %10s %9s %7s\n", "scenario", "req/s", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us",
+		"server cpu", "rss KB", "server", "connects", "errors");
+	std::printf("%-34s %9s %8s %8s %8s %8s %8s %10s %10s %10s %9s %7s\n", "", "", "", "", "", "", "", "us/req", "/conn", "allocs/req", "", "");
+	std::uint16_t cur_port = 18400;
+	try
+	{
+		for (bool tls : { false, true })
+		{
+			for (bool keep_alive : { false, true })
+			{
+				for (std::size_t body_size : { std::size_t(1024), std::size_t(1024 * 1024) })
+				{
+					for (std::size_t thread_num : { std::size_t(1), max_threads })
+					{
+						bench_scenario cur_scenario;
+						cur_scenario.tls = tls;
+						cur_scenario.keep_alive = keep_alive;
+						cur_scenario.body_size = body_size;
+						cur_scenario.thread_num = thread_num;
+						cur_scenario.duration_seconds = duration_seconds;
+						auto cur_allocs = run_scenario(cur_scenario, cur_port);
+						if (max_allocs && cur_allocs > max_allocs)
+						{
+							over_budget++;
+						}
+						cur_port = std::uint16_t(cur_port + thread_num);
+					}
+				}
+			}
+		}
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << "exception: " << e.what() << std::endl;
+		return 1;
+	}
+	if (over_budget)
+	{
+		std::cerr << over_budget << " scenarios allocate more than " << max_allocs << " times per request" << std::endl;
+		return 1;
+	}
+	return 0;
+}
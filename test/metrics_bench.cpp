@@ -0,0 +1,100 @@
+#include <metrics.h>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+using namespace spiritsaway::http_utils;
+
+// run body(thread_index) on thread_num threads and return the ns per iteration of one thread
+template <typename Body>
+double run_threads(std::size_t thread_num, std::size_t iterations, Body body)
+{
+	std::vector<std::thread> threads;
+	auto begin_ts = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < thread_num; i++)
+	{
+		threads.emplace_back([&body, iterations]()
+			{
+				for (std::size_t j = 0; j < iterations; j++)
+				{
+					body();
+				}
+			});
+	}
+	for (auto& one_thread : threads)
+	{
+		one_thread.join();
+	}
+	auto cost_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin_ts).count();
+	return double(cost_ns) / double(iterations * thread_num) * double(thread_num);
+}
+
+int main(int argc, char* argv[])
+{
+	std::size_t iterations = 20000000;
+	if (argc > 1)
+	{
+		iterations = std::stoul(argv[1]);
+	}
+	std::size_t max_threads = std::max(2u, std::thread::hardware_concurrency());
+	metrics_registry cur_registry;
+	auto& cur_counter = cur_registry.counter("bench_total", "bench counter");
+	std::atomic<std::uint64_t> shared_counter = 0;
+	volatile std::uint64_t plain_counter = 0;
+
+	for (std::size_t thread_num = 1; thread_num <= max_threads; thread_num *= 2)
+	{
+		auto pre_value = cur_counter.value();
+		auto plain_ns = run_threads(thread_num, iterations, [&plain_counter]()
+			{
+				plain_counter = plain_counter + 1;
+			});
+		auto sharded_ns = run_threads(thread_num, iterations, [&cur_counter]()
+			{
+				cur_counter.add();
+			});
+		auto atomic_ns = run_threads(thread_num, iterations, [&shared_counter]()
+			{
+				shared_counter.fetch_add(1, std::memory_order_relaxed);
+			});
+		auto cur_total = cur_counter.value() - pre_value;
+		std::cout << thread_num << " threads: plain " << plain_ns << " ns/op, metrics_counter " << sharded_ns << " ns/op, shared atomic "
+			<< atomic_ns << " ns/op, counted " << cur_total << "/" << iterations * thread_num << std::endl;
+	}
+
+	auto& cur_histogram = cur_registry.histogram("bench_microseconds", "bench histogram");
+	for (std::size_t thread_num = 1; thread_num <= max_threads; thread_num *= 2)
+	{
+		auto histogram_ns = run_threads(thread_num, iterations, [&cur_histogram]()
+			{
+				thread_local std::uint64_t cur_value = 0;
+				cur_histogram.record(cur_value++ & 0xffff);
+			});
+		std::cout << thread_num << " threads: metrics_histogram " << histogram_ns << " ns/op" << std::endl;
+	}
+	auto cur_snapshot = cur_histogram.snapshot();
+	// uniform values in [0, 65536), the percentiles should be within a bucket width of the exact ones
+	std::cout << "recorded " << cur_snapshot.count << " values, p50 " << cur_snapshot.percentile(0.5) << " (32767), p99 " << cur_snapshot.percentile(0.99)
+		<< " (64880), max " << cur_snapshot.percentile(1.0) << " (65535)" << std::endl;
+
+	auto scrape_begin = std::chrono::steady_clock::now();
+	auto cur_samples = cur_registry.collect();
+	auto cur_histogram_samples = cur_registry.collect_histograms();
+	auto scrape_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - scrape_begin).count();
+	std::cout << "collect of " << cur_samples.size() << " metrics and " << cur_histogram_samples.size() << " histograms took " << scrape_us << "us" << std::endl;
+
+	// servers created again and again take the slots their predecessors released
+	std::size_t server_num = 2 * metrics_max_slots;
+	for (std::size_t i = 0; i < server_num; i++)
+	{
+		server_metrics cur_metrics(cur_registry, metrics_labels({ { "server", "127.0.0.1:" + std::to_string(10000 + i) } }));
+		cur_metrics.requests.add();
+		cur_metrics.on_timeout("read_request");
+		cur_metrics.first_byte.record(i);
+	}
+	// their histograms are released with them, only the ones registered above stay in the scrape
+	std::cout << server_num << " server_metrics created and destroyed, " << cur_registry.collect().size() << " metrics and "
+		<< cur_registry.collect_histograms().size() << " histograms left" << std::endl;
+	return 0;
+}
@@ -0,0 +1,387 @@
+#include <http_request_parser.h>
+#include <http_reply_parser.h>
+#include <http_packet.h>
+#include <alloc_accounting.h>
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace spiritsaway::http_utils;
+
+// every allocation of the process is counted, the benchmarks report the difference over their loop.
+// With HTTP_UTILS_ALLOC_ACCOUNTING the library replaces operator new and counts them already.
+#if !HTTP_UTILS_ALLOC_ACCOUNTING
+namespace
+{
+	std::atomic<std::uint64_t> alloc_count = 0;
+	std::atomic<std::uint64_t> alloc_bytes = 0;
+}
+
+void* operator new(std::size_t size)
+{
+	alloc_count.fetch_add(1, std::memory_order_relaxed);
+	alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+	if (auto* result = std::malloc(size ? size : 1))
+	{
+		return result;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+#endif
+
+namespace
+{
+	alloc_counters current_allocs()
+	{
+#if HTTP_UTILS_ALLOC_ACCOUNTING
+		return thread_alloc_counters();
+#else
+		alloc_counters result;
+		result.allocs = alloc_count.load(std::memory_order_relaxed);
+		result.alloc_bytes = alloc_bytes.load(std::memory_order_relaxed);
+		return result;
+#endif
+	}
+
+	class alloc_counter
+	{
+	public:
+		alloc_counter()
+			: m_begin(current_allocs())
+		{
+
+		}
+
+		void report(benchmark::State& state) const
+		{
+			auto cur_allocs = current_allocs() - m_begin;
+			state.counters["allocs/op"] = benchmark::Counter(double(cur_allocs.allocs), benchmark::Counter::kAvgIterations);
+			state.counters["alloc_bytes/op"] = benchmark::Counter(double(cur_allocs.alloc_bytes), benchmark::Counter::kAvgIterations);
+		}
+
+	private:
+		const alloc_counters m_begin;
+	};
+
+	struct corpus_entry
+	{
+		std::string name;
+		std::string data;
+	};
+
+	std::string chunked_body(std::size_t chunk_num, std::size_t chunk_size)
+	{
+		std::string result;
+		char size_buffer[16];
+		for (std::size_t i = 0; i < chunk_num; i++)
+		{
+			std::snprintf(size_buffer, sizeof(size_buffer), "%zx\r\n", chunk_size);
+			result += size_buffer;
+			result.append(chunk_size, char('a' + i % 26));
+			result += "\r\n";
+		}
+		result += "0\r\n\r\n";
+		return result;
+	}
+
+	std::vector<corpus_entry> request_corpus()
+	{
+		std::vector<corpus_entry> result;
+		result.push_back({ "small_get", "GET /index.html HTTP/1.1\r\nHost: example.com\r\nUser-Agent: curl/7.88.1\r\nAccept: */*\r\n\r\n" });
+
+		// what a browser sends to an api behind a cookie based login
+		std::string large_headers = "GET /api/v1/users/12345/orders?page=2&per_page=50&sort=-created_at HTTP/1.1\r\n"
+			"Host: shop.example.com\r\n"
+			"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+			"Accept: application/json, text/plain, */*\r\n"
+			"Accept-Language: en-US,en;q=0.9,zh-CN;q=0.8,zh;q=0.7\r\n"
+			"Accept-Encoding: gzip, deflate, br\r\n"
+			"Referer: https://shop.example.com/account/orders\r\n"
+			"Authorization: Bearer " + std::string(600, 'x') + "\r\n"
+			"Cookie: session=" + std::string(256, 's') + "; csrftoken=" + std::string(64, 'c') + "; _ga=GA1.2.1234567890.1700000000; theme=dark\r\n"
+			"Sec-Fetch-Dest: empty\r\nSec-Fetch-Mode: cors\r\nSec-Fetch-Site: same-origin\r\n"
+			"sec-ch-ua: \"Not_A Brand\";v=\"8\", \"Chromium\";v=\"120\"\r\nsec-ch-ua-mobile: ?0\r\nsec-ch-ua-platform: \"Linux\"\r\n"
+			"X-Request-Id: 3f2b8c1e-5d4a-4e2f-9b7c-0a1d2e3f4a5b\r\n"
+			"traceparent: 00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01\r\n"
+			"Cache-Control: no-cache\r\nPragma: no-cache\r\nConnection: keep-alive\r\n\r\n";
+		result.push_back({ "large_headers", large_headers });
+
+		result.push_back({ "post_4k", "POST /api/v1/events HTTP/1.1\r\nHost: example.com\r\nContent-Type: application/json\r\nContent-Length: 4096\r\n\r\n" + std::string(4096, 'j') });
+		result.push_back({ "chunked_8x512", "POST /upload HTTP/1.1\r\nHost: example.com\r\nContent-Type: application/octet-stream\r\nTransfer-Encoding: chunked\r\n\r\n" + chunked_body(8, 512) });
+		return result;
+	}
+
+	std::vector<corpus_entry> reply_corpus()
+	{
+		std::vector<corpus_entry> result;
+		result.push_back({ "small", "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 13\r\n\r\nHello, world!" });
+
+		std::string large_headers = "HTTP/1.1 200 OK\r\n"
+			"Date: Mon, 18 Dec 2023 08:00:00 GMT\r\n"
+			"Content-Type: application/json; charset=utf-8\r\n"
+			"Content-Length: 2\r\n"
+			"Cache-Control: private, max-age=0, must-revalidate\r\n"
+			"ETag: W/\"5e-1a2b3c4d5e6f\"\r\n"
+			"Vary: Accept-Encoding, Origin\r\n"
+			"Set-Cookie: session=" + std::string(256, 's') + "; Path=/; HttpOnly; Secure; SameSite=Lax\r\n"
+			"Set-Cookie: csrftoken=" + std::string(64, 'c') + "; Path=/; Secure\r\n"
+			"Strict-Transport-Security: max-age=63072000; includeSubDomains; preload\r\n"
+			"Content-Security-Policy: default-src 'self'; script-src 'self' https://cdn.example.com; img-src * data:\r\n"
+			"X-Content-Type-Options: nosniff\r\nX-Frame-Options: DENY\r\n"
+			"X-Request-Id: 3f2b8c1e-5d4a-4e2f-9b7c-0a1d2e3f4a5b\r\n"
+			"Server: http_utils\r\n\r\n{}";
+		result.push_back({ "large_headers", large_headers });
+
+		result.push_back({ "content_16k", "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: 16384\r\n\r\n" + std::string(16384, 'b') });
+		result.push_back({ "chunked_8x1k", "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nTransfer-Encoding: chunked\r\n\r\n" + chunked_body(8, 1024) });
+		return result;
+	}
+
+	// feed data in slices of split_size bytes like reads from a socket, 0 for a single read
+	template <typename Parser>
+	typename Parser::result_type parse_split(Parser& parser, const std::string& data, std::size_t split_size)
+	{
+		if (!split_size)
+		{
+			return parser.parse(data.data(), data.size());
+		}
+		auto cur_result = Parser::result_type::indeterminate;
+		for (std::size_t i = 0; i < data.size() && cur_result == Parser::result_type::indeterminate; i += split_size)
+		{
+			cur_result = parser.parse(data.data() + i, std::min(split_size, data.size() - i));
+		}
+		return cur_result;
+	}
+
+	bool same_headers(const std::vector<header>& a, const std::vector<header>& b)
+	{
+		if (a.size() != b.size())
+		{
+			return false;
+		}
+		for (std::size_t i = 0; i < a.size(); i++)
+		{
+			if (a[i].name != b[i].name || a[i].value != b[i].value)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void bench_request_parse(benchmark::State& state, const std::string& data, std::size_t split_size)
+	{
+		http_request_parser cur_parser;
+		http_request_parser whole_parser;
+		if (parse_split(whole_parser, data, 0) != http_request_parser::result_type::good
+			|| parse_split(cur_parser, data, split_size) != http_request_parser::result_type::good
+			|| !same_headers(whole_parser.m_req.headers, cur_parser.m_req.headers)
+			|| whole_parser.m_req.uri != cur_parser.m_req.uri
+			|| whole_parser.m_req.body != cur_parser.m_req.body)
+		{
+			state.SkipWithError("split parse differs from the whole parse");
+			return;
+		}
+		alloc_counter cur_allocs;
+		for (auto _ : state)
+		{
+			cur_parser.reset();
+			auto cur_result = parse_split(cur_parser, data, split_size);
+			benchmark::DoNotOptimize(cur_result);
+			benchmark::DoNotOptimize(cur_parser.m_req);
+		}
+		cur_allocs.report(state);
+		state.SetBytesProcessed(std::int64_t(state.iterations() * data.size()));
+	}
+
+	void bench_reply_parse(benchmark::State& state, const std::string& data, std::size_t split_size)
+	{
+		http_reply_parser cur_parser;
+		http_reply_parser whole_parser;
+		if (parse_split(whole_parser, data, 0) != http_reply_parser::result_type::good
+			|| parse_split(cur_parser, data, split_size) != http_reply_parser::result_type::good
+			|| !same_headers(whole_parser.m_reply.headers, cur_parser.m_reply.headers)
+			|| whole_parser.m_reply.content != cur_parser.m_reply.content)
+		{
+			state.SkipWithError("split parse differs from the whole parse");
+			return;
+		}
+		alloc_counter cur_allocs;
+		for (auto _ : state)
+		{
+			cur_parser.reset();
+			auto cur_result = parse_split(cur_parser, data, split_size);
+			benchmark::DoNotOptimize(cur_result);
+			benchmark::DoNotOptimize(cur_parser.m_reply);
+		}
+		cur_allocs.report(state);
+		state.SetBytesProcessed(std::int64_t(state.iterations() * data.size()));
+	}
+
+	reply make_reply(std::size_t content_size)
+	{
+		reply result;
+		result.status_code = 200;
+		result.headers.push_back(header{ "Content-Type", "application/json" });
+		result.headers.push_back(header{ "Cache-Control", "no-cache" });
+		result.headers.push_back(header{ "X-Request-Id", "3f2b8c1e-5d4a-4e2f-9b7c-0a1d2e3f4a5b" });
+		result.content.assign(content_size, 'r');
+		return result;
+	}
+
+	request make_request(std::size_t body_size)
+	{
+		request result;
+		result.method = "POST";
+		result.uri = "/api/v1/events?source=bench";
+		result.http_version_major = 1;
+		result.http_version_minor = 1;
+		result.headers.push_back(header{ "Content-Type", "application/json" });
+		result.headers.push_back(header{ "User-Agent", "http_utils" });
+		result.headers.push_back(header{ "X-Request-Id", "3f2b8c1e-5d4a-4e2f-9b7c-0a1d2e3f4a5b" });
+		result.body.assign(body_size, 'q');
+		return result;
+	}
+
+	void bench_reply_to_string(benchmark::State& state)
+	{
+		auto cur_reply = make_reply(std::size_t(state.range(0)));
+		std::size_t cur_bytes = 0;
+		alloc_counter cur_allocs;
+		for (auto _ : state)
+		{
+			auto cur_text = cur_reply.to_string();
+			cur_bytes += cur_text.size();
+			benchmark::DoNotOptimize(cur_text);
+		}
+		cur_allocs.report(state);
+		state.SetBytesProcessed(std::int64_t(cur_bytes));
+	}
+
+	void bench_request_to_string(benchmark::State& state)
+	{
+		auto cur_request = make_request(std::size_t(state.range(0)));
+		const std::string cur_url = "example.com";
+		const std::string cur_port = "8080";
+		std::size_t cur_bytes = 0;
+		alloc_counter cur_allocs;
+		for (auto _ : state)
+		{
+			auto cur_text = cur_request.to_string(cur_url, cur_port);
+			cur_bytes += cur_text.size();
+			benchmark::DoNotOptimize(cur_text);
+		}
+		cur_allocs.report(state);
+		state.SetBytesProcessed(std::int64_t(cur_bytes));
+	}
+
+	// the same requests as bench_request_to_string through the reused buffer of request_template
+	void bench_request_template_build(benchmark::State& state)
+	{
+		auto cur_request = make_request(std::size_t(state.range(0)));
+		request_template cur_template(cur_request, "example.com");
+		std::size_t cur_bytes = 0;
+		alloc_counter cur_allocs;
+		for (auto _ : state)
+		{
+			const auto& cur_text = cur_template.build("", cur_request.body);
+			cur_bytes += cur_text.size();
+			benchmark::DoNotOptimize(cur_text.data());
+		}
+		cur_allocs.report(state);
+		state.SetBytesProcessed(std::int64_t(cur_bytes));
+	}
+
+	void bench_parse_uri(benchmark::State& state, const std::string& uri)
+	{
+		std::string cur_url;
+		std::string cur_port;
+		std::string cur_path;
+		alloc_counter cur_allocs;
+		for (auto _ : state)
+		{
+			parse_uri(uri, cur_url, cur_port, cur_path);
+			benchmark::DoNotOptimize(cur_path.data());
+		}
+		cur_allocs.report(state);
+		state.SetBytesProcessed(std::int64_t(state.iterations() * uri.size()));
+	}
+
+	void bench_stock_reply(benchmark::State& state, reply::status_type status)
+	{
+		alloc_counter cur_allocs;
+		for (auto _ : state)
+		{
+			auto cur_reply = reply::stock_reply(status);
+			benchmark::DoNotOptimize(cur_reply);
+		}
+		cur_allocs.report(state);
+	}
+
+	void bench_stock_reply_to_string(benchmark::State& state, reply::status_type status)
+	{
+		alloc_counter cur_allocs;
+		for (auto _ : state)
+		{
+			auto cur_text = reply::stock_reply(status).to_string();
+			benchmark::DoNotOptimize(cur_text);
+		}
+		cur_allocs.report(state);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	// 0 is a single read, 1460 a full ethernet segment, 64 a slow client
+	const std::size_t split_sizes[] = { 0, 1460, 64 };
+	for (const auto& one_entry : request_corpus())
+	{
+		for (auto one_split : split_sizes)
+		{
+			benchmark::RegisterBenchmark(("request_parse/" + one_entry.name + "/split:" + std::to_string(one_split)).c_str(), bench_request_parse, one_entry.data, one_split);
+		}
+	}
+	for (const auto& one_entry : reply_corpus())
+	{
+		for (auto one_split : split_sizes)
+		{
+			benchmark::RegisterBenchmark(("reply_parse/" + one_entry.name + "/split:" + std::to_string(one_split)).c_str(), bench_reply_parse, one_entry.data, one_split);
+		}
+	}
+	benchmark::RegisterBenchmark("reply_to_string", bench_reply_to_string)->ArgName("content")->Arg(0)->Arg(1024)->Arg(65536);
+	benchmark::RegisterBenchmark("request_to_string", bench_request_to_string)->ArgName("body")->Arg(0)->Arg(1024)->Arg(65536);
+	benchmark::RegisterBenchmark("request_template_build", bench_request_template_build)->ArgName("body")->Arg(0)->Arg(1024)->Arg(65536);
+	for (std::string one_uri : { "http://example.com", "http://127.0.0.1:8080/api/v1/users?id=12345", "https://shop.example.com/account/orders/2023/12/18/details" })
+	{
+		benchmark::RegisterBenchmark(("parse_uri/" + one_uri).c_str(), bench_parse_uri, one_uri);
+	}
+	for (auto one_status : { reply::status_type::ok, reply::status_type::not_found, reply::status_type::internal_server_error })
+	{
+		auto cur_name = std::to_string(int(one_status));
+		benchmark::RegisterBenchmark(("stock_reply/" + cur_name).c_str(), bench_stock_reply, one_status);
+		benchmark::RegisterBenchmark(("stock_reply_to_string/" + cur_name).c_str(), bench_stock_reply_to_string, one_status);
+	}
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+	{
+		return 1;
+	}
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
@@ -0,0 +1,169 @@
+#include <http_server.h>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/logger.h>
+
+using namespace spiritsaway::http_utils;
+
+std::shared_ptr<spdlog::logger> create_logger(const std::string& name)
+{
+	auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+	console_sink->set_level(spdlog::level::warn);
+	std::string pattern = "[" + name + "] [%^%l%$] %v";
+	console_sink->set_pattern(pattern);
+	auto logger = std::make_shared<spdlog::logger>(name, spdlog::sinks_init_list{ console_sink });
+	logger->set_level(spdlog::level::warn);
+	return logger;
+}
+
+class event_http_server : public http_server
+{
+public:
+	event_http_server(asio::io_context& io_context, std::shared_ptr<spdlog::logger> in_logger, const std::string& address, const std::string& port, std::shared_ptr<sse_hub> hub)
+		: http_server(io_context, in_logger, address, port)
+		, m_hub(std::move(hub))
+	{
+
+	}
+protected:
+	void handle_request(const request& req, reply_handler rep_cb) override
+	{
+		if (req.uri == "/events")
+		{
+			rep_cb(make_sse_reply(m_hub));
+			return;
+		}
+		rep_cb(reply::stock_reply(reply::status_type::not_found));
+	}
+private:
+	std::shared_ptr<sse_hub> m_hub;
+};
+
+// reads the event stream and counts the events, each ends with an empty line
+struct sse_bench_client
+{
+	asio::ip::tcp::socket socket;
+	std::array<char, 16384> buffer;
+	std::string request_str = "GET /events HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+	std::size_t event_num = 0;
+	char last_char = 0;
+
+	explicit sse_bench_client(asio::io_context& ioc)
+		: socket(ioc)
+	{
+
+	}
+
+	void start(const asio::ip::tcp::endpoint& endpoint, std::atomic<std::size_t>& total_events)
+	{
+		socket.async_connect(endpoint, [this, &total_events](const asio_ec& ec)
+			{
+				if (ec)
+				{
+					std::cerr << "connect error " << ec.message() << std::endl;
+					return;
+				}
+				asio::async_write(socket, asio::buffer(request_str), [this, &total_events](const asio_ec& ec, std::size_t)
+					{
+						if (!ec)
+						{
+							do_read(total_events);
+						}
+					});
+			});
+	}
+
+	void do_read(std::atomic<std::size_t>& total_events)
+	{
+		socket.async_read_some(asio::buffer(buffer), [this, &total_events](const asio_ec& ec, std::size_t n)
+			{
+				if (ec)
+				{
+					return;
+				}
+				std::size_t cur_events = 0;
+				for (std::size_t i = 0; i < n; i++)
+				{
+					if (buffer[i] == '\n' && last_char == '\n')
+					{
+						cur_events++;
+					}
+					last_char = buffer[i];
+				}
+				event_num += cur_events;
+				total_events += cur_events;
+				do_read(total_events);
+			});
+	}
+};
+
+int main(int argc, char* argv[])
+{
+	std::size_t client_num = 1000;
+	std::size_t event_num = 1000;
+	if (argc > 2)
+	{
+		client_num = std::stoul(argv[1]);
+		event_num = std::stoul(argv[2]);
+	}
+	auto cur_logger = create_logger("sse");
+	auto cur_hub = std::make_shared<sse_hub>();
+	asio::io_context server_ioc;
+	event_http_server cur_server(server_ioc, cur_logger, "127.0.0.1", "8480", cur_hub);
+	cur_server.run();
+	std::thread server_thread([&server_ioc]()
+		{
+			server_ioc.run();
+		});
+
+	asio::io_context client_ioc;
+	auto client_guard = asio::make_work_guard(client_ioc);
+	std::atomic<std::size_t> total_events = 0;
+	std::vector<std::unique_ptr<sse_bench_client>> clients;
+	asio::ip::tcp::endpoint cur_endpoint(asio::ip::make_address("127.0.0.1"), 8480);
+	for (std::size_t i = 0; i < client_num; i++)
+	{
+		clients.push_back(std::make_unique<sse_bench_client>(client_ioc));
+		clients.back()->start(cur_endpoint, total_events);
+	}
+	std::thread client_thread([&client_ioc]()
+		{
+			client_ioc.run();
+		});
+	while (cur_hub->subscriber_count() < client_num)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	sse_event cur_event;
+	cur_event.event = "tick";
+	auto begin_ts = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < event_num; i++)
+	{
+		cur_event.id = std::to_string(i);
+		cur_event.data = "{\"seq\":" + std::to_string(i) + ",\"payload\":\"" + std::string(64, 'x') + "\"}";
+		cur_hub->broadcast(cur_event);
+	}
+	auto broadcast_ts = std::chrono::steady_clock::now();
+	auto expected = client_num * event_num;
+	auto deadline = begin_ts + std::chrono::seconds(60);
+	while (total_events < expected && std::chrono::steady_clock::now() < deadline)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	auto end_ts = std::chrono::steady_clock::now();
+	auto broadcast_us = std::chrono::duration_cast<std::chrono::microseconds>(broadcast_ts - begin_ts).count();
+	auto total_us = std::chrono::duration_cast<std::chrono::microseconds>(end_ts - begin_ts).count();
+	std::cout << client_num << " subscribers " << event_num << " events: " << total_events << "/" << expected << " delivered in " << total_us / 1000 << "ms, "
+		<< std::uint64_t(double(total_events) * 1000000 / double(std::max<long long>(total_us, 1))) << " deliveries/sec, broadcast calls took " << broadcast_us / 1000 << "ms" << std::endl;
+
+	client_guard.reset();
+	client_ioc.stop();
+	client_thread.join();
+	cur_server.stop();
+	server_ioc.stop();
+	server_thread.join();
+	return 0;
+}
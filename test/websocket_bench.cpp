@@ -0,0 +1,221 @@
+#include <http_server.h>
+#include <https_server.h>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/logger.h>
+
+using namespace spiritsaway::http_utils;
+
+std::shared_ptr<spdlog::logger> create_logger(const std::string& name)
+{
+	auto console_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+	console_sink->set_level(spdlog::level::warn);
+	std::string pattern = "[" + name + "] [%^%l%$] %v";
+	console_sink->set_pattern(pattern);
+	auto logger = std::make_shared<spdlog::logger>(name, spdlog::sinks_init_list{ console_sink });
+	logger->set_level(spdlog::level::warn);
+	return logger;
+}
+
+void echo_websocket(std::shared_ptr<websocket_channel> channel)
+{
+	// the handler is owned by the channel, keep only a weak reference back
+	std::weak_ptr<websocket_channel> weak_channel = channel;
+	channel->set_message_handler([weak_channel](websocket_opcode opcode, const std::string& payload)
+		{
+			if (auto cur_channel = weak_channel.lock())
+			{
+				cur_channel->send(opcode, payload);
+			}
+		});
+}
+
+class echo_http_server : public http_server
+{
+public:
+	using http_server::http_server;
+protected:
+	void handle_request(const request& req, reply_handler rep_cb) override
+	{
+		rep_cb(reply::stock_reply(reply::status_type::not_found));
+	}
+	void handle_websocket(std::shared_ptr<websocket_channel> channel) override
+	{
+		echo_websocket(channel);
+	}
+};
+
+class echo_https_server : public https_server
+{
+public:
+	using https_server::https_server;
+protected:
+	void handle_request(const request& req, reply_handler rep_cb) override
+	{
+		rep_cb(reply::stock_reply(reply::status_type::not_found));
+	}
+	void handle_websocket(std::shared_ptr<websocket_channel> channel) override
+	{
+		echo_websocket(channel);
+	}
+};
+
+template <typename Stream>
+bool websocket_handshake(Stream& stream)
+{
+	const std::string client_key = "dGhlIHNhbXBsZSBub25jZQ==";
+	std::string cur_request = "GET /echo HTTP/1.1\r\nHost: 127.0.0.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: " + client_key + "\r\nSec-WebSocket-Version: 13\r\n\r\n";
+	asio::write(stream, asio::buffer(cur_request));
+	std::string cur_reply;
+	std::array<char, 1024> cur_buffer;
+	while (cur_reply.find("\r\n\r\n") == std::string::npos)
+	{
+		// the server sends nothing before our first frame, so the 101 reply arrives alone
+		cur_reply.append(cur_buffer.data(), stream.read_some(asio::buffer(cur_buffer)));
+	}
+	return cur_reply.rfind("HTTP/1.1 101", 0) == 0 && cur_reply.find(websocket_accept_key(client_key)) != std::string::npos;
+}
+
+// echo count messages of payload_size bytes, keeping a window of them in flight
+template <typename Stream>
+void run_echo(Stream& stream, const std::string& name, std::size_t payload_size, std::size_t count)
+{
+	websocket_connection cur_connection(websocket_role::client);
+	std::string cur_payload(payload_size, 'x');
+	std::size_t window = std::max<std::size_t>(1, std::min<std::size_t>(256, 256 * 1024 / std::max<std::size_t>(payload_size, 1)));
+	std::size_t sent_num = 0;
+	std::size_t received_num = 0;
+	std::size_t error_num = 0;
+	std::array<char, 65536> cur_buffer;
+	auto begin_ts = std::chrono::steady_clock::now();
+	while (sent_num < std::min(window, count))
+	{
+		cur_connection.send(websocket_opcode::binary, cur_payload);
+		sent_num++;
+	}
+	while (received_num < count)
+	{
+		if (!cur_connection.output().empty())
+		{
+			asio::write(stream, asio::buffer(cur_connection.output()));
+			cur_connection.output().clear();
+		}
+		auto cur_len = stream.read_some(asio::buffer(cur_buffer));
+		if (!cur_connection.feed(cur_buffer.data(), cur_len))
+		{
+			std::cout << name << ": protocol error" << std::endl;
+			return;
+		}
+		for (const auto& one_message : cur_connection.take_messages())
+		{
+			received_num++;
+			if (one_message.payload.size() != payload_size)
+			{
+				error_num++;
+			}
+			if (sent_num < count)
+			{
+				cur_connection.send(websocket_opcode::binary, cur_payload);
+				sent_num++;
+			}
+		}
+	}
+	auto cost_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin_ts).count();
+	auto cur_rate = double(count) * 1000000 / double(std::max<long long>(cost_us, 1));
+	std::cout << name << " payload " << payload_size << ": " << count << " messages " << error_num << " errors in " << cost_us / 1000 << "ms, "
+		<< std::uint64_t(cur_rate) << " msgs/sec, " << cur_rate * payload_size / (1024 * 1024) << " MB/s" << std::endl;
+}
+
+template <typename Stream>
+void run_sizes(Stream& stream, const std::string& name, std::size_t count)
+{
+	if (!websocket_handshake(stream))
+	{
+		std::cout << name << ": handshake failed" << std::endl;
+		return;
+	}
+	for (std::size_t one_size : { std::size_t(16), std::size_t(1024), std::size_t(65536) })
+	{
+		run_echo(stream, name, one_size, one_size >= 65536 ? count / 16 : count);
+	}
+	websocket_connection cur_connection(websocket_role::client);
+	cur_connection.close(1000, "done");
+	asio::write(stream, asio::buffer(cur_connection.output()));
+}
+
+// unmasking in place, the simd path against a byte loop
+void bench_unmask()
+{
+	std::string cur_data(1024 * 1024, 'x');
+	const std::array<std::uint8_t, 4> cur_mask = { 0x12, 0x34, 0x56, 0x78 };
+	const std::size_t rounds = 256;
+	auto begin_ts = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < rounds; i++)
+	{
+		websocket_unmask(cur_data.data(), cur_data.size(), cur_mask);
+	}
+	auto simd_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin_ts).count();
+	begin_ts = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < rounds; i++)
+	{
+		auto* cur_bytes = reinterpret_cast<volatile char*>(cur_data.data());
+		for (std::size_t j = 0; j < cur_data.size(); j++)
+		{
+			cur_bytes[j] ^= cur_mask[j % 4];
+		}
+	}
+	auto byte_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin_ts).count();
+	std::cout << "unmask: " << double(rounds) * 1000000 / double(std::max<long long>(simd_us, 1)) << " MB/s, byte loop "
+		<< double(rounds) * 1000000 / double(std::max<long long>(byte_us, 1)) << " MB/s" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	std::size_t count = 200000;
+	if (argc > 1)
+	{
+		count = std::stoul(argv[1]);
+	}
+	auto cur_logger = create_logger("websocket");
+	bench_unmask();
+	try
+	{
+		asio::io_context server_ioc;
+		echo_http_server ws_server(server_ioc, cur_logger, "127.0.0.1", "8470");
+		ws_server.enable_websocket();
+		ws_server.run();
+		asio::ssl::context server_ctx{ asio::ssl::context::tls_server };
+		server_ctx.use_certificate_chain_file("../data/keys/server.crt");
+		server_ctx.use_private_key_file("../data/keys/server.key", asio::ssl::context::pem);
+		echo_https_server wss_server(server_ioc, server_ctx, cur_logger, "127.0.0.1", "8471");
+		wss_server.enable_websocket();
+		wss_server.run();
+		std::thread server_thread([&server_ioc]()
+			{
+				server_ioc.run();
+			});
+
+		asio::io_context client_ioc;
+		asio::ip::tcp::socket ws_socket(client_ioc);
+		ws_socket.connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), 8470));
+		ws_socket.set_option(asio::ip::tcp::no_delay(true));
+		run_sizes(ws_socket, "ws", count);
+
+		asio::ssl::context client_ctx{ asio::ssl::context::tls_client };
+		asio::ssl::stream<asio::ip::tcp::socket> wss_stream(client_ioc, client_ctx);
+		wss_stream.lowest_layer().connect(asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), 8471));
+		wss_stream.lowest_layer().set_option(asio::ip::tcp::no_delay(true));
+		wss_stream.handshake(asio::ssl::stream_base::client);
+		run_sizes(wss_stream, "wss", count);
+
+		server_ioc.stop();
+		server_thread.join();
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << "exception: " << e.what() << std::endl;
+	}
+	return 0;
+}
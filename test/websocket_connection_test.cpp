@@ -0,0 +1,140 @@
+#include "websocket_connection.h"
+#include <iostream>
+using namespace spiritsaway::http_utils;
+
+// checks the message and close frame validation of websocket_connection without any socket, the client role
+// takes unmasked frames so they are written by hand, the close frame it answers with is parsed back from output()
+
+std::size_t g_failed_num = 0;
+
+void check(bool ok, const std::string& name)
+{
+	std::cout << (ok ? "ok " : "FAILED ") << name << std::endl;
+	if (!ok)
+	{
+		g_failed_num++;
+	}
+}
+
+// an unmasked frame of a server, payloads below 126 bytes
+std::string make_frame(bool fin, websocket_opcode opcode, const std::string& payload)
+{
+	std::string result;
+	result.push_back(char((fin ? 0x80 : 0) | std::uint8_t(opcode)));
+	result.push_back(char(payload.size()));
+	result += payload;
+	return result;
+}
+
+std::string make_close(std::uint16_t code, const std::string& reason)
+{
+	std::string payload;
+	payload.push_back(char(code >> 8));
+	payload.push_back(char(code & 0xff));
+	payload += reason;
+	return make_frame(true, websocket_opcode::close, payload);
+}
+
+// code of the close frame the client queued, 0 when there is none
+std::uint16_t sent_close_code(websocket_connection& conn)
+{
+	const auto& cur_output = conn.output();
+	if (cur_output.size() < 8 || std::uint8_t(cur_output[0]) != 0x88)
+	{
+		return 0;
+	}
+	// client frames are masked, the key follows the 2 byte head
+	auto cur_high = std::uint8_t(cur_output[6]) ^ std::uint8_t(cur_output[2]);
+	auto cur_low = std::uint8_t(cur_output[7]) ^ std::uint8_t(cur_output[3]);
+	return std::uint16_t((cur_high << 8) | cur_low);
+}
+
+// feed the frames into a new client, whether it failed and the close code it sent
+std::pair<bool, std::uint16_t> feed_frames(const std::vector<std::string>& frames, std::vector<websocket_message>* messages = nullptr)
+{
+	websocket_connection cur_conn(websocket_role::client);
+	bool cur_ok = true;
+	for (const auto& one_frame : frames)
+	{
+		cur_ok = cur_conn.feed(one_frame.data(), one_frame.size()) && cur_ok;
+	}
+	if (messages)
+	{
+		*messages = cur_conn.take_messages();
+	}
+	return std::make_pair(!cur_ok, sent_close_code(cur_conn));
+}
+
+void test_utf8()
+{
+	websocket_utf8_validator cur_validator;
+	check(cur_validator.feed("h\xc3\xa9llo \xe2\x82\xac \xf0\x9f\x98\x80", 15) && cur_validator.complete(), "utf-8 of 1 to 4 bytes");
+	for (std::string one_invalid : { "\xff", "\xc0\xaf", "\xe0\x80\xaf", "\xed\xa0\x80", "\xf4\x90\x80\x80", "\x80" })
+	{
+		cur_validator.reset();
+		check(!cur_validator.feed(one_invalid.data(), one_invalid.size()), "invalid utf-8 rejected");
+	}
+	cur_validator.reset();
+	check(cur_validator.feed("a\xe2\x82", 3) && !cur_validator.complete() && cur_validator.feed("\xac", 1) && cur_validator.complete(),
+		"code point split between feeds");
+
+	std::vector<websocket_message> cur_messages;
+	auto cur_result = feed_frames({ make_frame(true, websocket_opcode::text, "h\xc3\xa9llo") }, &cur_messages);
+	check(!cur_result.first && cur_messages.size() == 1 && cur_messages[0].payload == "h\xc3\xa9llo", "valid text message");
+
+	cur_result = feed_frames({ make_frame(false, websocket_opcode::text, "a\xe2"), make_frame(false, websocket_opcode::continuation, "\x82"),
+		make_frame(true, websocket_opcode::continuation, "\xac") }, &cur_messages);
+	check(!cur_result.first && cur_messages.size() == 1 && cur_messages[0].payload == "a\xe2\x82\xac", "code point split between fragments");
+
+	cur_result = feed_frames({ make_frame(true, websocket_opcode::binary, "\xff\xfe") }, &cur_messages);
+	check(!cur_result.first && cur_messages.size() == 1, "binary message is not checked");
+
+	cur_result = feed_frames({ make_frame(true, websocket_opcode::text, "bad \xff") });
+	check(cur_result.first && cur_result.second == 1007, "invalid text fails with 1007");
+
+	cur_result = feed_frames({ make_frame(true, websocket_opcode::text, "\xed\xa0\x80") });
+	check(cur_result.first && cur_result.second == 1007, "surrogate fails with 1007");
+
+	// the first fragment already fails, the rest of the message never comes
+	cur_result = feed_frames({ make_frame(false, websocket_opcode::text, "\xc0\xaf") });
+	check(cur_result.first && cur_result.second == 1007, "invalid fragment fails before the message ends");
+
+	cur_result = feed_frames({ make_frame(false, websocket_opcode::text, "a"), make_frame(true, websocket_opcode::continuation, "\xe2\x82") });
+	check(cur_result.first && cur_result.second == 1007, "message ending inside a code point fails with 1007");
+}
+
+void test_close()
+{
+	websocket_connection cur_conn(websocket_role::client);
+	auto cur_frame = make_close(1000, "bye");
+	check(cur_conn.feed(cur_frame.data(), cur_frame.size()) && cur_conn.close_code() == 1000 && cur_conn.close_reason() == "bye"
+		&& sent_close_code(cur_conn) == 1000, "close echoed");
+
+	for (std::uint16_t one_code : { 1001, 1011, 3000, 4999 })
+	{
+		auto cur_result = feed_frames({ make_close(one_code, std::string()) });
+		check(!cur_result.first && cur_result.second == one_code, "close code " + std::to_string(one_code) + " accepted");
+	}
+	for (std::uint16_t one_code : { 0, 999, 1004, 1005, 1006, 1015, 1016, 2999, 5000 })
+	{
+		auto cur_result = feed_frames({ make_close(one_code, std::string()) });
+		check(cur_result.first && cur_result.second == 1002, "close code " + std::to_string(one_code) + " rejected with 1002");
+	}
+
+	auto cur_result = feed_frames({ make_close(1000, "bad \xff") });
+	check(cur_result.first && cur_result.second == 1007, "invalid close reason fails with 1007");
+
+	cur_result = feed_frames({ make_frame(true, websocket_opcode::close, "x") });
+	check(cur_result.first && cur_result.second == 1002, "close payload of 1 byte fails with 1002");
+
+	cur_result = feed_frames({ make_frame(true, websocket_opcode::close, std::string()) });
+	check(!cur_result.first && cur_result.second == 1000, "empty close answered with 1000");
+}
+
+int main()
+{
+	test_utf8();
+	test_close();
+	std::cout << g_failed_num << " failed" << std::endl;
+	return g_failed_num ? 1 : 0;
+}
@@ -0,0 +1,50 @@
+#include <access_log.h>
+#include <fstream>
+#include <iostream>
+
+using namespace spiritsaway::http_utils;
+
+// print a binary access log written by access_logger as csv
+int main(int argc, char* argv[])
+{
+	if (argc != 2)
+	{
+		std::cerr << "Usage: access_log_dump <binary access log>\n";
+		return 1;
+	}
+	std::ifstream log_stream(argv[1], std::ios::binary);
+	if (!log_stream)
+	{
+		std::cerr << "can not open " << argv[1] << "\n";
+		return 1;
+	}
+	if (!read_access_log_header(log_stream))
+	{
+		std::cerr << argv[1] << " is not a binary access log\n";
+		return 1;
+	}
+	std::cout << access_log_csv_header() << "\n";
+	access_log_record cur_record;
+	std::string cur_line;
+	std::size_t record_num = 0;
+	while (true)
+	{
+		auto record_begin = log_stream.tellg();
+		if (!read_access_log_record(log_stream, cur_record))
+		{
+			// a log cut while being written ends with part of a record
+			log_stream.clear();
+			log_stream.seekg(0, std::ios::end);
+			if (log_stream.tellg() != record_begin)
+			{
+				std::cerr << "truncated record after " << record_num << " records\n";
+				return 1;
+			}
+			return 0;
+		}
+		cur_line.clear();
+		append_access_log_csv(cur_record, cur_line);
+		std::cout << cur_line;
+		record_num++;
+	}
+}